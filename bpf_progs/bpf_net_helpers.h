@@ -26,6 +26,10 @@
 static uint64_t (*bpf_get_socket_cookie)(struct __sk_buff* skb) = (void*)BPF_FUNC_get_socket_cookie;
 
 static uint32_t (*bpf_get_socket_uid)(struct __sk_buff* skb) = (void*)BPF_FUNC_get_socket_uid;
+static struct bpf_sock* (*bpf_sk_fullsock)(struct bpf_sock* sk) = (void*)BPF_FUNC_sk_fullsock;
+static int (*bpf_sock_ops_cb_flags_set)(struct bpf_sock_ops* skops,
+                                        int flags) = (void*)BPF_FUNC_sock_ops_cb_flags_set;
+
 static int (*bpf_skb_load_bytes)(struct __sk_buff* skb, int off, void* to,
                                  int len) = (void*)BPF_FUNC_skb_load_bytes;
 
@@ -377,5 +377,84 @@ DEFINE_BPF_PROG_KVER("cgroupsock/inet/create", AID_ROOT, AID_ROOT, inet_socket_c
     return (*permissions & BPF_PERMISSION_INTERNET) == BPF_PERMISSION_INTERNET;
 }
 
+// netd deletes the entry of a network when it destroys the network.
+DEFINE_BPF_MAP(tcp_health_map, HASH, uint32_t, TcpHealthValue, TCP_HEALTH_MAP_SIZE)
+
+// The netId occupies the low 16 bits of the socket mark, see include/Fwmark.h.
+#define FWMARK_NET_ID_MASK 0xffff
+
+static __always_inline inline TcpHealthValue* get_tcp_health_value(struct bpf_sock_ops* skops) {
+    struct bpf_sock* sk = skops->sk;
+    if (!sk) return NULL;
+    sk = bpf_sk_fullsock(sk);
+    if (!sk) return NULL;
+
+    // Unmarked sockets do not belong to any network and are not accounted.
+    uint32_t netId = sk->mark & FWMARK_NET_ID_MASK;
+    if (!netId) return NULL;
+
+    TcpHealthValue* value = bpf_tcp_health_map_lookup_elem(&netId);
+    if (!value) {
+        TcpHealthValue newValue = {};
+        bpf_tcp_health_map_update_elem(&netId, &newValue, BPF_NOEXIST);
+        value = bpf_tcp_health_map_lookup_elem(&netId);
+    }
+    return value;
+}
+
+// Reading skops->sk and calling bpf_sk_fullsock() from sock_ops requires a 5.10 kernel.
+DEFINE_BPF_PROG_KVER("sockops/tcp_health", AID_ROOT, AID_ROOT, tcp_health_sockops,
+                     KVER(5, 10, 0))
+(struct bpf_sock_ops* skops) {
+    TcpHealthValue* value;
+
+    switch (skops->op) {
+        case BPF_SOCK_OPS_TCP_CONNECT_CB:
+            // Ask for state changes so that failed connection attempts are counted.
+            bpf_sock_ops_cb_flags_set(skops, BPF_SOCK_OPS_STATE_CB_FLAG);
+            break;
+        case BPF_SOCK_OPS_ACTIVE_ESTABLISHED_CB:
+        case BPF_SOCK_OPS_PASSIVE_ESTABLISHED_CB:
+            bpf_sock_ops_cb_flags_set(skops, BPF_SOCK_OPS_RTT_CB_FLAG |
+                                                     BPF_SOCK_OPS_RETRANS_CB_FLAG |
+                                                     BPF_SOCK_OPS_STATE_CB_FLAG);
+            value = get_tcp_health_value(skops);
+            if (!value) break;
+            __sync_fetch_and_add(&value->established, 1);
+            if (skops->op == BPF_SOCK_OPS_ACTIVE_ESTABLISHED_CB) {
+                __sync_fetch_and_add(&value->connectSuccess, 1);
+            }
+            break;
+        case BPF_SOCK_OPS_RTT_CB:
+            value = get_tcp_health_value(skops);
+            if (value) {
+                // srtt_us is stored left-shifted by 3, like in struct tcp_sock.
+                __sync_fetch_and_add(&value->rttUsSum, skops->srtt_us >> 3);
+                __sync_fetch_and_add(&value->rttSamples, 1);
+            }
+            break;
+        case BPF_SOCK_OPS_RETRANS_CB:
+            // args[1] is the number of segments retransmitted.
+            value = get_tcp_health_value(skops);
+            if (value) __sync_fetch_and_add(&value->retransSegs, skops->args[1]);
+            break;
+        case BPF_SOCK_OPS_STATE_CB:
+            // args[0] is the old state and args[1] the new state.
+            if (skops->args[1] != BPF_TCP_CLOSE) break;
+            value = get_tcp_health_value(skops);
+            if (!value) break;
+            if (skops->args[0] == BPF_TCP_SYN_SENT) {
+                __sync_fetch_and_add(&value->connectFailure, 1);
+            } else {
+                __sync_fetch_and_add(&value->closedEstablished, 1);
+            }
+            __sync_fetch_and_add(&value->closedDataSegsOut, skops->data_segs_out);
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
 LICENSE("Apache 2.0");
 CRITICAL("netd");
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConnectPolicyCache.h"
+
+bool ConnectPolicyCache::shouldCheckMark() {
+    if (mUnmarkedInARow.load(std::memory_order_relaxed) < UNMARKED_SOCKETS_BEFORE_SAMPLING) {
+        return true;
+    }
+    return mSampled.fetch_add(1, std::memory_order_relaxed) % SAMPLE_INTERVAL == 0;
+}
+
+void ConnectPolicyCache::recordMark(Fwmark mark) {
+    if (mark.intValue != 0) {
+        mUnmarkedInARow.store(0, std::memory_order_relaxed);
+    } else if (mUnmarkedInARow.load(std::memory_order_relaxed) < UNMARKED_SOCKETS_BEFORE_SAMPLING) {
+        mUnmarkedInARow.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool ConnectPolicyCache::wouldKeepMark(uint32_t generation, uid_t uid, Fwmark mark) const {
+    std::lock_guard guard(mLock);
+    if (!mValid || generation != mGeneration || uid != mUid || mark.permission != mPermission) {
+        return false;
+    }
+    if (mark.explicitlySelected) {
+        return true;
+    }
+    // Whether ON_CONNECT keeps the netId of a protected socket depends on whether that netId is a
+    // VPN, which the client cannot tell.
+    if (mark.protectedFromVpn) {
+        return false;
+    }
+    return mNetIdKnown && mark.netId == mNetId;
+}
+
+void ConnectPolicyCache::learn(uint32_t generation, uid_t uid, Fwmark before, Fwmark after) {
+    std::lock_guard guard(mLock);
+    if (!mValid || generation != mGeneration || uid != mUid) {
+        mValid = true;
+        mGeneration = generation;
+        mUid = uid;
+        mNetIdKnown = false;
+    }
+    mPermission = after.permission;
+    if (!before.explicitlySelected && !before.protectedFromVpn) {
+        mNetIdKnown = true;
+        mNetId = after.netId;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_CLIENT_CONNECT_POLICY_CACHE_H
+#define NETD_CLIENT_CONNECT_POLICY_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "Fwmark.h"
+
+// Remembers what FwmarkCommand::ON_CONNECT did to the mark of an earlier socket, so that
+// netdClientConnect() can tell when sending it again would leave the mark of a socket unchanged.
+//
+// ON_CONNECT sets the permission bits of the mark to those of the calling user, and, unless the
+// socket is explicitly selected or protected from VPNs, sets the netId to the network that the user
+// connects on by default. Both only change when netd advances the generation of the
+// ConnectPolicyPage, so what was learned is only used while the generation stays the same.
+//
+// Only sockets that are already marked, such as ones being reconnected, can keep their mark. Most
+// sockets are fresh, so once a process has connected many unmarked sockets in a row, only a sample
+// of its sockets is checked, until one of them turns out to be marked.
+//
+// This class is thread-safe.
+class ConnectPolicyCache {
+  public:
+    static constexpr uint32_t UNMARKED_SOCKETS_BEFORE_SAMPLING = 8;
+    static constexpr uint32_t SAMPLE_INTERVAL = 32;
+
+    // Returns true if the mark of the next socket is worth reading and passing to recordMark().
+    bool shouldCheckMark();
+
+    // Records the mark that a socket had before ON_CONNECT.
+    void recordMark(Fwmark mark);
+
+    // Returns true if ON_CONNECT, sent by |uid| for a socket marked with |mark|, would not change
+    // the mark, provided that the policy generation is still |generation|.
+    bool wouldKeepMark(uint32_t generation, uid_t uid, Fwmark mark) const;
+
+    // Records that ON_CONNECT, sent by |uid| while the policy generation was |generation|, changed
+    // the mark of a socket from |before| to |after|.
+    void learn(uint32_t generation, uid_t uid, Fwmark before, Fwmark after);
+
+  private:
+    std::atomic<uint32_t> mUnmarkedInARow = 0;
+    std::atomic<uint32_t> mSampled = 0;
+
+    mutable std::mutex mLock;
+    bool mValid = false;
+    uint32_t mGeneration = 0;
+    uid_t mUid = 0;
+    Permission mPermission = PERMISSION_NONE;
+    // Only known once ON_CONNECT was sent for a socket that was neither explicitly selected nor
+    // protected from VPNs.
+    bool mNetIdKnown = false;
+    unsigned mNetId = 0;
+};
+
+#endif  // NETD_CLIENT_CONNECT_POLICY_CACHE_H
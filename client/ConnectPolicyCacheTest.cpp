@@ -0,0 +1,126 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ConnectPolicyCache.h"
+
+namespace {
+
+constexpr uint32_t GENERATION = 7;
+constexpr uid_t UID = 10001;
+
+Fwmark makeMark(unsigned netId, bool explicitlySelected, bool protectedFromVpn,
+                Permission permission) {
+    Fwmark mark;
+    mark.netId = netId;
+    mark.explicitlySelected = explicitlySelected;
+    mark.protectedFromVpn = protectedFromVpn;
+    mark.permission = permission;
+    return mark;
+}
+
+const Fwmark UNMARKED;
+const Fwmark DEFAULT = makeMark(100, false, false, PERMISSION_NETWORK);
+const Fwmark VPN = makeMark(200, false, false, PERMISSION_NETWORK);
+const Fwmark EXPLICIT = makeMark(300, true, false, PERMISSION_NETWORK);
+const Fwmark PROTECTED = makeMark(100, false, true, PERMISSION_NETWORK);
+
+}  // namespace
+
+TEST(ConnectPolicyCacheTest, NothingLearned) {
+    ConnectPolicyCache cache;
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, UNMARKED));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, DEFAULT));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, EXPLICIT));
+}
+
+TEST(ConnectPolicyCacheTest, ImplicitSockets) {
+    ConnectPolicyCache cache;
+    cache.learn(GENERATION, UID, UNMARKED, DEFAULT);
+
+    // Reconnecting a socket that ON_CONNECT already marked keeps its mark...
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION, UID, DEFAULT));
+    // ... but a fresh socket still needs to be marked.
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, UNMARKED));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, VPN));
+    // What was learned does not apply to other users or generations.
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID + 1, DEFAULT));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION + 1, UID, DEFAULT));
+
+    // The permission bits must match too.
+    Fwmark withoutPermission = DEFAULT;
+    withoutPermission.permission = PERMISSION_NONE;
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, withoutPermission));
+}
+
+TEST(ConnectPolicyCacheTest, ExplicitSockets) {
+    ConnectPolicyCache cache;
+    cache.learn(GENERATION, UID, EXPLICIT, EXPLICIT);
+
+    // The netId of explicitly selected sockets is never changed, so only the permission matters.
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION, UID, EXPLICIT));
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION, UID, makeMark(400, true, true, PERMISSION_NETWORK)));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, makeMark(400, true, false, PERMISSION_NONE)));
+    // Nothing was learned about the network that implicit sockets are put on.
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, DEFAULT));
+}
+
+TEST(ConnectPolicyCacheTest, ProtectedSockets) {
+    ConnectPolicyCache cache;
+    cache.learn(GENERATION, UID, UNMARKED, DEFAULT);
+    cache.learn(GENERATION, UID, PROTECTED, PROTECTED);
+
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, PROTECTED));
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION, UID, DEFAULT));
+}
+
+TEST(ConnectPolicyCacheTest, NewGenerationForgetsNetwork) {
+    ConnectPolicyCache cache;
+    cache.learn(GENERATION, UID, UNMARKED, DEFAULT);
+    cache.learn(GENERATION + 1, UID, EXPLICIT, EXPLICIT);
+
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION + 1, UID, EXPLICIT));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION + 1, UID, DEFAULT));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION, UID, DEFAULT));
+
+    cache.learn(GENERATION + 1, UID, DEFAULT, VPN);
+    EXPECT_TRUE(cache.wouldKeepMark(GENERATION + 1, UID, VPN));
+    EXPECT_FALSE(cache.wouldKeepMark(GENERATION + 1, UID, DEFAULT));
+}
+
+TEST(ConnectPolicyCacheTest, SamplesUnmarkedSockets) {
+    ConnectPolicyCache cache;
+    for (uint32_t i = 0; i < ConnectPolicyCache::UNMARKED_SOCKETS_BEFORE_SAMPLING; i++) {
+        EXPECT_TRUE(cache.shouldCheckMark());
+        cache.recordMark(UNMARKED);
+    }
+
+    // After that many fresh sockets, only one in every SAMPLE_INTERVAL is checked...
+    uint32_t checked = 0;
+    for (uint32_t i = 0; i < 2 * ConnectPolicyCache::SAMPLE_INTERVAL; i++) {
+        if (cache.shouldCheckMark()) {
+            checked++;
+            cache.recordMark(UNMARKED);
+        }
+    }
+    EXPECT_EQ(2U, checked);
+
+    // ... until a socket that was already marked shows up.
+    cache.recordMark(DEFAULT);
+    EXPECT_TRUE(cache.shouldCheckMark());
+    EXPECT_TRUE(cache.shouldCheckMark());
+}
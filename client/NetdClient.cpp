@@ -20,13 +20,16 @@
 #include <errno.h>
 #include <math.h>
 #include <resolv.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/system_properties.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -34,6 +37,8 @@
 #include <android-base/parseint.h>
 #include <android-base/unique_fd.h>
 
+#include "ConnectPolicy.h"
+#include "ConnectPolicyCache.h"
 #include "Fwmark.h"
 #include "FwmarkClient.h"
 #include "FwmarkCommand.h"
@@ -57,6 +62,9 @@ constexpr char PROPERTY_REDIRECT_SOCKET_CALLS[] = "ro.vendor.redirect_socket_cal
 // Whether some shimmed functions dispatch FwmarkCommand or not. The property can be changed by
 // System Server at runtime. Note: accept4(), socket(), connect() are always shimmed.
 constexpr char PROPERTY_REDIRECT_SOCKET_CALLS_HOOKED[] = "net.redirect_socket_calls.hooked";
+// How long connect() waits before looking for the connect policy page again if netd has not
+// created it yet.
+constexpr std::chrono::seconds CONNECT_POLICY_PAGE_RETRY_INTERVAL(5);
 
 std::atomic_uint netIdForProcess(NETID_UNSET);
 std::atomic_uint netIdForResolv(NETID_UNSET);
@@ -146,19 +154,99 @@ int netdClientAccept4(int sockfd, sockaddr* addr, socklen_t* addrlen, int flags)
     return acceptedSocket;
 }
 
-int netdClientConnect(int sockfd, const sockaddr* addr, socklen_t addrlen) {
-    const bool shouldSetFwmark = shouldMarkSocket(sockfd, addr);
-    if (shouldSetFwmark) {
-        FwmarkCommand command = {FwmarkCommand::ON_CONNECT, 0, 0, 0};
-        int error;
-        if (redirectSocketCallsIsTrue()) {
-            FwmarkConnectInfo connectInfo(0, 0, addr);
-            error = FwmarkClient().send(&command, sockfd, &connectInfo);
+// Returns the page that netd publishes the connect policy generation in, or nullptr if it cannot
+// be mapped. Until netd has created the page, mapping is retried at most once per
+// CONNECT_POLICY_PAGE_RETRY_INTERVAL. It is not retried after any other error, such as the process
+// not being allowed to read the page.
+const ConnectPolicyPage* connectPolicyPage() {
+    using std::chrono::steady_clock;
+    static std::atomic<const ConnectPolicyPage*> sPage(nullptr);
+    static std::atomic_bool sUnavailable(false);
+    static std::atomic<steady_clock::rep> sNextAttempt(0);
+
+    const ConnectPolicyPage* page = sPage.load();
+    if (page != nullptr || sUnavailable.load()) return page;
+    const steady_clock::time_point now = steady_clock::now();
+    if (now.time_since_epoch().count() < sNextAttempt.load()) return nullptr;
+
+    unique_fd fd(open(CONNECT_POLICY_PAGE_PATH, O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            sNextAttempt = (now + CONNECT_POLICY_PAGE_RETRY_INTERVAL).time_since_epoch().count();
         } else {
-            error = FwmarkClient().send(&command, sockfd, nullptr);
+            sUnavailable = true;
         }
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, sizeof(ConnectPolicyPage), PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        sUnavailable = true;
+        return nullptr;
+    }
+    page = static_cast<const ConnectPolicyPage*>(addr);
+    if (page->magic != ConnectPolicyPage::MAGIC) {
+        munmap(addr, sizeof(ConnectPolicyPage));
+        sUnavailable = true;
+        return nullptr;
+    }
+    const ConnectPolicyPage* expected = nullptr;
+    if (!sPage.compare_exchange_strong(expected, page)) {
+        // Another thread mapped the page first.
+        munmap(addr, sizeof(ConnectPolicyPage));
+        page = expected;
+    }
+    return page;
+}
+
+ConnectPolicyCache connectPolicyCache;
 
-        if (error) {
+int getSocketMark(int sockfd, Fwmark* mark) {
+    socklen_t markLen = sizeof(mark->intValue);
+    return getsockopt(sockfd, SOL_SOCKET, SO_MARK, &mark->intValue, &markLen) == -1 ? -errno : 0;
+}
+
+// Sends ON_CONNECT, unless it is known not to change the mark of the socket. Returns 0 on success
+// or a negative errno value on failure.
+int markSocketOnConnect(int sockfd, const sockaddr* addr) {
+    FwmarkCommand command = {FwmarkCommand::ON_CONNECT, 0, 0, 0};
+    if (redirectSocketCallsIsTrue()) {
+        // Vendor code may want to see the destination of every connect().
+        FwmarkConnectInfo connectInfo(0, 0, addr);
+        return FwmarkClient().send(&command, sockfd, &connectInfo);
+    }
+
+    // A fresh socket always needs ON_CONNECT, so do not spend any more syscalls on it than needed.
+    Fwmark before;
+    if (!connectPolicyCache.shouldCheckMark() || getSocketMark(sockfd, &before) != 0) {
+        return FwmarkClient().send(&command, sockfd, nullptr);
+    }
+    connectPolicyCache.recordMark(before);
+    const ConnectPolicyPage* page = before.intValue != 0 ? connectPolicyPage() : nullptr;
+    if (page == nullptr) {
+        return FwmarkClient().send(&command, sockfd, nullptr);
+    }
+    const uint32_t generation = page->generation.load();
+    const uid_t uid = geteuid();
+    if (connectPolicyCache.wouldKeepMark(generation, uid, before)) {
+        return 0;
+    }
+
+    if (int error = FwmarkClient().send(&command, sockfd, nullptr)) {
+        return error;
+    }
+    // If the policy changed while the command was in flight, the new mark may reflect either
+    // generation, so it must not be learned.
+    Fwmark after;
+    if (getSocketMark(sockfd, &after) == 0 && page->generation.load() == generation) {
+        connectPolicyCache.learn(generation, uid, before, after);
+    }
+    return 0;
+}
+
+int netdClientConnect(int sockfd, const sockaddr* addr, socklen_t addrlen) {
+    const bool shouldSetFwmark = shouldMarkSocket(sockfd, addr);
+    if (shouldSetFwmark) {
+        if (int error = markSocketOnConnect(sockfd, addr)) {
             errno = -error;
             return -1;
         }
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_INCLUDE_CONNECT_POLICY_H
+#define NETD_INCLUDE_CONNECT_POLICY_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+// The file that netd maps read-write and processes in the inet group map read-only. It lives on
+// tmpfs, so it is cleared on reboot but survives netd restarts: a restarted netd reopens the same
+// file and advances the generation, which invalidates what clients learned from the previous
+// instance.
+static const char CONNECT_POLICY_PAGE_PATH[] = "/dev/netd/connect_policy";
+
+// Lets libnetd_client tell, without a round trip to netd, whether what it learned from an earlier
+// FwmarkCommand::ON_CONNECT still holds.
+struct ConnectPolicyPage {
+    static constexpr uint32_t MAGIC = 0x6e637031;  // "ncp1"
+
+    uint32_t magic;
+    // Advanced whenever anything that ON_CONNECT uses to mark a socket may have changed, for any
+    // user: the default network, the VPNs and the users they apply to, and user permissions.
+    std::atomic_uint32_t generation;
+};
+
+static_assert(std::atomic_uint32_t::is_always_lock_free,
+              "The generation is read by processes that cannot share locks with netd");
+
+#endif  // NETD_INCLUDE_CONNECT_POLICY_H
@@ -134,53 +134,8 @@ int parseBpfNetworkStatsDetailInternal(std::vector<stats_line>* lines,
                                        const std::vector<std::string>& limitIfaces, int limitTag,
                                        int limitUid, const BpfMap<StatsKey, StatsValue>& statsMap,
                                        const BpfMap<uint32_t, IfaceValue>& ifaceMap) {
-    int64_t unknownIfaceBytesTotal = 0;
-    const auto processDetailUidStats =
-            [lines, &limitIfaces, &limitTag, &limitUid, &unknownIfaceBytesTotal, &ifaceMap](
-                    const StatsKey& key,
-                    const BpfMap<StatsKey, StatsValue>& statsMap) -> Result<void> {
-        char ifname[IFNAMSIZ];
-        if (getIfaceNameFromMap(ifaceMap, statsMap, key.ifaceIndex, ifname, key,
-                                &unknownIfaceBytesTotal)) {
-            return Result<void>();
-        }
-        std::string ifnameStr(ifname);
-        if (limitIfaces.size() > 0 &&
-            std::find(limitIfaces.begin(), limitIfaces.end(), ifnameStr) == limitIfaces.end()) {
-            // Nothing matched; skip this line.
-            return Result<void>();
-        }
-        if (limitTag != TAG_ALL && uint32_t(limitTag) != key.tag) {
-            return Result<void>();
-        }
-        if (limitUid != UID_ALL && uint32_t(limitUid) != key.uid) {
-            return Result<void>();
-        }
-        Result<StatsValue> statsEntry = statsMap.readValue(key);
-        if (!statsEntry.ok()) {
-            return base::ResultError(statsEntry.error().message(), statsEntry.error().code());
-        }
-        lines->push_back(populateStatsEntry(key, statsEntry.value(), ifname));
-        return Result<void>();
-    };
-    Result<void> res = statsMap.iterate(processDetailUidStats);
-    if (!res.ok()) {
-        ALOGE("failed to iterate per uid Stats map for detail traffic stats: %s",
-              strerror(res.error().code()));
-        return -res.error().code();
-    }
-
-    // Since eBPF use hash map to record stats, network stats collected from
-    // eBPF will be out of order. And the performance of findIndexHinted in
-    // NetworkStats will also be impacted.
-    //
-    // Furthermore, since the StatsKey contains iface index, the network stats
-    // reported to framework would create items with the same iface, uid, tag
-    // and set, which causes NetworkStats maps wrong item to subtract.
-    //
-    // Thus, the stats needs to be properly sorted and grouped before reported.
-    groupNetworkStats(lines);
-    return 0;
+    return parseBpfNetworkStatsDetailImpl(lines, limitIfaces, limitTag, limitUid, statsMap,
+                                          ifaceMap);
 }
 
 int parseBpfNetworkStatsDetail(std::vector<stats_line>* lines,
@@ -234,31 +189,7 @@ int parseBpfNetworkStatsDetail(std::vector<stats_line>* lines,
 int parseBpfNetworkStatsDevInternal(std::vector<stats_line>* lines,
                                     const BpfMap<uint32_t, StatsValue>& statsMap,
                                     const BpfMap<uint32_t, IfaceValue>& ifaceMap) {
-    int64_t unknownIfaceBytesTotal = 0;
-    const auto processDetailIfaceStats = [lines, &unknownIfaceBytesTotal, &ifaceMap, &statsMap](
-                                             const uint32_t& key, const StatsValue& value,
-                                             const BpfMap<uint32_t, StatsValue>&) {
-        char ifname[IFNAMSIZ];
-        if (getIfaceNameFromMap(ifaceMap, statsMap, key, ifname, key, &unknownIfaceBytesTotal)) {
-            return Result<void>();
-        }
-        StatsKey fakeKey = {
-                .uid = (uint32_t)UID_ALL,
-                .tag = (uint32_t)TAG_NONE,
-                .counterSet = (uint32_t)SET_ALL,
-        };
-        lines->push_back(populateStatsEntry(fakeKey, value, ifname));
-        return Result<void>();
-    };
-    Result<void> res = statsMap.iterateWithValue(processDetailIfaceStats);
-    if (!res.ok()) {
-        ALOGE("failed to iterate per uid Stats map for detail traffic stats: %s",
-              strerror(res.error().code()));
-        return -res.error().code();
-    }
-
-    groupNetworkStats(lines);
-    return 0;
+    return parseBpfNetworkStatsDevImpl(lines, statsMap, ifaceMap);
 }
 
 int parseBpfNetworkStatsDev(std::vector<stats_line>* lines) {
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "netdbpf/InMemoryBpfMap.h"
+#include "netdbpf/bpf_shared.h"
+
+namespace android {
+namespace bpf {
+
+using base::Result;
+
+constexpr uint32_t TEST_MAP_SIZE = 10;
+constexpr char TEST_PIN_PATH[] = "/sys/fs/bpf/in_memory_bpf_map_test";
+
+TEST(InMemoryBpfMapTest, InvalidMap) {
+    InMemoryBpfMap<uint32_t, uint32_t> map;
+    EXPECT_FALSE(map.isValid());
+    EXPECT_EQ(-1, map.getMap().get());
+    EXPECT_EQ(EBADF, map.writeValue(1, 1, BPF_ANY).error().code());
+    EXPECT_EQ(EBADF, map.readValue(1).error().code());
+    EXPECT_EQ(EBADF, map.deleteValue(1).error().code());
+    EXPECT_EQ(EBADF, map.getFirstKey().error().code());
+    EXPECT_EQ(EBADF, map.clear().error().code());
+}
+
+TEST(InMemoryBpfMapTest, WriteFlags) {
+    InMemoryBpfMap<uint32_t, uint32_t> map(TEST_MAP_SIZE);
+    ASSERT_TRUE(map.isValid());
+
+    EXPECT_EQ(ENOENT, map.writeValue(1, 10, BPF_EXIST).error().code());
+    EXPECT_TRUE(map.writeValue(1, 10, BPF_NOEXIST).ok());
+    EXPECT_EQ(EEXIST, map.writeValue(1, 11, BPF_NOEXIST).error().code());
+    EXPECT_TRUE(map.writeValue(1, 12, BPF_EXIST).ok());
+    EXPECT_EQ(12U, map.readValue(1).value());
+    EXPECT_TRUE(map.writeValue(1, 13, BPF_ANY).ok());
+    EXPECT_EQ(13U, map.readValue(1).value());
+    EXPECT_EQ(EINVAL, map.writeValue(1, 14, BPF_EXIST + 1).error().code());
+
+    EXPECT_EQ(ENOENT, map.readValue(2).error().code());
+    EXPECT_TRUE(map.deleteValue(1).ok());
+    EXPECT_EQ(ENOENT, map.deleteValue(1).error().code());
+}
+
+TEST(InMemoryBpfMapTest, SizeLimit) {
+    InMemoryBpfMap<uint32_t, uint32_t> map(TEST_MAP_SIZE);
+    for (uint32_t i = 0; i < TEST_MAP_SIZE; i++) {
+        ASSERT_TRUE(map.writeValue(i, i, BPF_NOEXIST).ok());
+    }
+    EXPECT_EQ(E2BIG, map.writeValue(TEST_MAP_SIZE, 0, BPF_ANY).error().code());
+    // Existing entries can still be updated.
+    EXPECT_TRUE(map.writeValue(0, 100, BPF_ANY).ok());
+    ASSERT_TRUE(map.deleteValue(0).ok());
+    EXPECT_TRUE(map.writeValue(TEST_MAP_SIZE, 0, BPF_ANY).ok());
+}
+
+TEST(InMemoryBpfMapTest, KeyIteration) {
+    InMemoryBpfMap<uint32_t, uint32_t> map(TEST_MAP_SIZE);
+    EXPECT_EQ(ENOENT, map.getFirstKey().error().code());
+    for (uint32_t i = 0; i < 5; i++) {
+        ASSERT_TRUE(map.writeValue(i, i * 10, BPF_ANY).ok());
+    }
+
+    std::set<uint32_t> keys;
+    Result<uint32_t> key = map.getFirstKey();
+    while (key.ok()) {
+        keys.insert(key.value());
+        key = map.getNextKey(key.value());
+    }
+    EXPECT_EQ(ENOENT, key.error().code());
+    EXPECT_EQ(std::set<uint32_t>({0, 1, 2, 3, 4}), keys);
+
+    // As in the kernel, the key after a missing key is the first key.
+    EXPECT_EQ(map.getFirstKey().value(), map.getNextKey(1000).value());
+}
+
+TEST(InMemoryBpfMapTest, IterateAndDelete) {
+    InMemoryBpfMap<uint32_t, uint32_t> map(TEST_MAP_SIZE);
+    for (uint32_t i = 0; i < TEST_MAP_SIZE; i++) {
+        ASSERT_TRUE(map.writeValue(i, i, BPF_ANY).ok());
+    }
+
+    int visited = 0;
+    const auto deleteOdd = [&visited](const uint32_t& key, const uint32_t& value,
+                                      InMemoryBpfMap<uint32_t, uint32_t>& map) -> Result<void> {
+        visited++;
+        EXPECT_EQ(key, value);
+        if (key % 2) return map.deleteValue(key);
+        return {};
+    };
+    ASSERT_TRUE(map.iterateWithValue(deleteOdd).ok());
+    EXPECT_EQ(static_cast<int>(TEST_MAP_SIZE), visited);
+
+    std::set<uint32_t> remaining;
+    const auto collect = [&remaining](const uint32_t& key,
+                                      const InMemoryBpfMap<uint32_t, uint32_t>&) -> Result<void> {
+        remaining.insert(key);
+        return {};
+    };
+    ASSERT_TRUE(map.iterate(collect).ok());
+    EXPECT_EQ(std::set<uint32_t>({0, 2, 4, 6, 8}), remaining);
+
+    // Errors from the callback stop the iteration.
+    visited = 0;
+    const auto fail = [&visited](const uint32_t&, const InMemoryBpfMap<uint32_t, uint32_t>&)
+            -> Result<void> {
+        visited++;
+        return base::ResultError("stop", EIO);
+    };
+    EXPECT_EQ(EIO, map.iterate(fail).error().code());
+    EXPECT_EQ(1, visited);
+
+    ASSERT_TRUE(map.clear().ok());
+    EXPECT_EQ(ENOENT, map.getFirstKey().error().code());
+}
+
+TEST(InMemoryBpfMapTest, StructKeys) {
+    InMemoryBpfMap<StatsKey, StatsValue> map(TEST_MAP_SIZE);
+    const StatsKey key1 = {.uid = 10001, .tag = 1, .counterSet = 0, .ifaceIndex = 3};
+    StatsKey key2 = key1;
+    key2.tag = 2;
+    ASSERT_TRUE(map.writeValue(key1, {.rxBytes = 100}, BPF_NOEXIST).ok());
+    ASSERT_TRUE(map.writeValue(key2, {.rxBytes = 200}, BPF_NOEXIST).ok());
+    EXPECT_EQ(100U, map.readValue(key1).value().rxBytes);
+    EXPECT_EQ(200U, map.readValue(key2).value().rxBytes);
+}
+
+TEST(InMemoryBpfMapTest, PinAndInit) {
+    InMemoryBpfMap<uint32_t, uint32_t> map(TEST_MAP_SIZE);
+    ASSERT_TRUE(map.pin(TEST_PIN_PATH).ok());
+    EXPECT_EQ(EEXIST, map.pin(TEST_PIN_PATH).error().code());
+
+    InMemoryBpfMap<uint32_t, uint32_t> opened;
+    ASSERT_TRUE(opened.init(TEST_PIN_PATH).ok());
+    ASSERT_TRUE(opened.writeValue(1, 2, BPF_ANY).ok());
+    EXPECT_EQ(2U, map.readValue(1).value());
+
+    InMemoryBpfMap<uint64_t, uint32_t> wrongKeySize;
+    EXPECT_EQ(EINVAL, wrongKeySize.init(TEST_PIN_PATH).error().code());
+
+    InMemoryBpfMap<uint32_t, uint32_t>::unpin(TEST_PIN_PATH);
+    InMemoryBpfMap<uint32_t, uint32_t> unpinned;
+    EXPECT_EQ(ENOENT, unpinned.init(TEST_PIN_PATH).error().code());
+    // Handles opened before unpinning keep working.
+    EXPECT_EQ(2U, opened.readValue(1).value());
+}
+
+}  // namespace bpf
+}  // namespace android
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDBPF_BPFMAPINTERFACE_H
+#define NETDBPF_BPFMAPINTERFACE_H
+
+#include <functional>
+
+#include <android-base/result.h>
+#include <android-base/unique_fd.h>
+
+#include "bpf/BpfMap.h"
+
+namespace android {
+namespace bpf {
+
+// The subset of the BpfMap<Key, Value> API that TrafficController uses, so that benchmarks can
+// run it on maps other than kernel BPF maps. The methods behave as their BpfMap counterparts.
+template <class Key, class Value>
+class BpfMapInterface {
+  public:
+    virtual ~BpfMapInterface() = default;
+
+    virtual base::Result<void> init(const char* path) = 0;
+    virtual bool isValid() const = 0;
+    virtual const base::unique_fd& getMap() const = 0;
+
+    virtual base::Result<Value> readValue(const Key key) const = 0;
+    virtual base::Result<void> writeValue(const Key& key, const Value& value, uint64_t flags) = 0;
+    virtual base::Result<void> deleteValue(const Key& key) = 0;
+    virtual base::Result<void> clear() = 0;
+
+    virtual base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, const BpfMapInterface& map)>&
+                    filter) const = 0;
+    virtual base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, BpfMapInterface& map)>&
+                    filter) = 0;
+    virtual base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   const BpfMapInterface& map)>& filter) const = 0;
+    virtual base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   BpfMapInterface& map)>& filter) = 0;
+};
+
+// Implements BpfMapInterface by forwarding to a map with the BpfMap<Key, Value> API: a kernel
+// BpfMap by default, or e.g. an InMemoryBpfMap.
+template <class Key, class Value, template <class, class> class MapType = BpfMap>
+class BpfMapAdapter final : public BpfMapInterface<Key, Value> {
+  public:
+    using Interface = BpfMapInterface<Key, Value>;
+
+    // The wrapped map, e.g. to reset() it to an existing fd.
+    MapType<Key, Value>& map() { return mMap; }
+
+    base::Result<void> init(const char* path) override { return mMap.init(path); }
+    bool isValid() const override { return mMap.isValid(); }
+    const base::unique_fd& getMap() const override { return mMap.getMap(); }
+
+    base::Result<Value> readValue(const Key key) const override { return mMap.readValue(key); }
+    base::Result<void> writeValue(const Key& key, const Value& value, uint64_t flags) override {
+        return mMap.writeValue(key, value, flags);
+    }
+    base::Result<void> deleteValue(const Key& key) override { return mMap.deleteValue(key); }
+    base::Result<void> clear() override { return mMap.clear(); }
+
+    base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, const Interface& map)>& filter)
+            const override {
+        return mMap.iterate([this, &filter](const Key& key, const MapType<Key, Value>&) {
+            return filter(key, *this);
+        });
+    }
+    base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, Interface& map)>& filter)
+            override {
+        return mMap.iterate([this, &filter](const Key& key, MapType<Key, Value>&) {
+            return filter(key, *this);
+        });
+    }
+    base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   const Interface& map)>& filter) const override {
+        return mMap.iterateWithValue(
+                [this, &filter](const Key& key, const Value& value, const MapType<Key, Value>&) {
+                    return filter(key, value, *this);
+                });
+    }
+    base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   Interface& map)>& filter) override {
+        return mMap.iterateWithValue(
+                [this, &filter](const Key& key, const Value& value, MapType<Key, Value>&) {
+                    return filter(key, value, *this);
+                });
+    }
+
+  private:
+    MapType<Key, Value> mMap;
+};
+
+}  // namespace bpf
+}  // namespace android
+
+#endif  // NETDBPF_BPFMAPINTERFACE_H
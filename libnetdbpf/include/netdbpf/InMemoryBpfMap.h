@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDBPF_INMEMORYBPFMAP_H
+#define NETDBPF_INMEMORYBPFMAP_H
+
+#include <errno.h>
+#include <linux/bpf.h>
+#include <string.h>
+
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+#include <android-base/result.h>
+#include <android-base/thread_annotations.h>
+#include <android-base/unique_fd.h>
+
+namespace android {
+namespace bpf {
+
+namespace internal_ {
+
+struct PinnedMap {
+    size_t keySize;
+    size_t valueSize;
+    std::shared_ptr<void> storage;
+};
+
+// Stand-in for the BPF filesystem: in-memory maps pinned by path.
+class PinnedMaps {
+  public:
+    static PinnedMaps& get() {
+        static PinnedMaps instance;
+        return instance;
+    }
+
+    bool pin(const std::string& path, PinnedMap map) EXCLUDES(mLock) {
+        std::lock_guard guard(mLock);
+        return mMaps.emplace(path, std::move(map)).second;
+    }
+
+    bool find(const std::string& path, PinnedMap* map) EXCLUDES(mLock) {
+        std::lock_guard guard(mLock);
+        const auto it = mMaps.find(path);
+        if (it == mMaps.end()) return false;
+        *map = it->second;
+        return true;
+    }
+
+    void unpin(const std::string& path) EXCLUDES(mLock) {
+        std::lock_guard guard(mLock);
+        mMaps.erase(path);
+    }
+
+  private:
+    std::mutex mLock;
+    std::map<std::string, PinnedMap> mMaps GUARDED_BY(mLock);
+};
+
+}  // namespace internal_
+
+// An in-memory implementation of the BpfMap<Key, Value> API, for running code written against
+// BpfMap without root or kernel BPF support, e.g. in benchmarks.
+//
+// It behaves like a kernel BPF_MAP_TYPE_HASH map:
+//  - writeValue() honours BPF_ANY, BPF_NOEXIST and BPF_EXIST, and fails with E2BIG when adding a
+//    key to a map that already holds maxEntries entries.
+//  - readValue() and deleteValue() fail with ENOENT for missing keys.
+//  - getNextKey() on a key that is not in the map returns the first key, so deleting the current
+//    key while walking the map by hand restarts the walk. iterate() fetches the next key before
+//    calling its callback, as BpfMap does, so callbacks may delete the key they are given.
+//  - Iteration order is unspecified but stable, and entries added or removed during an iteration
+//    may or may not be visited.
+//  - A default-constructed map is invalid, and every operation on it fails with EBADF.
+//
+// Keys are hashed and compared as raw bytes, as in the kernel, so they must not contain padding.
+// Maps can be shared by pinning them to a path with pin() and opening them elsewhere with init(),
+// the way netd opens the maps created by bpfloader. getMap() always returns an invalid fd.
+//
+// Like kernel maps, each operation is atomic and the map can be used from multiple threads. Copies
+// of a map handle, including ones obtained through init(), refer to the same entries.
+template <class Key, class Value>
+class InMemoryBpfMap {
+  public:
+    static_assert(std::has_unique_object_representations_v<Key>,
+                  "InMemoryBpfMap keys are compared byte-wise and must not contain padding");
+
+    InMemoryBpfMap() = default;
+
+    // Creates an empty map that holds at most maxEntries entries.
+    explicit InMemoryBpfMap(uint32_t maxEntries) : mStorage(std::make_shared<Storage>(maxEntries)) {}
+
+    InMemoryBpfMap(const InMemoryBpfMap&) = default;
+    InMemoryBpfMap& operator=(const InMemoryBpfMap&) = default;
+
+    // Makes this map available to init() under path. Fails with EEXIST if path is already in use.
+    base::Result<void> pin(const char* path) const {
+        if (!isValid()) return base::ResultError("pin() on invalid map", EBADF);
+        if (!internal_::PinnedMaps::get().pin(path, {sizeof(Key), sizeof(Value), mStorage})) {
+            return base::ResultError(std::string("already pinned: ") + path, EEXIST);
+        }
+        return {};
+    }
+
+    // Removes the map pinned at path, if any. Open handles to it remain valid.
+    static void unpin(const char* path) { internal_::PinnedMaps::get().unpin(path); }
+
+    // Opens the map pinned at path, like BpfMap::init(). Fails with ENOENT if nothing is pinned
+    // there and with EINVAL if the pinned map has different key or value sizes.
+    base::Result<void> init(const char* path) {
+        internal_::PinnedMap pinned;
+        if (!internal_::PinnedMaps::get().find(path, &pinned)) {
+            return base::ResultError(std::string("no map pinned at ") + path, ENOENT);
+        }
+        if (pinned.keySize != sizeof(Key) || pinned.valueSize != sizeof(Value)) {
+            return base::ResultError(std::string("key or value size mismatch for ") + path,
+                                     EINVAL);
+        }
+        mStorage = std::static_pointer_cast<Storage>(pinned.storage);
+        return {};
+    }
+
+    const base::unique_fd& getMap() const {
+        static const base::unique_fd kNoFd;
+        return kNoFd;
+    }
+
+    bool isValid() const { return mStorage != nullptr; }
+
+    base::Result<Key> getFirstKey() const {
+        if (!isValid()) return badMap();
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        const auto& entries = storage.entries;
+        if (entries.empty()) return base::ResultError("map is empty", ENOENT);
+        return entries.begin()->first;
+    }
+
+    base::Result<Key> getNextKey(const Key& key) const {
+        if (!isValid()) return badMap();
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        const auto& entries = storage.entries;
+        auto it = entries.find(key);
+        it = (it == entries.end()) ? entries.begin() : std::next(it);
+        if (it == entries.end()) return base::ResultError("no next key", ENOENT);
+        return it->first;
+    }
+
+    base::Result<void> writeValue(const Key& key, const Value& value, uint64_t flags) {
+        if (!isValid()) return badMap();
+        if (flags > BPF_EXIST) return base::ResultError("invalid flags", EINVAL);
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        auto& entries = storage.entries;
+        const auto it = entries.find(key);
+        if (it != entries.end()) {
+            if (flags == BPF_NOEXIST) return base::ResultError("key exists", EEXIST);
+            it->second = value;
+            return {};
+        }
+        if (flags == BPF_EXIST) return base::ResultError("key not found", ENOENT);
+        if (entries.size() >= storage.maxEntries) return base::ResultError("map full", E2BIG);
+        entries.emplace(key, value);
+        return {};
+    }
+
+    base::Result<Value> readValue(const Key key) const {
+        if (!isValid()) return badMap();
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        const auto it = storage.entries.find(key);
+        if (it == storage.entries.end()) return base::ResultError("key not found", ENOENT);
+        return it->second;
+    }
+
+    base::Result<void> deleteValue(const Key& key) {
+        if (!isValid()) return badMap();
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        if (storage.entries.erase(key) == 0) return base::ResultError("key not found", ENOENT);
+        return {};
+    }
+
+    base::Result<void> clear() {
+        if (!isValid()) return badMap();
+        Storage& storage = *mStorage;
+        std::lock_guard guard(storage.lock);
+        storage.entries.clear();
+        return {};
+    }
+
+    base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, const InMemoryBpfMap& map)>&
+                    filter) const {
+        return iterateKeys([this, &filter](const Key& key) { return filter(key, *this); });
+    }
+
+    base::Result<void> iterate(
+            const std::function<base::Result<void>(const Key& key, InMemoryBpfMap& map)>& filter) {
+        return iterateKeys([this, &filter](const Key& key) { return filter(key, *this); });
+    }
+
+    base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   const InMemoryBpfMap& map)>& filter) const {
+        return iterateKeys([this, &filter](const Key& key) -> base::Result<void> {
+            auto value = readValue(key);
+            if (!value.ok()) return value.error();
+            return filter(key, value.value(), *this);
+        });
+    }
+
+    base::Result<void> iterateWithValue(
+            const std::function<base::Result<void>(const Key& key, const Value& value,
+                                                   InMemoryBpfMap& map)>& filter) {
+        return iterateKeys([this, &filter](const Key& key) -> base::Result<void> {
+            auto value = readValue(key);
+            if (!value.ok()) return value.error();
+            return filter(key, value.value(), *this);
+        });
+    }
+
+  private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string_view>()(
+                    std::string_view(reinterpret_cast<const char*>(&key), sizeof(key)));
+        }
+    };
+
+    struct KeyEqual {
+        bool operator()(const Key& a, const Key& b) const {
+            return memcmp(&a, &b, sizeof(Key)) == 0;
+        }
+    };
+
+    struct Storage {
+        explicit Storage(uint32_t maxEntries) : maxEntries(maxEntries) {
+            // Never rehash, so that iteration order does not change as entries are added.
+            entries.reserve(maxEntries);
+        }
+
+        std::mutex lock;
+        const uint32_t maxEntries;
+        std::unordered_map<Key, Value, KeyHash, KeyEqual> entries GUARDED_BY(lock);
+    };
+
+    static base::ResultError badMap() { return base::ResultError("invalid map", EBADF); }
+
+    // Same walk as BpfMap::iterate(): each step is a separate atomic operation, and the next key
+    // is looked up before the current one is handed to the callback.
+    template <class Fn>
+    base::Result<void> iterateKeys(const Fn& fn) const {
+        auto curKey = getFirstKey();
+        while (curKey.ok()) {
+            const auto nextKey = getNextKey(curKey.value());
+            auto status = fn(curKey.value());
+            if (!status.ok()) return status;
+            curKey = nextKey;
+        }
+        if (curKey.error().code() == ENOENT) return {};
+        return curKey.error();
+    }
+
+    std::shared_ptr<Storage> mStorage;
+};
+
+}  // namespace bpf
+}  // namespace android
+
+#endif  // NETDBPF_INMEMORYBPFMAP_H
@@ -88,6 +88,7 @@ const int IFACE_INDEX_NAME_MAP_SIZE = 1000;
 const int IFACE_STATS_MAP_SIZE = 1000;
 const int CONFIGURATION_MAP_SIZE = 2;
 const int UID_OWNER_MAP_SIZE = 2000;
+const int TCP_HEALTH_MAP_SIZE = 1000;
 
 #define BPF_PATH "/sys/fs/bpf"
 
@@ -98,6 +99,7 @@ const int UID_OWNER_MAP_SIZE = 2000;
 #define XT_BPF_WHITELIST_PROG_PATH BPF_PATH "/prog_netd_skfilter_whitelist_xtbpf"
 #define XT_BPF_BLACKLIST_PROG_PATH BPF_PATH "/prog_netd_skfilter_blacklist_xtbpf"
 #define CGROUP_SOCKET_PROG_PATH BPF_PATH "/prog_netd_cgroupsock_inet_create"
+#define TCP_HEALTH_SOCK_OPS_PROG_PATH BPF_PATH "/prog_netd_sockops_tcp_health"
 
 #define COOKIE_TAG_MAP_PATH BPF_PATH "/map_netd_cookie_tag_map"
 #define UID_COUNTERSET_MAP_PATH BPF_PATH "/map_netd_uid_counterset_map"
@@ -109,6 +111,7 @@ const int UID_OWNER_MAP_SIZE = 2000;
 #define CONFIGURATION_MAP_PATH BPF_PATH "/map_netd_configuration_map"
 #define UID_OWNER_MAP_PATH BPF_PATH "/map_netd_uid_owner_map"
 #define UID_PERMISSION_MAP_PATH BPF_PATH "/map_netd_uid_permission_map"
+#define TCP_HEALTH_MAP_PATH BPF_PATH "/map_netd_tcp_health_map"
 
 enum UidOwnerMatchType {
     NO_MATCH = 0,
@@ -152,6 +155,20 @@ typedef struct {
     uint8_t rule;
 } UidOwnerValue;
 
+// Per-network TCP health counters, keyed by netId and updated by the sock_ops program at the
+// time of the corresponding kernel event. All fields are monotonically increasing; readers compute
+// deltas between two reads instead of resetting the entries.
+typedef struct {
+    uint64_t rttUsSum;            // Sum of smoothed RTT samples, in microseconds
+    uint64_t rttSamples;          // Number of RTT samples summed in rttUsSum
+    uint64_t closedDataSegsOut;   // Data segments sent by connections, added when they close
+    uint64_t retransSegs;         // Retransmitted segments
+    uint64_t connectSuccess;      // Active opens that reached ESTABLISHED
+    uint64_t connectFailure;      // Active opens that closed before reaching ESTABLISHED
+    uint64_t established;         // Active and passive opens that reached ESTABLISHED
+    uint64_t closedEstablished;   // Connections counted in established that have since closed
+} TcpHealthValue;
+
 #define UID_RULES_CONFIGURATION_KEY 1
 #define CURRENT_STATS_MAP_CONFIGURATION_KEY 2
 
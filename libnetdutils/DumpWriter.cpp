@@ -36,6 +36,8 @@ const size_t kIndentStringLen = strlen(kIndentString);
 
 DumpWriter::DumpWriter(int fd) : mIndentLevel(0), mFd(fd) {}
 
+DumpWriter::DumpWriter(Sink sink) : mIndentLevel(0), mFd(-1), mSink(std::move(sink)) {}
+
 void DumpWriter::incIndent() {
     if (mIndentLevel < std::numeric_limits<decltype(mIndentLevel)>::max()) {
         mIndentLevel++;
@@ -49,13 +51,22 @@ void DumpWriter::decIndent() {
 }
 
 void DumpWriter::println(const std::string& line) {
+    // Assemble the whole line so that it is written at once.
+    std::string out;
     if (!line.empty()) {
+        out.reserve(mIndentLevel * kIndentStringLen + line.size() + 1);
         for (int i = 0; i < mIndentLevel; i++) {
-            ::write(mFd, kIndentString, kIndentStringLen);
+            out.append(kIndentString, kIndentStringLen);
         }
-        ::write(mFd, line.c_str(), line.size());
+        out.append(line);
+    }
+    out.push_back('\n');
+
+    if (mSink) {
+        mSink(out);
+    } else {
+        ::write(mFd, out.c_str(), out.size());
     }
-    ::write(mFd, "\n", 1);
 }
 
 // NOLINTNEXTLINE(cert-dcl50-cpp): Grandfathered C-style variadic function.
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "netdutils/EventLoop.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include "netdutils/ThreadUtil.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace netdutils {
+
+namespace {
+
+// epoll data of the wakeup eventfd. Source ids start at 1.
+constexpr EventLoop::SourceId kWakeupId = 0;
+
+uint64_t elapsedUs(EventLoop::TimePoint from, EventLoop::TimePoint to) {
+    if (to <= from) return 0;
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+}  // namespace
+
+EventLoop::EventLoop(Options options)
+    : mOptions(std::move(options)),
+      mEpoll(Fd(epoll_create1(EPOLL_CLOEXEC))),
+      mWakeup(Fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))) {
+    epoll_event event = {.events = EPOLLIN, .data = {.u64 = kWakeupId}};
+    if (epoll_ctl(Fd(mEpoll).get(), EPOLL_CTL_ADD, Fd(mWakeup).get(), &event) == -1) {
+        PLOG(ERROR) << "Unable to set up EventLoop " << mOptions.name;
+        return;
+    }
+    if (mOptions.thread) {
+        mThread = std::thread([this] { loop(); });
+    }
+}
+
+EventLoop::~EventLoop() {
+    shutdown();
+}
+
+EventLoop::TimePoint EventLoop::now() const {
+    return mOptions.clock ? mOptions.clock() : std::chrono::steady_clock::now();
+}
+
+StatusOr<EventLoop::SourceId> EventLoop::addSource(std::unique_ptr<Source> source,
+                                                   uint32_t events) {
+    std::lock_guard guard(mLock);
+    const SourceId id = mNextId++;
+    epoll_event event = {.events = events, .data = {.u64 = id}};
+    if (epoll_ctl(Fd(mEpoll).get(), EPOLL_CTL_ADD, source->fd.get(), &event) == -1) {
+        return statusFromErrno(errno, "Unable to add " + source->name + " to EventLoop");
+    }
+    mSources[id] = std::move(source);
+    return id;
+}
+
+StatusOr<EventLoop::SourceId> EventLoop::addFd(Fd fd, uint32_t events, const std::string& name,
+                                               Callback callback) {
+    if (!isWellFormed(fd)) return statusFromErrno(EBADF, "Invalid fd for " + name);
+    auto source = std::make_unique<Source>();
+    source->name = name;
+    source->fd = fd;
+    source->callback = std::move(callback);
+    return addSource(std::move(source), events);
+}
+
+StatusOr<EventLoop::SourceId> EventLoop::addTimer(const std::string& name,
+                                                  std::chrono::milliseconds interval,
+                                                  std::function<void()> callback) {
+    if (interval.count() <= 0) return statusFromErrno(EINVAL, "Invalid interval for " + name);
+    UniqueFd timerFd(Fd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)));
+    if (!isWellFormed(timerFd)) return statusFromErrno(errno, "Unable to create timer " + name);
+
+    const timespec ts = {.tv_sec = static_cast<time_t>(interval.count() / 1000),
+                         .tv_nsec = static_cast<long>(interval.count() % 1000 * 1000000)};
+    const itimerspec spec = {.it_interval = ts, .it_value = ts};
+    if (timerfd_settime(Fd(timerFd).get(), 0, &spec, nullptr) == -1) {
+        return statusFromErrno(errno, "Unable to start timer " + name);
+    }
+
+    auto source = std::make_unique<Source>();
+    source->name = name;
+    source->fd = timerFd;
+    source->timerFd = std::move(timerFd);
+    source->callback = [callback = std::move(callback)](uint32_t) { callback(); };
+    return addSource(std::move(source), EPOLLIN);
+}
+
+Status EventLoop::remove(SourceId id) NO_THREAD_SAFETY_ANALYSIS {
+    std::shared_ptr<Source> source;
+    std::unique_lock lock(mLock);
+    const auto it = mSources.find(id);
+    if (it == mSources.end()) {
+        return statusFromErrno(ENOENT, StringPrintf("No EventLoop source %" PRIu64, id));
+    }
+    source = std::move(it->second);
+    mSources.erase(it);
+    // Fails harmlessly if the owner already closed the fd.
+    epoll_ctl(Fd(mEpoll).get(), EPOLL_CTL_DEL, source->fd.get(), nullptr);
+
+    // A callback that removes its own source must not wait for itself to return.
+    if (mDispatchThread != std::this_thread::get_id()) {
+        mDispatchCv.wait(lock, [this, id]() NO_THREAD_SAFETY_ANALYSIS {
+            return mDispatching != id;
+        });
+    }
+    lock.unlock();
+    // The timer fd, if any, is closed here, after it was removed from the epoll set.
+    source.reset();
+    return status::ok;
+}
+
+StatusOr<size_t> EventLoop::dispatchOnce(int timeoutMs) NO_THREAD_SAFETY_ANALYSIS {
+    std::vector<epoll_event> events(std::max(mOptions.maxEventsPerWakeup, 1));
+    const int n = epoll_wait(Fd(mEpoll).get(), events.data(), events.size(), timeoutMs);
+    if (n == -1) {
+        if (errno == EINTR) return 0;
+        return statusFromErrno(errno, "epoll_wait failed");
+    }
+    const TimePoint woke = now();
+
+    size_t dispatched = 0;
+    for (int i = 0; i < n; i++) {
+        const SourceId id = events[i].data.u64;
+        if (id == kWakeupId) continue;
+
+        std::shared_ptr<Source> source;
+        {
+            std::lock_guard guard(mLock);
+            if (mShutdown) break;
+            const auto it = mSources.find(id);
+            // Removed by an earlier callback of this wakeup.
+            if (it == mSources.end()) continue;
+            source = it->second;
+            mDispatching = id;
+            mDispatchThread = std::this_thread::get_id();
+        }
+
+        uint64_t expirations = 1;
+        bool ready = true;
+        if (isWellFormed(source->timerFd)) {
+            ready = read(Fd(source->timerFd).get(), &expirations, sizeof(expirations)) ==
+                    sizeof(expirations);
+        }
+
+        const TimePoint start = now();
+        if (ready) {
+            source->callback(events[i].events);
+            dispatched++;
+        }
+        const uint64_t runUs = elapsedUs(start, now());
+        {
+            std::lock_guard guard(mLock);
+            if (ready) {
+                SourceStats& stats = source->stats;
+                const uint64_t delayUs = elapsedUs(woke, start);
+                stats.dispatches++;
+                stats.totalDelayUs += delayUs;
+                stats.maxDelayUs = std::max(stats.maxDelayUs, delayUs);
+                stats.totalRunUs += runUs;
+                stats.maxRunUs = std::max(stats.maxRunUs, runUs);
+                stats.missedTimerExpirations += expirations - 1;
+            }
+        }
+        // If the callback removed its own source, destroy it before reporting the dispatch as done.
+        source.reset();
+        {
+            std::lock_guard guard(mLock);
+            mDispatching = 0;
+            mDispatchThread = std::thread::id();
+        }
+        mDispatchCv.notify_all();
+    }
+    return dispatched;
+}
+
+void EventLoop::loop() {
+    setThreadName(mOptions.name);
+    while (true) {
+        {
+            std::lock_guard guard(mLock);
+            if (mShutdown) break;
+        }
+        const auto result = dispatchOnce(-1);
+        if (!isOk(result)) {
+            LOG(ERROR) << "EventLoop " << mOptions.name << " stopped: " << toString(result);
+            break;
+        }
+    }
+}
+
+StatusOr<size_t> EventLoop::runOnce(std::chrono::milliseconds timeout) {
+    CHECK(!mOptions.thread) << "runOnce() is only available without a loop thread";
+    return dispatchOnce(timeout.count());
+}
+
+void EventLoop::shutdown() {
+    {
+        std::lock_guard guard(mLock);
+        if (mShutdown) return;
+        mShutdown = true;
+    }
+    const uint64_t one = 1;
+    if (write(Fd(mWakeup).get(), &one, sizeof(one)) == -1) {
+        PLOG(ERROR) << "Unable to wake up EventLoop " << mOptions.name;
+    }
+    if (mThread.joinable()) mThread.join();
+}
+
+EventLoop::SourceStats EventLoop::stats(SourceId id) const {
+    std::lock_guard guard(mLock);
+    const auto it = mSources.find(id);
+    return it == mSources.end() ? SourceStats{} : it->second->stats;
+}
+
+void EventLoop::dump(DumpWriter& dw) const {
+    std::lock_guard guard(mLock);
+    dw.println("EventLoop %s: %zu sources%s", mOptions.name.c_str(), mSources.size(),
+               mShutdown ? " (shut down)" : "");
+    ScopedIndent indent(dw);
+    for (const auto& entry : mSources) {
+        const Source* source = entry.second.get();
+        const SourceStats& s = source->stats;
+        std::string line = StringPrintf("%s: dispatches=%" PRIu64, source->name.c_str(),
+                                        s.dispatches);
+        if (s.dispatches > 0) {
+            line += StringPrintf(" delay: avg=%" PRIu64 "us max=%" PRIu64 "us; run: avg=%" PRIu64
+                                 "us max=%" PRIu64 "us",
+                                 s.totalDelayUs / s.dispatches, s.maxDelayUs,
+                                 s.totalRunUs / s.dispatches, s.maxRunUs);
+        }
+        if (isWellFormed(source->timerFd)) {
+            line += StringPrintf(" missedExpirations=%" PRIu64, s.missedTimerExpirations);
+        }
+        dw.println(line);
+    }
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <numeric>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+#include "netdutils/EventLoop.h"
+
+namespace android {
+namespace netdutils {
+
+using android::base::unique_fd;
+using std::chrono::milliseconds;
+using SourceId = EventLoop::SourceId;
+
+namespace {
+
+constexpr milliseconds kNoWait(0);
+
+EventLoop::Options deterministic() {
+    return {.name = "test", .thread = false};
+}
+
+// A fake event source: readable from the first signal() until drain().
+unique_fd makeFakeFd() {
+    return unique_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+}
+
+void signal(const unique_fd& fd) {
+    const uint64_t one = 1;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(one)), write(fd.get(), &one, sizeof(one)));
+}
+
+void drain(const unique_fd& fd) {
+    uint64_t value;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(value)), read(fd.get(), &value, sizeof(value)));
+}
+
+SourceId addOrDie(EventLoop& loop, const unique_fd& fd, const std::string& name,
+                  EventLoop::Callback callback) {
+    auto id = loop.addFd(fd.get(), EPOLLIN, name, std::move(callback));
+    EXPECT_TRUE(isOk(id)) << toString(id);
+    return isOk(id) ? id.value() : 0;
+}
+
+// Runs one iteration of a deterministic loop and returns the number of callbacks run.
+size_t dispatch(EventLoop& loop, milliseconds timeout = kNoWait) {
+    const auto result = loop.runOnce(timeout);
+    EXPECT_TRUE(isOk(result)) << toString(result);
+    return isOk(result) ? result.value() : 0;
+}
+
+}  // namespace
+
+TEST(EventLoopTest, DispatchesReadyFds) {
+    EventLoop loop(deterministic());
+    unique_fd fd = makeFakeFd();
+    int calls = 0;
+    uint32_t lastEvents = 0;
+    const SourceId id = addOrDie(loop, fd, "fake", [&](uint32_t events) {
+        calls++;
+        lastEvents = events;
+        drain(fd);
+    });
+
+    EXPECT_EQ(0U, dispatch(loop));
+    signal(fd);
+    EXPECT_EQ(1U, dispatch(loop));
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(static_cast<uint32_t>(EPOLLIN), lastEvents);
+    // Drained, so not dispatched again.
+    EXPECT_EQ(0U, dispatch(loop));
+    EXPECT_EQ(1U, loop.stats(id).dispatches);
+
+    EXPECT_TRUE(isOk(loop.remove(id)));
+    signal(fd);
+    EXPECT_EQ(0U, dispatch(loop));
+    EXPECT_EQ(ENOENT, loop.remove(id).code());
+}
+
+TEST(EventLoopTest, BusySourceDoesNotStarveOthers) {
+    constexpr int kSources = 5;
+    constexpr int kWakeups = 50;
+    EventLoop::Options options = deterministic();
+    options.maxEventsPerWakeup = 2;
+    EventLoop loop(options);
+
+    // Sources are never drained, so all of them are ready all the time, and there are more of
+    // them than fit in one wakeup.
+    std::vector<unique_fd> fds;
+    std::vector<int> calls(kSources);
+    for (int i = 0; i < kSources; i++) {
+        fds.push_back(makeFakeFd());
+        signal(fds.back());
+        addOrDie(loop, fds.back(), "busy" + std::to_string(i), [&calls, i](uint32_t) {
+            calls[i]++;
+        });
+    }
+
+    for (int i = 0; i < kWakeups; i++) {
+        EXPECT_EQ(2U, dispatch(loop));
+    }
+    // Every source got its share of the wakeups.
+    const auto [fewest, most] = std::minmax_element(calls.begin(), calls.end());
+    EXPECT_LE(*most - *fewest, 1);
+    EXPECT_EQ(kWakeups * 2, std::accumulate(calls.begin(), calls.end(), 0));
+}
+
+TEST(EventLoopTest, EachSourceDispatchedOncePerWakeup) {
+    EventLoop loop(deterministic());
+    unique_fd busy = makeFakeFd();
+    unique_fd quiet = makeFakeFd();
+    int busyCalls = 0;
+    int quietCalls = 0;
+    addOrDie(loop, busy, "busy", [&busyCalls](uint32_t) { busyCalls++; });
+    addOrDie(loop, quiet, "quiet", [&](uint32_t) {
+        quietCalls++;
+        drain(quiet);
+    });
+
+    signal(busy);
+    signal(quiet);
+    EXPECT_EQ(2U, dispatch(loop));
+    EXPECT_EQ(1, busyCalls);
+    EXPECT_EQ(1, quietCalls);
+    EXPECT_EQ(1U, dispatch(loop));
+    EXPECT_EQ(2, busyCalls);
+}
+
+TEST(EventLoopTest, DispatchLatency) {
+    EventLoop::TimePoint fakeNow;
+    EventLoop::Options options = deterministic();
+    options.clock = [&fakeNow] { return fakeNow; };
+    EventLoop loop(options);
+
+    using std::chrono::microseconds;
+    unique_fd slow = makeFakeFd();
+    unique_fd fast = makeFakeFd();
+    std::vector<SourceId> order;
+    SourceId slowId = 0;
+    SourceId fastId = 0;
+    slowId = addOrDie(loop, slow, "slow", [&](uint32_t) {
+        order.push_back(slowId);
+        fakeNow += microseconds(700);
+        drain(slow);
+    });
+    fastId = addOrDie(loop, fast, "fast", [&](uint32_t) {
+        order.push_back(fastId);
+        fakeNow += microseconds(20);
+        drain(fast);
+    });
+
+    signal(slow);
+    signal(fast);
+    EXPECT_EQ(2U, dispatch(loop));
+    ASSERT_EQ(2U, order.size());
+
+    // The source dispatched second waited for the first one to run.
+    const SourceId first = order[0];
+    const SourceId second = order[1];
+    const uint64_t firstRunUs = first == slowId ? 700 : 20;
+    EXPECT_EQ(0U, loop.stats(first).maxDelayUs);
+    EXPECT_EQ(firstRunUs, loop.stats(second).maxDelayUs);
+    EXPECT_EQ(700U, loop.stats(slowId).maxRunUs);
+    EXPECT_EQ(20U, loop.stats(fastId).totalRunUs);
+}
+
+TEST(EventLoopTest, Timer) {
+    EventLoop loop(deterministic());
+    int calls = 0;
+    auto id = loop.addTimer("timer", milliseconds(10), [&calls] { calls++; });
+    ASSERT_TRUE(isOk(id));
+
+    EXPECT_EQ(1U, dispatch(loop, milliseconds(1000)));
+    EXPECT_EQ(1, calls);
+
+    // Expirations that happen while the loop is busy are merged.
+    usleep(35 * 1000);
+    EXPECT_EQ(1U, dispatch(loop));
+    EXPECT_EQ(2, calls);
+    EXPECT_LE(2U, loop.stats(id.value()).missedTimerExpirations);
+
+    EXPECT_TRUE(isOk(loop.remove(id.value())));
+    EXPECT_EQ(0U, dispatch(loop, milliseconds(30)));
+    EXPECT_EQ(EINVAL, loop.addTimer("bad", milliseconds(0), [] {}).status().code());
+}
+
+TEST(EventLoopTest, RemoveWaitsForRunningCallback) {
+    EventLoop loop({.name = "test"});
+    unique_fd fd = makeFakeFd();
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<bool> finished = false;
+    const SourceId id = addOrDie(loop, fd, "blocking", [&](uint32_t) {
+        drain(fd);
+        started.set_value();
+        released.wait();
+        finished = true;
+    });
+
+    signal(fd);
+    started.get_future().wait();
+    std::atomic<bool> removed = false;
+    std::thread remover([&] {
+        EXPECT_TRUE(isOk(loop.remove(id)));
+        removed = true;
+    });
+    std::this_thread::sleep_for(milliseconds(20));
+    EXPECT_FALSE(removed);
+
+    release.set_value();
+    remover.join();
+    EXPECT_TRUE(finished);
+}
+
+TEST(EventLoopTest, CallbackRemovesItself) {
+    EventLoop loop({.name = "test"});
+    unique_fd fd = makeFakeFd();
+    std::promise<void> removed;
+    SourceId id = 0;
+    std::atomic<int> calls = 0;
+    id = addOrDie(loop, fd, "once", [&](uint32_t) {
+        // Not drained: only removing the source stops the dispatches.
+        if (calls++ == 0) {
+            EXPECT_TRUE(isOk(loop.remove(id)));
+            removed.set_value();
+        }
+    });
+
+    signal(fd);
+    removed.get_future().wait();
+    std::this_thread::sleep_for(milliseconds(20));
+    EXPECT_EQ(1, calls);
+}
+
+TEST(EventLoopTest, ShutdownStopsDispatching) {
+    EventLoop loop({.name = "test"});
+    unique_fd fd = makeFakeFd();
+    std::atomic<int> calls = 0;
+    const SourceId id = addOrDie(loop, fd, "fake", [&](uint32_t) {
+        calls++;
+        drain(fd);
+    });
+    loop.shutdown();
+    signal(fd);
+    std::this_thread::sleep_for(milliseconds(20));
+    EXPECT_EQ(0, calls);
+    EXPECT_TRUE(isOk(loop.remove(id)));
+}
+
+TEST(EventLoopTest, Dump) {
+    EventLoop loop(deterministic());
+    unique_fd fd = makeFakeFd();
+    addOrDie(loop, fd, "fake", [&fd](uint32_t) { drain(fd); });
+    signal(fd);
+    EXPECT_EQ(1U, dispatch(loop));
+
+    unique_fd out(memfd_create("dump", MFD_CLOEXEC));
+    {
+        DumpWriter dw(out.get());
+        loop.dump(dw);
+    }
+    std::string dump(4096, '\0');
+    ASSERT_NE(-1, lseek(out.get(), 0, SEEK_SET));
+    dump.resize(std::max<ssize_t>(0, read(out.get(), dump.data(), dump.size())));
+    EXPECT_NE(std::string::npos, dump.find("EventLoop test: 1 sources")) << dump;
+    EXPECT_NE(std::string::npos, dump.find("fake: dispatches=1 delay:")) << dump;
+}
+
+}  // namespace netdutils
+}  // namespace android
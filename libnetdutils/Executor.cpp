@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "netdutils/Executor.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+
+#include "netdutils/ThreadUtil.h"
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace netdutils {
+
+namespace {
+
+uint64_t elapsedUs(Executor::TimePoint from, Executor::TimePoint to) {
+    if (to <= from) return 0;
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+size_t histogramBucket(uint64_t us) {
+    const auto& bounds = Executor::kLatencyBucketsUs;
+    return std::upper_bound(bounds.begin(), bounds.end(), us) - bounds.begin();
+}
+
+}  // namespace
+
+Executor::Executor(Options options) : mOptions(std::move(options)) {
+    for (int i = 0; i < mOptions.threads; i++) {
+        mWorkers.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+Executor::~Executor() {
+    shutdown();
+}
+
+const char* Executor::laneName(Lane lane) {
+    switch (lane) {
+        case Lane::HIGH:
+            return "high";
+        case Lane::NORMAL:
+            return "normal";
+        case Lane::BACKGROUND:
+            return "background";
+    }
+    return "unknown";
+}
+
+Executor::TimePoint Executor::now() const {
+    return mOptions.clock ? mOptions.clock() : std::chrono::steady_clock::now();
+}
+
+Status Executor::post(Lane lane, Task task) NO_THREAD_SAFETY_ANALYSIS {
+    const size_t index = static_cast<size_t>(lane);
+    const LaneOptions& options = mOptions.lanes[index];
+    // Destroyed after the lock is released, in case its destructor does real work.
+    QueuedTask dropped;
+
+    std::unique_lock lock(mLock);
+    LaneState& state = mLanes[index];
+    if (!mShutdown && state.queue.size() >= options.capacity) {
+        if (options.overflow == Overflow::DROP_OLDEST && !state.queue.empty()) {
+            dropped = std::move(state.queue.front());
+            state.queue.pop_front();
+            state.stats.dropped++;
+        } else if (options.overflow == Overflow::BLOCK && !mWorkers.empty()) {
+            mDoneCv.wait(lock, [&]() NO_THREAD_SAFETY_ANALYSIS {
+                return mShutdown || state.queue.size() < options.capacity;
+            });
+        }
+    }
+    if (mShutdown) {
+        state.stats.rejected++;
+        return statusFromErrno(ESHUTDOWN, "Executor is shut down");
+    }
+    if (state.queue.size() >= options.capacity) {
+        state.stats.rejected++;
+        return statusFromErrno(EAGAIN, StringPrintf("Executor lane %s is full", laneName(lane)));
+    }
+
+    state.queue.push_back({std::move(task), now()});
+    state.stats.posted++;
+    state.stats.queued = state.queue.size();
+    state.stats.maxQueued = std::max(state.stats.maxQueued, state.stats.queued);
+    lock.unlock();
+    mWorkCv.notify_one();
+    return status::ok;
+}
+
+bool Executor::takeNextLocked(QueuedTask* task, size_t* lane) {
+    for (size_t i = 0; i < kNumLanes; i++) {
+        LaneState& state = mLanes[i];
+        if (state.queue.empty()) continue;
+
+        *task = std::move(state.queue.front());
+        state.queue.pop_front();
+        state.stats.queued = state.queue.size();
+        const uint64_t waitUs = elapsedUs(task->posted, now());
+        state.stats.totalWaitUs += waitUs;
+        state.stats.maxWaitUs = std::max(state.stats.maxWaitUs, waitUs);
+        state.stats.waitHistogram[histogramBucket(waitUs)]++;
+        *lane = i;
+        return true;
+    }
+    return false;
+}
+
+void Executor::runLocked(std::unique_lock<std::mutex>& lock, QueuedTask task,
+                         size_t lane) NO_THREAD_SAFETY_ANALYSIS {
+    mRunning++;
+    lock.unlock();
+    const TimePoint start = now();
+    task.task();
+    const uint64_t runUs = elapsedUs(start, now());
+    // Destroy the closure before reporting the task as done, so that waitForIdle() also waits for
+    // whatever it holds to be released.
+    task.task = nullptr;
+    lock.lock();
+    mRunning--;
+
+    LaneStats& stats = mLanes[lane].stats;
+    stats.executed++;
+    stats.totalRunUs += runUs;
+    stats.maxRunUs = std::max(stats.maxRunUs, runUs);
+    mDoneCv.notify_all();
+}
+
+bool Executor::idleLocked() const {
+    if (mRunning > 0) return false;
+    return std::all_of(mLanes.begin(), mLanes.end(),
+                       [](const LaneState& state) { return state.queue.empty(); });
+}
+
+void Executor::workerLoop(int index) NO_THREAD_SAFETY_ANALYSIS {
+    setThreadName(StringPrintf("%s-%d", mOptions.name.c_str(), index));
+
+    std::unique_lock lock(mLock);
+    while (true) {
+        QueuedTask task;
+        size_t lane;
+        if (takeNextLocked(&task, &lane)) {
+            runLocked(lock, std::move(task), lane);
+            continue;
+        }
+        if (mShutdown) break;
+        mWorkCv.wait(lock);
+    }
+}
+
+void Executor::shutdown() {
+    {
+        std::lock_guard guard(mLock);
+        mShutdown = true;
+    }
+    mWorkCv.notify_all();
+    mDoneCv.notify_all();
+    for (auto& worker : mWorkers) {
+        if (worker.joinable()) worker.join();
+    }
+    if (mWorkers.empty()) runPending();
+}
+
+void Executor::waitForIdle() NO_THREAD_SAFETY_ANALYSIS {
+    if (mWorkers.empty()) {
+        runPending();
+        return;
+    }
+    std::unique_lock lock(mLock);
+    mDoneCv.wait(lock, [this]() NO_THREAD_SAFETY_ANALYSIS { return idleLocked(); });
+}
+
+bool Executor::runOne() NO_THREAD_SAFETY_ANALYSIS {
+    CHECK(mWorkers.empty()) << "runOne() is only available without worker threads";
+    std::unique_lock lock(mLock);
+    QueuedTask task;
+    size_t lane;
+    if (!takeNextLocked(&task, &lane)) return false;
+    runLocked(lock, std::move(task), lane);
+    return true;
+}
+
+size_t Executor::runPending() {
+    size_t count = 0;
+    while (runOne()) count++;
+    return count;
+}
+
+Executor::LaneStats Executor::stats(Lane lane) const {
+    std::lock_guard guard(mLock);
+    return mLanes[static_cast<size_t>(lane)].stats;
+}
+
+void Executor::dump(DumpWriter& dw) const {
+    std::lock_guard guard(mLock);
+    dw.println("Executor %s: %zu threads%s", mOptions.name.c_str(), mWorkers.size(),
+               mShutdown ? " (shut down)" : "");
+    ScopedIndent indent(dw);
+    for (size_t i = 0; i < kNumLanes; i++) {
+        const LaneStats& s = mLanes[i].stats;
+        const LaneOptions& options = mOptions.lanes[i];
+        dw.println("%s: queued=%zu/%zu maxQueued=%zu posted=%" PRIu64 " executed=%" PRIu64
+                   " rejected=%" PRIu64 " dropped=%" PRIu64,
+                   laneName(static_cast<Lane>(i)), s.queued, options.capacity, s.maxQueued,
+                   s.posted, s.executed, s.rejected, s.dropped);
+        if (s.executed == 0) continue;
+
+        ScopedIndent laneIndent(dw);
+        dw.println("wait: avg=%" PRIu64 "us max=%" PRIu64 "us; run: avg=%" PRIu64
+                   "us max=%" PRIu64 "us",
+                   s.totalWaitUs / s.executed, s.maxWaitUs, s.totalRunUs / s.executed,
+                   s.maxRunUs);
+        std::string histogram = "wait histogram:";
+        for (size_t b = 0; b < s.waitHistogram.size(); b++) {
+            if (b < kLatencyBucketsUs.size()) {
+                histogram += StringPrintf(" <%" PRIu64 "us=%" PRIu64, kLatencyBucketsUs[b],
+                                          s.waitHistogram[b]);
+            } else {
+                histogram += StringPrintf(" >=%" PRIu64 "us=%" PRIu64, kLatencyBucketsUs.back(),
+                                          s.waitHistogram[b]);
+            }
+        }
+        dw.println(histogram);
+    }
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/Executor.h"
+
+namespace android {
+namespace netdutils {
+
+using Lane = Executor::Lane;
+using Overflow = Executor::Overflow;
+
+namespace {
+
+Executor::Options deterministic() {
+    return {.name = "test", .threads = 0};
+}
+
+}  // namespace
+
+TEST(ExecutorTest, DeterministicRunsInPriorityOrder) {
+    Executor executor(deterministic());
+    std::vector<std::string> ran;
+    EXPECT_TRUE(isOk(executor.post(Lane::BACKGROUND, [&ran] { ran.push_back("bg1"); })));
+    EXPECT_TRUE(isOk(executor.post(Lane::NORMAL, [&ran] { ran.push_back("normal"); })));
+    EXPECT_TRUE(isOk(executor.post(Lane::BACKGROUND, [&ran] { ran.push_back("bg2"); })));
+    EXPECT_TRUE(isOk(executor.post(Lane::HIGH, [&ran] { ran.push_back("high"); })));
+
+    // Nothing runs until the test asks.
+    EXPECT_TRUE(ran.empty());
+    EXPECT_TRUE(executor.runOne());
+    EXPECT_EQ(std::vector<std::string>{"high"}, ran);
+
+    EXPECT_EQ(3U, executor.runPending());
+    const std::vector<std::string> expected = {"high", "normal", "bg1", "bg2"};
+    EXPECT_EQ(expected, ran);
+    EXPECT_FALSE(executor.runOne());
+}
+
+TEST(ExecutorTest, RunPendingRunsTasksPostedByTasks) {
+    Executor executor(deterministic());
+    int count = 0;
+    std::function<void()> chain = [&] {
+        if (++count < 5) executor.post(Lane::NORMAL, chain).ignoreError();
+    };
+    executor.post(Lane::NORMAL, chain).ignoreError();
+    EXPECT_EQ(5U, executor.runPending());
+    EXPECT_EQ(5, count);
+}
+
+TEST(ExecutorTest, Reject) {
+    Executor::Options options = deterministic();
+    options.lanes[static_cast<size_t>(Lane::NORMAL)] = {.capacity = 2,
+                                                         .overflow = Overflow::REJECT};
+    Executor executor(options);
+    int ran = 0;
+    EXPECT_TRUE(isOk(executor.post(Lane::NORMAL, [&ran] { ran += 1; })));
+    EXPECT_TRUE(isOk(executor.post(Lane::NORMAL, [&ran] { ran += 10; })));
+    EXPECT_EQ(EAGAIN, executor.post(Lane::NORMAL, [&ran] { ran += 100; }).code());
+    // Other lanes are unaffected.
+    EXPECT_TRUE(isOk(executor.post(Lane::HIGH, [&ran] { ran += 1000; })));
+
+    executor.runPending();
+    EXPECT_EQ(1011, ran);
+    const auto stats = executor.stats(Lane::NORMAL);
+    EXPECT_EQ(2U, stats.posted);
+    EXPECT_EQ(2U, stats.executed);
+    EXPECT_EQ(1U, stats.rejected);
+    EXPECT_EQ(2U, stats.maxQueued);
+    EXPECT_EQ(0U, stats.queued);
+}
+
+TEST(ExecutorTest, DropOldest) {
+    Executor::Options options = deterministic();
+    options.lanes[static_cast<size_t>(Lane::BACKGROUND)] = {.capacity = 2,
+                                                            .overflow = Overflow::DROP_OLDEST};
+    Executor executor(options);
+    std::vector<int> ran;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(isOk(executor.post(Lane::BACKGROUND, [&ran, i] { ran.push_back(i); })));
+    }
+    executor.runPending();
+    EXPECT_EQ((std::vector<int>{3, 4}), ran);
+    const auto stats = executor.stats(Lane::BACKGROUND);
+    EXPECT_EQ(5U, stats.posted);
+    EXPECT_EQ(3U, stats.dropped);
+    EXPECT_EQ(2U, stats.executed);
+}
+
+TEST(ExecutorTest, BlockWithoutWorkersRejects) {
+    Executor::Options options = deterministic();
+    options.lanes[static_cast<size_t>(Lane::HIGH)] = {.capacity = 1, .overflow = Overflow::BLOCK};
+    Executor executor(options);
+    EXPECT_TRUE(isOk(executor.post(Lane::HIGH, [] {})));
+    EXPECT_EQ(EAGAIN, executor.post(Lane::HIGH, [] {}).code());
+}
+
+TEST(ExecutorTest, BlockWaitsForRoom) {
+    Executor::Options options = {.name = "test", .threads = 1};
+    options.lanes[static_cast<size_t>(Lane::NORMAL)] = {.capacity = 1,
+                                                         .overflow = Overflow::BLOCK};
+    Executor executor(options);
+
+    // Occupy the worker, then fill the lane.
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    executor.post(Lane::NORMAL, [&started, released] {
+                started.set_value();
+                released.wait();
+            }).ignoreError();
+    started.get_future().wait();
+    EXPECT_TRUE(isOk(executor.post(Lane::NORMAL, [] {})));
+
+    std::atomic<bool> posted = false;
+    std::thread poster([&] {
+        EXPECT_TRUE(isOk(executor.post(Lane::NORMAL, [] {})));
+        posted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(posted);
+
+    release.set_value();
+    poster.join();
+    EXPECT_TRUE(posted);
+    executor.waitForIdle();
+    EXPECT_EQ(3U, executor.stats(Lane::NORMAL).executed);
+    EXPECT_EQ(0U, executor.stats(Lane::NORMAL).rejected);
+}
+
+TEST(ExecutorTest, WorkersRunEverything) {
+    constexpr int kTasks = 1000;
+    Executor::Options options = {.name = "test", .threads = 4};
+    for (auto& lane : options.lanes) lane.capacity = kTasks;
+    Executor executor(options);
+    std::atomic<int> count = 0;
+    for (int i = 0; i < kTasks; i++) {
+        const Lane lane = static_cast<Lane>(i % Executor::kNumLanes);
+        EXPECT_TRUE(isOk(executor.post(lane, [&count] { count++; })));
+    }
+    executor.waitForIdle();
+    EXPECT_EQ(kTasks, count);
+}
+
+TEST(ExecutorTest, ShutdownDrainsAndRejects) {
+    Executor executor({.name = "test", .threads = 2});
+    std::atomic<int> count = 0;
+    for (int i = 0; i < 100; i++) {
+        executor.post(Lane::BACKGROUND, [&count] { count++; }).ignoreError();
+    }
+    executor.shutdown();
+    EXPECT_EQ(100, count);
+    EXPECT_EQ(ESHUTDOWN, executor.post(Lane::HIGH, [] {}).code());
+    EXPECT_EQ(1U, executor.stats(Lane::HIGH).rejected);
+
+    // Without workers, shutdown runs what is queued on the calling thread.
+    Executor manual(deterministic());
+    manual.post(Lane::NORMAL, [&count] { count++; }).ignoreError();
+    manual.shutdown();
+    EXPECT_EQ(101, count);
+}
+
+TEST(ExecutorTest, LatencyMetrics) {
+    Executor::TimePoint fakeNow;
+    Executor::Options options = deterministic();
+    options.clock = [&fakeNow] { return fakeNow; };
+    Executor executor(options);
+
+    using std::chrono::microseconds;
+    // Waits of 5us, 50us and 5ms; the second task also takes 30us to run.
+    executor.post(Lane::NORMAL, [] {}).ignoreError();
+    fakeNow += microseconds(5);
+    EXPECT_TRUE(executor.runOne());
+
+    executor.post(Lane::NORMAL, [&fakeNow] { fakeNow += microseconds(30); }).ignoreError();
+    fakeNow += microseconds(50);
+    EXPECT_TRUE(executor.runOne());
+
+    executor.post(Lane::NORMAL, [] {}).ignoreError();
+    fakeNow += microseconds(5000);
+    EXPECT_TRUE(executor.runOne());
+
+    const auto stats = executor.stats(Lane::NORMAL);
+    EXPECT_EQ(3U, stats.executed);
+    EXPECT_EQ(5055U, stats.totalWaitUs);
+    EXPECT_EQ(5000U, stats.maxWaitUs);
+    EXPECT_EQ(30U, stats.totalRunUs);
+    EXPECT_EQ(30U, stats.maxRunUs);
+    const Executor::Histogram expected = {1, 1, 0, 1, 0, 0, 0};
+    EXPECT_EQ(expected, stats.waitHistogram);
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/IPPrefixTrie.h"
+
+namespace android {
+namespace netdutils {
+
+namespace {
+
+IPPrefix prefix(const std::string& repr) {
+    IPPrefix p;
+    EXPECT_TRUE(IPPrefix::forString(repr, &p)) << repr;
+    return p;
+}
+
+IPAddress addr(const std::string& repr) {
+    IPAddress ip;
+    EXPECT_TRUE(IPAddress::forString(repr, &ip)) << repr;
+    return ip;
+}
+
+template <typename Value>
+std::vector<std::pair<IPPrefix, Value>> entries(const IPPrefixTrie<Value>& trie) {
+    std::vector<std::pair<IPPrefix, Value>> out;
+    trie.forEach([&out](const IPPrefix& p, const Value& v) { out.emplace_back(p, v); });
+    return out;
+}
+
+// The reference implementation: a sorted map searched exhaustively.
+using Reference = std::map<IPPrefix, int>;
+
+bool contains(const IPPrefix& p, const IPPrefix& q) {
+    return p.family() == q.family() && p.length() <= q.length() &&
+           IPPrefix(q.ip(), p.length()) == p;
+}
+
+const int* bruteForceMatch(const Reference& ref, const IPPrefix& q, IPPrefix* matched) {
+    const int* best = nullptr;
+    int bestLength = -1;
+    for (const auto& [p, value] : ref) {
+        if (contains(p, q) && p.length() > bestLength) {
+            best = &value;
+            bestLength = p.length();
+            *matched = p;
+        }
+    }
+    return best;
+}
+
+// Random prefixes concentrated under a few base addresses, so that they nest and share paths.
+class PrefixGenerator {
+  public:
+    explicit PrefixGenerator(uint32_t seed) : mRng(seed) {}
+
+    IPAddress address() {
+        if (std::uniform_int_distribution<int>(0, 1)(mRng) == 0) {
+            in_addr v4 = {htonl(0x0a000000 | (uniform() & 0x00ff00ff) | (uniform() & 0x3))};
+            return IPAddress(v4);
+        }
+        in6_addr v6 = {};
+        v6.s6_addr[0] = 0x20;
+        v6.s6_addr[1] = 0x01;
+        v6.s6_addr[2] = 0x0d;
+        v6.s6_addr[3] = 0xb8;
+        v6.s6_addr[5] = uniform() & 0x3;
+        v6.s6_addr[8] = uniform() & 0x81;
+        v6.s6_addr[15] = uniform();
+        return IPAddress(v6);
+    }
+
+    IPPrefix prefix() {
+        const IPAddress ip = address();
+        const int maxLength = ip.family() == AF_INET ? 32 : 128;
+        return IPPrefix(ip, std::uniform_int_distribution<int>(0, maxLength)(mRng));
+    }
+
+    int value() { return uniform(); }
+
+    bool chance(int percent) { return std::uniform_int_distribution<int>(1, 100)(mRng) <= percent; }
+
+  private:
+    uint32_t uniform() { return std::uniform_int_distribution<uint32_t>()(mRng); }
+
+    std::mt19937 mRng;
+};
+
+void expectSameAs(const Reference& ref, const IPPrefixTrie<int>& trie, PrefixGenerator& gen) {
+    ASSERT_EQ(ref.size(), trie.size());
+    const std::vector<std::pair<IPPrefix, int>> expectedEntries(ref.begin(), ref.end());
+    ASSERT_EQ(expectedEntries, entries(trie));
+
+    for (int i = 0; i < 200; i++) {
+        const IPPrefix q = gen.prefix();
+        const auto it = ref.find(q);
+        const int* exact = trie.find(q);
+        if (it == ref.end()) {
+            EXPECT_EQ(nullptr, exact) << q;
+        } else {
+            ASSERT_NE(nullptr, exact) << q;
+            EXPECT_EQ(it->second, *exact) << q;
+        }
+
+        IPPrefix expectedMatch, actualMatch;
+        const int* expected = bruteForceMatch(ref, q, &expectedMatch);
+        const int* actual = trie.longestMatch(q, &actualMatch);
+        if (expected == nullptr) {
+            EXPECT_EQ(nullptr, actual) << q;
+        } else {
+            ASSERT_NE(nullptr, actual) << q;
+            EXPECT_EQ(*expected, *actual) << q;
+            EXPECT_EQ(expectedMatch, actualMatch) << q;
+        }
+    }
+}
+
+}  // namespace
+
+TEST(IPPrefixTrieTest, Basic) {
+    IPPrefixTrie<int> trie;
+    EXPECT_TRUE(trie.empty());
+    EXPECT_EQ(nullptr, trie.longestMatch(addr("192.0.2.1")));
+
+    EXPECT_TRUE(trie.insert(prefix("0.0.0.0/0"), 0));
+    EXPECT_TRUE(trie.insert(prefix("192.0.2.0/24"), 24));
+    EXPECT_TRUE(trie.insert(prefix("192.0.2.128/25"), 25));
+    EXPECT_TRUE(trie.insert(prefix("2001:db8::/32"), 32));
+    EXPECT_TRUE(trie.insert(prefix("2001:db8:1::/48"), 48));
+    EXPECT_FALSE(trie.insert(IPPrefix(), 99));
+    EXPECT_EQ(5U, trie.size());
+
+    IPPrefix matched;
+    EXPECT_EQ(25, *trie.longestMatch(addr("192.0.2.200"), &matched));
+    EXPECT_EQ(prefix("192.0.2.128/25"), matched);
+    EXPECT_EQ(24, *trie.longestMatch(addr("192.0.2.1")));
+    EXPECT_EQ(0, *trie.longestMatch(addr("198.51.100.1")));
+    EXPECT_EQ(48, *trie.longestMatch(addr("2001:db8:1::1")));
+    EXPECT_EQ(32, *trie.longestMatch(addr("2001:db8:2::1")));
+    // The families are separate: there is no IPv6 default route.
+    EXPECT_EQ(nullptr, trie.longestMatch(addr("2001:db9::1")));
+    EXPECT_EQ(nullptr, trie.longestMatch(IPAddress()));
+
+    // A prefix matches itself and its supernets.
+    EXPECT_EQ(24, *trie.longestMatch(prefix("192.0.2.0/24")));
+    EXPECT_EQ(0, *trie.longestMatch(prefix("192.0.0.0/16")));
+
+    EXPECT_EQ(24, *trie.find(prefix("192.0.2.0/24")));
+    EXPECT_EQ(nullptr, trie.find(prefix("192.0.2.0/23")));
+    EXPECT_EQ(nullptr, trie.find(prefix("192.0.2.0/26")));
+
+    // Replacing a value does not change the size.
+    EXPECT_TRUE(trie.insert(prefix("192.0.2.0/24"), 240));
+    EXPECT_EQ(5U, trie.size());
+    EXPECT_EQ(240, *trie.find(prefix("192.0.2.0/24")));
+
+    EXPECT_TRUE(trie.erase(prefix("192.0.2.128/25")));
+    EXPECT_FALSE(trie.erase(prefix("192.0.2.128/25")));
+    EXPECT_FALSE(trie.erase(prefix("2001:db8::/33")));
+    EXPECT_EQ(240, *trie.longestMatch(addr("192.0.2.200")));
+    EXPECT_EQ(4U, trie.size());
+
+    trie.clear();
+    EXPECT_TRUE(trie.empty());
+    EXPECT_EQ(nullptr, trie.longestMatch(addr("192.0.2.1")));
+}
+
+TEST(IPPrefixTrieTest, IterationOrder) {
+    const std::vector<std::string> sorted = {
+            "10.0.0.0/8", "10.0.0.0/16", "10.0.0.128/25", "10.1.0.0/16",
+            "192.0.2.0/24", "::/0", "2001:db8::/32", "2001:db8::/64", "2001:db8:0:1::/64",
+    };
+    IPPrefixTrie<int> trie;
+    for (size_t i = sorted.size(); i > 0; i--) {
+        trie.insert(prefix(sorted[i - 1]), i - 1);
+    }
+    const auto actual = entries(trie);
+    ASSERT_EQ(sorted.size(), actual.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        EXPECT_EQ(prefix(sorted[i]), actual[i].first);
+        EXPECT_EQ(static_cast<int>(i), actual[i].second);
+    }
+}
+
+TEST(IPPrefixTrieTest, Build) {
+    const auto trie = IPPrefixTrie<std::string>::build({
+            {prefix("2001:db8::/32"), "a"},
+            {prefix("192.0.2.0/24"), "b"},
+            {prefix("2001:db8::/32"), "c"},
+            {IPPrefix(), "d"},
+    });
+    EXPECT_EQ(2U, trie.size());
+    EXPECT_EQ("c", *trie.find(prefix("2001:db8::/32")));
+    EXPECT_EQ("b", *trie.longestMatch(addr("192.0.2.1")));
+}
+
+// Random inserts and erases, checked against a map searched exhaustively after every batch.
+TEST(IPPrefixTrieTest, MatchesBruteForce) {
+    for (uint32_t seed = 1; seed <= 20; seed++) {
+        SCOPED_TRACE(testing::Message() << "seed " << seed);
+        PrefixGenerator gen(seed);
+        Reference ref;
+        IPPrefixTrie<int> trie;
+        for (int round = 0; round < 10; round++) {
+            for (int i = 0; i < 50; i++) {
+                const IPPrefix p = gen.prefix();
+                if (gen.chance(30)) {
+                    EXPECT_EQ(ref.erase(p) == 1, trie.erase(p)) << p;
+                } else {
+                    const int value = gen.value();
+                    ref[p] = value;
+                    EXPECT_TRUE(trie.insert(p, value));
+                }
+            }
+            expectSameAs(ref, trie, gen);
+            if (HasFatalFailure()) return;
+        }
+
+        // Erasing everything leaves an empty trie that still works.
+        for (const auto& [p, value] : Reference(ref)) {
+            EXPECT_TRUE(trie.erase(p)) << p;
+            ref.erase(p);
+        }
+        expectSameAs(ref, trie, gen);
+        if (HasFatalFailure()) return;
+    }
+}
+
+TEST(IPPrefixTrieTest, BuildMatchesBruteForce) {
+    PrefixGenerator gen(42);
+    Reference ref;
+    std::vector<std::pair<IPPrefix, int>> input;
+    for (int i = 0; i < 500; i++) {
+        const IPPrefix p = gen.prefix();
+        const int value = gen.value();
+        input.emplace_back(p, value);
+        ref[p] = value;
+    }
+    const auto trie = IPPrefixTrie<int>::build(input);
+    expectSameAs(ref, trie, gen);
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "netdutils/IoUringSyscalls.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <bitset>
+#include <vector>
+
+namespace android {
+namespace netdutils {
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// A memory mapping that is unmapped on destruction.
+class Mapping {
+  public:
+    Mapping() = default;
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    ~Mapping() {
+        if (mAddr != MAP_FAILED) munmap(mAddr, mSize);
+    }
+
+    bool map(int fd, size_t size, off_t offset) {
+        mSize = size;
+        mAddr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return mAddr != MAP_FAILED;
+    }
+
+    template <typename T>
+    T* at(uint32_t offset) const {
+        return reinterpret_cast<T*>(static_cast<uint8_t*>(mAddr) + offset);
+    }
+
+  private:
+    void* mAddr = MAP_FAILED;
+    size_t mSize = 0;
+};
+
+// A single io_uring instance. Not thread-safe: each thread uses its own ring, and every request is
+// completed before the call that submitted it returns, so requests never outlive the buffers and
+// message headers on the caller's stack.
+class Ring {
+  public:
+    // Returns nullptr if io_uring is not available or lacks an opcode netdutils relies on.
+    static std::unique_ptr<Ring> create(unsigned entries) {
+        std::unique_ptr<Ring> ring(new Ring());
+        return ring->init(entries) ? std::move(ring) : nullptr;
+    }
+
+    bool supports(uint8_t opcode) const { return mSupportedOps.test(opcode); }
+
+    // Submits |sqes| and waits for all of them to complete. On success, results[i] holds the
+    // result of sqes[i]. Returns an error only if the requests could not be submitted or reaped.
+    Status submitAndWait(std::span<io_uring_sqe> sqes, std::span<int> results) {
+        while (sqes.size() > mEntries) {
+            // Linked chains must not be split across submissions, or the kernel would start the
+            // second half before the first half has completed.
+            if (sqes[mEntries - 1].flags & IOSQE_IO_LINK) {
+                return statusFromErrno(E2BIG, "linked chain longer than the ring");
+            }
+            RETURN_IF_NOT_OK(submitAndWaitChunk(sqes.first(mEntries), results.first(mEntries)));
+            sqes = sqes.subspan(mEntries);
+            results = results.subspan(mEntries);
+        }
+        return submitAndWaitChunk(sqes, results);
+    }
+
+    // Returns the index of the registered buffer that contains [base, base + len), or -1.
+    int fixedBufferIndex(const void* base, size_t len) const {
+        const auto* begin = static_cast<const uint8_t*>(base);
+        for (size_t i = 0; i < mFixedBuffers.size(); i++) {
+            const auto* bufBegin = static_cast<const uint8_t*>(mFixedBuffers[i].iov_base);
+            if (begin >= bufBegin && begin + len <= bufBegin + mFixedBuffers[i].iov_len) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    Status registerBuffers(std::span<const iovec> buffers) {
+        RETURN_IF_NOT_OK(unregisterBuffers());
+        if (ioUringRegister(fd(), IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == -1) {
+            return statusFromErrno(errno, "IORING_REGISTER_BUFFERS failed");
+        }
+        mFixedBuffers.assign(buffers.begin(), buffers.end());
+        return status::ok;
+    }
+
+    Status unregisterBuffers() {
+        if (mFixedBuffers.empty()) return status::ok;
+        if (ioUringRegister(fd(), IORING_UNREGISTER_BUFFERS, nullptr, 0) == -1) {
+            return statusFromErrno(errno, "IORING_UNREGISTER_BUFFERS failed");
+        }
+        mFixedBuffers.clear();
+        return status::ok;
+    }
+
+  private:
+    Ring() = default;
+
+    bool init(unsigned entries) {
+        io_uring_params params = {};
+        int fd = ioUringSetup(entries, &params);
+        if (fd == -1) return false;
+        mFd.reset(Fd(fd));
+        mEntries = params.sq_entries;
+
+        const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        const size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (!mSqRing.map(fd, sqRingSize, IORING_OFF_SQ_RING) ||
+            !mCqRing.map(fd, cqRingSize, IORING_OFF_CQ_RING) ||
+            !mSqeMapping.map(fd, params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES)) {
+            return false;
+        }
+
+        mSqTail = mSqRing.at<uint32_t>(params.sq_off.tail);
+        mSqMask = *mSqRing.at<uint32_t>(params.sq_off.ring_mask);
+        mSqArray = mSqRing.at<uint32_t>(params.sq_off.array);
+        mCqHead = mCqRing.at<uint32_t>(params.cq_off.head);
+        mCqTail = mCqRing.at<uint32_t>(params.cq_off.tail);
+        mCqMask = *mCqRing.at<uint32_t>(params.cq_off.ring_mask);
+        mCqes = mCqRing.at<io_uring_cqe>(params.cq_off.cqes);
+        mSqes = mSqeMapping.at<io_uring_sqe>(0);
+
+        // IORING_REGISTER_PROBE appeared in 5.6, together with IORING_OP_READ and IORING_OP_WRITE.
+        // Don't bother with older kernels.
+        constexpr size_t kMaxOps = 256;
+        std::vector<uint8_t> probeBuf(sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(probeBuf.data());
+        if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, kMaxOps) == -1) return false;
+        for (unsigned i = 0; i < probe->ops_len && i < kMaxOps; i++) {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) mSupportedOps.set(probe->ops[i].op);
+        }
+        return true;
+    }
+
+    Status submitAndWaitChunk(std::span<io_uring_sqe> sqes, std::span<int> results) {
+        // This thread is the only producer, so the tail can be read without synchronization.
+        uint32_t tail = *mSqTail;
+        for (size_t i = 0; i < sqes.size(); i++) {
+            const uint32_t index = tail & mSqMask;
+            mSqes[index] = sqes[i];
+            mSqes[index].user_data = i;
+            mSqArray[index] = index;
+            tail++;
+        }
+        __atomic_store_n(mSqTail, tail, __ATOMIC_RELEASE);
+
+        size_t submitted = 0;
+        size_t completed = 0;
+        while (completed < sqes.size()) {
+            const unsigned toSubmit = sqes.size() - submitted;
+            const int rv = ioUringEnter(fd(), toSubmit, sqes.size() - completed,
+                                        IORING_ENTER_GETEVENTS);
+            // EAGAIN and EBUSY mean that the completion queue is full. It is drained below.
+            if (rv == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return statusFromErrno(errno, "io_uring_enter() failed");
+            }
+            if (rv > 0) submitted += rv;
+
+            uint32_t head = *mCqHead;
+            const uint32_t cqTail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+            for (; head != cqTail; head++) {
+                const io_uring_cqe& cqe = mCqes[head & mCqMask];
+                results[cqe.user_data] = cqe.res;
+                completed++;
+            }
+            __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+        }
+        return status::ok;
+    }
+
+    int fd() const { return static_cast<const Fd&>(mFd).get(); }
+
+    // Destroyed in reverse order: the mappings go before the ring fd.
+    UniqueFd mFd;
+    Mapping mSqRing;
+    Mapping mCqRing;
+    Mapping mSqeMapping;
+    unsigned mEntries = 0;
+    uint32_t* mSqTail = nullptr;
+    uint32_t mSqMask = 0;
+    uint32_t* mSqArray = nullptr;
+    uint32_t* mCqHead = nullptr;
+    uint32_t* mCqTail = nullptr;
+    uint32_t mCqMask = 0;
+    io_uring_cqe* mCqes = nullptr;
+    io_uring_sqe* mSqes = nullptr;
+    std::bitset<256> mSupportedOps;
+    std::vector<iovec> mFixedBuffers;
+};
+
+// Returns the ring of the calling thread, creating it on first use, or nullptr if io_uring is
+// not available. Creation is only attempted once per thread.
+Ring* threadRing() {
+    thread_local bool tried = false;
+    thread_local std::unique_ptr<Ring> ring;
+    if (!tried) {
+        tried = true;
+        ring = Ring::create(IoUringSyscalls::kRingEntries);
+    }
+    return ring.get();
+}
+
+// Returns the ring of the calling thread if it supports |opcode|, or nullptr.
+Ring* ringFor(uint8_t opcode) {
+    Ring* ring = threadRing();
+    return (ring != nullptr && ring->supports(opcode)) ? ring : nullptr;
+}
+
+io_uring_sqe makeSqe(uint8_t opcode, Fd fd, const void* addr, uint32_t len) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = opcode;
+    sqe.fd = fd.get();
+    sqe.addr = reinterpret_cast<uint64_t>(addr);
+    sqe.len = len;
+    // Use and update the file position, like read(2) and write(2). Sockets ignore it.
+    sqe.off = static_cast<uint64_t>(-1);
+    return sqe;
+}
+
+io_uring_sqe makeMsgSqe(uint8_t opcode, Fd sock, const msghdr* msg, int flags) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = opcode;
+    sqe.fd = sock.get();
+    sqe.addr = reinterpret_cast<uint64_t>(msg);
+    sqe.len = 1;
+    sqe.msg_flags = flags;
+    return sqe;
+}
+
+// Runs a single request and returns its result, or an error status for negative results.
+StatusOr<size_t> runOne(Ring* ring, io_uring_sqe sqe, const char* what) {
+    int result = 0;
+    RETURN_IF_NOT_OK(ring->submitAndWait({&sqe, 1}, {&result, 1}));
+    if (result < 0) {
+        return statusFromErrno(-result, std::string(what) + " failed");
+    }
+    return static_cast<size_t>(result);
+}
+
+// Runs a chain of linked message requests, stopping at the first failure like sendmmsg(2) and
+// recvmmsg(2). Returns the number of messages that succeeded, and sets their msg_len.
+StatusOr<size_t> runMessageChain(Ring* ring, std::span<io_uring_sqe> sqes,
+                                 std::span<mmsghdr> msgs, const char* what) {
+    int results[IoUringSyscalls::kRingEntries];
+    RETURN_IF_NOT_OK(ring->submitAndWait(sqes, {results, sqes.size()}));
+    size_t done = 0;
+    while (done < sqes.size() && results[done] >= 0) {
+        msgs[done].msg_len = results[done];
+        done++;
+    }
+    if (done == 0 && !sqes.empty()) {
+        return statusFromErrno(-results[0], std::string(what) + " failed");
+    }
+    return done;
+}
+
+}  // namespace
+
+IoUringSyscalls::IoUringSyscalls(Syscalls& fallback) : mFallback(fallback) {}
+
+bool IoUringSyscalls::ringAvailable() const {
+    return threadRing() != nullptr;
+}
+
+Status IoUringSyscalls::registerBuffers(std::span<const iovec> buffers) const {
+    Ring* ring = threadRing();
+    if (ring == nullptr) return statusFromErrno(ENOSYS, "io_uring not available");
+    return ring->registerBuffers(buffers);
+}
+
+Status IoUringSyscalls::unregisterBuffers() const {
+    Ring* ring = threadRing();
+    if (ring == nullptr) return status::ok;
+    return ring->unregisterBuffers();
+}
+
+StatusOr<size_t> IoUringSyscalls::writev(Fd fd, std::span<const iovec> iov) const {
+    Ring* ring = ringFor(IORING_OP_WRITEV);
+    if (ring == nullptr) return mFallback.writev(fd, iov);
+    return runOne(ring, makeSqe(IORING_OP_WRITEV, fd, iov.data(), iov.size()), "writev()");
+}
+
+StatusOr<size_t> IoUringSyscalls::write(Fd fd, const Slice buf) const {
+    Ring* ring = ringFor(IORING_OP_WRITE);
+    if (ring == nullptr) return mFallback.write(fd, buf);
+    const int index = ring->fixedBufferIndex(buf.base(), buf.size());
+    io_uring_sqe sqe =
+            makeSqe(index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, buf.base(), buf.size());
+    if (index >= 0) sqe.buf_index = index;
+    return runOne(ring, sqe, "write()");
+}
+
+StatusOr<Slice> IoUringSyscalls::read(Fd fd, const Slice buf) const {
+    Ring* ring = ringFor(IORING_OP_READ);
+    if (ring == nullptr) return mFallback.read(fd, buf);
+    const int index = ring->fixedBufferIndex(buf.base(), buf.size());
+    io_uring_sqe sqe =
+            makeSqe(index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, buf.base(), buf.size());
+    if (index >= 0) sqe.buf_index = index;
+    ASSIGN_OR_RETURN(auto len, runOne(ring, sqe, "read()"));
+    return Slice(buf.base(), len);
+}
+
+StatusOr<size_t> IoUringSyscalls::sendto(Fd sock, const Slice buf, int flags, const sockaddr* dst,
+                                         socklen_t dstlen) const {
+    const iovec iov = {buf.base(), buf.size()};
+    return sendmsg(sock, {&iov, 1}, flags, dst, dstlen);
+}
+
+StatusOr<Slice> IoUringSyscalls::recvfrom(Fd sock, const Slice dst, int flags, sockaddr* src,
+                                          socklen_t* srclen) const {
+    Ring* ring = ringFor(IORING_OP_RECVMSG);
+    if (ring == nullptr) return mFallback.recvfrom(sock, dst, flags, src, srclen);
+    iovec iov = {dst.base(), dst.size()};
+    msghdr msg = {
+            .msg_name = src,
+            .msg_namelen = srclen ? *srclen : 0,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+    };
+    ASSIGN_OR_RETURN(auto len, runOne(ring, makeMsgSqe(IORING_OP_RECVMSG, sock, &msg, flags),
+                                      "recvfrom()"));
+    if (srclen) *srclen = msg.msg_namelen;
+    if (len == 0) {
+        return status::eof;
+    }
+    return take(dst, len);
+}
+
+StatusOr<size_t> IoUringSyscalls::sendmsg(Fd sock, std::span<const iovec> iov, int flags,
+                                          const sockaddr* dst, socklen_t dstlen) const {
+    Ring* ring = ringFor(IORING_OP_SENDMSG);
+    if (ring == nullptr) return mFallback.sendmsg(sock, iov, flags, dst, dstlen);
+    const msghdr msg = {
+            .msg_name = const_cast<sockaddr*>(dst),
+            .msg_namelen = dstlen,
+            .msg_iov = const_cast<iovec*>(iov.data()),
+            .msg_iovlen = iov.size(),
+    };
+    return runOne(ring, makeMsgSqe(IORING_OP_SENDMSG, sock, &msg, flags), "sendmsg()");
+}
+
+StatusOr<size_t> IoUringSyscalls::sendmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const {
+    Ring* ring = ringFor(IORING_OP_SENDMSG);
+    if (ring == nullptr || msgs.size() > kRingEntries) return mFallback.sendmmsg(sock, msgs, flags);
+    io_uring_sqe sqes[kRingEntries];
+    for (size_t i = 0; i < msgs.size(); i++) {
+        sqes[i] = makeMsgSqe(IORING_OP_SENDMSG, sock, &msgs[i].msg_hdr, flags);
+        if (i + 1 < msgs.size()) sqes[i].flags |= IOSQE_IO_LINK;
+    }
+    return runMessageChain(ring, {sqes, msgs.size()}, msgs, "sendmmsg()");
+}
+
+StatusOr<size_t> IoUringSyscalls::recvmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const {
+    Ring* ring = ringFor(IORING_OP_RECVMSG);
+    if (ring == nullptr || msgs.size() > kRingEntries) return mFallback.recvmmsg(sock, msgs, flags);
+    // Like recvmmsg(2), MSG_WAITFORONE only blocks for the first message.
+    const int firstFlags = flags & ~MSG_WAITFORONE;
+    const int restFlags = (flags & MSG_WAITFORONE) ? (firstFlags | MSG_DONTWAIT) : firstFlags;
+    io_uring_sqe sqes[kRingEntries];
+    for (size_t i = 0; i < msgs.size(); i++) {
+        sqes[i] = makeMsgSqe(IORING_OP_RECVMSG, sock, &msgs[i].msg_hdr,
+                             i == 0 ? firstFlags : restFlags);
+        if (i + 1 < msgs.size()) sqes[i].flags |= IOSQE_IO_LINK;
+    }
+    return runMessageChain(ring, {sqes, msgs.size()}, msgs, "recvmmsg()");
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cstring>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/IoUringSyscalls.h"
+#include "netdutils/MockSyscalls.h"
+#include "netdutils/Slice.h"
+#include "netdutils/Status.h"
+#include "netdutils/Syscalls.h"
+
+using testing::_;
+using testing::Return;
+using testing::StrictMock;
+
+namespace android {
+namespace netdutils {
+
+class IoUringSyscallsTest : public testing::Test {
+  protected:
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds));
+        mTx.reset(Fd(fds[0]));
+        mRx.reset(Fd(fds[1]));
+    }
+
+    IoUringSyscalls mSys{sSyscalls.get()};
+    UniqueFd mTx;
+    UniqueFd mRx;
+};
+
+// These run whether or not io_uring is available, since the fallback must behave identically.
+TEST_F(IoUringSyscallsTest, WriteRead) {
+    const char payload[] = "hello";
+    auto written = mSys.write(mTx, makeSlice(payload));
+    ASSERT_EQ(status::ok, written.status());
+    EXPECT_EQ(sizeof(payload), written.value());
+
+    std::array<char, 32> buf;
+    auto read = mSys.read(mRx, makeSlice(buf));
+    ASSERT_EQ(status::ok, read.status());
+    EXPECT_EQ(sizeof(payload), read.value().size());
+    EXPECT_EQ(0, memcmp(payload, buf.data(), sizeof(payload)));
+}
+
+TEST_F(IoUringSyscallsTest, WritevSendmsg) {
+    char header[] = "head";
+    char body[] = "body";
+    const iovec iov[] = {{header, 4}, {body, 4}};
+    auto written = mSys.writev(mTx, iov);
+    ASSERT_EQ(status::ok, written.status());
+    EXPECT_EQ(8U, written.value());
+    auto sent = mSys.sendmsg(mTx, iov, 0);
+    ASSERT_EQ(status::ok, sent.status());
+    EXPECT_EQ(8U, sent.value());
+
+    std::array<char, 32> buf;
+    for (int i = 0; i < 2; i++) {
+        auto rx = mSys.recvfrom(mRx, makeSlice(buf), 0);
+        ASSERT_EQ(status::ok, rx.status());
+        EXPECT_EQ(8U, rx.value().size());
+        EXPECT_EQ(0, memcmp("headbody", buf.data(), 8));
+    }
+}
+
+TEST_F(IoUringSyscallsTest, Batches) {
+    constexpr size_t kNumMsgs = 5;
+    char payloads[kNumMsgs][8] = {"a", "bb", "ccc", "dddd", "eeeee"};
+    iovec txIov[kNumMsgs];
+    std::array<mmsghdr, kNumMsgs> txMsgs = {};
+    for (size_t i = 0; i < kNumMsgs; i++) {
+        txIov[i] = {payloads[i], strlen(payloads[i])};
+        txMsgs[i].msg_hdr.msg_iov = &txIov[i];
+        txMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto sent = mSys.sendmmsg(mTx, txMsgs, 0);
+    ASSERT_EQ(status::ok, sent.status());
+    ASSERT_EQ(kNumMsgs, sent.value());
+    for (size_t i = 0; i < kNumMsgs; i++) {
+        EXPECT_EQ(strlen(payloads[i]), txMsgs[i].msg_len);
+    }
+
+    // Ask for more messages than are queued: the chain stops at the first EAGAIN.
+    char bufs[kNumMsgs + 2][16];
+    iovec rxIov[kNumMsgs + 2];
+    std::array<mmsghdr, kNumMsgs + 2> rxMsgs = {};
+    for (size_t i = 0; i < rxMsgs.size(); i++) {
+        rxIov[i] = {bufs[i], sizeof(bufs[i])};
+        rxMsgs[i].msg_hdr.msg_iov = &rxIov[i];
+        rxMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto received = mSys.recvmmsg(mRx, rxMsgs, MSG_DONTWAIT);
+    ASSERT_EQ(status::ok, received.status());
+    ASSERT_EQ(kNumMsgs, received.value());
+    for (size_t i = 0; i < kNumMsgs; i++) {
+        EXPECT_EQ(strlen(payloads[i]), rxMsgs[i].msg_len);
+        EXPECT_EQ(0, memcmp(payloads[i], bufs[i], rxMsgs[i].msg_len));
+    }
+
+    EXPECT_EQ(EAGAIN, mSys.recvmmsg(mRx, rxMsgs, MSG_DONTWAIT).status().code());
+}
+
+TEST_F(IoUringSyscallsTest, WaitForOne) {
+    // The first message blocks, the rest don't.
+    std::thread writer([this] {
+        usleep(20 * 1000);
+        const char payload[] = "late";
+        mSys.write(mTx, makeSlice(payload)).ignoreError();
+    });
+    char buf[2][16];
+    iovec rxIov[2] = {{buf[0], sizeof(buf[0])}, {buf[1], sizeof(buf[1])}};
+    std::array<mmsghdr, 2> rxMsgs = {};
+    for (size_t i = 0; i < rxMsgs.size(); i++) {
+        rxMsgs[i].msg_hdr.msg_iov = &rxIov[i];
+        rxMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto received = mSys.recvmmsg(mRx, rxMsgs, MSG_WAITFORONE);
+    writer.join();
+    ASSERT_EQ(status::ok, received.status());
+    EXPECT_EQ(1U, received.value());
+}
+
+TEST_F(IoUringSyscallsTest, RegisteredBuffers) {
+    if (!mSys.ringAvailable()) {
+        EXPECT_EQ(ENOSYS, mSys.registerBuffers({}).code());
+        GTEST_SKIP() << "io_uring not available";
+    }
+
+    std::array<char, 4096> fixed;
+    const iovec buffers[] = {{fixed.data(), fixed.size()}};
+    ASSERT_EQ(status::ok, mSys.registerBuffers(buffers));
+
+    int pipeFds[2];
+    ASSERT_EQ(0, pipe2(pipeFds, O_CLOEXEC));
+    UniqueFd readEnd{Fd(pipeFds[0])};
+    UniqueFd writeEnd{Fd(pipeFds[1])};
+
+    // Both ends use the fixed buffer: the write from its start, the read into its second half.
+    strcpy(fixed.data(), "registered");
+    auto written = mSys.write(writeEnd, Slice(fixed.data(), strlen("registered")));
+    ASSERT_EQ(status::ok, written.status());
+    auto read = mSys.read(readEnd, Slice(fixed.data() + 2048, 2048));
+    ASSERT_EQ(status::ok, read.status());
+    EXPECT_EQ(strlen("registered"), read.value().size());
+    EXPECT_EQ(0, memcmp("registered", fixed.data() + 2048, strlen("registered")));
+
+    EXPECT_EQ(status::ok, mSys.unregisterBuffers());
+}
+
+TEST(IoUringSyscallsFallback, ForwardsUnsupportedOperations) {
+    StrictMock<MockSyscalls> fallback;
+    IoUringSyscalls ioUringSyscalls(fallback);
+    const Syscalls& sys = ioUringSyscalls;
+    constexpr Fd kFd(40);
+
+    EXPECT_CALL(fallback, setsockopt(kFd, SOL_SOCKET, SO_RCVBUF, _, sizeof(int)))
+            .WillOnce(Return(status::ok));
+    const int rcvbuf = 65536;
+    EXPECT_EQ(status::ok, sys.setsockopt(kFd, SOL_SOCKET, SO_RCVBUF, rcvbuf));
+
+    EXPECT_CALL(fallback, close(kFd)).WillOnce(Return(status::ok));
+    EXPECT_EQ(status::ok, sys.close(kFd));
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -17,39 +17,8 @@
 #include <ios>
 #include <linux/netlink.h>
 
-#include "netdutils/Math.h"
 #include "netdutils/Netlink.h"
 
-namespace android {
-namespace netdutils {
-
-void forEachNetlinkMessage(const Slice buf,
-                           const std::function<void(const nlmsghdr&, const Slice)>& onMsg) {
-    Slice tail = buf;
-    while (tail.size() >= sizeof(nlmsghdr)) {
-        nlmsghdr hdr = {};
-        extract(tail, hdr);
-        const auto len = std::max<size_t>(hdr.nlmsg_len, sizeof(hdr));
-        onMsg(hdr, drop(take(tail, len), sizeof(hdr)));
-        tail = drop(tail, align(len, 2));
-    }
-}
-
-void forEachNetlinkAttribute(const Slice buf,
-                             const std::function<void(const nlattr&, const Slice)>& onAttr) {
-    Slice tail = buf;
-    while (tail.size() >= sizeof(nlattr)) {
-        nlattr hdr = {};
-        extract(tail, hdr);
-        const auto len = std::max<size_t>(hdr.nla_len, sizeof(hdr));
-        onAttr(hdr, drop(take(tail, len), sizeof(hdr)));
-        tail = drop(tail, align(len, 2));
-    }
-}
-
-}  // namespace netdutils
-}  // namespace android
-
 bool operator==(const sockaddr_nl& lhs, const sockaddr_nl& rhs) {
     return (lhs.nl_family == rhs.nl_family) && (lhs.nl_pid == rhs.nl_pid) &&
            (lhs.nl_groups == rhs.nl_groups);
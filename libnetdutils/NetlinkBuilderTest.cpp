@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <linux/fib_rules.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/Netlink.h"
+#include "netdutils/NetlinkBuilder.h"
+#include "netdutils/Slice.h"
+#include "netdutils/Status.h"
+
+namespace android {
+namespace netdutils {
+
+namespace {
+
+using FraPriority = NetlinkAttr<FRA_PRIORITY, uint32_t>;
+using FraTable = NetlinkAttr<FRA_TABLE, uint32_t>;
+using FraFwmark = NetlinkAttr<FRA_FWMARK, uint32_t>;
+using FraFwmask = NetlinkAttr<FRA_FWMASK, uint32_t>;
+using FraIifName = NetlinkBytesAttr<FRA_IIFNAME, IFNAMSIZ>;
+using RuleMessage =
+        NetlinkMessage<fib_rule_hdr, FraPriority, FraTable, FraFwmark, FraFwmask, FraIifName>;
+
+using RtaTable = NetlinkAttr<RTA_TABLE, uint32_t>;
+using RtaDst = NetlinkBytesAttr<RTA_DST, sizeof(in6_addr)>;
+using RtaOif = NetlinkAttr<RTA_OIF, uint32_t>;
+using RtaxMtu = NetlinkAttr<RTAX_MTU, uint32_t>;
+using RtaMetrics = NetlinkNestedAttr<RTA_METRICS, RtaxMtu>;
+using RouteMessage = NetlinkMessage<rtmsg, RtaTable, RtaDst, RtaOif, RtaMetrics>;
+
+// Sizes are known at compile time, so buffers can live on the stack.
+static_assert(RuleMessage::kMaxSize == 16 + 12 + 4 * 8 + 4 + 16);
+static_assert(RouteMessage::kMaxSize == 16 + 12 + 8 + 20 + 8 + 12);
+
+// Kernel wire format, on a little-endian machine, of the request for
+// "ip -4 rule add pref 10000 iif wlan0 fwmark 0x64/0xffff table 1022", limited to the attributes
+// in RuleMessage.
+const std::vector<uint8_t> kRuleFixture = {
+        // nlmsghdr: len 72, RTM_NEWRULE, NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE, seq 1.
+        0x48, 0x00, 0x00, 0x00, 0x20, 0x00, 0x05, 0x04,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // fib_rule_hdr: AF_INET, FR_ACT_TO_TBL.
+        0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        // FRA_PRIORITY 10000.
+        0x08, 0x00, 0x06, 0x00, 0x10, 0x27, 0x00, 0x00,
+        // FRA_TABLE 1022.
+        0x08, 0x00, 0x0f, 0x00, 0xfe, 0x03, 0x00, 0x00,
+        // FRA_FWMARK 0x64.
+        0x08, 0x00, 0x0a, 0x00, 0x64, 0x00, 0x00, 0x00,
+        // FRA_FWMASK 0xffff.
+        0x08, 0x00, 0x10, 0x00, 0xff, 0xff, 0x00, 0x00,
+        // FRA_IIFNAME "wlan0", NUL-terminated and padded.
+        0x0a, 0x00, 0x03, 0x00, 'w', 'l', 'a', 'n', '0', 0x00, 0x00, 0x00,
+};
+
+// Likewise for "ip -6 route add 2001:db8::/64 dev <ifindex 7> mtu 1280 table 1022 proto static".
+const std::vector<uint8_t> kRouteFixture = {
+        // nlmsghdr: len 76, RTM_NEWROUTE, NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE | NLM_F_EXCL.
+        0x4c, 0x00, 0x00, 0x00, 0x18, 0x00, 0x05, 0x06,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // rtmsg: AF_INET6, /64, RTPROT_STATIC, RT_SCOPE_UNIVERSE, RTN_UNICAST.
+        0x0a, 0x40, 0x00, 0x00, 0x00, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        // RTA_TABLE 1022.
+        0x08, 0x00, 0x0f, 0x00, 0xfe, 0x03, 0x00, 0x00,
+        // RTA_DST 2001:db8::.
+        0x14, 0x00, 0x01, 0x00, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        // RTA_OIF 7.
+        0x08, 0x00, 0x04, 0x00, 0x07, 0x00, 0x00, 0x00,
+        // RTA_METRICS { RTAX_MTU 1280 }.
+        0x0c, 0x00, 0x08, 0x00, 0x08, 0x00, 0x02, 0x00, 0x00, 0x05, 0x00, 0x00,
+};
+
+std::vector<uint8_t> toVector(const Slice s) {
+    return std::vector<uint8_t>(s.base(), s.limit());
+}
+
+RuleMessage makeRule(const char* iif) {
+    RuleMessage rule;
+    rule.family = {.family = AF_INET, .action = FR_ACT_TO_TBL};
+    rule.get<FraPriority>().set(10000);
+    rule.get<FraTable>().set(1022);
+    rule.get<FraFwmark>().set(0x64);
+    rule.get<FraFwmask>().set(0xffff);
+    rule.get<FraIifName>().set(iif, iif ? strlen(iif) + 1 : 0, iif != nullptr);
+    return rule;
+}
+
+}  // namespace
+
+TEST(NetlinkBuilderTest, ruleMatchesFixture) {
+    std::array<uint8_t, RuleMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    const uint16_t flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE;
+    ASSERT_EQ(status::ok, writer.append(RTM_NEWRULE, flags, makeRule("wlan0"), 1));
+    EXPECT_EQ(1U, writer.count());
+    EXPECT_EQ(kRuleFixture, toVector(writer.messages()));
+}
+
+TEST(NetlinkBuilderTest, routeMatchesFixture) {
+    RouteMessage route;
+    route.family = {
+            .rtm_family = AF_INET6,
+            .rtm_dst_len = 64,
+            .rtm_protocol = RTPROT_STATIC,
+            .rtm_scope = RT_SCOPE_UNIVERSE,
+            .rtm_type = RTN_UNICAST,
+    };
+    in6_addr dst;
+    ASSERT_EQ(1, inet_pton(AF_INET6, "2001:db8::", &dst));
+    route.get<RtaTable>().set(1022);
+    route.get<RtaDst>().set(&dst, sizeof(dst));
+    route.get<RtaOif>().set(7);
+    route.get<RtaMetrics>().get<RtaxMtu>().set(1280);
+
+    std::array<uint8_t, RouteMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    const uint16_t flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE | NLM_F_EXCL;
+    ASSERT_EQ(status::ok, writer.append(RTM_NEWROUTE, flags, route));
+    EXPECT_EQ(kRouteFixture, toVector(writer.messages()));
+}
+
+TEST(NetlinkBuilderTest, absentAttributes) {
+    RouteMessage route;
+    route.get<RtaTable>().set(1022);
+    route.get<RtaDst>().set(nullptr, 0, false);
+    route.get<RtaOif>().present = false;
+    route.get<RtaMetrics>().present = false;
+
+    std::array<uint8_t, RouteMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    ASSERT_EQ(status::ok, writer.append(RTM_DELROUTE, NLM_F_REQUEST, route));
+    EXPECT_EQ(NLMSG_HDRLEN + sizeof(rtmsg) + 8, writer.messages().size());
+
+    // Round trip: only RTA_TABLE comes back.
+    int messages = 0;
+    forEachNetlinkMessage(writer.messages(), [&](const nlmsghdr& hdr, const Slice payload) {
+        messages++;
+        EXPECT_EQ(RTM_DELROUTE, hdr.nlmsg_type);
+        EXPECT_EQ(writer.messages().size(), hdr.nlmsg_len);
+        NetlinkAttributeTable<RTA_MAX> attrs;
+        EXPECT_EQ(status::ok, attrs.parse(drop(payload, NLMSG_ALIGN(sizeof(rtmsg)))));
+        uint32_t table = 0;
+        EXPECT_TRUE(attrs.get(RTA_TABLE, table));
+        EXPECT_EQ(1022U, table);
+        for (uint16_t type : {RTA_DST, RTA_OIF, RTA_METRICS}) {
+            EXPECT_FALSE(attrs.has(type)) << type;
+        }
+    });
+    EXPECT_EQ(1, messages);
+}
+
+TEST(NetlinkBuilderTest, batchRoundTrip) {
+    const char* const kNames[] = {"wlan0", "rmnet_data0", nullptr};
+    std::array<uint8_t, std::size(kNames) * RuleMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    for (size_t i = 0; i < std::size(kNames); i++) {
+        ASSERT_EQ(status::ok, writer.append(RTM_NEWRULE, NLM_F_REQUEST, makeRule(kNames[i]), i));
+    }
+    EXPECT_EQ(std::size(kNames), writer.count());
+
+    // Parse the batch back, as the kernel would.
+    size_t i = 0;
+    forEachNetlinkMessage(writer.messages(), [&](const nlmsghdr& hdr, const Slice payload) {
+        ASSERT_LT(i, std::size(kNames));
+        EXPECT_EQ(i, hdr.nlmsg_seq);
+        fib_rule_hdr rule = {};
+        extract(payload, rule);
+        EXPECT_EQ(FR_ACT_TO_TBL, rule.action);
+
+        NetlinkAttributeTable<FRA_MAX> attrs;
+        EXPECT_EQ(status::ok, attrs.parse(drop(payload, NLMSG_ALIGN(sizeof(rule)))));
+        uint32_t priority = 0, table = 0, fwmark = 0, fwmask = 0;
+        EXPECT_TRUE(attrs.get(FRA_PRIORITY, priority));
+        EXPECT_TRUE(attrs.get(FRA_TABLE, table));
+        EXPECT_TRUE(attrs.get(FRA_FWMARK, fwmark));
+        EXPECT_TRUE(attrs.get(FRA_FWMASK, fwmask));
+        EXPECT_EQ(10000U, priority);
+        EXPECT_EQ(1022U, table);
+        EXPECT_EQ(0x64U, fwmark);
+        EXPECT_EQ(0xffffU, fwmask);
+        if (kNames[i] == nullptr) {
+            EXPECT_FALSE(attrs.has(FRA_IIFNAME));
+        } else {
+            EXPECT_EQ(std::string(kNames[i]) + '\0', toString(attrs.get(FRA_IIFNAME)));
+        }
+        i++;
+    });
+    EXPECT_EQ(std::size(kNames), i);
+
+    writer.clear();
+    EXPECT_EQ(0U, writer.count());
+    EXPECT_TRUE(writer.messages().empty());
+}
+
+TEST(NetlinkBuilderTest, errors) {
+    // Too long for the layout.
+    RuleMessage rule = makeRule("wlan0");
+    const char kLongName[] = "an_interface_name_that_is_too_long";
+    rule.get<FraIifName>().set(kLongName, sizeof(kLongName));
+
+    std::array<uint8_t, 2 * RuleMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    EXPECT_EQ(EMSGSIZE, writer.append(RTM_NEWRULE, NLM_F_REQUEST, rule).code());
+    EXPECT_EQ(0U, writer.count());
+
+    // Out of space. Nothing is written for the message that does not fit.
+    NetlinkMessageWriter small(take(makeSlice(buf), kRuleFixture.size() + 8));
+    EXPECT_EQ(status::ok, small.append(RTM_NEWRULE, NLM_F_REQUEST, makeRule("wlan0")));
+    EXPECT_EQ(ENOBUFS, small.append(RTM_NEWRULE, NLM_F_REQUEST, makeRule("wlan0")).code());
+    EXPECT_EQ(1U, small.count());
+    EXPECT_EQ(kRuleFixture.size(), small.messages().size());
+}
+
+}  // namespace netdutils
+}  // namespace android
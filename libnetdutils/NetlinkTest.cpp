@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/Netlink.h"
+#include "netdutils/Slice.h"
+#include "netdutils/Status.h"
+
+namespace android {
+namespace netdutils {
+
+class NetlinkTest : public testing::Test {
+  protected:
+    // Appends an attribute, padded to NLA_ALIGNTO, and returns the offset of its header.
+    size_t appendAttr(uint16_t type, const void* payload, size_t len) {
+        const size_t offset = mUsed;
+        nlattr hdr = {.nla_len = static_cast<uint16_t>(sizeof(hdr) + len), .nla_type = type};
+        memcpy(mRaw.data() + mUsed, &hdr, sizeof(hdr));
+        memcpy(mRaw.data() + mUsed + sizeof(hdr), payload, len);
+        mUsed += NLA_ALIGN(sizeof(hdr) + len);
+        return offset;
+    }
+
+    size_t appendU32(uint16_t type, uint32_t value) {
+        return appendAttr(type, &value, sizeof(value));
+    }
+
+    Slice attrs() { return Slice(mRaw.data(), mUsed); }
+
+    nlattr* attrAt(size_t offset) { return reinterpret_cast<nlattr*>(mRaw.data() + offset); }
+
+    std::array<uint8_t, 256> mRaw = {};
+    size_t mUsed = 0;
+};
+
+TEST_F(NetlinkTest, forEachNetlinkMessage) {
+    struct {
+        nlmsghdr hdr1;
+        uint32_t payload1;
+        nlmsghdr hdr2;
+        uint8_t payload2[3];
+        uint8_t pad[1];
+        nlmsghdr hdr3;
+    } msgs = {};
+    msgs.hdr1 = {.nlmsg_len = sizeof(nlmsghdr) + 4, .nlmsg_type = 1};
+    msgs.payload1 = 42;
+    msgs.hdr2 = {.nlmsg_len = sizeof(nlmsghdr) + 3, .nlmsg_type = 2};
+    msgs.hdr3 = {.nlmsg_len = sizeof(nlmsghdr), .nlmsg_type = NLMSG_DONE};
+
+    std::vector<std::pair<uint16_t, size_t>> seen;
+    forEachNetlinkMessage(makeSlice(msgs), [&seen](const nlmsghdr& hdr, const Slice payload) {
+        seen.emplace_back(hdr.nlmsg_type, payload.size());
+    });
+    const std::vector<std::pair<uint16_t, size_t>> expected = {{1, 4}, {2, 3}, {NLMSG_DONE, 0}};
+    EXPECT_EQ(expected, seen);
+
+    // A callback returning bool stops the iteration when it returns false.
+    int count = 0;
+    forEachNetlinkMessage(makeSlice(msgs), [&count](const nlmsghdr& hdr, const Slice) {
+        count++;
+        return hdr.nlmsg_type != 2;
+    });
+    EXPECT_EQ(2, count);
+}
+
+TEST_F(NetlinkTest, forEachNetlinkAttribute) {
+    appendU32(1, 0x11111111);
+    const uint8_t three[3] = {1, 2, 3};
+    appendAttr(2, three, sizeof(three));
+    appendAttr(3, nullptr, 0);
+
+    std::vector<std::pair<uint16_t, size_t>> seen;
+    forEachNetlinkAttribute(attrs(), [&seen](const nlattr& hdr, const Slice payload) {
+        seen.emplace_back(hdr.nla_type, payload.size());
+    });
+    const std::vector<std::pair<uint16_t, size_t>> expected = {{1, 4}, {2, 3}, {3, 0}};
+    EXPECT_EQ(expected, seen);
+
+    // Headers shorter than themselves are visited as empty attributes and iteration continues.
+    const size_t offset = appendU32(4, 0);
+    attrAt(offset)->nla_len = 1;
+    appendU32(5, 0x55555555);
+    seen.clear();
+    forEachNetlinkAttribute(attrs(), [&seen](const nlattr& hdr, const Slice payload) {
+        seen.emplace_back(hdr.nla_type, payload.size());
+    });
+    const std::vector<std::pair<uint16_t, size_t>> expectedWithBad = {
+            {1, 4}, {2, 3}, {3, 0}, {4, 0}, {0, 0}, {5, 4}};
+    EXPECT_EQ(expectedWithBad, seen);
+}
+
+TEST_F(NetlinkTest, attributeTable) {
+    appendU32(1, 0x11111111);
+    appendU32(3 | NLA_F_NESTED, 0x33333333);
+    appendAttr(2, nullptr, 0);
+    appendU32(99, 0x99999999);
+    appendU32(1, 0x11112222);
+
+    NetlinkAttributeTable<3> table;
+    EXPECT_EQ(status::ok, table.parse(attrs()));
+
+    EXPECT_FALSE(table.has(0));
+    EXPECT_TRUE(table.has(1));
+    EXPECT_TRUE(table.has(2));
+    EXPECT_TRUE(table.has(3));
+    EXPECT_FALSE(table.has(4));
+    EXPECT_FALSE(table.has(99));
+
+    // The last occurrence wins.
+    uint32_t value = 0;
+    EXPECT_TRUE(table.get(1, value));
+    EXPECT_EQ(0x11112222U, value);
+    // Flags are stripped from the type.
+    EXPECT_TRUE(table.get(3, value));
+    EXPECT_EQ(0x33333333U, value);
+    // Present but empty.
+    EXPECT_TRUE(table.get(2).empty());
+    // Absent attributes leave the value unchanged.
+    value = 7;
+    EXPECT_FALSE(table.get(0, value));
+    EXPECT_FALSE(table.get(99, value));
+    EXPECT_EQ(7U, value);
+    EXPECT_TRUE(table.get(99).empty());
+
+    // Parsing again clears the previous contents.
+    EXPECT_EQ(status::ok, table.parse(Slice()));
+    EXPECT_FALSE(table.has(1));
+    EXPECT_FALSE(table.has(3));
+}
+
+TEST_F(NetlinkTest, attributeTablePolicy) {
+    const uint16_t shortValue = 0x2222;
+    appendU32(1, 0x11111111);
+    appendAttr(2, &shortValue, sizeof(shortValue));
+    appendU32(3, 0x33333333);
+
+    const NetlinkAttributeTable<3>::Policy policy = {0, 4, 4, 4};
+    NetlinkAttributeTable<3> table;
+    EXPECT_EQ(ERANGE, table.parse(attrs(), &policy).code());
+    EXPECT_TRUE(table.has(1));
+    EXPECT_FALSE(table.has(2));
+    EXPECT_TRUE(table.has(3));
+
+    // Without a policy, short attributes are stored and partially copied.
+    EXPECT_EQ(status::ok, table.parse(attrs()));
+    uint32_t value = 0;
+    EXPECT_TRUE(table.get(2, value));
+    EXPECT_EQ(0x2222U, value);
+}
+
+TEST_F(NetlinkTest, attributeTableMalformed) {
+    appendU32(1, 0x11111111);
+    // The payload of this attribute is read as another header, with length zero.
+    const size_t tooShort = appendU32(2, 0);
+    appendU32(3, 0x33333333);
+    const size_t truncated = appendU32(4, 0x44444444);
+    attrAt(tooShort)->nla_len = 2;
+    attrAt(truncated)->nla_len = 64;
+
+    NetlinkAttributeTable<4> table;
+    EXPECT_EQ(EINVAL, table.parse(attrs()).code());
+    EXPECT_TRUE(table.has(1));
+    EXPECT_FALSE(table.has(2));
+    EXPECT_FALSE(table.has(4));
+    // Iteration resynchronizes after the bad header, like forEachNetlinkAttribute.
+    uint32_t value = 0;
+    EXPECT_TRUE(table.get(3, value));
+    EXPECT_EQ(0x33333333U, value);
+
+    // A buffer too short for a header contains no attributes.
+    EXPECT_EQ(status::ok, table.parse(take(attrs(), sizeof(nlattr) - 1)));
+    EXPECT_FALSE(table.has(1));
+}
+
+}  // namespace netdutils
+}  // namespace android
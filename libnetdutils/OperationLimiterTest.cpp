@@ -16,6 +16,13 @@
 
 #include "netdutils/OperationLimiter.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest-spi.h>
 
 namespace android {
@@ -69,5 +76,121 @@ TEST(OperationLimiter, destroyWithActiveOperations) {
     }, "" /* "active operations */);
 }
 
+TEST(ShardedOperationLimiter, limits) {
+    ShardedOperationLimiter<int> limiter(3);
+
+    EXPECT_TRUE(limiter.start(42));
+    EXPECT_TRUE(limiter.start(42));
+    EXPECT_TRUE(limiter.start(42));
+    EXPECT_FALSE(limiter.start(42));
+
+    limiter.finish(42);
+    EXPECT_TRUE(limiter.start(42));
+    EXPECT_FALSE(limiter.start(42));
+
+    // Keys in the same shard are still counted separately.
+    EXPECT_TRUE(limiter.start(42 + 16));
+    EXPECT_EQ(4, limiter.total());
+    limiter.finish(42 + 16);
+
+    limiter.finish(42);
+    limiter.finish(42);
+    limiter.finish(42);
+    EXPECT_EQ(0, limiter.total());
+}
+
+TEST(ShardedOperationLimiter, globalLimit) {
+    ShardedOperationLimiter<int> limiter(2, 3);
+
+    EXPECT_TRUE(limiter.start(1));
+    EXPECT_TRUE(limiter.start(2));
+    EXPECT_TRUE(limiter.start(3));
+    EXPECT_FALSE(limiter.start(4));
+    EXPECT_EQ(3, limiter.total());
+
+    // A start() rejected by its key does not leak a global slot.
+    limiter.finish(3);
+    EXPECT_TRUE(limiter.start(1));
+    EXPECT_FALSE(limiter.start(1));
+    EXPECT_EQ(3, limiter.total());
+
+    limiter.finish(1);
+    limiter.finish(1);
+    limiter.finish(2);
+    EXPECT_EQ(0, limiter.total());
+}
+
+TEST(ShardedOperationLimiter, finishWithoutStart) {
+    ShardedOperationLimiter<int> limiter(1, 1);
+
+    // Will output a LOG(FATAL_WITHOUT_ABORT) and must not touch the global count.
+    limiter.finish(42);
+    EXPECT_EQ(0, limiter.total());
+    EXPECT_TRUE(limiter.start(42));
+    EXPECT_FALSE(limiter.start(43));
+    limiter.finish(42);
+}
+
+// Many threads hammer a few keys. The number of operations observed in progress for each key, and
+// overall, never exceeds the limits, and every operation that starts is accounted for.
+template <typename Limiter>
+void checkConcurrentLimits(Limiter& limiter, int limitPerKey, int globalLimit) {
+    constexpr int kThreads = 16;
+    constexpr int kKeys = 4;
+    constexpr int kIterations = 5000;
+
+    std::array<std::atomic<int>, kKeys> inFlight = {};
+    std::atomic<int> totalInFlight = 0;
+    std::atomic<int> started = 0;
+    std::atomic<bool> exceeded = false;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < kIterations; i++) {
+                const int key = (t + i) % kKeys;
+                if (!limiter.start(key)) continue;
+                started++;
+                if (++inFlight[key] > limitPerKey) exceeded = true;
+                if (++totalInFlight > globalLimit) exceeded = true;
+                --totalInFlight;
+                --inFlight[key];
+                limiter.finish(key);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_FALSE(exceeded);
+    EXPECT_LT(0, started);
+    // Every operation finished, so the full quota of a key is available again.
+    const int quota = std::min(limitPerKey, globalLimit);
+    for (int i = 0; i < quota; i++) EXPECT_TRUE(limiter.start(0));
+    EXPECT_FALSE(limiter.start(0));
+    for (int i = 0; i < quota; i++) limiter.finish(0);
+}
+
+TEST(OperationLimiter, concurrentStartFinish) {
+    OperationLimiter<int> limiter(3);
+    checkConcurrentLimits(limiter, 3, INT_MAX);
+}
+
+TEST(ShardedOperationLimiter, concurrentStartFinish) {
+    ShardedOperationLimiter<int, 4> limiter(3);
+    checkConcurrentLimits(limiter, 3, INT_MAX);
+    EXPECT_EQ(0, limiter.total());
+}
+
+TEST(ShardedOperationLimiter, concurrentGlobalLimit) {
+    // With a single shard all keys contend on the same lock; with 4 each has its own.
+    ShardedOperationLimiter<int, 1> oneShard(3, 5);
+    checkConcurrentLimits(oneShard, 3, 5);
+    EXPECT_EQ(0, oneShard.total());
+
+    ShardedOperationLimiter<int, 4> fourShards(3, 5);
+    checkConcurrentLimits(fourShards, 3, 5);
+    EXPECT_EQ(0, fourShards.total());
+}
+
 }  // namespace netdutils
 }  // namespace android
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "netdutils/ParallelDump.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include <android-base/logging.h>
+#include <android-base/thread_annotations.h>
+
+namespace android {
+namespace netdutils {
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+// State shared between run() and a section's task, which may outlive run().
+struct SectionState {
+    std::mutex lock;
+    std::condition_variable done;
+    std::string output GUARDED_BY(lock);
+    bool finished GUARDED_BY(lock) = false;
+    // Set by run() when it gives up on the section. Later output is dropped, and the section is
+    // not run if it has not started yet.
+    bool abandoned GUARDED_BY(lock) = false;
+    steady_clock::time_point finishedAt GUARDED_BY(lock);
+};
+
+// Writes the buffered output of a section to dw line by line, so that it picks up the indentation
+// of dw.
+void emit(DumpWriter& dw, const std::string& output) {
+    size_t start = 0;
+    while (start < output.size()) {
+        size_t end = output.find('\n', start);
+        if (end == std::string::npos) end = output.size();
+        dw.println(output.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+}  // namespace
+
+void ParallelDump::add(std::string name, milliseconds budget, Section section) {
+    mSections.push_back({std::move(name), budget, std::move(section)});
+}
+
+void ParallelDump::run(DumpWriter& dw) NO_THREAD_SAFETY_ANALYSIS {
+    CHECK(mTimings.empty()) << "ParallelDump::run() called twice";
+    const steady_clock::time_point start = steady_clock::now();
+
+    std::vector<std::shared_ptr<SectionState>> states;
+    std::vector<Status> posted;
+    for (auto& pending : mSections) {
+        auto state = std::make_shared<SectionState>();
+        states.push_back(state);
+        Executor::Task task = [state, section = std::move(pending.section)] {
+            {
+                std::lock_guard guard(state->lock);
+                if (state->abandoned) return;
+            }
+            DumpWriter sectionWriter([&state](const std::string& line) {
+                std::lock_guard guard(state->lock);
+                if (!state->abandoned) state->output.append(line);
+            });
+            section(sectionWriter);
+            std::lock_guard guard(state->lock);
+            state->finished = true;
+            state->finishedAt = steady_clock::now();
+            state->done.notify_all();
+        };
+        posted.push_back(mExecutor.post(Executor::Lane::NORMAL, std::move(task)));
+    }
+
+    for (size_t i = 0; i < mSections.size(); i++) {
+        const PendingSection& pending = mSections[i];
+        SectionState& state = *states[i];
+        std::string output;
+        Timing timing = {.name = pending.name, .truncated = false};
+        if (!isOk(posted[i])) {
+            dw.println("<%s not run: %s>", pending.name.c_str(), toString(posted[i]).c_str());
+            timing.elapsed = milliseconds(0);
+            timing.truncated = true;
+            mTimings.push_back(std::move(timing));
+            continue;
+        }
+        {
+            std::unique_lock lock(state.lock);
+            const bool finished = state.done.wait_until(lock, start + pending.budget,
+                                                        [&state]() NO_THREAD_SAFETY_ANALYSIS {
+                                                            return state.finished;
+                                                        });
+            if (finished) {
+                timing.elapsed = std::chrono::duration_cast<milliseconds>(state.finishedAt - start);
+            } else {
+                state.abandoned = true;
+                timing.elapsed = pending.budget;
+                timing.truncated = true;
+            }
+            output = std::move(state.output);
+            state.output.clear();
+        }
+
+        emit(dw, output);
+        if (timing.truncated) {
+            dw.println("<%s truncated: not finished after %lld ms>", pending.name.c_str(),
+                       static_cast<long long>(pending.budget.count()));
+        }
+        mTimings.push_back(std::move(timing));
+    }
+}
+
+void ParallelDump::dumpTimings(DumpWriter& dw) const {
+    dw.println("Dump section timings:");
+    ScopedIndent indent(dw);
+    for (const auto& timing : mTimings) {
+        dw.println("%s: %s%lld ms", timing.name.c_str(), timing.truncated ? ">" : "",
+                   static_cast<long long>(timing.elapsed.count()));
+    }
+}
+
+}  // namespace netdutils
+}  // namespace android
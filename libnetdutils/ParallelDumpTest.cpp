@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/ParallelDump.h"
+
+namespace android {
+namespace netdutils {
+
+using std::chrono::milliseconds;
+
+namespace {
+
+DumpWriter stringWriter(std::string* out) {
+    return DumpWriter([out](const std::string& line) { out->append(line); });
+}
+
+}  // namespace
+
+class ParallelDumpTest : public ::testing::Test {
+  protected:
+    Executor mExecutor{{.name = "dump-test", .threads = 4}};
+};
+
+TEST_F(ParallelDumpTest, WritesSectionsInOrder) {
+    ParallelDump dump(mExecutor);
+    // The first section finishes last.
+    dump.add("first", milliseconds(5000), [](DumpWriter& dw) {
+        std::this_thread::sleep_for(milliseconds(20));
+        dw.println("one");
+        ScopedIndent indent(dw);
+        dw.println("two");
+    });
+    dump.add("second", milliseconds(5000), [](DumpWriter& dw) {
+        dw.println("three");
+        dw.blankline();
+    });
+
+    std::string out;
+    DumpWriter dw = stringWriter(&out);
+    ScopedIndent indent(dw);
+    dump.run(dw);
+
+    // Section output picks up the indentation of the writer it is emitted to.
+    EXPECT_EQ("  one\n    two\n  three\n\n", out);
+    ASSERT_EQ(2U, dump.timings().size());
+    EXPECT_EQ("first", dump.timings()[0].name);
+    EXPECT_FALSE(dump.timings()[0].truncated);
+    EXPECT_LE(20, dump.timings()[0].elapsed.count());
+    EXPECT_EQ("second", dump.timings()[1].name);
+    EXPECT_FALSE(dump.timings()[1].truncated);
+}
+
+TEST_F(ParallelDumpTest, TruncatesSlowSections) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> slowDone;
+
+    ParallelDump dump(mExecutor);
+    dump.add("slow", milliseconds(50), [released, &slowDone](DumpWriter& dw) {
+        dw.println("before");
+        released.wait();
+        dw.println("after");
+        slowDone.set_value();
+    });
+    dump.add("fast", milliseconds(50), [](DumpWriter& dw) { dw.println("fast"); });
+
+    std::string out;
+    DumpWriter dw = stringWriter(&out);
+    const auto start = std::chrono::steady_clock::now();
+    dump.run(dw);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ("before\n<slow truncated: not finished after 50 ms>\nfast\n", out);
+    EXPECT_LT(elapsed, milliseconds(1000));
+    EXPECT_TRUE(dump.timings()[0].truncated);
+    EXPECT_EQ(50, dump.timings()[0].elapsed.count());
+    EXPECT_FALSE(dump.timings()[1].truncated);
+
+    // The abandoned section can still finish, and its output goes nowhere.
+    release.set_value();
+    slowDone.get_future().wait();
+    EXPECT_EQ("before\n<slow truncated: not finished after 50 ms>\nfast\n", out);
+
+    std::string timings;
+    DumpWriter timingWriter = stringWriter(&timings);
+    dump.dumpTimings(timingWriter);
+    EXPECT_EQ(0U, timings.find("Dump section timings:\n  slow: >50 ms\n  fast: ")) << timings;
+}
+
+TEST_F(ParallelDumpTest, SectionsRunConcurrently) {
+    // Each section waits for all the others to start, which only works if they run at once.
+    constexpr int kSections = 4;
+    // Shared, since sections that miss their budget keep running after the test returns.
+    auto started = std::make_shared<std::atomic<int>>(0);
+    ParallelDump dump(mExecutor);
+    for (int i = 0; i < kSections; i++) {
+        dump.add(std::to_string(i), milliseconds(5000), [started, i](DumpWriter& dw) {
+            (*started)++;
+            while (*started < kSections) std::this_thread::yield();
+            dw.println("section %d", i);
+        });
+    }
+    std::string out;
+    DumpWriter dw = stringWriter(&out);
+    dump.run(dw);
+    EXPECT_EQ("section 0\nsection 1\nsection 2\nsection 3\n", out);
+}
+
+TEST_F(ParallelDumpTest, SkipsSectionsQueuedPastTheirBudget) {
+    // One worker, held by the first section until the second one runs out of budget.
+    Executor executor({.name = "dump-test-1", .threads = 1});
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<bool> queuedRan = false;
+
+    ParallelDump dump(executor);
+    dump.add("slow", milliseconds(50), [released](DumpWriter&) { released.wait(); });
+    dump.add("queued", milliseconds(50), [&queuedRan](DumpWriter&) { queuedRan = true; });
+
+    std::string out;
+    DumpWriter dw = stringWriter(&out);
+    dump.run(dw);
+    EXPECT_EQ("<slow truncated: not finished after 50 ms>\n"
+              "<queued truncated: not finished after 50 ms>\n", out);
+
+    release.set_value();
+    executor.waitForIdle();
+    EXPECT_FALSE(queuedRan);
+}
+
+TEST_F(ParallelDumpTest, ReportsSectionsThatCannotBeQueued) {
+    Executor executor({.name = "dump-test-0", .threads = 1});
+    executor.shutdown();
+
+    ParallelDump dump(executor);
+    dump.add("rejected", milliseconds(50), [](DumpWriter& dw) { dw.println("never"); });
+    std::string out;
+    DumpWriter dw = stringWriter(&out);
+    dump.run(dw);
+    EXPECT_EQ(0U, out.find("<rejected not run: ")) << out;
+    ASSERT_EQ(1U, dump.timings().size());
+    EXPECT_TRUE(dump.timings()[0].truncated);
+}
+
+}  // namespace netdutils
+}  // namespace android
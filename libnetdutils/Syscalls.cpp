@@ -126,7 +126,7 @@ class RealSyscalls final : public Syscalls {
         return rv;
     }
 
-    StatusOr<size_t> writev(Fd fd, const std::vector<iovec>& iov) const override {
+    StatusOr<size_t> writev(Fd fd, std::span<const iovec> iov) const override {
         auto rv = syscallRetry(::writev, fd.get(), iov.data(), iov.size());
         if (rv == -1) {
             return statusFromErrno(errno, "writev() failed");
@@ -171,6 +171,37 @@ class RealSyscalls final : public Syscalls {
         return take(dst, rv);
     }
 
+    StatusOr<size_t> sendmsg(Fd sock, std::span<const iovec> iov, int flags, const sockaddr* dst,
+                             socklen_t dstlen) const override {
+        const msghdr msg = {
+                .msg_name = const_cast<sockaddr*>(dst),
+                .msg_namelen = dstlen,
+                .msg_iov = const_cast<iovec*>(iov.data()),
+                .msg_iovlen = iov.size(),
+        };
+        auto rv = syscallRetry(::sendmsg, sock.get(), &msg, flags);
+        if (rv == -1) {
+            return statusFromErrno(errno, "sendmsg() failed");
+        }
+        return static_cast<size_t>(rv);
+    }
+
+    StatusOr<size_t> sendmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const override {
+        auto rv = syscallRetry(::sendmmsg, sock.get(), msgs.data(), msgs.size(), flags);
+        if (rv == -1) {
+            return statusFromErrno(errno, "sendmmsg() failed");
+        }
+        return static_cast<size_t>(rv);
+    }
+
+    StatusOr<size_t> recvmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const override {
+        auto rv = syscallRetry(::recvmmsg, sock.get(), msgs.data(), msgs.size(), flags, nullptr);
+        if (rv == -1) {
+            return statusFromErrno(errno, "recvmmsg() failed");
+        }
+        return static_cast<size_t>(rv);
+    }
+
     Status shutdown(Fd fd, int how) const override {
         auto rv = ::shutdown(fd.get(), how);
         if (rv == -1) {
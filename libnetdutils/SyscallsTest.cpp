@@ -198,5 +198,102 @@ TEST_F(SyscallsTest, recvfrom) {
     EXPECT_EQ(expected, result.value().second);
 }
 
+TEST_F(SyscallsTest, sendmsg) {
+    constexpr Fd kFd(40);
+    constexpr int kFlags = 0;
+    std::array<char, 10> header;
+    std::array<char, 20> payload;
+    const iovec iov[] = {
+        {header.data(), header.size()},
+        {payload.data(), payload.size()},
+    };
+    sockaddr_nl expected = {};
+    auto& sys = sSyscalls.get();
+
+    // Success
+    EXPECT_CALL(mSyscalls, sendmsg(kFd, _, kFlags, asSockaddrPtr(&expected), sizeof(expected)))
+            .WillOnce(Invoke([&iov](Fd, std::span<const iovec> sent, int, const sockaddr*,
+                                    socklen_t) {
+                EXPECT_EQ(std::size(iov), sent.size());
+                EXPECT_EQ(iov, sent.data());
+                return sizeof(header) + sizeof(payload);
+            }));
+    auto result = sys.sendmsg(kFd, iov, kFlags, expected);
+    EXPECT_EQ(status::ok, result.status());
+    EXPECT_EQ(sizeof(header) + sizeof(payload), result.value());
+
+    // Failure
+    const Status kError = statusFromErrno(ENOBUFS, "test");
+    EXPECT_CALL(mSyscalls, sendmsg(kFd, _, kFlags, nullptr, 0)).WillOnce(Return(kError));
+    EXPECT_EQ(kError, sys.sendmsg(kFd, iov, kFlags).status());
+}
+
+TEST_F(SyscallsTest, recvmmsg) {
+    constexpr Fd kFd(40);
+    constexpr int kFlags = MSG_DONTWAIT;
+    std::array<mmsghdr, 4> msgs = {};
+    auto& sys = sSyscalls.get();
+
+    // Success, fewer datagrams than requested
+    EXPECT_CALL(mSyscalls, recvmmsg(kFd, _, kFlags))
+            .WillOnce(Invoke([&msgs](Fd, std::span<mmsghdr> rx, int) {
+                EXPECT_EQ(msgs.data(), rx.data());
+                EXPECT_EQ(msgs.size(), rx.size());
+                rx[0].msg_len = 100;
+                rx[1].msg_len = 200;
+                return size_t{2};
+            }));
+    auto result = sys.recvmmsg(kFd, msgs, kFlags);
+    EXPECT_EQ(status::ok, result.status());
+    EXPECT_EQ(2U, result.value());
+    EXPECT_EQ(100U, msgs[0].msg_len);
+    EXPECT_EQ(200U, msgs[1].msg_len);
+
+    // Failure
+    const Status kError = statusFromErrno(ENOBUFS, "test");
+    EXPECT_CALL(mSyscalls, recvmmsg(kFd, _, kFlags)).WillOnce(Return(kError));
+    EXPECT_EQ(kError, sys.recvmmsg(kFd, msgs, kFlags).status());
+}
+
+TEST(syscalls, sendmmsgRecvmmsg) {
+    auto& sys = sSyscalls.get();
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds));
+    UniqueFd tx(fds[0]);
+    UniqueFd rx(fds[1]);
+
+    constexpr size_t kNumMsgs = 3;
+    char payloads[kNumMsgs][8] = {"one", "two", "three"};
+    iovec txIov[kNumMsgs];
+    std::array<mmsghdr, kNumMsgs> txMsgs = {};
+    for (size_t i = 0; i < kNumMsgs; i++) {
+        txIov[i] = {payloads[i], strlen(payloads[i])};
+        txMsgs[i].msg_hdr.msg_iov = &txIov[i];
+        txMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto sent = sys.sendmmsg(tx, txMsgs, 0);
+    ASSERT_EQ(status::ok, sent.status());
+    EXPECT_EQ(kNumMsgs, sent.value());
+
+    char bufs[kNumMsgs + 1][16];
+    iovec rxIov[kNumMsgs + 1];
+    std::array<mmsghdr, kNumMsgs + 1> rxMsgs = {};
+    for (size_t i = 0; i < rxMsgs.size(); i++) {
+        rxIov[i] = {bufs[i], sizeof(bufs[i])};
+        rxMsgs[i].msg_hdr.msg_iov = &rxIov[i];
+        rxMsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    auto received = sys.recvmmsg(rx, rxMsgs, MSG_DONTWAIT);
+    ASSERT_EQ(status::ok, received.status());
+    ASSERT_EQ(kNumMsgs, received.value());
+    for (size_t i = 0; i < kNumMsgs; i++) {
+        EXPECT_EQ(strlen(payloads[i]), rxMsgs[i].msg_len);
+        EXPECT_EQ(0, memcmp(payloads[i], bufs[i], rxMsgs[i].msg_len));
+    }
+
+    // Nothing left to read.
+    EXPECT_EQ(EAGAIN, sys.recvmmsg(rx, rxMsgs, MSG_DONTWAIT).status().code());
+}
+
 }  // namespace netdutils
 }  // namespace android
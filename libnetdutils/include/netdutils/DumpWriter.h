@@ -17,6 +17,7 @@
 #ifndef NETDUTILS_DUMPWRITER_H_
 #define NETDUTILS_DUMPWRITER_H_
 
+#include <functional>
 #include <string>
 
 namespace android {
@@ -24,7 +25,12 @@ namespace netdutils {
 
 class DumpWriter {
   public:
+    // Receives each line, including indentation and the trailing newline.
+    using Sink = std::function<void(const std::string& line)>;
+
     DumpWriter(int fd);
+    // Writes to sink instead of a file descriptor, e.g., to render into a buffer.
+    explicit DumpWriter(Sink sink);
 
     void incIndent();
     void decIndent();
@@ -43,6 +49,7 @@ class DumpWriter {
   private:
     uint8_t mIndentLevel;
     int mFd;
+    Sink mSink;
 };
 
 class ScopedIndent {
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDUTILS_EVENT_LOOP_H
+#define NETDUTILS_EVENT_LOOP_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <android-base/thread_annotations.h>
+
+#include "netdutils/DumpWriter.h"
+#include "netdutils/Fd.h"
+#include "netdutils/Status.h"
+#include "netdutils/StatusOr.h"
+#include "netdutils/UniqueFd.h"
+
+namespace android {
+namespace netdutils {
+
+// Waits for many event sources on a single thread with epoll, so that listeners that spend most of
+// their time blocked do not each need a thread of their own.
+//
+// A source is either a file descriptor, whose callback runs when it becomes ready, or a periodic
+// timer. Callbacks run on the loop thread, one at a time, and must not block: a listener should
+// handle one batch of input per call and rely on the loop to call it again while the fd remains
+// readable.
+//
+// Sources are registered level-triggered and each ready source is dispatched at most once per
+// wakeup, so a source that is always ready cannot starve the others. When more sources are ready
+// than fit in one wakeup (Options::maxEventsPerWakeup), the kernel returns the ones not yet served
+// first on the next wakeup.
+//
+// Loops that should not delay each other, e.g., for sources of different priority, are simply
+// separate instances.
+//
+// Without a thread the loop is deterministic: callbacks run only when the owner calls runOnce(),
+// on the calling thread. This is intended for unit tests.
+//
+// Example:
+//     EventLoop loop({.name = "netd-listen"});
+//     auto id = loop.addFd(sock, EPOLLIN, "SkDestroyListen", [this](uint32_t) { readBatch(); });
+//     ...
+//     loop.remove(id.value());
+//
+// This class is thread-safe.
+class EventLoop {
+  public:
+    using Callback = std::function<void(uint32_t events)>;
+    using SourceId = uint64_t;
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    struct Options {
+        // Name of the loop thread.
+        std::string name = "netdutils-loop";
+        // Whether to run a loop thread. If false, the owner must call runOnce().
+        bool thread = true;
+        // Maximum number of sources dispatched per wakeup.
+        int maxEventsPerWakeup = 32;
+        // Overrides the clock used for latency metrics. Only used by tests.
+        std::function<TimePoint()> clock;
+    };
+
+    struct SourceStats {
+        uint64_t dispatches = 0;
+        // Time between the wakeup that found the source ready and the start of its callback, i.e.,
+        // how long other sources kept it waiting.
+        uint64_t totalDelayUs = 0;
+        uint64_t maxDelayUs = 0;
+        // Time spent running the callback.
+        uint64_t totalRunUs = 0;
+        uint64_t maxRunUs = 0;
+        // Timers only: expirations that were merged into a single callback because the loop was
+        // late.
+        uint64_t missedTimerExpirations = 0;
+    };
+
+    explicit EventLoop(Options options);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Calls callback on the loop thread whenever fd is ready for any of the epoll events in events.
+    // The caller keeps ownership of fd, and must remove the source before closing it.
+    StatusOr<SourceId> addFd(Fd fd, uint32_t events, const std::string& name, Callback callback)
+            EXCLUDES(mLock);
+
+    // Calls callback on the loop thread every interval, starting one interval from now.
+    StatusOr<SourceId> addTimer(const std::string& name, std::chrono::milliseconds interval,
+                                std::function<void()> callback) EXCLUDES(mLock);
+
+    // Unregisters a source. Once this returns, its callback is not running and will not be called
+    // again, unless remove() was called from that callback. Returns ENOENT for unknown sources.
+    Status remove(SourceId id) EXCLUDES(mLock);
+
+    // Deterministic mode only. Waits up to timeout for sources to become ready and dispatches
+    // them. Returns the number of callbacks run.
+    StatusOr<size_t> runOnce(std::chrono::milliseconds timeout) EXCLUDES(mLock);
+
+    // Stops the loop thread. Sources can still be removed afterwards, but are no longer
+    // dispatched. Called by the destructor.
+    void shutdown() EXCLUDES(mLock);
+
+    // Returns the stats of a source, or empty stats if it was removed.
+    SourceStats stats(SourceId id) const EXCLUDES(mLock);
+
+    void dump(DumpWriter& dw) const EXCLUDES(mLock);
+
+  private:
+    struct Source {
+        std::string name;
+        Fd fd;
+        // Only set for timers, which own their timerfd.
+        UniqueFd timerFd;
+        Callback callback;
+        SourceStats stats;
+    };
+
+    TimePoint now() const;
+    StatusOr<SourceId> addSource(std::unique_ptr<Source> source, uint32_t events)
+            EXCLUDES(mLock);
+    // Waits for and dispatches one batch of events. Returns the number of callbacks run.
+    StatusOr<size_t> dispatchOnce(int timeoutMs) EXCLUDES(mLock);
+    void loop() EXCLUDES(mLock);
+
+    const Options mOptions;
+    const UniqueFd mEpoll;
+    // Written to wake the loop thread up for shutdown.
+    const UniqueFd mWakeup;
+
+    mutable std::mutex mLock;
+    // Signalled when a callback returns.
+    std::condition_variable mDispatchCv;
+    std::map<SourceId, std::shared_ptr<Source>> mSources GUARDED_BY(mLock);
+    SourceId mNextId GUARDED_BY(mLock) = 1;
+    // The source whose callback is running, or 0.
+    SourceId mDispatching GUARDED_BY(mLock) = 0;
+    std::thread::id mDispatchThread GUARDED_BY(mLock);
+    bool mShutdown GUARDED_BY(mLock) = false;
+    std::thread mThread;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif  // NETDUTILS_EVENT_LOOP_H
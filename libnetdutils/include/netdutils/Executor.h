@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDUTILS_EXECUTOR_H
+#define NETDUTILS_EXECUTOR_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/thread_annotations.h>
+
+#include "netdutils/DumpWriter.h"
+#include "netdutils/Status.h"
+
+namespace android {
+namespace netdutils {
+
+// Runs deferrable work on a fixed number of worker threads, so that listener and binder threads
+// can hand off slow jobs without spawning a thread per job.
+//
+// Work is posted to one of several priority lanes. Each lane has a bounded queue, and what happens
+// when it is full is chosen per lane: the new task can be rejected, the oldest queued task can be
+// dropped, or the caller can block until there is room. Workers always take the oldest task from
+// the highest priority non-empty lane, so BACKGROUND work only runs when nothing more urgent is
+// waiting.
+//
+// With zero worker threads the executor is deterministic: tasks run only when the owner calls
+// runOne() or runPending(), on the calling thread. This is intended for unit tests.
+//
+// Example:
+//     Executor executor({.name = "netd-work", .threads = 2});
+//     ...
+//     Status s = executor.post(Executor::Lane::BACKGROUND, [this] { garbageCollect(); });
+//     if (!isOk(s)) ALOGW("Dropping map GC: %s", toString(s).c_str());
+//
+// This class is thread-safe.
+class Executor {
+  public:
+    enum class Lane { HIGH, NORMAL, BACKGROUND };
+    static constexpr size_t kNumLanes = 3;
+
+    enum class Overflow {
+        // post() returns EAGAIN and the task is discarded.
+        REJECT,
+        // The oldest queued task in the lane is discarded without running.
+        DROP_OLDEST,
+        // post() blocks until the lane has room. Behaves like REJECT when there are no workers.
+        // Tasks must not post to a BLOCK lane, since they may be blocking the only worker that
+        // could make room.
+        BLOCK,
+    };
+
+    struct LaneOptions {
+        size_t capacity = 256;
+        Overflow overflow = Overflow::REJECT;
+    };
+
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    struct Options {
+        // Prefix of the worker thread names.
+        std::string name = "netdutils-exec";
+        // Number of worker threads. Zero selects the deterministic mode.
+        int threads = 1;
+        std::array<LaneOptions, kNumLanes> lanes = {};
+        // Overrides the clock used for latency metrics. Only used by tests.
+        std::function<TimePoint()> clock;
+    };
+
+    // Upper bounds of the latency histogram buckets, in microseconds. The last bucket counts
+    // everything slower.
+    static constexpr std::array<uint64_t, 6> kLatencyBucketsUs = {10,     100,     1000,
+                                                                  10'000, 100'000, 1'000'000};
+    using Histogram = std::array<uint64_t, kLatencyBucketsUs.size() + 1>;
+
+    struct LaneStats {
+        uint64_t posted = 0;
+        uint64_t executed = 0;
+        uint64_t rejected = 0;
+        uint64_t dropped = 0;
+        size_t queued = 0;
+        size_t maxQueued = 0;
+        // Time between post() and the start of the task.
+        uint64_t totalWaitUs = 0;
+        uint64_t maxWaitUs = 0;
+        Histogram waitHistogram = {};
+        // Time spent running the task.
+        uint64_t totalRunUs = 0;
+        uint64_t maxRunUs = 0;
+    };
+
+    using Task = std::function<void()>;
+
+    explicit Executor(Options options);
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Queues task on lane. Returns EAGAIN if the lane is full and its policy is REJECT (or BLOCK
+    // without workers), or ESHUTDOWN after shutdown() has been called.
+    Status post(Lane lane, Task task) EXCLUDES(mLock);
+
+    // Stops accepting new tasks, runs the tasks already queued and joins the workers. Later calls
+    // to post(), and calls blocked in post(), return ESHUTDOWN. Called by the destructor.
+    void shutdown() EXCLUDES(mLock);
+
+    // Blocks until all lanes are empty and no task is running. Without workers, runs all pending
+    // tasks on the calling thread instead.
+    void waitForIdle() EXCLUDES(mLock);
+
+    // Deterministic mode only. Runs the next task, if any, on the calling thread and returns
+    // whether one was run.
+    bool runOne() EXCLUDES(mLock);
+
+    // Deterministic mode only. Runs tasks until all lanes are empty, including tasks posted by the
+    // tasks themselves. Returns the number of tasks run.
+    size_t runPending() EXCLUDES(mLock);
+
+    LaneStats stats(Lane lane) const EXCLUDES(mLock);
+
+    void dump(DumpWriter& dw) const EXCLUDES(mLock);
+
+    static const char* laneName(Lane lane);
+
+  private:
+    struct QueuedTask {
+        Task task;
+        TimePoint posted;
+    };
+
+    struct LaneState {
+        std::deque<QueuedTask> queue;
+        LaneStats stats;
+    };
+
+    TimePoint now() const;
+    // Removes the next task to run and records its wait time. Returns false if all lanes are empty.
+    bool takeNextLocked(QueuedTask* task, size_t* lane) REQUIRES(mLock);
+    // Runs a task taken by takeNextLocked() with the lock released.
+    void runLocked(std::unique_lock<std::mutex>& lock, QueuedTask task, size_t lane)
+            REQUIRES(mLock);
+    bool idleLocked() const REQUIRES(mLock);
+    void workerLoop(int index) EXCLUDES(mLock);
+
+    const Options mOptions;
+
+    mutable std::mutex mLock;
+    // Signalled when a task is queued or when shutting down.
+    std::condition_variable mWorkCv;
+    // Signalled when a task finishes, i.e., when there may be room in a lane or nothing to do.
+    std::condition_variable mDoneCv;
+    std::array<LaneState, kNumLanes> mLanes GUARDED_BY(mLock);
+    int mRunning GUARDED_BY(mLock) = 0;
+    bool mShutdown GUARDED_BY(mLock) = false;
+    std::vector<std::thread> mWorkers;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif  // NETDUTILS_EXECUTOR_H
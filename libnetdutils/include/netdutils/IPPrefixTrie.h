@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDUTILS_IPPREFIXTRIE_H
+#define NETDUTILS_IPPREFIXTRIE_H
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "netdutils/InternetAddresses.h"
+
+namespace android {
+namespace netdutils {
+
+namespace internal_ {
+
+// A prefix as a 128-bit big-endian bit string. IPv4 addresses occupy the top 32 bits.
+struct PrefixKey {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    // Bit i, counting from the most significant.
+    int bit(int i) const {
+        return i < 64 ? (hi >> (63 - i)) & 1 : (lo >> (127 - i)) & 1;
+    }
+
+    // Length of the common prefix of a and b, at most 128.
+    static int commonLength(const PrefixKey& a, const PrefixKey& b) {
+        if (const uint64_t x = a.hi ^ b.hi; x != 0) return __builtin_clzll(x);
+        if (const uint64_t x = a.lo ^ b.lo; x != 0) return 64 + __builtin_clzll(x);
+        return 128;
+    }
+
+    // The first len bits of this key, with the rest zeroed.
+    PrefixKey truncate(int len) const {
+        if (len <= 0) return {};
+        if (len < 64) return {hi & ~(~uint64_t{0} >> len), 0};
+        if (len == 64) return {hi, 0};
+        if (len < 128) return {hi, lo & ~(~uint64_t{0} >> (len - 64))};
+        return *this;
+    }
+};
+
+}  // namespace internal_
+
+// A map from IP prefixes to values that finds the longest prefix containing an address, e.g., the
+// most specific route or NAT64 prefix that covers it.
+//
+// IPv4 and IPv6 prefixes are kept in separate binary tries that are path-compressed: a node only
+// exists where a stored prefix ends or two stored prefixes diverge, so a trie with n prefixes has
+// fewer than 2n nodes and lookups visit at most one node per distinct length along the path.
+// Nodes live in a single vector and refer to each other by index, so building a trie of known size
+// allocates once. Scope IDs of link-local prefixes are ignored.
+//
+// Example:
+//     IPPrefixTrie<int> routes;
+//     routes.insert(IPPrefix::forString("2001:db8::/32"), 1);
+//     routes.insert(IPPrefix::forString("2001:db8:1::/48"), 2);
+//     const int* netId = routes.longestMatch(IPAddress::forString("2001:db8:1::1"));  // 2
+//
+// This class is not thread-safe.
+template <typename Value>
+class IPPrefixTrie {
+  public:
+    IPPrefixTrie() = default;
+
+    // Builds a trie from entries in one allocation. If a prefix appears more than once, its last
+    // value is kept. Uninitialized prefixes are skipped.
+    static IPPrefixTrie build(std::vector<std::pair<IPPrefix, Value>> entries) {
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        IPPrefixTrie trie;
+        trie.reserve(entries.size());
+        // Inserting in order always extends the rightmost path of the trie.
+        for (auto& [prefix, value] : entries) {
+            trie.insert(prefix, std::move(value));
+        }
+        return trie;
+    }
+
+    // Makes room for n prefixes without reallocating.
+    void reserve(size_t n) { mNodes.reserve(2 * n); }
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    void clear() {
+        mNodes.clear();
+        mFree.clear();
+        mRoots = {kNone, kNone};
+        mSize = 0;
+    }
+
+    // Adds prefix with the given value, or replaces the value if prefix is already present.
+    // Returns false, and does nothing, if prefix is uninitialized.
+    bool insert(const IPPrefix& prefix, Value value) {
+        int* root = rootFor(prefix.family());
+        if (root == nullptr) return false;
+        const int len = prefix.length();
+        const Key key = keyFor(prefix);
+        // An insertion creates at most two nodes. Make room for them first so that link, which may
+        // point into mNodes, stays valid.
+        if (mFree.size() < 2 && mNodes.capacity() - mNodes.size() < 2) {
+            mNodes.reserve(std::max<size_t>(16, 2 * mNodes.capacity()));
+        }
+
+        int* link = root;
+        while (true) {
+            if (*link == kNone) {
+                *link = newNode(key, len, std::move(value));
+                mSize++;
+                return true;
+            }
+            const int index = *link;
+            const int nodeLen = mNodes[index].len;
+            const int common = std::min({Key::commonLength(mNodes[index].key, key), nodeLen, len});
+
+            if (common == nodeLen && common == len) {
+                if (!mNodes[index].value) mSize++;
+                mNodes[index].value = std::move(value);
+                return true;
+            }
+            if (common == nodeLen) {
+                // The node covers prefix: descend.
+                link = &mNodes[index].child[key.bit(nodeLen)];
+                continue;
+            }
+
+            // The new prefix ends, or diverges from the node, above the node.
+            int above;
+            if (common == len) {
+                above = newNode(key, len, std::move(value));
+            } else {
+                above = newNode(key.truncate(common), common, std::nullopt);
+                const int leaf = newNode(key, len, std::move(value));
+                mNodes[above].child[key.bit(common)] = leaf;
+            }
+            mNodes[above].child[mNodes[index].key.bit(common)] = index;
+            *link = above;
+            mSize++;
+            return true;
+        }
+    }
+
+    // Removes prefix. Returns whether it was present.
+    bool erase(const IPPrefix& prefix) {
+        int* root = rootFor(prefix.family());
+        if (root == nullptr) return false;
+        const int len = prefix.length();
+        const Key key = keyFor(prefix);
+
+        // Erasing never allocates, so pointers to links stay valid.
+        int* parentLink = nullptr;
+        int* link = root;
+        while (*link != kNone) {
+            Node& node = mNodes[*link];
+            if (node.len > len || Key::commonLength(node.key, key) < node.len) return false;
+            if (node.len == len) break;
+            parentLink = link;
+            link = &node.child[key.bit(node.len)];
+        }
+        if (*link == kNone || !mNodes[*link].value) return false;
+
+        mNodes[*link].value.reset();
+        mSize--;
+        // Remove the node if it no longer separates anything, and then its parent if that was
+        // only there to separate the node from its sibling.
+        if (collapse(link) && parentLink != nullptr && !mNodes[*parentLink].value) {
+            collapse(parentLink);
+        }
+        return true;
+    }
+
+    // Returns the value of exactly prefix, or nullptr if it is not present.
+    const Value* find(const IPPrefix& prefix) const {
+        const int* root = rootFor(prefix.family());
+        if (root == nullptr) return nullptr;
+        const int len = prefix.length();
+        const Key key = keyFor(prefix);
+
+        int index = *root;
+        while (index != kNone) {
+            const Node& node = mNodes[index];
+            if (node.len > len || Key::commonLength(node.key, key) < node.len) return nullptr;
+            if (node.len == len) return node.value ? &*node.value : nullptr;
+            index = node.child[key.bit(node.len)];
+        }
+        return nullptr;
+    }
+
+    // Returns the value of the longest stored prefix that contains prefix, including prefix
+    // itself, or nullptr if there is none. If matched is not null, it is set to that prefix.
+    const Value* longestMatch(const IPPrefix& prefix, IPPrefix* matched = nullptr) const {
+        const int* root = rootFor(prefix.family());
+        if (root == nullptr) return nullptr;
+        const int len = prefix.length();
+        const Key key = keyFor(prefix);
+
+        const Node* best = nullptr;
+        int index = *root;
+        while (index != kNone) {
+            const Node& node = mNodes[index];
+            if (node.len > len || Key::commonLength(node.key, key) < node.len) break;
+            if (node.value) best = &node;
+            if (node.len == len) break;
+            index = node.child[key.bit(node.len)];
+        }
+        if (best == nullptr) return nullptr;
+        if (matched != nullptr) *matched = prefixFor(prefix.family(), best->key, best->len);
+        return &*best->value;
+    }
+
+    // Returns the value of the longest stored prefix that contains ip, or nullptr.
+    const Value* longestMatch(const IPAddress& ip, IPPrefix* matched = nullptr) const {
+        return longestMatch(IPPrefix(ip), matched);
+    }
+
+    // Calls fn(const IPPrefix&, const Value&) for every prefix, in IPPrefix order: IPv4 before
+    // IPv6, by address, and shorter prefixes before longer ones with the same address.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        forEachIn(AF_INET, mRoots[0], fn);
+        forEachIn(AF_INET6, mRoots[1], fn);
+    }
+
+  private:
+    using Key = internal_::PrefixKey;
+    static constexpr int kNone = -1;
+
+    struct Node {
+        Key key;
+        uint8_t len = 0;
+        std::optional<Value> value;
+        int child[2] = {kNone, kNone};
+    };
+
+    static Key keyFor(const IPPrefix& prefix) {
+        Key key;
+        if (prefix.family() == AF_INET) {
+            key.hi = uint64_t{ntohl(prefix.addr4().s_addr)} << 32;
+        } else {
+            const in6_addr addr = prefix.addr6();
+            for (int i = 0; i < 8; i++) {
+                key.hi = (key.hi << 8) | addr.s6_addr[i];
+                key.lo = (key.lo << 8) | addr.s6_addr[8 + i];
+            }
+        }
+        return key.truncate(prefix.length());
+    }
+
+    static IPPrefix prefixFor(sa_family_t family, const Key& key, int len) {
+        if (family == AF_INET) {
+            const in_addr addr = {htonl(static_cast<uint32_t>(key.hi >> 32))};
+            return IPPrefix(IPAddress(addr), len);
+        }
+        in6_addr addr;
+        for (int i = 0; i < 8; i++) {
+            addr.s6_addr[i] = key.hi >> (56 - 8 * i);
+            addr.s6_addr[8 + i] = key.lo >> (56 - 8 * i);
+        }
+        return IPPrefix(IPAddress(addr), len);
+    }
+
+    int* rootFor(sa_family_t family) {
+        switch (family) {
+            case AF_INET:
+                return &mRoots[0];
+            case AF_INET6:
+                return &mRoots[1];
+        }
+        return nullptr;
+    }
+    const int* rootFor(sa_family_t family) const {
+        return const_cast<IPPrefixTrie*>(this)->rootFor(family);
+    }
+
+    int newNode(const Key& key, int len, std::optional<Value> value) {
+        Node node;
+        node.key = key;
+        node.len = len;
+        node.value = std::move(value);
+        if (!mFree.empty()) {
+            const int index = mFree.back();
+            mFree.pop_back();
+            mNodes[index] = std::move(node);
+            return index;
+        }
+        mNodes.push_back(std::move(node));
+        return mNodes.size() - 1;
+    }
+
+    void freeNode(int index) {
+        mNodes[index] = Node();
+        mFree.push_back(index);
+    }
+
+    // Removes the valueless node at *link if it has fewer than two children, replacing it with
+    // its child, if any. Returns whether the node was removed.
+    bool collapse(int* link) {
+        const int index = *link;
+        const Node& node = mNodes[index];
+        if (node.child[0] != kNone && node.child[1] != kNone) return false;
+        *link = node.child[0] != kNone ? node.child[0] : node.child[1];
+        freeNode(index);
+        return true;
+    }
+
+    template <typename Fn>
+    void forEachIn(sa_family_t family, int index, Fn& fn) const {
+        if (index == kNone) return;
+        const Node& node = mNodes[index];
+        if (node.value) fn(prefixFor(family, node.key, node.len), *node.value);
+        forEachIn(family, node.child[0], fn);
+        forEachIn(family, node.child[1], fn);
+    }
+
+    std::vector<Node> mNodes;
+    // Indices of unused entries in mNodes.
+    std::vector<int> mFree;
+    std::array<int, 2> mRoots = {kNone, kNone};
+    size_t mSize = 0;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif  // NETDUTILS_IPPREFIXTRIE_H
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDUTILS_IOURINGSYSCALLS_H
+#define NETDUTILS_IOURINGSYSCALLS_H
+
+#include <memory>
+#include <span>
+
+#include "netdutils/Syscalls.h"
+
+namespace android {
+namespace netdutils {
+
+// Implementation of Syscalls that performs socket and file I/O through io_uring.
+//
+// Each calling thread gets its own ring, created on first use. Batched operations (sendmmsg,
+// recvmmsg) are submitted as a single chain of linked requests, so that a burst of datagrams costs
+// one kernel transition regardless of the number of messages. Reads and writes into buffers
+// registered with registerBuffers() use the fixed-buffer opcodes, which skip pinning the user
+// pages on every request.
+//
+// Operations that io_uring does not support, and all operations on threads where a ring cannot be
+// created (kernels older than 5.6, or io_uring blocked by seccomp or SELinux), are forwarded to
+// the fallback implementation. Callers therefore never need to check for io_uring support.
+//
+// Not part of libnetdutils: link libnetdutils_io_uring to use it.
+class IoUringSyscalls final : public Syscalls {
+  public:
+    // |fallback| must outlive this object. It should be the real implementation, i.e., the value
+    // of sSyscalls.get() before this object is swapped in.
+    explicit IoUringSyscalls(Syscalls& fallback);
+    ~IoUringSyscalls() override = default;
+
+    // Returns true if the calling thread has a working ring.
+    bool ringAvailable() const;
+
+    // Registers |buffers| with the ring of the calling thread, replacing any previous
+    // registration. The buffers must remain valid until they are unregistered or the thread exits.
+    Status registerBuffers(std::span<const iovec> buffers) const;
+    Status unregisterBuffers() const;
+
+    // Keep the helper overloads declared in Syscalls visible.
+    using Syscalls::recvfrom;
+    using Syscalls::sendmsg;
+    using Syscalls::sendto;
+    using Syscalls::writev;
+
+    StatusOr<size_t> writev(Fd fd, std::span<const iovec> iov) const override;
+    StatusOr<size_t> write(Fd fd, const Slice buf) const override;
+    StatusOr<Slice> read(Fd fd, const Slice buf) const override;
+    StatusOr<size_t> sendto(Fd sock, const Slice buf, int flags, const sockaddr* dst,
+                            socklen_t dstlen) const override;
+    StatusOr<Slice> recvfrom(Fd sock, const Slice dst, int flags, sockaddr* src,
+                             socklen_t* srclen) const override;
+    StatusOr<size_t> sendmsg(Fd sock, std::span<const iovec> iov, int flags, const sockaddr* dst,
+                             socklen_t dstlen) const override;
+    StatusOr<size_t> sendmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const override;
+    StatusOr<size_t> recvmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const override;
+
+    // Everything else is forwarded to the fallback implementation.
+    StatusOr<UniqueFd> open(const std::string& pathname, int flags, mode_t mode) const override {
+        return mFallback.open(pathname, flags, mode);
+    }
+    StatusOr<UniqueFd> socket(int domain, int type, int protocol) const override {
+        return mFallback.socket(domain, type, protocol);
+    }
+    Status getsockname(Fd sock, sockaddr* addr, socklen_t* addrlen) const override {
+        return mFallback.getsockname(sock, addr, addrlen);
+    }
+    Status getsockopt(Fd sock, int level, int optname, void* optval,
+                      socklen_t* optlen) const override {
+        return mFallback.getsockopt(sock, level, optname, optval, optlen);
+    }
+    Status setsockopt(Fd sock, int level, int optname, const void* optval,
+                      socklen_t optlen) const override {
+        return mFallback.setsockopt(sock, level, optname, optval, optlen);
+    }
+    Status bind(Fd sock, const sockaddr* addr, socklen_t addrlen) const override {
+        return mFallback.bind(sock, addr, addrlen);
+    }
+    Status connect(Fd sock, const sockaddr* addr, socklen_t addrlen) const override {
+        return mFallback.connect(sock, addr, addrlen);
+    }
+    StatusOr<ifreq> ioctl(Fd sock, unsigned long request, ifreq* ifr) const override {
+        return mFallback.ioctl(sock, request, ifr);
+    }
+    StatusOr<UniqueFd> eventfd(unsigned int initval, int flags) const override {
+        return mFallback.eventfd(initval, flags);
+    }
+    StatusOr<int> ppoll(pollfd* fds, nfds_t nfds, double timeout) const override {
+        return mFallback.ppoll(fds, nfds, timeout);
+    }
+    Status shutdown(Fd fd, int how) const override { return mFallback.shutdown(fd, how); }
+    Status close(Fd fd) const override { return mFallback.close(fd); }
+    StatusOr<UniqueFile> fopen(const std::string& path, const std::string& mode) const override {
+        return mFallback.fopen(path, mode);
+    }
+    StatusOr<int> vfprintf(FILE* file, const char* format, va_list ap) const override {
+        return mFallback.vfprintf(file, format, ap);
+    }
+    StatusOr<int> vfscanf(FILE* file, const char* format, va_list ap) const override {
+        return mFallback.vfscanf(file, format, ap);
+    }
+    Status fclose(FILE* file) const override { return mFallback.fclose(file); }
+    StatusOr<pid_t> fork() const override { return mFallback.fork(); }
+
+    // Number of submission queue entries of each ring. Longer batches are split.
+    static constexpr unsigned kRingEntries = 64;
+
+  private:
+    Syscalls& mFallback;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif /* NETDUTILS_IOURINGSYSCALLS_H */
@@ -50,13 +50,19 @@ class MockSyscalls : public Syscalls {
     MOCK_CONST_METHOD2(eventfd, StatusOr<UniqueFd>(unsigned int initval, int flags));
     MOCK_CONST_METHOD3(ppoll, StatusOr<int>(pollfd* fds, nfds_t nfds, double timeout));
 
-    MOCK_CONST_METHOD2(writev, StatusOr<size_t>(Fd fd, const std::vector<iovec>& iov));
+    using Syscalls::writev;
+    MOCK_CONST_METHOD2(writev, StatusOr<size_t>(Fd fd, std::span<const iovec> iov));
     MOCK_CONST_METHOD2(write, StatusOr<size_t>(Fd fd, const Slice buf));
     MOCK_CONST_METHOD2(read, StatusOr<Slice>(Fd fd, const Slice buf));
     MOCK_CONST_METHOD5(sendto, StatusOr<size_t>(Fd sock, const Slice buf, int flags,
                                                 const sockaddr* dst, socklen_t dstlen));
     MOCK_CONST_METHOD5(recvfrom, StatusOr<Slice>(Fd sock, const Slice dst, int flags, sockaddr* src,
                                                  socklen_t* srclen));
+    using Syscalls::sendmsg;
+    MOCK_CONST_METHOD5(sendmsg, StatusOr<size_t>(Fd sock, std::span<const iovec> iov, int flags,
+                                                 const sockaddr* dst, socklen_t dstlen));
+    MOCK_CONST_METHOD3(sendmmsg, StatusOr<size_t>(Fd sock, std::span<mmsghdr> msgs, int flags));
+    MOCK_CONST_METHOD3(recvmmsg, StatusOr<size_t>(Fd sock, std::span<mmsghdr> msgs, int flags));
     MOCK_CONST_METHOD2(shutdown, Status(Fd fd, int how));
     MOCK_CONST_METHOD1(close, Status(Fd fd));
 
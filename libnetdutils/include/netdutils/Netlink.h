@@ -17,30 +17,140 @@
 #ifndef NETUTILS_NETLINK_H
 #define NETUTILS_NETLINK_H
 
-#include <functional>
+#include <array>
 #include <ostream>
+#include <type_traits>
 #include <linux/netlink.h>
 
+#include "netdutils/Math.h"
 #include "netdutils/Slice.h"
+#include "netdutils/Status.h"
 
 namespace android {
 namespace netdutils {
 
+namespace internal_ {
+
+inline size_t netlinkLength(const nlmsghdr& hdr) {
+    return hdr.nlmsg_len;
+}
+
+inline size_t netlinkLength(const nlattr& hdr) {
+    return hdr.nla_len;
+}
+
+// Shared implementation of forEachNetlinkMessage and forEachNetlinkAttribute. Headers that
+// claim to be shorter than themselves are treated as empty, so that iteration always advances.
+template <typename Header, typename Fn>
+inline void forEachNetlinkHeader(const Slice buf, Fn& fn) {
+    Slice tail = buf;
+    while (tail.size() >= sizeof(Header)) {
+        Header hdr = {};
+        extract(tail, hdr);
+        const auto len = std::max<size_t>(netlinkLength(hdr), sizeof(hdr));
+        const Slice payload = drop(take(tail, len), sizeof(hdr));
+        if constexpr (std::is_same_v<std::invoke_result_t<Fn&, const Header&, const Slice>,
+                                     bool>) {
+            if (!fn(hdr, payload)) return;
+        } else {
+            fn(hdr, payload);
+        }
+        tail = drop(tail, align(len, 2));
+    }
+}
+
+}  // namespace internal_
+
 // Invoke onMsg once for each netlink message in buf. onMsg will be
 // invoked with an aligned and deserialized header along with a Slice
-// containing the message payload.
+// containing the message payload. If onMsg returns bool, iteration
+// stops as soon as it returns false.
 //
 // Assume that the first message begins at offset zero within buf.
-void forEachNetlinkMessage(const Slice buf,
-                           const std::function<void(const nlmsghdr&, const Slice)>& onMsg);
+template <typename Fn>
+inline void forEachNetlinkMessage(const Slice buf, Fn&& onMsg) {
+    internal_::forEachNetlinkHeader<nlmsghdr>(buf, onMsg);
+}
 
 // Invoke onAttr once for each netlink attribute in buf. onAttr will be
 // invoked with an aligned and deserialized header along with a Slice
-// containing the attribute payload.
+// containing the attribute payload. If onAttr returns bool, iteration
+// stops as soon as it returns false.
 //
 // Assume that the first attribute begins at offset zero within buf.
-void forEachNetlinkAttribute(const Slice buf,
-                             const std::function<void(const nlattr&, const Slice)>& onAttr);
+template <typename Fn>
+inline void forEachNetlinkAttribute(const Slice buf, Fn&& onAttr) {
+    internal_::forEachNetlinkHeader<nlattr>(buf, onAttr);
+}
+
+// Payloads of the netlink attributes in a buffer, indexed by attribute type, in the style of the
+// kernel's nla_parse(). One call to parse() replaces repeated linear scans of the attributes.
+//
+// Example:
+//   NetlinkAttributeTable<NFULA_MAX> attrs;
+//   attrs.parse(payload);
+//   uint32_t uid;
+//   if (attrs.get(NFULA_UID, uid)) { ... }
+template <uint16_t kMaxType>
+class NetlinkAttributeTable {
+  public:
+    // Minimum payload length of each attribute type.
+    using Policy = std::array<uint16_t, kMaxType + 1>;
+
+    // Clears the table and stores every attribute in buf whose type is at most kMaxType. The
+    // NLA_F_NESTED and NLA_F_NET_BYTEORDER flags are ignored. If a type appears more than once,
+    // the last occurrence wins.
+    //
+    // Malformed attributes are skipped: attributes whose length is shorter than their header or
+    // runs past the end of buf, and, if policy is not null, attributes shorter than the policy
+    // minimum. The first problem found is returned (EINVAL for malformed headers, ERANGE for
+    // short payloads), but well-formed attributes are stored either way, so the caller can choose
+    // between rejecting the message and using what was parsed.
+    Status parse(const Slice buf, const Policy* policy = nullptr) {
+        mPayloads.fill(Slice());
+        // Only build a Status at the end: this runs once per message on hot paths.
+        int error = 0;
+        forEachNetlinkAttribute(buf, [&](const nlattr& hdr, const Slice payload) {
+            if (hdr.nla_len < sizeof(hdr) || hdr.nla_len > sizeof(hdr) + payload.size()) {
+                if (error == 0) error = EINVAL;
+                return;
+            }
+            const uint16_t type = hdr.nla_type & NLA_TYPE_MASK;
+            if (type > kMaxType) return;
+            if (policy != nullptr && payload.size() < (*policy)[type]) {
+                if (error == 0) error = ERANGE;
+                return;
+            }
+            mPayloads[type] = payload;
+        });
+        if (error != 0) {
+            return statusFromErrno(error, "Malformed netlink attributes");
+        }
+        return status::ok;
+    }
+
+    // Returns true if the last parse() found an attribute of this type.
+    bool has(uint16_t type) const {
+        // A present attribute always has a non-null base, even if its payload is empty.
+        return type <= kMaxType && mPayloads[type].base() != nullptr;
+    }
+
+    // Returns the payload of the attribute, or an empty Slice if it is absent.
+    Slice get(uint16_t type) const { return has(type) ? mPayloads[type] : Slice(); }
+
+    // Copies the payload of the attribute into value, which is left unchanged if the attribute is
+    // absent. Short payloads are copied partially, as with extract(). Returns true if the
+    // attribute is present.
+    template <typename T>
+    bool get(uint16_t type, T& value) const {
+        if (!has(type)) return false;
+        extract(mPayloads[type], value);
+        return true;
+    }
+
+  private:
+    std::array<Slice, kMaxType + 1> mPayloads;
+};
 
 }  // namespace netdutils
 }  // namespace android
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETUTILS_NETLINKBUILDER_H
+#define NETUTILS_NETLINKBUILDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <linux/netlink.h>
+
+#include "netdutils/Slice.h"
+#include "netdutils/Status.h"
+
+// Typed builders for netlink request messages.
+//
+// A message layout is a type: the family header (e.g., rtmsg or fib_rule_hdr) followed by a fixed
+// list of attribute types. The maximum size of a layout, and so the size of a buffer that can hold
+// it, is known at compile time. Each instance carries the values to send, and attributes can be
+// left out per message. NetlinkMessageWriter serializes any number of messages back to back into
+// a caller-supplied buffer, so that several requests can be sent with a single write.
+//
+// Example:
+//   using FraPriority = NetlinkAttr<FRA_PRIORITY, uint32_t>;
+//   using FraIifName = NetlinkBytesAttr<FRA_IIFNAME, IFNAMSIZ>;
+//   using RuleMessage = NetlinkMessage<fib_rule_hdr, FraPriority, FraIifName>;
+//
+//   RuleMessage rule;
+//   rule.family.action = FR_ACT_TO_TBL;
+//   rule.get<FraPriority>().set(priority);
+//   rule.get<FraIifName>().set(name, strlen(name) + 1, name != nullptr);
+//
+//   std::array<uint8_t, 2 * RuleMessage::kMaxSize> buf;
+//   NetlinkMessageWriter writer(makeSlice(buf));
+//   RETURN_IF_NOT_OK(writer.append(RTM_NEWRULE, NLM_F_REQUEST | NLM_F_ACK, rule));
+
+namespace android {
+namespace netdutils {
+
+namespace internal_ {
+
+// Writes an attribute header and payload at dst and zeroes the padding after it. Returns the
+// address following the padding.
+inline uint8_t* writeNetlinkAttr(uint8_t* dst, uint16_t type, const void* payload, size_t len) {
+    const nlattr hdr = {
+            .nla_len = static_cast<uint16_t>(NLA_HDRLEN + len),
+            .nla_type = type,
+    };
+    memcpy(dst, &hdr, sizeof(hdr));
+    if (len > 0) memcpy(dst + NLA_HDRLEN, payload, len);
+    const size_t padded = NLA_ALIGN(NLA_HDRLEN + len);
+    memset(dst + NLA_HDRLEN + len, 0, padded - NLA_HDRLEN - len);
+    return dst + padded;
+}
+
+template <typename... Attrs>
+inline size_t netlinkAttrsSize(const std::tuple<Attrs...>& attrs) {
+    return std::apply([](const Attrs&... attr) { return (size_t{0} + ... + attr.size()); }, attrs);
+}
+
+template <typename... Attrs>
+inline bool netlinkAttrsValid(const std::tuple<Attrs...>& attrs) {
+    return std::apply([](const Attrs&... attr) { return (true && ... && attr.valid()); }, attrs);
+}
+
+template <typename... Attrs>
+inline uint8_t* writeNetlinkAttrs(uint8_t* dst, const std::tuple<Attrs...>& attrs) {
+    std::apply([&dst](const Attrs&... attr) { ((dst = attr.write(dst)), ...); }, attrs);
+    return dst;
+}
+
+}  // namespace internal_
+
+// An attribute whose payload is a T, e.g., a uint32_t or a fib_rule_uid_range.
+template <uint16_t kType, typename T>
+struct NetlinkAttr {
+    static_assert(std::is_trivially_copyable_v<T>, "netlink payloads must be trivially copyable");
+    static constexpr size_t kMaxSize = NLA_ALIGN(NLA_HDRLEN + sizeof(T));
+
+    T value{};
+    bool present = true;
+
+    void set(const T& v, bool isPresent = true) {
+        value = v;
+        present = isPresent;
+    }
+
+    size_t size() const { return present ? kMaxSize : 0; }
+    bool valid() const { return true; }
+    uint8_t* write(uint8_t* dst) const {
+        return present ? internal_::writeNetlinkAttr(dst, kType, &value, sizeof(value)) : dst;
+    }
+};
+
+// An attribute whose payload is at most kMaxLen bytes, e.g., an IP address or an interface name.
+// The payload is not copied until the message is serialized and must outlive the message.
+template <uint16_t kType, size_t kMaxLen>
+struct NetlinkBytesAttr {
+    static constexpr size_t kMaxSize = NLA_ALIGN(NLA_HDRLEN + kMaxLen);
+
+    const void* data = nullptr;
+    size_t len = 0;
+    bool present = true;
+
+    void set(const void* d, size_t l, bool isPresent = true) {
+        data = d;
+        len = l;
+        present = isPresent;
+    }
+
+    size_t size() const { return present ? NLA_ALIGN(NLA_HDRLEN + len) : 0; }
+    bool valid() const { return !present || len <= kMaxLen; }
+    uint8_t* write(uint8_t* dst) const {
+        return present ? internal_::writeNetlinkAttr(dst, kType, data, len) : dst;
+    }
+};
+
+// An attribute that contains other attributes, e.g., RTA_METRICS.
+template <uint16_t kType, typename... Attrs>
+struct NetlinkNestedAttr {
+    static constexpr size_t kMaxSize = NLA_HDRLEN + (size_t{0} + ... + Attrs::kMaxSize);
+
+    std::tuple<Attrs...> attrs;
+    bool present = true;
+
+    template <typename Attr>
+    Attr& get() {
+        return std::get<Attr>(attrs);
+    }
+    template <typename Attr>
+    const Attr& get() const {
+        return std::get<Attr>(attrs);
+    }
+
+    size_t size() const { return present ? NLA_HDRLEN + internal_::netlinkAttrsSize(attrs) : 0; }
+    bool valid() const { return !present || internal_::netlinkAttrsValid(attrs); }
+    uint8_t* write(uint8_t* dst) const {
+        if (!present) return dst;
+        const nlattr hdr = {
+                .nla_len = static_cast<uint16_t>(size()),
+                .nla_type = kType,
+        };
+        memcpy(dst, &hdr, sizeof(hdr));
+        return internal_::writeNetlinkAttrs(dst + NLA_HDRLEN, attrs);
+    }
+};
+
+// A message with family header Family followed by the attributes Attrs, in that order. Each
+// attribute type may appear only once in a layout.
+template <typename Family, typename... Attrs>
+struct NetlinkMessage {
+    static_assert(std::is_trivially_copyable_v<Family>,
+                  "family headers must be trivially copyable");
+    static constexpr size_t kMaxSize =
+            NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(Family)) + (size_t{0} + ... + Attrs::kMaxSize);
+
+    Family family{};
+    std::tuple<Attrs...> attrs;
+
+    template <typename Attr>
+    Attr& get() {
+        return std::get<Attr>(attrs);
+    }
+    template <typename Attr>
+    const Attr& get() const {
+        return std::get<Attr>(attrs);
+    }
+
+    // Size of the serialized message, including the nlmsghdr.
+    size_t size() const {
+        return NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(Family)) + internal_::netlinkAttrsSize(attrs);
+    }
+    bool valid() const { return internal_::netlinkAttrsValid(attrs); }
+
+    // Writes the family header and attributes, but not the nlmsghdr, at dst.
+    uint8_t* writePayload(uint8_t* dst) const {
+        memcpy(dst, &family, sizeof(family));
+        memset(dst + sizeof(family), 0, NLMSG_ALIGN(sizeof(family)) - sizeof(family));
+        return internal_::writeNetlinkAttrs(dst + NLMSG_ALIGN(sizeof(family)), attrs);
+    }
+};
+
+// Serializes netlink messages back to back into a caller-supplied buffer.
+class NetlinkMessageWriter {
+  public:
+    explicit NetlinkMessageWriter(const Slice buf) : mBuf(buf) {}
+
+    // Appends msg with a header built from the other arguments. Returns ENOBUFS if the message does
+    // not fit in the remaining space, or EMSGSIZE if a variable-length attribute is longer than its
+    // layout allows. Nothing is written on error.
+    template <typename Message>
+    Status append(uint16_t type, uint16_t flags, const Message& msg, uint32_t seq = 0) {
+        if (!msg.valid()) {
+            return statusFromErrno(EMSGSIZE, "Netlink attribute longer than its layout allows");
+        }
+        const size_t len = msg.size();
+        if (len > mBuf.size() - mUsed) {
+            return statusFromErrno(ENOBUFS, "Netlink message does not fit in buffer");
+        }
+        const nlmsghdr hdr = {
+                .nlmsg_len = static_cast<uint32_t>(len),
+                .nlmsg_type = type,
+                .nlmsg_flags = flags,
+                .nlmsg_seq = seq,
+        };
+        uint8_t* const dst = mBuf.base() + mUsed;
+        memcpy(dst, &hdr, sizeof(hdr));
+        msg.writePayload(dst + NLMSG_HDRLEN);
+        mUsed += len;
+        mCount++;
+        return status::ok;
+    }
+
+    // The messages appended so far.
+    Slice messages() const { return take(mBuf, mUsed); }
+    size_t count() const { return mCount; }
+
+    // Discards all messages, so that the buffer can be reused.
+    void clear() {
+        mUsed = 0;
+        mCount = 0;
+    }
+
+  private:
+    const Slice mBuf;
+    size_t mUsed = 0;
+    size_t mCount = 0;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif /* NETUTILS_NETLINKBUILDER_H */
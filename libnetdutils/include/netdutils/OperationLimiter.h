@@ -17,6 +17,10 @@
 #ifndef NETUTILS_OPERATIONLIMITER_H
 #define NETUTILS_OPERATIONLIMITER_H
 
+#include <array>
+#include <atomic>
+#include <climits>
+#include <functional>
 #include <mutex>
 #include <unordered_map>
 
@@ -98,6 +102,111 @@ private:
     const int mLimitPerKey;
 };
 
+// Same contract as OperationLimiter, for keys that are started and finished concurrently from many
+// threads. Keys are hashed into kNumShards independent shards, each with its own lock and counter
+// map on its own cache line, so callers only contend when their keys share a shard. A key always
+// maps to the same shard, so the per-key limit is exact.
+//
+// In addition to the per-key limit, an optional global limit caps the number of operations in
+// progress across all keys. It is enforced exactly with an atomic counter, which is updated before
+// the shard is locked and rolled back if the per-key limit is hit. Such a rejected start() may
+// briefly hold the last global slot and cause a concurrent start() for another key to fail. Without
+// a global limit, the counter is not used, so calls for keys in different shards share no state.
+//
+// This class is thread-safe.
+template <typename KeyType, size_t kNumShards = 16, typename Hash = std::hash<KeyType>>
+class ShardedOperationLimiter {
+  public:
+    explicit ShardedOperationLimiter(int limitPerKey, int globalLimit = INT_MAX)
+        : mLimitPerKey(limitPerKey), mGlobalLimit(globalLimit) {}
+
+    ~ShardedOperationLimiter() {
+        DCHECK(total() == 0) << "Destroying ShardedOperationLimiter with active operations";
+    }
+
+    // Returns false if |key| has reached the maximum number of concurrent operations or the
+    // global limit has been reached, otherwise increments the counters and returns true.
+    //
+    // Note: each successful start(key) must be matched by exactly one call to finish(key).
+    bool start(const KeyType& key) {
+        if (hasGlobalLimit()) {
+            int total = mTotal.load(std::memory_order_relaxed);
+            do {
+                if (total >= mGlobalLimit) return false;
+            } while (!mTotal.compare_exchange_weak(total, total + 1, std::memory_order_relaxed));
+        }
+
+        Shard& shard = shardFor(key);
+        {
+            std::lock_guard lock(shard.mutex);
+            auto& cnt = shard.counters[key];  // operator[] creates new entries as needed.
+            if (cnt < mLimitPerKey) {
+                ++cnt;
+                ++shard.total;
+                return true;
+            }
+        }
+        if (hasGlobalLimit()) mTotal.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Decrements the number of operations in progress accounted to |key|.
+    // See usage notes on start().
+    void finish(const KeyType& key) {
+        Shard& shard = shardFor(key);
+        {
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.counters.find(key);
+            if (it == shard.counters.end()) {
+                LOG(FATAL_WITHOUT_ABORT) << "Decremented non-existent counter for key=" << key;
+                return;
+            }
+            if (--it->second <= 0) {
+                // Cleanup counters once they drop down to zero.
+                shard.counters.erase(it);
+            }
+            --shard.total;
+        }
+        if (hasGlobalLimit()) mTotal.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Number of operations in progress across all keys. Locks every shard in turn, so this is only
+    // a snapshot if operations start or finish concurrently.
+    int total() {
+        int sum = 0;
+        for (Shard& shard : mShards) {
+            std::lock_guard lock(shard.mutex);
+            sum += shard.total;
+        }
+        return sum;
+    }
+
+  private:
+    // Padded to a cache line so that locking one shard does not invalidate its neighbours.
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<KeyType, int> counters GUARDED_BY(mutex);
+        // Sum of the counters.
+        int total GUARDED_BY(mutex) = 0;
+    };
+
+    bool hasGlobalLimit() const { return mGlobalLimit != INT_MAX; }
+
+    Shard& shardFor(const KeyType& key) { return mShards[Hash()(key) % kNumShards]; }
+
+    std::array<Shard, kNumShards> mShards;
+
+    // Operations in progress across all shards, if there is a global limit. Has its own cache line,
+    // since every start() and finish() writes it.
+    alignas(64) std::atomic<int> mTotal{0};
+
+    // Maximum number of outstanding operations from a single key.
+    const int mLimitPerKey;
+
+    // Maximum number of outstanding operations across all keys.
+    const int mGlobalLimit;
+};
+
 }  // namespace netdutils
 }  // namespace android
 
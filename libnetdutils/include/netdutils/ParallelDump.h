@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETDUTILS_PARALLELDUMP_H
+#define NETDUTILS_PARALLELDUMP_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "netdutils/DumpWriter.h"
+#include "netdutils/Executor.h"
+
+namespace android {
+namespace netdutils {
+
+// Renders the sections of a dump concurrently on an Executor, each into its own buffer, and writes
+// them out in the order they were added.
+//
+// Every section has a time budget, counted from the start of run(). A section that has not
+// finished by then is written up to the point it reached, followed by a truncation marker, and
+// whatever it writes afterwards is discarded. A section still queued by then is not run at all. A
+// running section keeps its worker until it finishes, so a section stuck on a lock delays the dump
+// by at most its budget and does not hold up the others, and the number of stuck sections is
+// bounded by the number of workers. Since a truncated section may still be running after run()
+// returns, its function must only use state that outlives the dump.
+//
+// Example:
+//     ParallelDump dump(gCtls->dumpExecutor);
+//     dump.add("NetworkController", 1s, [](DumpWriter& dw) { gCtls->netCtrl.dump(dw); });
+//     dump.add("TrafficController", 3s, [](DumpWriter& dw) { gCtls->trafficCtrl.dump(dw); });
+//     dump.run(dw);
+//
+// This class is not thread-safe.
+class ParallelDump {
+  public:
+    using Section = std::function<void(DumpWriter& dw)>;
+
+    struct Timing {
+        std::string name;
+        // Time until the section finished, or until its budget expired if it was truncated.
+        std::chrono::milliseconds elapsed;
+        bool truncated;
+    };
+
+    // The sections run on the NORMAL lane of |executor|, which must outlive any section that is
+    // still running.
+    explicit ParallelDump(Executor& executor) : mExecutor(executor) {}
+
+    void add(std::string name, std::chrono::milliseconds budget, Section section);
+
+    // Renders all sections and writes them to dw. Can only be called once.
+    void run(DumpWriter& dw);
+
+    // How long each section took in the last run(), in the order the sections were added.
+    const std::vector<Timing>& timings() const { return mTimings; }
+
+    // Writes timings() to dw.
+    void dumpTimings(DumpWriter& dw) const;
+
+  private:
+    struct PendingSection {
+        std::string name;
+        std::chrono::milliseconds budget;
+        Section section;
+    };
+
+    Executor& mExecutor;
+    std::vector<PendingSection> mSections;
+    std::vector<Timing> mTimings;
+};
+
+}  // namespace netdutils
+}  // namespace android
+
+#endif  // NETDUTILS_PARALLELDUMP_H
@@ -18,6 +18,8 @@
 #define NETDUTILS_SYSCALLS_H
 
 #include <memory>
+#include <span>
+#include <vector>
 
 #include <net/if.h>
 #include <poll.h>
@@ -65,7 +67,7 @@ class Syscalls {
 
     virtual StatusOr<int> ppoll(pollfd* fds, nfds_t nfds, double timeout) const = 0;
 
-    virtual StatusOr<size_t> writev(Fd fd, const std::vector<iovec>& iov) const = 0;
+    virtual StatusOr<size_t> writev(Fd fd, std::span<const iovec> iov) const = 0;
 
     virtual StatusOr<size_t> write(Fd fd, const Slice buf) const = 0;
 
@@ -77,6 +79,18 @@ class Syscalls {
     virtual StatusOr<Slice> recvfrom(Fd sock, const Slice dst, int flags, sockaddr* src,
                                      socklen_t* srclen) const = 0;
 
+    virtual StatusOr<size_t> sendmsg(Fd sock, std::span<const iovec> iov, int flags,
+                                     const sockaddr* dst, socklen_t dstlen) const = 0;
+
+    // Sends up to msgs.size() datagrams in a single system call. Returns the number of datagrams
+    // sent, and updates msg_len of each of them with the number of bytes sent.
+    virtual StatusOr<size_t> sendmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const = 0;
+
+    // Receives up to msgs.size() datagrams in a single system call. Returns the number of
+    // datagrams received, and updates msg_len of each of them with the number of bytes received.
+    // Pass MSG_DONTWAIT to return as soon as no more datagrams are queued.
+    virtual StatusOr<size_t> recvmmsg(Fd sock, std::span<mmsghdr> msgs, int flags) const = 0;
+
     virtual Status shutdown(Fd fd, int how) const = 0;
 
     virtual Status close(Fd fd) const = 0;
@@ -163,6 +177,20 @@ class Syscalls {
         return sendto(sock, buf, flags, asSockaddrPtr(&dst), sizeof(dst));
     }
 
+    StatusOr<size_t> writev(Fd fd, const std::vector<iovec>& iov) const {
+        return writev(fd, std::span<const iovec>(iov));
+    }
+
+    StatusOr<size_t> sendmsg(Fd sock, std::span<const iovec> iov, int flags) const {
+        return sendmsg(sock, iov, flags, nullptr, 0);
+    }
+
+    template <typename SockaddrT>
+    StatusOr<size_t> sendmsg(Fd sock, std::span<const iovec> iov, int flags,
+                             const SockaddrT& dst) const {
+        return sendmsg(sock, iov, flags, asSockaddrPtr(&dst), sizeof(dst));
+    }
+
     // Ignore src sockaddr
     StatusOr<Slice> recvfrom(Fd sock, const Slice dst, int flags) const {
         return recvfrom(sock, dst, flags, nullptr, nullptr);
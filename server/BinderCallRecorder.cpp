@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BinderCallRecorder.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <json/writer.h>
+
+namespace android {
+namespace net {
+
+const String16 BinderCallRecorder::DUMP_KEYWORD = String16("binder_trace");
+
+void BinderCallRecorder::start(size_t maxCalls) {
+    std::lock_guard guard(mLock);
+    mStartTime = Clock::now();
+    mMaxCalls = maxCalls;
+    mCalls.clear();
+    mDropped = 0;
+    mRecording = true;
+}
+
+void BinderCallRecorder::stop() {
+    std::lock_guard guard(mLock);
+    mRecording = false;
+}
+
+void BinderCallRecorder::record(const Json::Value& logTransaction, Clock::time_point end) {
+    if (!mRecording) return;
+
+    const double durationMs = logTransaction["duration_ms"].asDouble();
+    const Json::Value& binderStatus = logTransaction["binder_status"];
+    Json::Value call(Json::objectValue);
+    call["method"] = logTransaction["method_name"].asString();
+    call["duration_ms"] = durationMs;
+    call["exception_code"] = binderStatus["exception_code"].asInt();
+    call["service_specific_error"] = binderStatus["service_specific_error_code"].asInt();
+    Json::Value& args = call["args"] = Json::Value(Json::arrayValue);
+    for (const Json::Value& arg : logTransaction["input_args"]) {
+        args.append(arg["value"]);
+    }
+    const auto start = end - std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double, std::milli>(durationMs));
+
+    Json::FastWriter writer;
+    writer.omitEndingLineFeed();
+
+    std::lock_guard guard(mLock);
+    // Checked again in case stop() or start() ran in the meantime.
+    if (!mRecording) return;
+    const auto sinceStart =
+            std::chrono::duration_cast<std::chrono::microseconds>(start - mStartTime).count();
+    call["start_us"] = Json::UInt64(std::max<int64_t>(sinceStart, 0));
+    mCalls.push_back(writer.write(call));
+    while (mCalls.size() > mMaxCalls) {
+        mCalls.pop_front();
+        mDropped++;
+    }
+}
+
+void BinderCallRecorder::dump(netdutils::DumpWriter& dw) const {
+    std::lock_guard guard(mLock);
+    dw.println("# %s, %zu calls, %" PRIu64 " dropped", mRecording ? "recording" : "stopped",
+               mCalls.size(), mDropped);
+    for (const std::string& call : mCalls) {
+        dw.println(call);
+    }
+}
+
+}  // namespace net
+}  // namespace android
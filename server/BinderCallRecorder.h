@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_BINDER_CALL_RECORDER_H
+#define NETD_SERVER_BINDER_CALL_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include <android-base/thread_annotations.h>
+#include <json/value.h>
+#include <utils/String16.h>
+
+#include "netdutils/DumpWriter.h"
+
+namespace android {
+namespace net {
+
+// Records INetd calls as a trace that tests/replay/netd_replay can run against a netd instance.
+// It is fed the same transactions as gLog, from BnNetd::logFunc.
+//
+// The trace has one JSON object per line, oldest call first, e.g.:
+//   {"args":[100,0],"duration_ms":1.5,"exception_code":0,"method":"networkCreatePhysical",
+//    "service_specific_error":0,"start_us":1234}
+// start_us is when the call started, in microseconds since the recording started. args are the
+// input arguments in declaration order, as logged by the AIDL backend. Lines starting with '#' are
+// comments.
+//
+// Recording is off unless started. A recording holds at most maxCalls calls; after that the oldest
+// calls are dropped.
+class BinderCallRecorder {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t DEFAULT_MAX_CALLS = 20000;
+    // dumpsys netd binder_trace [start [<max calls>] | stop]
+    static const String16 DUMP_KEYWORD;
+
+    // Starts a new recording, discarding the previous one.
+    void start(size_t maxCalls = DEFAULT_MAX_CALLS) EXCLUDES(mLock);
+    // Stops recording. The calls recorded so far are kept until the next start().
+    void stop() EXCLUDES(mLock);
+    bool isRecording() const { return mRecording; }
+
+    // Records a transaction as passed to BnNetd::logFunc, which is called once the call has
+    // returned at time end. Does nothing unless recording.
+    void record(const Json::Value& logTransaction, Clock::time_point end = Clock::now())
+            EXCLUDES(mLock);
+
+    // Writes the trace without indentation, so that the output can be replayed as is.
+    void dump(netdutils::DumpWriter& dw) const EXCLUDES(mLock);
+
+  private:
+    mutable std::mutex mLock;
+    // Also read without the lock, so that record() is cheap when not recording.
+    std::atomic<bool> mRecording = false;
+    Clock::time_point mStartTime GUARDED_BY(mLock);
+    size_t mMaxCalls GUARDED_BY(mLock) = 0;
+    std::deque<std::string> mCalls GUARDED_BY(mLock);
+    uint64_t mDropped GUARDED_BY(mLock) = 0;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_BINDER_CALL_RECORDER_H
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <json/reader.h>
+
+#include "BinderCallRecorder.h"
+
+namespace android {
+namespace net {
+
+using netdutils::DumpWriter;
+using namespace std::chrono_literals;
+
+class BinderCallRecorderTest : public ::testing::Test {
+  protected:
+    // A transaction in the form that the AIDL backend passes to BnNetd::logFunc.
+    static Json::Value makeTransaction(const std::string& method, const Json::Value& args,
+                                       double durationMs, int serviceSpecificError = 0) {
+        Json::Value transaction(Json::objectValue);
+        transaction["method_name"] = method;
+        transaction["duration_ms"] = durationMs;
+        transaction["input_args"] = Json::Value(Json::arrayValue);
+        for (const Json::Value& arg : args) {
+            Json::Value namedArg(Json::objectValue);
+            namedArg["name"] = "arg";
+            namedArg["value"] = arg;
+            transaction["input_args"].append(namedArg);
+        }
+        // -8 is EX_SERVICE_SPECIFIC.
+        transaction["binder_status"]["exception_code"] = serviceSpecificError ? -8 : 0;
+        transaction["binder_status"]["service_specific_error_code"] = serviceSpecificError;
+        return transaction;
+    }
+
+    std::vector<std::string> dumpLines() {
+        std::vector<std::string> lines;
+        DumpWriter dw([&lines](const std::string& line) {
+            lines.push_back(line.substr(0, line.size() - 1));  // Strip the newline.
+        });
+        mRecorder.dump(dw);
+        return lines;
+    }
+
+    static Json::Value parse(const std::string& line) {
+        Json::Value value;
+        std::string errors;
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        EXPECT_TRUE(reader->parse(line.data(), line.data() + line.size(), &value, &errors))
+                << errors;
+        return value;
+    }
+
+    BinderCallRecorder mRecorder;
+};
+
+TEST_F(BinderCallRecorderTest, NotRecordingByDefault) {
+    EXPECT_FALSE(mRecorder.isRecording());
+    mRecorder.record(makeTransaction("networkDestroy", Json::Value(Json::arrayValue), 1));
+    EXPECT_EQ(std::vector<std::string>({"# stopped, 0 calls, 0 dropped"}), dumpLines());
+}
+
+TEST_F(BinderCallRecorderTest, RecordsCalls) {
+    const auto before = BinderCallRecorder::Clock::now();
+    mRecorder.start();
+    const auto after = BinderCallRecorder::Clock::now();
+    ASSERT_TRUE(mRecorder.isRecording());
+
+    Json::Value args(Json::arrayValue);
+    args.append(100);
+    args.append("wlan0");
+    mRecorder.record(makeTransaction("networkAddInterface", args, 1.5), before + 100ms);
+    mRecorder.record(makeTransaction("networkAddInterface", args, 0.5, EEXIST), before + 200ms);
+
+    const auto lines = dumpLines();
+    ASSERT_EQ(3U, lines.size());
+    EXPECT_EQ("# recording, 2 calls, 0 dropped", lines[0]);
+
+    const Json::Value first = parse(lines[1]);
+    EXPECT_EQ("networkAddInterface", first["method"].asString());
+    EXPECT_EQ(args, first["args"]);
+    EXPECT_EQ(1.5, first["duration_ms"].asDouble());
+    EXPECT_EQ(0, first["exception_code"].asInt());
+    EXPECT_EQ(0, first["service_specific_error"].asInt());
+    // The call started 1.5ms before it returned at before + 100ms, and recording started between
+    // before and after.
+    const int64_t slackUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(after - before).count();
+    EXPECT_LE(first["start_us"].asInt64(), 98500);
+    EXPECT_GE(first["start_us"].asInt64(), 98500 - slackUs);
+
+    const Json::Value second = parse(lines[2]);
+    EXPECT_EQ(EEXIST, second["service_specific_error"].asInt());
+    EXPECT_EQ(199500 - 98500, second["start_us"].asInt64() - first["start_us"].asInt64());
+}
+
+TEST_F(BinderCallRecorderTest, DropsOldestCalls) {
+    mRecorder.start(2);
+    for (const char* method : {"networkCreatePhysical", "networkAddInterface", "networkDestroy"}) {
+        mRecorder.record(makeTransaction(method, Json::Value(Json::arrayValue), 1));
+    }
+
+    const auto lines = dumpLines();
+    ASSERT_EQ(3U, lines.size());
+    EXPECT_EQ("# recording, 2 calls, 1 dropped", lines[0]);
+    EXPECT_EQ("networkAddInterface", parse(lines[1])["method"].asString());
+    EXPECT_EQ("networkDestroy", parse(lines[2])["method"].asString());
+}
+
+TEST_F(BinderCallRecorderTest, StopKeepsCallsUntilRestart) {
+    mRecorder.start();
+    mRecorder.record(makeTransaction("networkCreatePhysical", Json::Value(Json::arrayValue), 1));
+    mRecorder.stop();
+    EXPECT_FALSE(mRecorder.isRecording());
+    mRecorder.record(makeTransaction("networkDestroy", Json::Value(Json::arrayValue), 1));
+
+    auto lines = dumpLines();
+    ASSERT_EQ(2U, lines.size());
+    EXPECT_EQ("# stopped, 1 calls, 0 dropped", lines[0]);
+    EXPECT_EQ("networkCreatePhysical", parse(lines[1])["method"].asString());
+
+    mRecorder.start();
+    EXPECT_EQ(std::vector<std::string>({"# recording, 0 calls, 0 dropped"}), dumpLines());
+}
+
+}  // namespace net
+}  // namespace android
@@ -37,6 +37,7 @@
 #include "android-base/properties.h"
 #include "android-base/scopeguard.h"
 #include "android-base/stringprintf.h"
+#include "android-base/strings.h"
 #include "android-base/unique_fd.h"
 #include "bpf/BpfMap.h"
 #include "netdbpf/bpf_shared.h"
@@ -70,6 +71,20 @@ using android::netdutils::ScopedIndent;
 namespace android {
 namespace net {
 
+ClatdController::~ClatdController() NO_THREAD_SAFETY_ANALYSIS {
+    // A replenishSpareTun() already posted still references this object, so wait for it. It
+    // creates nothing once mRunning is false.
+    std::unique_lock<std::mutex> ul(mSpareLock);
+    mRunning = false;
+    mSpareCv.wait(ul, [this]() NO_THREAD_SAFETY_ANALYSIS { return !mReplenishScheduled; });
+    // Closing the fd deletes the spare.
+    mSpareTunFd.reset();
+}
+
+bool ClatdController::isSpareTunName(const std::string& ifName) {
+    return base::StartsWith(ifName, kSpareTunPrefix);
+}
+
 void ClatdController::init(void) {
     std::lock_guard guard(mutex);
 
@@ -464,6 +479,115 @@ int ClatdController::ClatdTracker::init(unsigned networkId, const std::string& i
     return 0;
 }
 
+int ClatdController::createTunInterface(const char* name, unique_fd* fd, std::string* ifName) {
+    // clatd requires the tun device in non blocking mode.
+    unique_fd tunFd(open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC));
+    if (tunFd == -1) {
+        int res = errno;
+        ALOGE("open of tun device failed (%s)", strerror(res));
+        return -res;
+    }
+
+    struct ifreq ifr = {
+            .ifr_flags = IFF_TUN,
+    };
+    strlcpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+
+    if (ioctl(tunFd, TUNSETIFF, &ifr, sizeof(ifr)) == -1) {
+        int res = errno;
+        ALOGE("ioctl(TUNSETIFF) failed (%s)", strerror(res));
+        return -res;
+    }
+
+    // disable IPv6 on it - failing to do so is not a critical error
+    int res = InterfaceController::setEnableIPv6(ifr.ifr_name, 0);
+    if (res) ALOGE("setEnableIPv6 %s failed (%s)", ifr.ifr_name, strerror(-res));
+
+    *fd = std::move(tunFd);
+    *ifName = ifr.ifr_name;
+    return 0;
+}
+
+unique_fd ClatdController::takeSpareTun(const std::string& ifName) {
+    if (mExecutor == nullptr) return unique_fd();
+
+    unique_fd tunFd;
+    std::string spareName;
+    {
+        std::lock_guard guard(mSpareLock);
+        tunFd = std::move(mSpareTunFd);
+        spareName = std::move(mSpareTunName);
+        mSpareTunName.clear();
+        if (tunFd != -1) {
+            mSpareHits++;
+        } else {
+            mSpareMisses++;
+        }
+    }
+    scheduleReplenish();
+    if (tunFd == -1) return tunFd;
+
+    // The spare was never brought up, so it can be renamed. Its ifindex and its disable_ipv6
+    // setting are unchanged.
+    struct ifreq ifr = {};
+    strlcpy(ifr.ifr_name, spareName.c_str(), sizeof(ifr.ifr_name));
+    strlcpy(ifr.ifr_newname, ifName.c_str(), sizeof(ifr.ifr_newname));
+    unique_fd s(socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    if (s == -1 || ioctl(s, SIOCSIFNAME, &ifr) == -1) {
+        // Closing the fd deletes the spare.
+        ALOGE("Unable to rename %s to %s (%s)", spareName.c_str(), ifName.c_str(),
+              strerror(errno));
+        return unique_fd();
+    }
+    return tunFd;
+}
+
+void ClatdController::scheduleReplenish() {
+    if (mExecutor == nullptr) return;
+    {
+        std::lock_guard guard(mSpareLock);
+        if (mReplenishScheduled || mSpareTunFd != -1) return;
+        mReplenishScheduled = true;
+    }
+    const auto status = mExecutor->post(netdutils::Executor::Lane::BACKGROUND,
+                                        [this] { replenishSpareTun(); });
+    if (!isOk(status)) {
+        // The next startClatd will try again.
+        ALOGE("Error scheduling spare tun interface: %s", toString(status).c_str());
+        std::lock_guard guard(mSpareLock);
+        mReplenishScheduled = false;
+        mSpareCv.notify_all();
+    }
+}
+
+void ClatdController::replenishSpareTun() {
+    {
+        std::lock_guard guard(mSpareLock);
+        if (!mRunning) {
+            mReplenishScheduled = false;
+            mSpareCv.notify_all();
+            return;
+        }
+    }
+
+    unique_fd tunFd;
+    std::string ifName;
+    const int res = createTunInterface(StringPrintf("%s%%d", kSpareTunPrefix).c_str(), &tunFd,
+                                       &ifName);
+
+    std::lock_guard guard(mSpareLock);
+    mReplenishScheduled = false;
+    mSpareCv.notify_all();
+    if (res) {
+        // Don't retry if tun interfaces cannot be created. The next startClatd will try again.
+        return;
+    }
+    // If this object is being destroyed, closing tunFd deletes the interface again.
+    if (!mRunning) return;
+    mSpareTunFd = std::move(tunFd);
+    mSpareTunName = std::move(ifName);
+}
+
 int ClatdController::startClatd(const std::string& interface, const std::string& nat64Prefix,
                                 std::string* v6Str) {
     std::lock_guard guard(mutex);
@@ -482,35 +606,19 @@ int ClatdController::startClatd(const std::string& interface, const std::string&
         return -ENODEV;
     }
 
-    // 3. open the tun device in non blocking mode as required by clatd
-    int res = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
-    if (res == -1) {
-        res = errno;
-        ALOGE("open of tun device failed (%s)", strerror(res));
-        return -res;
-    }
-    unique_fd tmpTunFd(res);
-
-    // 4. create the v4-... tun interface
+    // 3. rename the spare v4-... tun interface into place, if there is one
     std::string v4interface("v4-");
     v4interface += interface;
+    unique_fd tmpTunFd = takeSpareTun(v4interface);
 
-    struct ifreq ifr = {
-            .ifr_flags = IFF_TUN,
-    };
-    strlcpy(ifr.ifr_name, v4interface.c_str(), sizeof(ifr.ifr_name));
-
-    res = ioctl(tmpTunFd, TUNSETIFF, &ifr, sizeof(ifr));
-    if (res == -1) {
-        res = errno;
-        ALOGE("ioctl(TUNSETIFF) failed (%s)", strerror(res));
-        return -res;
+    // 4. otherwise, create the v4-... tun interface
+    int res;
+    if (tmpTunFd == -1) {
+        std::string unused;
+        res = createTunInterface(v4interface.c_str(), &tmpTunFd, &unused);
+        if (res) return res;
     }
 
-    // disable IPv6 on it - failing to do so is not a critical error
-    res = InterfaceController::setEnableIPv6(v4interface.c_str(), 0);
-    if (res) ALOGE("setEnableIPv6 %s failed (%s)", v4interface.c_str(), strerror(res));
-
     // 5. initialize tracker object
     ClatdTracker tracker;
     int ret = tracker.init(networkId, interface, v4interface, nat64Prefix);
@@ -693,12 +801,22 @@ void ClatdController::dumpTrackers(DumpWriter& dw) {
     }
 }
 
+void ClatdController::dumpSpareTun(DumpWriter& dw) {
+    if (mExecutor == nullptr) return;
+
+    std::lock_guard guard(mSpareLock);
+    ScopedIndent spareIndent(dw);
+    dw.println("Spare tun interface: %s hits=%u misses=%u",
+               mSpareTunName.empty() ? "none" : mSpareTunName.c_str(), mSpareHits, mSpareMisses);
+}
+
 void ClatdController::dump(DumpWriter& dw) {
     std::lock_guard guard(mutex);
 
     ScopedIndent clatdIndent(dw);
     dw.println("ClatdController");
 
+    dumpSpareTun(dw);
     dumpTrackers(dw);
     dumpIngress(dw);
     dumpEgress(dw);
@@ -17,6 +17,7 @@
 #ifndef _CLATD_CONTROLLER_H
 #define _CLATD_CONTROLLER_H
 
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <string>
@@ -25,12 +26,14 @@
 #include <netinet/in.h>
 
 #include <android-base/thread_annotations.h>
+#include <android-base/unique_fd.h>
 
 #include "Fwmark.h"
 #include "NetdConstants.h"
 #include "bpf/BpfMap.h"
 #include "netdbpf/bpf_shared.h"
 #include "netdutils/DumpWriter.h"
+#include "netdutils/Executor.h"
 
 namespace android {
 namespace net {
@@ -39,9 +42,18 @@ class NetworkController;
 
 class ClatdController {
   public:
-    explicit ClatdController(NetworkController* controller) EXCLUDES(mutex)
-        : mNetCtrl(controller){};
-    virtual ~ClatdController() EXCLUDES(mutex){};
+    // If executor is not null, a spare tun interface is kept ready on it once clatd has been
+    // started. Later startClatd calls rename the spare to v4-<interface> instead of creating the
+    // tun interface on the calling thread, and a new spare is created in the background. executor
+    // must outlive this object.
+    explicit ClatdController(NetworkController* controller,
+                             netdutils::Executor* executor = nullptr) EXCLUDES(mutex)
+        : mNetCtrl(controller), mExecutor(executor){};
+    virtual ~ClatdController() EXCLUDES(mutex, mSpareLock);
+
+    // Whether ifName is a spare tun interface that has not been handed to clatd yet. These are
+    // internal to netd and are not reported to the framework.
+    static bool isSpareTunName(const std::string& ifName);
 
     /* First thing init/startClatd/stopClatd/dump do is grab the mutex. */
     void init(void) EXCLUDES(mutex);
@@ -50,7 +62,7 @@ class ClatdController {
                    std::string* v6Addr) EXCLUDES(mutex);
     int stopClatd(const std::string& interface) EXCLUDES(mutex);
 
-    void dump(netdutils::DumpWriter& dw) EXCLUDES(mutex);
+    void dump(netdutils::DumpWriter& dw) EXCLUDES(mutex, mSpareLock);
 
     static constexpr const char LOCAL_RAW_PREROUTING[] = "clat_raw_PREROUTING";
 
@@ -83,6 +95,7 @@ class ClatdController {
     void dumpEgress(netdutils::DumpWriter& dw) REQUIRES(mutex);
     void dumpIngress(netdutils::DumpWriter& dw) REQUIRES(mutex);
     void dumpTrackers(netdutils::DumpWriter& dw) REQUIRES(mutex);
+    void dumpSpareTun(netdutils::DumpWriter& dw) EXCLUDES(mSpareLock);
 
     static in_addr_t selectIpv4Address(const in_addr ip, int16_t prefixlen);
     static int generateIpv6Address(const char* iface, const in_addr v4, const in6_addr& nat64Prefix,
@@ -108,8 +121,41 @@ class ClatdController {
     void setIptablesDropRule(bool add, const char* iface, const char* pfx96Str, const char* v6Str)
             REQUIRES(mutex);
 
+    // Creates a tun interface named name, which may contain a %d template, with IPv6 disabled.
+    // On success, returns 0 and sets *fd and *ifName. The interface is deleted when *fd is closed.
+    static int createTunInterface(const char* name, base::unique_fd* fd, std::string* ifName);
+
+    // Renames the spare tun interface to ifName and returns its fd, or returns an invalid fd if
+    // there is no spare or it cannot be renamed. Schedules a replacement either way.
+    base::unique_fd takeSpareTun(const std::string& ifName) EXCLUDES(mSpareLock);
+
+    // Posts replenishSpareTun() to the executor unless there is a spare or it is already pending.
+    void scheduleReplenish() EXCLUDES(mSpareLock);
+    void replenishSpareTun() EXCLUDES(mSpareLock);
+
+    netdutils::Executor* const mExecutor;
+
+    // Guards the spare tun interface. Never held while creating one, so that taking the spare is
+    // always fast.
+    std::mutex mSpareLock;
+    base::unique_fd mSpareTunFd GUARDED_BY(mSpareLock);
+    std::string mSpareTunName GUARDED_BY(mSpareLock);
+    // Signalled when mReplenishScheduled becomes false.
+    std::condition_variable mSpareCv;
+    // True from the time replenishSpareTun() is posted until it returns.
+    bool mReplenishScheduled GUARDED_BY(mSpareLock) = false;
+    // Cleared by the destructor so that a pending replenishSpareTun() creates nothing.
+    bool mRunning GUARDED_BY(mSpareLock) = true;
+    // Times startClatd used the spare, and times there was none to use.
+    uint32_t mSpareHits GUARDED_BY(mSpareLock) = 0;
+    uint32_t mSpareMisses GUARDED_BY(mSpareLock) = 0;
+
+    // The name prefix of spare tun interfaces, before they are renamed.
+    static constexpr const char kSpareTunPrefix[] = "clatspare";
+
     // For testing.
     friend class ClatdControllerTest;
+    friend class ClatdControllerSpareTest;
 
     static bool (*isIpv4AddressFreeFunc)(in_addr_t);
     static bool isIpv4AddressFree(in_addr_t addr);
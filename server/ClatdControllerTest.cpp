@@ -17,11 +17,13 @@
  */
 
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <netinet/in.h>
 #include <string>
 
 #include <gtest/gtest.h>
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <netutils/ifc.h>
@@ -40,7 +42,10 @@ static const char kIPv4LocalAddr[] = "192.0.0.4";
 namespace android {
 namespace net {
 
+using android::base::ReadFileToString;
 using android::base::StringPrintf;
+using android::base::unique_fd;
+using android::netdutils::Executor;
 
 // Mock functions for isIpv4AddressFree.
 bool neverFree(in_addr_t /* addr */) {
@@ -205,5 +210,92 @@ TEST_F(ClatdControllerTest, RemoveIptablesRule) {
              "COMMIT\n"}});
 }
 
+class ClatdControllerSpareTest : public ::testing::Test {
+  protected:
+    // The destructor waits for a posted replenishSpareTun(), which only runPending() runs.
+    void TearDown() override { mExecutor.runPending(); }
+
+    static std::string spareTunName(ClatdController& clatdCtrl) {
+        std::lock_guard guard(clatdCtrl.mSpareLock);
+        return clatdCtrl.mSpareTunName;
+    }
+    static unique_fd takeSpareTun(ClatdController& clatdCtrl, const std::string& ifName) {
+        return clatdCtrl.takeSpareTun(ifName);
+    }
+    std::string spareTunName() { return spareTunName(mClatdCtrl); }
+    void scheduleReplenish() { mClatdCtrl.scheduleReplenish(); }
+    unique_fd takeSpareTun(const std::string& ifName) { return takeSpareTun(mClatdCtrl, ifName); }
+
+    // Without threads, spare interfaces are only created by runPending().
+    Executor mExecutor{{.name = "clatd-test", .threads = 0}};
+    ClatdController mClatdCtrl{nullptr, &mExecutor};
+};
+
+TEST_F(ClatdControllerSpareTest, CreatesSpareOnlyAfterFirstStart) {
+    mClatdCtrl.init();
+    EXPECT_EQ(0U, mExecutor.runPending());
+    EXPECT_EQ("", spareTunName());
+}
+
+TEST_F(ClatdControllerSpareTest, DestructionDeletesSpareTun) {
+    std::string spare;
+    {
+        ClatdController clatdCtrl{nullptr, &mExecutor};
+        EXPECT_EQ(-1, takeSpareTun(clatdCtrl, "v4-netdtest0").get());
+        EXPECT_EQ(1U, mExecutor.runPending());
+        spare = spareTunName(clatdCtrl);
+    }
+    ASSERT_NE("", spare);
+    EXPECT_EQ(0U, if_nametoindex(spare.c_str()));
+
+    // A worker thread may still be creating the spare when the controller is destroyed.
+    Executor executor({.name = "clatd-test-mt", .threads = 1});
+    for (int i = 0; i < 5; i++) {
+        ClatdController clatdCtrl{nullptr, &executor};
+        takeSpareTun(clatdCtrl, "v4-netdtest0");
+    }
+    executor.waitForIdle();
+}
+
+TEST_F(ClatdControllerSpareTest, IsSpareTunName) {
+    EXPECT_TRUE(ClatdController::isSpareTunName("clatspare0"));
+    EXPECT_FALSE(ClatdController::isSpareTunName("v4-wlan0"));
+    EXPECT_FALSE(ClatdController::isSpareTunName("wlan0"));
+}
+
+TEST_F(ClatdControllerSpareTest, RenamesSpareTun) {
+    static const char kV4Iface[] = "v4-netdtest0";
+
+    // No spare yet: startClatd would create the interface itself.
+    EXPECT_EQ(-1, takeSpareTun(kV4Iface).get());
+    EXPECT_EQ(1U, mExecutor.runPending());
+    const std::string spare = spareTunName();
+    ASSERT_TRUE(android::base::StartsWith(spare, "clatspare")) << spare;
+    const unsigned spareIndex = if_nametoindex(spare.c_str());
+    EXPECT_NE(0U, spareIndex);
+    // Nothing to do while there is a spare.
+    scheduleReplenish();
+    EXPECT_EQ(0U, mExecutor.runPending());
+
+    unique_fd tunFd = takeSpareTun(kV4Iface);
+    ASSERT_NE(-1, tunFd.get());
+    EXPECT_EQ(spareIndex, if_nametoindex(kV4Iface));
+    EXPECT_EQ(0U, if_nametoindex(spare.c_str()));
+    std::string disableIpv6;
+    EXPECT_TRUE(ReadFileToString(
+            StringPrintf("/proc/sys/net/ipv6/conf/%s/disable_ipv6", kV4Iface), &disableIpv6));
+    EXPECT_EQ("1\n", disableIpv6);
+
+    // A replacement is created in the background.
+    EXPECT_EQ("", spareTunName());
+    EXPECT_EQ(1U, mExecutor.runPending());
+    EXPECT_NE("", spareTunName());
+    EXPECT_NE(0U, if_nametoindex(spareTunName().c_str()));
+
+    // Closing the fd deletes the interface.
+    tunFd.reset();
+    EXPECT_EQ(0U, if_nametoindex(kV4Iface));
+}
+
 }  // namespace net
 }  // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Netd"
+
+#include "ConnectPolicyPublisher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <android-base/unique_fd.h>
+#include <log/log.h>
+#include <private/android_filesystem_config.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace net {
+
+namespace {
+
+ConnectPolicyPage* mapPage(int fd) {
+    void* addr =
+            mmap(nullptr, sizeof(ConnectPolicyPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return addr == MAP_FAILED ? nullptr : static_cast<ConnectPolicyPage*>(addr);
+}
+
+// Reuses the page left by a previous netd instance, so that the processes that mapped it see the
+// generation advance.
+ConnectPolicyPage* openExistingPage(const std::string& path) {
+    unique_fd fd(open(path.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW));
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 ||
+        st.st_size < static_cast<off_t>(sizeof(ConnectPolicyPage))) {
+        return nullptr;
+    }
+    ConnectPolicyPage* page = mapPage(fd);
+    if (page != nullptr && page->magic != ConnectPolicyPage::MAGIC) {
+        munmap(page, sizeof(ConnectPolicyPage));
+        return nullptr;
+    }
+    return page;
+}
+
+// Initializes a new page in a temporary file and renames it into place, so that clients never map
+// a page that is not initialized yet. Only the inet group, which is also the only one that may
+// connect to fwmarkd, can read the page: the generation reveals when the policy of any user
+// changes.
+ConnectPolicyPage* createPage(const std::string& path) {
+    const std::string tmpPath = path + ".tmp";
+    unlink(tmpPath.c_str());
+    unique_fd fd(open(tmpPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0440));
+    if (fd == -1) {
+        ALOGE("Cannot create %s: %s", tmpPath.c_str(), strerror(errno));
+        return nullptr;
+    }
+    // open() applies the umask.
+    ConnectPolicyPage* page = nullptr;
+    if (fchown(fd, AID_ROOT, AID_INET) == -1 || fchmod(fd, 0440) == -1 ||
+        ftruncate(fd, sizeof(ConnectPolicyPage)) == -1 || (page = mapPage(fd)) == nullptr) {
+        ALOGE("Cannot set up %s: %s", tmpPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return nullptr;
+    }
+    page->magic = ConnectPolicyPage::MAGIC;
+    page->generation = 0;
+    if (rename(tmpPath.c_str(), path.c_str()) == -1) {
+        ALOGE("Cannot rename %s to %s: %s", tmpPath.c_str(), path.c_str(), strerror(errno));
+        munmap(page, sizeof(ConnectPolicyPage));
+        unlink(tmpPath.c_str());
+        return nullptr;
+    }
+    return page;
+}
+
+}  // namespace
+
+ConnectPolicyPublisher::ConnectPolicyPublisher(const std::string& path) {
+    mPage = openExistingPage(path);
+    if (mPage == nullptr) mPage = createPage(path);
+    // Nothing that clients learned from a previous instance can be trusted.
+    invalidate();
+}
+
+ConnectPolicyPublisher::~ConnectPolicyPublisher() {
+    if (mPage != nullptr) munmap(mPage, sizeof(ConnectPolicyPage));
+}
+
+void ConnectPolicyPublisher::invalidate() {
+    if (mPage != nullptr) mPage->generation++;
+}
+
+uint32_t ConnectPolicyPublisher::generation() const {
+    return mPage != nullptr ? mPage->generation.load() : 0;
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_CONNECT_POLICY_PUBLISHER_H
+#define NETD_SERVER_CONNECT_POLICY_PUBLISHER_H
+
+#include <string>
+
+#include "ConnectPolicy.h"
+
+namespace android {
+namespace net {
+
+// Owns the writable mapping of the ConnectPolicyPage. See include/ConnectPolicy.h.
+//
+// If the page cannot be created, for example because /dev/netd does not exist, an error is logged
+// and the publisher does nothing. Clients then fail to map the page and always send ON_CONNECT.
+//
+// This class is thread-safe.
+class ConnectPolicyPublisher {
+  public:
+    // Maps the page at path, creating it if needed, and advances its generation.
+    explicit ConnectPolicyPublisher(const std::string& path = CONNECT_POLICY_PAGE_PATH);
+    ~ConnectPolicyPublisher();
+
+    ConnectPolicyPublisher(const ConnectPolicyPublisher&) = delete;
+    ConnectPolicyPublisher& operator=(const ConnectPolicyPublisher&) = delete;
+
+    // Invalidates everything that clients have learned from ON_CONNECT so far. Must be called
+    // while holding the lock that guards the state that changed, so that no ON_CONNECT can observe
+    // the new state before the generation changes.
+    void invalidate();
+
+    // Returns 0 if the page could not be created.
+    uint32_t generation() const;
+
+  private:
+    ConnectPolicyPage* mPage = nullptr;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_CONNECT_POLICY_PUBLISHER_H
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * ConnectPolicyPublisherTest.cpp - unit tests for ConnectPolicyPublisher.cpp
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+#include <private/android_filesystem_config.h>
+
+#include "ConnectPolicyPublisher.h"
+
+namespace android {
+namespace net {
+
+using android::base::unique_fd;
+using android::base::WriteStringToFile;
+
+class ConnectPolicyPublisherTest : public ::testing::Test {
+  protected:
+    TemporaryDir mTempDir;
+    const std::string mPath = std::string(mTempDir.path) + "/connect_policy";
+};
+
+TEST_F(ConnectPolicyPublisherTest, CreatesPageReadableByInetGroup) {
+    ConnectPolicyPublisher publisher(mPath);
+    EXPECT_EQ(1U, publisher.generation());
+
+    struct stat st;
+    ASSERT_EQ(0, stat(mPath.c_str(), &st));
+    EXPECT_EQ(0440U, st.st_mode & 0777);
+    EXPECT_EQ(static_cast<gid_t>(AID_INET), st.st_gid);
+    EXPECT_EQ(static_cast<off_t>(sizeof(ConnectPolicyPage)), st.st_size);
+    EXPECT_EQ(-1, access((mPath + ".tmp").c_str(), F_OK));
+}
+
+TEST_F(ConnectPolicyPublisherTest, ClientsSeeInvalidations) {
+    ConnectPolicyPublisher publisher(mPath);
+
+    unique_fd fd(open(mPath.c_str(), O_RDONLY | O_CLOEXEC));
+    ASSERT_NE(-1, fd);
+    void* addr = mmap(nullptr, sizeof(ConnectPolicyPage), PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, addr);
+    const auto* page = static_cast<const ConnectPolicyPage*>(addr);
+    EXPECT_EQ(ConnectPolicyPage::MAGIC, page->magic);
+    EXPECT_EQ(1U, page->generation.load());
+
+    publisher.invalidate();
+    publisher.invalidate();
+    EXPECT_EQ(3U, page->generation.load());
+    EXPECT_EQ(3U, publisher.generation());
+    munmap(addr, sizeof(ConnectPolicyPage));
+}
+
+TEST_F(ConnectPolicyPublisherTest, RestartContinuesGeneration) {
+    {
+        ConnectPolicyPublisher publisher(mPath);
+        publisher.invalidate();
+        EXPECT_EQ(2U, publisher.generation());
+    }
+    // Clients that mapped the page of the previous instance must see the generation advance.
+    ConnectPolicyPublisher publisher(mPath);
+    EXPECT_EQ(3U, publisher.generation());
+}
+
+TEST_F(ConnectPolicyPublisherTest, ReplacesBadPage) {
+    ASSERT_TRUE(WriteStringToFile("not a connect policy page", mPath));
+    ConnectPolicyPublisher publisher(mPath);
+    EXPECT_EQ(1U, publisher.generation());
+}
+
+TEST_F(ConnectPolicyPublisherTest, MissingDirectory) {
+    ConnectPolicyPublisher publisher(std::string(mTempDir.path) + "/missing/connect_policy");
+    EXPECT_EQ(0U, publisher.generation());
+    publisher.invalidate();
+    EXPECT_EQ(0U, publisher.generation());
+}
+
+}  // namespace net
+}  // namespace android
@@ -15,6 +15,7 @@
  */
 
 #include <cinttypes>
+#include <memory>
 #include <regex>
 #include <set>
 #include <string>
@@ -191,8 +192,12 @@ void Controllers::createChildChains(IptablesTarget target, const char* table,
     execIptablesRestore(target, command);
 }
 
-Controllers::Controllers()
-    : clatdCtrl(&netCtrl),
+Controllers::Controllers(const std::string& connectPolicyPath)
+    : executor({.name = "netd-exec", .threads = 2}),
+      listenerLoop({.name = "netd-listen"}),
+      netCtrl(connectPolicyPath),
+      clatdCtrl(&netCtrl, &executor),
+      iptablesRestoreCtrl(&executor),
       wakeupCtrl(
               [this](const WakeupController::ReportArgs& args) {
                   const auto listener = eventReporter.getNetdEventListener();
@@ -207,7 +212,10 @@ Controllers::Controllers()
                                           args.dstHw, srcIp, dstIp, args.srcPort, args.dstPort,
                                           args.timestampNs);
               },
-              &iptablesRestoreCtrl) {
+              &iptablesRestoreCtrl),
+      trafficCtrl(&executor, &listenerLoop),
+      sockDestroyQueue(executor),
+      dumpExecutor({.name = "netd-dump", .threads = 4}) {
     InterfaceController::initializeAll();
 }
 
@@ -288,6 +296,15 @@ void Controllers::init() {
     }
     gLog.info("Initializing traffic control: %" PRId64 "us", s.getTimeAndResetUs());
 
+    if (trafficCtrl.getBpfEnabled()) {
+        netdutils::Status tsmStatus = tcpSocketMonitor.initSockOpsAggregation();
+        if (!isOk(tsmStatus)) {
+            gLog.warn("TCP health sock_ops unavailable, using sock_diag: (%s)",
+                      toString(tsmStatus).c_str());
+        }
+        gLog.info("Initializing TCP health sock_ops: %" PRId64 "us", s.getTimeAndResetUs());
+    }
+
     bandwidthCtrl.setBpfEnabled(trafficCtrl.getBpfEnabled());
     bandwidthCtrl.enableBandwidthControl();
     gLog.info("Enabling bandwidth control: %" PRId64 "us", s.getTimeAndResetUs());
@@ -304,6 +321,17 @@ void Controllers::init() {
     gLog.info("Initializing XfrmController: %" PRId64 "us", s.getTimeAndResetUs());
 }
 
+std::unique_ptr<Controllers> Controllers::createForNetnsTest(const std::string& connectPolicyPath) {
+    auto ctls = std::make_unique<Controllers>(connectPolicyPath);
+    ctls->initIptablesRules();
+    ctls->bandwidthCtrl.setBpfEnabled(ctls->trafficCtrl.getBpfEnabled());
+    ctls->bandwidthCtrl.enableBandwidthControl();
+    if (int ret = RouteController::Init(NetworkController::LOCAL_NET_ID)) {
+        gLog.error("Failed to initialize RouteController (%s)", strerror(-ret));
+    }
+    return ctls;
+}
+
 Controllers* gCtls = nullptr;
 
 }  // namespace net
@@ -17,6 +17,8 @@
 #ifndef _CONTROLLERS_H__
 #define _CONTROLLERS_H__
 
+#include <memory>
+
 #include "BandwidthController.h"
 #include "ClatdController.h"
 #include "EventReporter.h"
@@ -26,12 +28,15 @@
 #include "IptablesRestoreController.h"
 #include "NetworkController.h"
 #include "PppController.h"
+#include "SockDestroyQueue.h"
 #include "StrictController.h"
 #include "TcpSocketMonitor.h"
 #include "TetherController.h"
 #include "TrafficController.h"
 #include "WakeupController.h"
 #include "XfrmController.h"
+#include "netdutils/EventLoop.h"
+#include "netdutils/Executor.h"
 #include "netdutils/Log.h"
 
 namespace android {
@@ -39,8 +44,15 @@ namespace net {
 
 class Controllers {
   public:
-    Controllers();
+    // |connectPolicyPath| is passed to NetworkController.
+    explicit Controllers(const std::string& connectPolicyPath = CONNECT_POLICY_PAGE_PATH);
 
+    // Shared by the controllers for work that should not run on binder or listener threads.
+    // Declared first so that it outlives every controller that posts to it.
+    netdutils::Executor executor;
+    // Services the netlink listeners that do not need a thread of their own. Declared before the
+    // controllers so that it outlives their listeners.
+    netdutils::EventLoop listenerLoop;
     NetworkController netCtrl;
     TetherController tetherCtrl;
     PppController pppCtrl;
@@ -55,9 +67,20 @@ class Controllers {
     XfrmController xfrmCtrl;
     TrafficController trafficCtrl;
     TcpSocketMonitor tcpSocketMonitor;
+    SockDestroyQueue sockDestroyQueue;
+    // Renders the sections of dumpsys. Separate from executor, since a dump section stuck on a lock
+    // holds its worker until the lock is released. Declared last so that it joins its workers
+    // before the controllers that the sections dump are destroyed.
+    netdutils::Executor dumpExecutor;
 
     void init();
 
+    // For benchmarks and tests that run in a network namespace of their own. Returns controllers
+    // initialized as by init(), except for the parts that act on state shared by all namespaces:
+    // TrafficController, clatd and XFRM. The ConnectPolicyPage is published at |connectPolicyPath|
+    // instead of the path that clients map.
+    static std::unique_ptr<Controllers> createForNetnsTest(const std::string& connectPolicyPath);
+
   private:
     friend class ControllersTest;
     void initIptablesRules();
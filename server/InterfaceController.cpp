@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
 #include <malloc.h>
@@ -38,6 +39,7 @@
 #include <netdutils/Syscalls.h>
 
 #include "InterfaceController.h"
+#include "NetlinkCommands.h"
 #include "RouteController.h"
 
 using android::base::ReadFileToString;
@@ -447,6 +449,37 @@ StatusOr<std::map<std::string, uint32_t>> InterfaceController::getIfaceList() {
     return ifacePairs;
 }
 
+StatusOr<std::unordered_map<std::string, std::unordered_set<unsigned>>>
+InterfaceController::getIfaceAddresses() {
+    std::unordered_map<std::string, std::unordered_set<unsigned>> addresses;
+    const NetlinkDumpCallback callback = [&addresses](nlmsghdr* nlh) {
+        if (nlh->nlmsg_type != RTM_NEWADDR) return;
+        ifaddrmsg* ifa = reinterpret_cast<ifaddrmsg*>(NLMSG_DATA(nlh));
+        int len = IFA_PAYLOAD(nlh);
+        for (rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            // Like NetlinkEvent, only look at IFA_ADDRESS.
+            if (rta->rta_type != IFA_ADDRESS) continue;
+            char addrstr[INET6_ADDRSTRLEN];
+            if (inet_ntop(ifa->ifa_family, RTA_DATA(rta), addrstr, sizeof(addrstr))) {
+                addresses[StringPrintf("%s/%d", addrstr, ifa->ifa_prefixlen)].insert(
+                        ifa->ifa_index);
+            }
+            break;
+        }
+    };
+
+    ifaddrmsg ifa = {.ifa_family = AF_UNSPEC};
+    iovec iov[] = {
+            {nullptr, 0},
+            {&ifa, sizeof(ifa)},
+    };
+    if (int ret = sendNetlinkRequest(RTM_GETADDR, NETLINK_DUMP_FLAGS, iov, ARRAY_SIZE(iov),
+                                     &callback)) {
+        return statusFromErrno(-ret, "Cannot dump interface addresses");
+    }
+    return addresses;
+}
+
 namespace {
 
 std::string hwAddrToStr(unsigned char* hwaddr) {
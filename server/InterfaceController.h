@@ -20,6 +20,8 @@
 #include <functional>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <android/net/InterfaceConfigurationParcel.h>
 #include <netdutils/Status.h>
@@ -61,6 +63,12 @@ public:
 
     static android::netdutils::StatusOr<std::vector<std::string>> getIfaceNames();
     static android::netdutils::StatusOr<std::map<std::string, uint32_t>> getIfaceList();
+    // Maps each address configured on any interface, formatted as "<address>/<prefixlen>" like
+    // the ADDRESS parameter of the NetlinkEvents that report address changes, to the indices of
+    // the interfaces that have it.
+    static android::netdutils::StatusOr<
+            std::unordered_map<std::string, std::unordered_set<unsigned>>>
+    getIfaceAddresses();
 
     static std::mutex mutex;
 
@@ -205,5 +205,13 @@ TEST_F(GetIfaceListTest, IfaceExist) {
     freeifaddrs(ifaddr);
 }
 
+TEST_F(GetIfaceListTest, IfaceAddresses) {
+    const auto addresses = InterfaceController::getIfaceAddresses();
+    ASSERT_EQ(ok, addresses.status());
+    const auto loopback = addresses.value().find("127.0.0.1/8");
+    ASSERT_NE(addresses.value().end(), loopback);
+    EXPECT_EQ(1U, loopback->second.count(if_nametoindex("lo")));
+}
+
 }  // namespace net
 }  // namespace android
@@ -16,31 +16,97 @@
 
 #include "IptablesRestoreController.h"
 
+#include <inttypes.h>
 #include <poll.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <sstream>
+
 #define LOG_TAG "IptablesRestoreController"
 #include <android-base/logging.h>
 #include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <netdutils/Syscalls.h>
 
 #include "Controllers.h"
 
+using android::base::StartsWith;
+using android::base::StringAppendF;
+using android::base::StringPrintf;
+using android::netdutils::DumpWriter;
+using android::netdutils::Executor;
+using android::netdutils::ScopedIndent;
 using android::netdutils::StatusOr;
 using android::netdutils::sSyscalls;
 
-constexpr char IPTABLES_RESTORE_PATH[] = "/system/bin/iptables-restore";
-constexpr char IP6TABLES_RESTORE_PATH[] = "/system/bin/ip6tables-restore";
-
 constexpr char PING[] = "#PING\n";
 
 constexpr size_t PING_SIZE = sizeof(PING) - 1;
 
 // Not compile-time constants because they are changed by the unit tests.
+const char* IptablesRestoreController::IPTABLES_RESTORE_PATH = "/system/bin/iptables-restore";
+const char* IptablesRestoreController::IP6TABLES_RESTORE_PATH = "/system/bin/ip6tables-restore";
 int IptablesRestoreController::MAX_RETRIES = 50;
 int IptablesRestoreController::POLL_TIMEOUT_MS = 100;
+std::chrono::milliseconds IptablesRestoreController::SLOW_COMMAND_THRESHOLD(100);
+
+namespace {
+
+constexpr size_t MAX_RECENT_COMMANDS = 64;
+constexpr size_t MAX_SLOW_COMMANDS = 16;
+// How much of each slow command to keep.
+constexpr size_t MAX_SLOW_COMMAND_SIZE = 512;
+
+// Chain name prefixes of the components that issue iptables-restore commands.
+constexpr struct {
+    const char* chainPrefix;
+    const char* caller;
+} CALLERS[] = {
+        {"bw_", "BandwidthController"},   {"clat_", "ClatdController"},
+        {"fw_", "FirewallController"},    {"idletimer_", "IdletimerController"},
+        {"oem_", "oem_iptables_hook"},    {"routectrl_", "RouteController"},
+        {"st_", "StrictController"},      {"tetherctrl_", "TetherController"},
+        {"wakeupctrl_", "WakeupController"},
+};
+constexpr char UNKNOWN_CALLER[] = "other";
+
+const char* targetName(IptablesTarget target) {
+    switch (target) {
+        case V4:
+            return "v4";
+        case V6:
+            return "v6";
+        case V4V6:
+            return "v4v6";
+    }
+    return "?";
+}
+
+int64_t toMs(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+std::string formatTime(std::chrono::system_clock::time_point time) {
+    const time_t seconds = std::chrono::system_clock::to_time_t(time);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            time.time_since_epoch()).count() % 1000;
+    struct tm tm;
+    char buf[32];
+    strftime(buf, sizeof(buf), "%m-%d %H:%M:%S", localtime_r(&seconds, &tm));
+    return StringPrintf("%s.%03lld", buf, static_cast<long long>(ms));
+}
+
+// Spare processes are forked on the executor while commands may be forking replacements on binder
+// threads. Serializes forkAndExec() for the reasons explained in Init(). File-scope rather than a
+// member because children inherit fds from the whole process, not just from one controller.
+std::mutex sForkLock;
+
+}  // namespace
 
 class IptablesProcess {
 public:
@@ -116,11 +182,20 @@ public:
     static constexpr size_t STDERR_IDX = 1;
 };
 
-IptablesRestoreController::IptablesRestoreController() {
+IptablesRestoreController::IptablesRestoreController(Executor* executor) : mExecutor(executor) {
     Init();
 }
 
-IptablesRestoreController::~IptablesRestoreController() {
+IptablesRestoreController::~IptablesRestoreController() NO_THREAD_SAFETY_ANALYSIS {
+    // A replenishStandby() already posted still references this object, so wait for it. It stops
+    // forking once mRunning is false.
+    std::unique_lock<std::mutex> ul(mStandbyLock);
+    mRunning = false;
+    mStandbyCv.wait(ul, [this]() NO_THREAD_SAFETY_ANALYSIS { return !mReplenishScheduled; });
+    for (auto* standby : {&mIpRestoreStandby, &mIp6RestoreStandby}) {
+        if (*standby != nullptr) (*standby)->stop();
+        standby->reset();
+    }
 }
 
 void IptablesRestoreController::Init() {
@@ -130,6 +205,7 @@ void IptablesRestoreController::Init() {
     // forkAndExec, which is sub-millisecond, and the child processes then call exec() in parallel.
     mIpRestore.reset(forkAndExec(IPTABLES_PROCESS));
     mIp6Restore.reset(forkAndExec(IP6TABLES_PROCESS));
+    scheduleReplenish();
 }
 
 /* static */
@@ -137,6 +213,8 @@ IptablesProcess* IptablesRestoreController::forkAndExec(const IptablesProcessTyp
     const char* const cmd = (type == IPTABLES_PROCESS) ?
         IPTABLES_RESTORE_PATH : IP6TABLES_RESTORE_PATH;
 
+    std::lock_guard lock(sForkLock);
+
     // Create the pipes we'll use for communication with the child
     // process. One each for the child's in, out and err files.
     int stdin_pipe[2];
@@ -201,8 +279,6 @@ IptablesProcess* IptablesRestoreController::forkAndExec(const IptablesProcessTyp
 }
 
 // TODO: Return -errno on failure instead of -1.
-// TODO: Maybe we should keep a rotating buffer of the last N commands
-// so that they can be dumped on dumpsys.
 int IptablesRestoreController::sendCommand(const IptablesProcessType type,
                                            const std::string& command,
                                            std::string *output) {
@@ -224,14 +300,19 @@ int IptablesRestoreController::sendCommand(const IptablesProcessType type,
     }
 
     if (existingProcess == nullptr) {
-        // Fork a new iptables[6]-restore process.
-        IptablesProcess *newProcess = IptablesRestoreController::forkAndExec(type);
-        if (newProcess == nullptr) {
-            LOG(ERROR) << "Unable to fork ip[6]tables-restore, type: " << type;
-            return -1;
-        }
+        std::unique_ptr<IptablesProcess> standby = takeStandby(type);
+        if (standby != nullptr) {
+            *process = std::move(standby);
+        } else {
+            // Fork a new iptables[6]-restore process.
+            IptablesProcess *newProcess = IptablesRestoreController::forkAndExec(type);
+            if (newProcess == nullptr) {
+                LOG(ERROR) << "Unable to fork ip[6]tables-restore, type: " << type;
+                return -1;
+            }
 
-        process->reset(newProcess);
+            process->reset(newProcess);
+        }
     }
 
     if (!android::base::WriteFully((*process)->stdIn, command.data(), command.length())) {
@@ -245,13 +326,110 @@ int IptablesRestoreController::sendCommand(const IptablesProcessType type,
     }
 
     if (!drainAndWaitForAck(*process, command, output)) {
-        // drainAndWaitForAck has already logged an error.
+        // drainAndWaitForAck has already logged an error. iptables-restore exits on error, so swap
+        // in the spare now rather than when the next command finds the process gone.
+        if ((*process)->processTerminated) {
+            std::unique_ptr<IptablesProcess> standby = takeStandby(type);
+            if (standby != nullptr) *process = std::move(standby);
+        }
         return -1;
     }
 
     return 0;
 }
 
+/* static */
+std::unique_ptr<IptablesProcess> IptablesRestoreController::startStandbyProcess(
+        const IptablesProcessType type) {
+    std::unique_ptr<IptablesProcess> process(forkAndExec(type));
+    if (process == nullptr) return nullptr;
+
+    std::string output;
+    if (!android::base::WriteFully(process->stdIn, PING, PING_SIZE) ||
+        !drainAndWaitForAck(process, PING, &output)) {
+        ALOGE("Spare iptables-restore process %d did not start", process->pid);
+        process->stop();
+        return nullptr;
+    }
+    return process;
+}
+
+std::unique_ptr<IptablesProcess>& IptablesRestoreController::standbySlot(
+        const IptablesProcessType type) {
+    return type == IPTABLES_PROCESS ? mIpRestoreStandby : mIp6RestoreStandby;
+}
+
+std::unique_ptr<IptablesProcess> IptablesRestoreController::takeStandby(
+        const IptablesProcessType type) {
+    if (mExecutor == nullptr) return nullptr;
+
+    std::unique_ptr<IptablesProcess> standby;
+    {
+        std::lock_guard lock(mStandbyLock);
+        standby = std::move(standbySlot(type));
+        if (standby != nullptr && !standby->outputReady()) {
+            ALOGW("Spare iptables-restore process %d died", standby->pid);
+            standby->stop();
+            standby.reset();
+        }
+        if (standby != nullptr) {
+            mStandbyHits++;
+        } else {
+            mStandbyMisses++;
+        }
+    }
+    scheduleReplenish();
+    return standby;
+}
+
+void IptablesRestoreController::scheduleReplenish() {
+    if (mExecutor == nullptr) return;
+    {
+        std::lock_guard lock(mStandbyLock);
+        if (mReplenishScheduled) return;
+        mReplenishScheduled = true;
+    }
+    const auto status = mExecutor->post(Executor::Lane::BACKGROUND, [this] { replenishStandby(); });
+    if (!isOk(status)) {
+        // The next command that needs a spare will try again.
+        ALOGE("Error scheduling spare iptables-restore processes: %s", toString(status).c_str());
+        std::lock_guard lock(mStandbyLock);
+        mReplenishScheduled = false;
+        mStandbyCv.notify_all();
+    }
+}
+
+void IptablesRestoreController::replenishStandby() {
+    while (true) {
+        IptablesProcessType type;
+        {
+            std::lock_guard lock(mStandbyLock);
+            if (mRunning && mIpRestoreStandby == nullptr) {
+                type = IPTABLES_PROCESS;
+            } else if (mRunning && mIp6RestoreStandby == nullptr) {
+                type = IP6TABLES_PROCESS;
+            } else {
+                mReplenishScheduled = false;
+                mStandbyCv.notify_all();
+                return;
+            }
+        }
+
+        // Slow: takes as long as the iptables-restore startup that this class is trying to hide.
+        std::unique_ptr<IptablesProcess> process = startStandbyProcess(type);
+
+        std::lock_guard lock(mStandbyLock);
+        if (process == nullptr) {
+            // Don't spin if fork or exec keeps failing. The next command that takes or misses a
+            // spare will try again.
+            mReplenishScheduled = false;
+            mStandbyCv.notify_all();
+            return;
+        }
+        standbySlot(type) = std::move(process);
+    }
+}
+
 void IptablesRestoreController::maybeLogStderr(const std::unique_ptr<IptablesProcess> &process,
                                                const std::string& command) {
     if (process->errBuf.empty()) {
@@ -346,25 +524,157 @@ bool IptablesRestoreController::drainAndWaitForAck(const std::unique_ptr<Iptable
 
 int IptablesRestoreController::execute(const IptablesTarget target, const std::string& command,
                                        std::string *output) {
-    std::lock_guard lock(mLock);
+    const Clock::time_point waitStart = Clock::now();
+    Clock::time_point execStart;
+    int res = 0;
+    {
+        std::lock_guard lock(mLock);
+        execStart = Clock::now();
+
+        std::string buffer;
+        if (output == nullptr) {
+            output = &buffer;
+        } else {
+            output->clear();
+        }
 
-    std::string buffer;
-    if (output == nullptr) {
-        output = &buffer;
-    } else {
-        output->clear();
+        if (target == V4 || target == V4V6) {
+            res |= sendCommand(IPTABLES_PROCESS, command, output);
+        }
+        if (target == V6 || target == V4V6) {
+            res |= sendCommand(IP6TABLES_PROCESS, command, output);
+        }
     }
 
-    int res = 0;
-    if (target == V4 || target == V4V6) {
-        res |= sendCommand(IPTABLES_PROCESS, command, output);
+    recordCommand({.time = std::chrono::system_clock::now(),
+                   .caller = callerOf(command),
+                   .target = target,
+                   .size = command.size(),
+                   .lockWait = execStart - waitStart,
+                   .execution = Clock::now() - execStart,
+                   .result = res},
+                  command);
+    return res;
+}
+
+/* static */
+const char* IptablesRestoreController::callerOf(const std::string& commands) {
+    std::istringstream stream(commands);
+    std::string word;
+    while (stream >> word) {
+        // Chains are declared as ":chain policy" and used everywhere else as a separate word.
+        if (StartsWith(word, ":")) word.erase(0, 1);
+        for (const auto& [chainPrefix, caller] : CALLERS) {
+            if (StartsWith(word, chainPrefix)) return caller;
+        }
     }
-    if (target == V6 || target == V4V6) {
-        res |= sendCommand(IP6TABLES_PROCESS, command, output);
+    return UNKNOWN_CALLER;
+}
+
+void IptablesRestoreController::LatencyHistogram::add(Clock::duration duration) {
+    const int64_t ms = toMs(duration);
+    size_t bucket = 0;
+    // Bucket i holds durations below 4^i ms.
+    while (bucket < mBuckets.size() - 1 && ms >= (int64_t{1} << (2 * bucket))) bucket++;
+    mBuckets[bucket]++;
+}
+
+std::string IptablesRestoreController::LatencyHistogram::toString() const {
+    std::string out;
+    for (size_t i = 0; i < mBuckets.size(); i++) {
+        if (i < mBuckets.size() - 1) {
+            StringAppendF(&out, "%s<%d:%u", i ? " " : "", 1 << (2 * i), mBuckets[i]);
+        } else {
+            StringAppendF(&out, " >=%d:%u", 1 << (2 * (i - 1)), mBuckets[i]);
+        }
+    }
+    return out;
+}
+
+void IptablesRestoreController::recordCommand(CommandRecord record, const std::string& commands) {
+    const bool slow = record.lockWait + record.execution >= SLOW_COMMAND_THRESHOLD;
+    if (slow) {
+        ALOGW("Slow iptables-restore command from %s: %zu bytes, waited %" PRId64
+              "ms, ran %" PRId64 "ms",
+              record.caller, record.size, toMs(record.lockWait), toMs(record.execution));
+    }
+
+    std::lock_guard lock(mStatsLock);
+    CallerStats& stats = mCallerStats[record.caller];
+    stats.commands++;
+    if (record.result != 0) stats.failures++;
+    stats.lockWait.add(record.lockWait);
+    stats.execution.add(record.execution);
+
+    mRecentCommands.push_back(record);
+    if (mRecentCommands.size() > MAX_RECENT_COMMANDS) mRecentCommands.pop_front();
+
+    if (slow) {
+        record.commands = commands.substr(0, MAX_SLOW_COMMAND_SIZE);
+        mSlowCommands.push_back(std::move(record));
+        if (mSlowCommands.size() > MAX_SLOW_COMMANDS) mSlowCommands.pop_front();
+    }
+}
+
+void IptablesRestoreController::dump(DumpWriter& dw) {
+    const auto printRecord = [&dw](const CommandRecord& record) {
+        dw.println("%s %s %s size=%zu wait=%" PRId64 "ms exec=%" PRId64 "ms result=%d",
+                   formatTime(record.time).c_str(), record.caller, targetName(record.target),
+                   record.size, toMs(record.lockWait), toMs(record.execution), record.result);
+    };
+
+    dw.println("IptablesRestoreController");
+    ScopedIndent indentController(dw);
+
+    if (mExecutor != nullptr) {
+        std::lock_guard lock(mStandbyLock);
+        dw.println("Spare processes: iptables-restore=%d ip6tables-restore=%d hits=%u misses=%u",
+                   mIpRestoreStandby ? mIpRestoreStandby->pid : 0,
+                   mIp6RestoreStandby ? mIp6RestoreStandby->pid : 0, mStandbyHits,
+                   mStandbyMisses);
+    }
+
+    std::lock_guard lock(mStatsLock);
+
+    dw.println("Latency histograms (ms):");
+    {
+        ScopedIndent indentCallers(dw);
+        for (const auto& [caller, stats] : mCallerStats) {
+            dw.println("%s: commands=%u failures=%u", caller.c_str(), stats.commands,
+                       stats.failures);
+            ScopedIndent indentHistograms(dw);
+            dw.println("lock wait: %s", stats.lockWait.toString().c_str());
+            dw.println("execution: %s", stats.execution.toString().c_str());
+        }
+    }
+
+    dw.println("Recent commands:");
+    {
+        ScopedIndent indentRecent(dw);
+        for (const CommandRecord& record : mRecentCommands) printRecord(record);
+    }
+
+    dw.println("Slow commands (>=%lldms):",
+               static_cast<long long>(SLOW_COMMAND_THRESHOLD.count()));
+    ScopedIndent indentSlow(dw);
+    for (const CommandRecord& record : mSlowCommands) {
+        printRecord(record);
+        ScopedIndent indentCommands(dw);
+        for (const std::string& line : android::base::Split(record.commands, "\n")) {
+            if (!line.empty()) dw.println(line);
+        }
+        if (record.size > record.commands.size()) {
+            dw.println("... %zu more bytes", record.size - record.commands.size());
+        }
     }
-    return res;
 }
 
 int IptablesRestoreController::getIpRestorePid(const IptablesProcessType type) {
     return type == IPTABLES_PROCESS ? mIpRestore->pid : mIp6Restore->pid;
 }
+
+pid_t IptablesRestoreController::getStandbyPid(const IptablesProcessType type) {
+    std::lock_guard lock(mStandbyLock);
+    const std::unique_ptr<IptablesProcess>& standby = standbySlot(type);
+    return standby != nullptr ? standby->pid : 0;
+}
@@ -17,11 +17,21 @@
 #ifndef NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
 #define NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <sys/types.h>
 
+#include <android-base/thread_annotations.h>
+
 #include "NetdConstants.h"
+#include "netdutils/DumpWriter.h"
+#include "netdutils/Executor.h"
 
 class IptablesProcess;
 
@@ -38,7 +48,12 @@ class IptablesRestoreController final : public IptablesRestoreInterface {
   public:
     // Not for general use. Use gCtls->iptablesRestoreCtrl
     // to get an instance of this class.
-    IptablesRestoreController();
+    //
+    // If executor is not null, a spare, already initialized iptables-restore and ip6tables-restore
+    // process is kept ready on it. When a child process dies, usually because a command failed, the
+    // spare is swapped in instead of forking a new process on the calling thread, and a new spare
+    // is started in the background. executor must outlive this object.
+    explicit IptablesRestoreController(android::netdutils::Executor* executor = nullptr);
 
     ~IptablesRestoreController() override;
 
@@ -55,9 +70,20 @@ class IptablesRestoreController final : public IptablesRestoreInterface {
     // of the forked iptables[6]-restore process has died.
     IptablesProcessType notifyChildTermination(pid_t pid);
 
+    // Dumps the spare processes, per-caller latency histograms, the most recent commands and the
+    // slowest ones. Does not wait for commands in progress.
+    void dump(android::netdutils::DumpWriter& dw) EXCLUDES(mStatsLock, mStandbyLock);
+
 protected:
     friend class IptablesRestoreControllerTest;
+    friend class IptablesRestoreControllerStandbyTest;
     pid_t getIpRestorePid(const IptablesProcessType type);
+    // Returns 0 if there is no spare process of the given type.
+    pid_t getStandbyPid(const IptablesProcessType type) EXCLUDES(mStandbyLock);
+
+    // The binaries to run. Not compile-time constants because they are changed by the unit tests.
+    static const char* IPTABLES_RESTORE_PATH;
+    static const char* IP6TABLES_RESTORE_PATH;
 
     // The maximum number of times we poll(2) for a response on our set of polled
     // fds. Chosen so that the overall timeout is 5s. The timeout is so high because
@@ -68,6 +94,14 @@ protected:
     // |POLL_TIMEOUT_MS * MAX_RETRIES|. Chosen so that the overall timeout is 1s.
     static int POLL_TIMEOUT_MS;
 
+    // Commands that take longer than this, including the time spent waiting for other commands to
+    // finish, are logged and kept in the slow command history.
+    static std::chrono::milliseconds SLOW_COMMAND_THRESHOLD;
+
+    // Returns the component that issued |commands|, going by the first netd chain they mention.
+    // Each controller prefixes the names of its chains, e.g. "bw_" for BandwidthController.
+    static const char* callerOf(const std::string& commands);
+
     void Init();
 
 private:
@@ -83,11 +117,86 @@ private:
     static void maybeLogStderr(const std::unique_ptr<IptablesProcess> &process,
                                const std::string& command);
 
+    // Forks a process and waits until it has answered a ping, i.e., until it is ready to accept
+    // commands without delay. Returns null on error.
+    static std::unique_ptr<IptablesProcess> startStandbyProcess(const IptablesProcessType type);
+
+    // Returns the spare process of the given type and schedules a replacement, or returns null if
+    // there is no spare or it has died.
+    std::unique_ptr<IptablesProcess> takeStandby(const IptablesProcessType type)
+            EXCLUDES(mStandbyLock);
+
+    // Posts replenishStandby() to the executor unless it is already pending.
+    void scheduleReplenish() EXCLUDES(mStandbyLock);
+
+    // Starts spare processes until there is one of each type.
+    void replenishStandby() EXCLUDES(mStandbyLock);
+
+    std::unique_ptr<IptablesProcess>& standbySlot(const IptablesProcessType type)
+            REQUIRES(mStandbyLock);
+
+    using Clock = std::chrono::steady_clock;
+
+    // Counts of durations in buckets of <1ms, <4ms, <16ms, ... <1024ms and >=1024ms.
+    class LatencyHistogram {
+      public:
+        void add(Clock::duration duration);
+        std::string toString() const;
+
+      private:
+        std::array<uint32_t, 7> mBuckets = {};
+    };
+
+    struct CallerStats {
+        uint32_t commands = 0;
+        uint32_t failures = 0;
+        LatencyHistogram lockWait;
+        LatencyHistogram execution;
+    };
+
+    struct CommandRecord {
+        std::chrono::system_clock::time_point time;
+        const char* caller;
+        IptablesTarget target;
+        size_t size;
+        Clock::duration lockWait;
+        Clock::duration execution;
+        int result;
+        // Only kept for slow commands, and truncated.
+        std::string commands;
+    };
+
+    void recordCommand(CommandRecord record, const std::string& commands) EXCLUDES(mStatsLock);
+
     // Guards calls to execute().
     std::mutex mLock;
 
     std::unique_ptr<IptablesProcess> mIpRestore;
     std::unique_ptr<IptablesProcess> mIp6Restore;
+
+    android::netdutils::Executor* const mExecutor;
+
+    // Guards the spare processes. Never held while forking or waiting for a child, so that taking a
+    // spare is always fast.
+    std::mutex mStandbyLock;
+    std::unique_ptr<IptablesProcess> mIpRestoreStandby GUARDED_BY(mStandbyLock);
+    std::unique_ptr<IptablesProcess> mIp6RestoreStandby GUARDED_BY(mStandbyLock);
+    // Signalled when mReplenishScheduled becomes false.
+    std::condition_variable mStandbyCv;
+    // True from the time replenishStandby() is posted until it returns.
+    bool mReplenishScheduled GUARDED_BY(mStandbyLock) = false;
+    // Cleared by the destructor so that a pending replenishStandby() forks nothing more.
+    bool mRunning GUARDED_BY(mStandbyLock) = true;
+    // Times a child was replaced by a spare, and times there was no spare to replace it with.
+    uint32_t mStandbyHits GUARDED_BY(mStandbyLock) = 0;
+    uint32_t mStandbyMisses GUARDED_BY(mStandbyLock) = 0;
+
+    // Guards the statistics below. Separate from mLock so that dump() does not wait for a command
+    // that is stuck on the xtables lock.
+    std::mutex mStatsLock;
+    std::map<std::string, CallerStats> mCallerStats GUARDED_BY(mStatsLock);
+    std::deque<CommandRecord> mRecentCommands GUARDED_BY(mStatsLock);
+    std::deque<CommandRecord> mSlowCommands GUARDED_BY(mStatsLock);
 };
 
 #endif  // NETD_SERVER_IPTABLES_RESTORE_CONTROLLER_H
@@ -19,6 +19,7 @@
 #include <gtest/gtest.h>
 #include <sys/file.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 
 #include <cinttypes>
@@ -26,6 +27,7 @@
 #include <string>
 
 #define LOG_TAG "IptablesRestoreControllerTest"
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <log/log.h>
@@ -47,8 +49,11 @@
 #define IP6TABLES_COMM "(ip6tables-resto)"
 
 using android::base::Join;
+using android::base::WriteStringToFile;
 using android::base::StringAppendF;
 using android::base::StringPrintf;
+using android::netdutils::DumpWriter;
+using android::netdutils::Executor;
 using android::netdutils::ScopedMockSyscalls;
 using android::netdutils::Stopwatch;
 using testing::Return;
@@ -59,6 +64,7 @@ public:
   IptablesRestoreController con;
   int mDefaultMaxRetries = con.MAX_RETRIES;
   int mDefaultPollTimeoutMs = con.POLL_TIMEOUT_MS;
+  std::chrono::milliseconds mDefaultSlowCommandThreshold = con.SLOW_COMMAND_THRESHOLD;
   int mIptablesLock = -1;
   std::string mChainName;
 
@@ -71,6 +77,7 @@ public:
   void TearDown() {
     con.MAX_RETRIES = mDefaultMaxRetries;
     con.POLL_TIMEOUT_MS = mDefaultPollTimeoutMs;
+    con.SLOW_COMMAND_THRESHOLD = mDefaultSlowCommandThreshold;
     deleteTestChain();
   }
 
@@ -194,6 +201,21 @@ public:
     con.MAX_RETRIES = maxRetries;
     con.POLL_TIMEOUT_MS = pollTimeoutMs;
   }
+
+  void setSlowCommandThreshold(std::chrono::milliseconds threshold) {
+    con.SLOW_COMMAND_THRESHOLD = threshold;
+  }
+
+  static std::string callerOf(const std::string& commands) {
+    return IptablesRestoreController::callerOf(commands);
+  }
+
+  std::string dump() {
+    std::string out;
+    DumpWriter dw([&out](const std::string& line) { out += line; });
+    con.dump(dw);
+    return out;
+  }
 };
 
 TEST_F(IptablesRestoreControllerTest, TestBasicCommand) {
@@ -380,3 +402,157 @@ TEST_F(IptablesRestoreControllerTest, TestMemoryLeak) {
     EXPECT_GE(5U, getRssPages(pid4) - pages4) << "iptables-restore leaked too many pages";
     EXPECT_GE(5U, getRssPages(pid6) - pages6) << "ip6tables-restore leaked too many pages";
 }
+
+TEST_F(IptablesRestoreControllerTest, TestCallerOf) {
+    EXPECT_EQ("FirewallController", callerOf("*filter\n:fw_dozable -\n-A fw_dozable -j DROP\n"));
+    EXPECT_EQ("BandwidthController",
+              callerOf("*filter\n-I bw_penalty_box -m owner --uid-owner 10001 -j REJECT\n"));
+    EXPECT_EQ("TetherController", callerOf("*nat\n:tetherctrl_nat_POSTROUTING -\nCOMMIT\n"));
+    // The first netd chain wins, even if it is not the first word.
+    EXPECT_EQ("StrictController", callerOf("*filter\n-A st_OUTPUT -j bw_OUTPUT\n"));
+    EXPECT_EQ("other", callerOf("#Test\n"));
+    EXPECT_EQ("other", callerOf(""));
+}
+
+TEST_F(IptablesRestoreControllerTest, TestDump) {
+    // Every command is slow with a threshold of zero.
+    setSlowCommandThreshold(std::chrono::milliseconds(0));
+    EXPECT_EQ(0, con.execute(IptablesTarget::V4, "# fw_INPUT\n", nullptr));
+    EXPECT_EQ(-1, con.execute(IptablesTarget::V6, "malformed command\n", nullptr));
+
+    const std::string out = dump();
+    // The chain created by SetUp() counts as "other" too.
+    EXPECT_THAT(out, testing::HasSubstr("FirewallController: commands=1 failures=0"));
+    EXPECT_THAT(out, testing::HasSubstr("other: commands=2 failures=1"));
+    EXPECT_THAT(out, testing::HasSubstr("FirewallController v4 size=11 "));
+    EXPECT_THAT(out, testing::ContainsRegex("other v6 size=18 wait=[0-9]+ms exec=[0-9]+ms "
+                                            "result=-1"));
+    EXPECT_THAT(out, testing::HasSubstr("Slow commands (>=0ms):"));
+    EXPECT_THAT(out, testing::HasSubstr("      # fw_INPUT\n"));
+    EXPECT_THAT(out, testing::HasSubstr("      malformed command\n"));
+}
+
+// Runs a fake iptables-restore that echoes comments, like the real one does in verbose mode, and
+// exits with an error when it reads "#FAIL".
+class IptablesRestoreControllerStandbyTest : public ::testing::Test {
+  protected:
+    using ProcessType = IptablesRestoreController::IptablesProcessType;
+
+    void SetUp() override {
+        mFakePath = std::string(mTempDir.path) + "/fake-iptables-restore";
+        ASSERT_TRUE(WriteStringToFile("#!/system/bin/sh\n"
+                                      "while read -r line; do\n"
+                                      "    case \"$line\" in\n"
+                                      "        \"#FAIL\") echo \"fake failure\" >&2; exit 1 ;;\n"
+                                      "        \"#\"*) echo \"$line\" ;;\n"
+                                      "    esac\n"
+                                      "done\n",
+                                      mFakePath));
+        ASSERT_EQ(0, chmod(mFakePath.c_str(), 0700));
+        IptablesRestoreController::IPTABLES_RESTORE_PATH = mFakePath.c_str();
+        IptablesRestoreController::IP6TABLES_RESTORE_PATH = mFakePath.c_str();
+        mCon = std::make_unique<IptablesRestoreController>(&mExecutor);
+    }
+
+    void TearDown() override {
+        mExecutor.runPending();
+        mCon.reset();
+        IptablesRestoreController::IPTABLES_RESTORE_PATH = mDefaultPath;
+        IptablesRestoreController::IP6TABLES_RESTORE_PATH = mDefaultPath6;
+        unlink(mFakePath.c_str());
+    }
+
+    pid_t getIpRestorePid() {
+        return mCon->getIpRestorePid(IptablesRestoreController::IPTABLES_PROCESS);
+    }
+    pid_t getStandbyPid(ProcessType type = IptablesRestoreController::IPTABLES_PROCESS) {
+        return mCon->getStandbyPid(type);
+    }
+
+    const char* const mDefaultPath = IptablesRestoreController::IPTABLES_RESTORE_PATH;
+    const char* const mDefaultPath6 = IptablesRestoreController::IP6TABLES_RESTORE_PATH;
+    TemporaryDir mTempDir;
+    std::string mFakePath;
+    // Without threads, spare processes are only started by runPending().
+    Executor mExecutor{{.name = "iptables-test", .threads = 0}};
+    std::unique_ptr<IptablesRestoreController> mCon;
+};
+
+TEST_F(IptablesRestoreControllerStandbyTest, StartsSparesInBackground) {
+    EXPECT_EQ(0, getStandbyPid());
+    EXPECT_EQ(0, getStandbyPid(IptablesRestoreController::IP6TABLES_PROCESS));
+
+    EXPECT_EQ(1U, mExecutor.runPending());
+    const pid_t standby = getStandbyPid();
+    EXPECT_NE(0, standby);
+    EXPECT_NE(getIpRestorePid(), standby);
+    EXPECT_NE(0, getStandbyPid(IptablesRestoreController::IP6TABLES_PROCESS));
+
+    // Successful commands leave the spare alone.
+    std::string output;
+    EXPECT_EQ(0, mCon->execute(IptablesTarget::V4V6, "#Test\n", &output));
+    EXPECT_EQ("#Test\n#Test\n", output);
+    EXPECT_EQ(standby, getStandbyPid());
+    EXPECT_EQ(0U, mExecutor.runPending());
+}
+
+TEST_F(IptablesRestoreControllerStandbyTest, SwapsInSpareOnFailure) {
+    mExecutor.runPending();
+    const pid_t original = getIpRestorePid();
+    const pid_t standby = getStandbyPid();
+    ASSERT_NE(0, standby);
+
+    EXPECT_EQ(-1, mCon->execute(IptablesTarget::V4, "#FAIL\n", nullptr));
+    EXPECT_EQ(standby, getIpRestorePid());
+    EXPECT_EQ(0, getStandbyPid());
+
+    std::string output;
+    EXPECT_EQ(0, mCon->execute(IptablesTarget::V4, "#Test\n", &output));
+    EXPECT_EQ("#Test\n", output);
+    EXPECT_EQ(standby, getIpRestorePid());
+
+    // A new spare is started in the background.
+    EXPECT_EQ(1U, mExecutor.runPending());
+    const pid_t newStandby = getStandbyPid();
+    EXPECT_NE(0, newStandby);
+    EXPECT_NE(original, newStandby);
+    EXPECT_NE(standby, newStandby);
+}
+
+TEST_F(IptablesRestoreControllerStandbyTest, StopsSparesOnDestruction) {
+    mExecutor.runPending();
+    const pid_t standby = getStandbyPid();
+    const pid_t standby6 = getStandbyPid(IptablesRestoreController::IP6TABLES_PROCESS);
+    ASSERT_NE(0, standby);
+    ASSERT_NE(0, standby6);
+
+    mCon.reset();
+    // Reaped, so the pids no longer exist.
+    EXPECT_EQ(-1, kill(standby, 0));
+    EXPECT_EQ(ESRCH, errno);
+    EXPECT_EQ(-1, kill(standby6, 0));
+    EXPECT_EQ(ESRCH, errno);
+}
+
+TEST_F(IptablesRestoreControllerStandbyTest, DestructionWaitsForPendingReplenish) {
+    // The constructor posts replenishStandby(), which a worker thread may still be running while
+    // the controller is destroyed.
+    Executor executor({.name = "iptables-test-mt", .threads = 1});
+    for (int i = 0; i < 5; i++) {
+        auto con = std::make_unique<IptablesRestoreController>(&executor);
+        con.reset();
+    }
+    executor.waitForIdle();
+}
+
+TEST_F(IptablesRestoreControllerStandbyTest, ForksWithoutSpare) {
+    // The spares were never started.
+    const pid_t original = getIpRestorePid();
+    EXPECT_EQ(-1, mCon->execute(IptablesTarget::V4, "#FAIL\n", nullptr));
+    EXPECT_EQ(original, getIpRestorePid());
+
+    std::string output;
+    EXPECT_EQ(0, mCon->execute(IptablesTarget::V4, "#Test\n", &output));
+    EXPECT_EQ("#Test\n", output);
+    EXPECT_NE(original, getIpRestorePid());
+}
@@ -202,9 +202,8 @@ Status NFLogListener::unsubscribe(uint16_t nfLogGroup) {
     return ok;
 }
 
-StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener() {
+StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener(netdutils::EventLoop* eventLoop) {
     const auto& sys = sSyscalls.get();
-    ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
     const auto domain = AF_NETLINK;
     const auto flags = SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
     const auto protocol = NETLINK_NETFILTER;
@@ -213,8 +212,14 @@ StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener() {
     // Timestamps are disabled by default. Request RX timestamping
     RETURN_IF_NOT_OK(sys.setsockopt<int32_t>(sock, SOL_SOCKET, SO_TIMESTAMP, 1));
 
-    std::shared_ptr<NetlinkListenerInterface> listener =
-            std::make_unique<NetlinkListener>(std::move(event), std::move(sock), "NFLogListener");
+    std::shared_ptr<NetlinkListenerInterface> listener;
+    if (eventLoop != nullptr) {
+        listener = std::make_unique<NetlinkListener>(std::move(sock), "NFLogListener", eventLoop);
+    } else {
+        ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
+        listener = std::make_unique<NetlinkListener>(std::move(event), std::move(sock),
+                                                     "NFLogListener");
+    }
     const auto sendFn = [&listener](const Slice msg) { return listener->send(msg); };
     RETURN_IF_NOT_OK(cfgCmdPfUnbind(sendFn));
     return std::unique_ptr<NFLogListener>(new NFLogListener(std::move(listener)));
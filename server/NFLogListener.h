@@ -82,8 +82,10 @@ class NFLogListener : public NFLogListenerInterface {
 };
 
 // Allocate and return a new NFLogListener. On success, the returned
-// listener is ready to use with a running service thread.
-netdutils::StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener();
+// listener is ready to use with a running service thread, or, if
+// eventLoop is not null, serviced by eventLoop, which must outlive it.
+netdutils::StatusOr<std::unique_ptr<NFLogListener>> makeNFLogListener(
+        netdutils::EventLoop* eventLoop = nullptr);
 
 }  // namespace net
 }  // namespace android
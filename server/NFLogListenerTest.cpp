@@ -55,6 +55,7 @@ class MockNetlinkListener : public NetlinkListenerInterface {
     MOCK_METHOD1(unsubscribe, netdutils::Status(uint16_t type));
     MOCK_METHOD0(join, void());
     MOCK_METHOD1(registerSkErrorHandler, void(const SkErrorHandler& handler));
+    MOCK_METHOD1(registerOverflowHandler, void(const OverflowHandler& handler));
 };
 
 class NFLogListenerTest : public testing::Test {
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NetdDumpDecoder.h"
+
+#include <inttypes.h>
+
+#include <map>
+
+#include <android-base/stringprintf.h>
+
+namespace android {
+namespace net {
+
+using base::StringAppendF;
+using netd::NetdDumpProto;
+using netd::StatsValueProto;
+using netd::TrafficControllerProto;
+
+namespace {
+
+std::string ifaceName(const std::map<uint32_t, std::string>& names, uint32_t index) {
+    const auto it = names.find(index);
+    return it == names.end() ? "unknown" : it->second;
+}
+
+void printStats(std::string* out, const StatsValueProto& stats) {
+    StringAppendF(out, " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", stats.rx_bytes(),
+                  stats.rx_packets(), stats.tx_bytes(), stats.tx_packets());
+}
+
+void printTagStats(std::string* out, const char* mapName,
+                   const google::protobuf::RepeatedPtrField<TrafficControllerProto::TagStats>& map,
+                   const std::map<uint32_t, std::string>& names) {
+    StringAppendF(out,
+                  "%s: ifaceIndex ifaceName tag_hex uid_int cnt_set rxBytes rxPackets txBytes"
+                  " txPackets\n",
+                  mapName);
+    for (const auto& entry : map) {
+        StringAppendF(out, "  %u %s 0x%x %u %u", entry.iface_index(),
+                      ifaceName(names, entry.iface_index()).c_str(), entry.tag(), entry.uid(),
+                      entry.counter_set());
+        printStats(out, entry.stats());
+    }
+}
+
+void printTrafficController(std::string* out, const TrafficControllerProto& tc) {
+    StringAppendF(out, "TrafficController\n");
+    StringAppendF(out, "BPF module status: %s\n", tc.bpf_enabled() ? "enabled" : "disabled");
+    if (!tc.bpf_enabled()) return;
+
+    std::map<uint32_t, std::string> names;
+    for (const auto& entry : tc.iface_names()) {
+        names[entry.iface_index()] = entry.name();
+    }
+
+    StringAppendF(out, "mCookieTagMap:\n");
+    for (const auto& entry : tc.cookie_tags()) {
+        StringAppendF(out, "  cookie=%" PRIu64 " tag=0x%x uid=%u\n", entry.cookie(),
+                      entry.tag(), entry.uid());
+    }
+    StringAppendF(out, "mUidCounterSetMap:\n");
+    for (const auto& entry : tc.uid_counter_sets()) {
+        StringAppendF(out, "  %u %u\n", entry.uid(), entry.counter_set());
+    }
+    StringAppendF(out, "mAppUidStatsMap: uid rxBytes rxPackets txBytes txPackets\n");
+    for (const auto& entry : tc.app_uid_stats()) {
+        StringAppendF(out, "  %u", entry.uid());
+        printStats(out, entry.stats());
+    }
+    printTagStats(out, "mStatsMapA", tc.stats_map_a(), names);
+    printTagStats(out, "mStatsMapB", tc.stats_map_b(), names);
+    StringAppendF(out, "mIfaceIndexNameMap:\n");
+    for (const auto& [index, name] : names) {
+        StringAppendF(out, "  ifaceIndex=%u ifaceName=%s\n", index, name.c_str());
+    }
+    StringAppendF(out,
+                  "mIfaceStatsMap: ifaceIndex ifaceName rxBytes rxPackets txBytes txPackets\n");
+    for (const auto& entry : tc.iface_stats()) {
+        StringAppendF(out, "  %u %s", entry.iface_index(),
+                      ifaceName(names, entry.iface_index()).c_str());
+        printStats(out, entry.stats());
+    }
+    StringAppendF(out, "current ownerMatch configuration: 0x%x\n",
+                  tc.owner_match_configuration());
+    StringAppendF(out, "current statsMap configuration: %u\n", tc.stats_map_configuration());
+    StringAppendF(out, "mUidOwnerMap: uid rule_hex [iif]\n");
+    for (const auto& entry : tc.uid_owners()) {
+        if (entry.has_iif()) {
+            StringAppendF(out, "  %u 0x%x %s\n", entry.uid(), entry.rule(),
+                          ifaceName(names, entry.iif()).c_str());
+        } else {
+            StringAppendF(out, "  %u 0x%x\n", entry.uid(), entry.rule());
+        }
+    }
+    StringAppendF(out, "mUidPermissionMap: uid permission_hex\n");
+    for (const auto& entry : tc.uid_permissions()) {
+        StringAppendF(out, "  %u 0x%x\n", entry.uid(), entry.permission());
+    }
+    StringAppendF(out, "mPrivilegedUser:\n");
+    for (uint32_t uid : tc.privileged_uids()) {
+        StringAppendF(out, "  %u ALLOW_UPDATE_DEVICE_STATS\n", uid);
+    }
+    for (const auto& error : tc.errors()) {
+        StringAppendF(out, "error: %s\n", error.c_str());
+    }
+}
+
+}  // namespace
+
+std::string decodeNetdDump(const NetdDumpProto& dump) {
+    std::string out;
+    if (dump.has_traffic_controller()) {
+        printTrafficController(&out, dump.traffic_controller());
+    }
+    return out;
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "netd_dump.pb.h"
+
+namespace android {
+namespace net {
+
+// Formats the output of "dumpsys netd --proto" as text. Interface indexes are resolved with the
+// iface_names table in the dump itself.
+std::string decodeNetdDump(const netd::NetdDumpProto& dump);
+
+}  // namespace net
+}  // namespace android
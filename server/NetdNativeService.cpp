@@ -16,7 +16,10 @@
 
 #define LOG_TAG "Netd"
 
+#include <algorithm>
+#include <chrono>
 #include <cinttypes>
+#include <iterator>
 #include <numeric>
 #include <set>
 #include <string>
@@ -24,6 +27,8 @@
 #include <vector>
 
 #include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <binder/IPCThreadState.h>
@@ -32,9 +37,11 @@
 #include <cutils/properties.h>
 #include <log/log.h>
 #include <netdutils/DumpWriter.h>
+#include <netdutils/ParallelDump.h>
 #include <utils/Errors.h>
 #include <utils/String16.h>
 
+#include "BinderCallRecorder.h"
 #include "Controllers.h"
 #include "Fwmark.h"
 #include "InterfaceController.h"
@@ -48,14 +55,17 @@
 #include "android/net/BnNetd.h"
 #include "binder_utils/BinderUtil.h"
 #include "binder_utils/NetdPermissions.h"
+#include "netd_dump.pb.h"
 #include "netid_client.h"  // NETID_UNSET
 
 using android::base::StringPrintf;
 using android::base::WriteStringToFile;
 using android::net::TetherOffloadRuleParcel;
+using android::net::netd::NetdDumpProto;
 using android::net::TetherStatsParcel;
 using android::net::UidRangeParcel;
 using android::netdutils::DumpWriter;
+using android::netdutils::ParallelDump;
 using android::netdutils::ScopedIndent;
 using android::os::ParcelFileDescriptor;
 
@@ -64,6 +74,18 @@ namespace net {
 
 namespace {
 const char OPT_SHORT[] = "--short";
+// Writes a serialized NetdDumpProto instead of text. See netd_dump.proto.
+const char OPT_PROTO[] = "--proto";
+
+// How long dump() waits for each section. Sections render concurrently, so a bugreport waits for
+// the longest budget rather than their sum.
+constexpr std::chrono::milliseconds kDumpSectionBudget(2000);
+constexpr std::chrono::milliseconds kDumpTrafficBudget(5000);
+
+// Set to true to record binder calls from the time netd starts, e.g. to capture a boot sequence.
+const char kRecordBinderCallsProperty[] = "persist.netd.record_binder_calls";
+
+BinderCallRecorder gBinderCallRecorder;
 
 // The input permissions should be equivalent that this function would return ok if any of them is
 // granted.
@@ -166,12 +188,37 @@ bool contains(const Vector<String16>& words, const String16& word) {
     return false;
 }
 
+// Handles "dumpsys netd binder_trace [start [<max calls>] | stop]".
+status_t dumpBinderTrace(DumpWriter& dw, const Vector<String16>& args) {
+    if (args.size() > 1 && args[1] == String16("start")) {
+        size_t maxCalls = BinderCallRecorder::DEFAULT_MAX_CALLS;
+        if (args.size() > 2 && !base::ParseUint(String8(args[2]).string(), &maxCalls)) {
+            dw.println("Invalid number of calls: %s", String8(args[2]).string());
+            return BAD_VALUE;
+        }
+        gBinderCallRecorder.start(maxCalls);
+        dw.println("Recording up to %zu binder calls", maxCalls);
+    } else if (args.size() > 1 && args[1] == String16("stop")) {
+        gBinderCallRecorder.stop();
+        dw.println("Stopped recording binder calls");
+    } else {
+        gBinderCallRecorder.dump(dw);
+    }
+    return NO_ERROR;
+}
+
 }  // namespace
 
 NetdNativeService::NetdNativeService() {
+    if (base::GetBoolProperty(kRecordBinderCallsProperty, false)) {
+        gBinderCallRecorder.start();
+    }
     // register log callback to BnNetd::logFunc
-    BnNetd::logFunc = std::bind(binderCallLogFn, std::placeholders::_1,
-                                [](const std::string& msg) { gLog.info("%s", msg.c_str()); });
+    BnNetd::logFunc = [](const Json::Value& logTransaction) {
+        gBinderCallRecorder.record(logTransaction);
+        binderCallLogFn(logTransaction,
+                        [](const std::string& msg) { gLog.info("%s", msg.c_str()); });
+    };
 }
 
 status_t NetdNativeService::start() {
@@ -198,6 +245,12 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> &args) {
     // This method does not grab any locks. If individual classes need locking
     // their dump() methods MUST handle locking appropriately.
 
+    if (contains(args, String16(OPT_PROTO))) {
+        NetdDumpProto proto;
+        gCtls->trafficCtrl.dumpProto(proto.mutable_traffic_controller());
+        return proto.SerializeToFileDescriptor(fd) ? NO_ERROR : UNKNOWN_ERROR;
+    }
+
     DumpWriter dw(fd);
 
     if (!args.isEmpty() && args[0] == TcpSocketMonitor::DUMP_KEYWORD) {
@@ -207,6 +260,10 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> &args) {
       return NO_ERROR;
     }
 
+    if (!args.isEmpty() && args[0] == BinderCallRecorder::DUMP_KEYWORD) {
+        return dumpBinderTrace(dw, args);
+    }
+
     if (!args.isEmpty() && args[0] == TrafficController::DUMP_KEYWORD) {
         dw.blankline();
         gCtls->trafficCtrl.dump(dw, true);
@@ -216,43 +273,69 @@ status_t NetdNativeService::dump(int fd, const Vector<String16> &args) {
 
     process::dump(dw);
     dw.blankline();
-    gCtls->netCtrl.dump(dw);
-    dw.blankline();
-
-    gCtls->trafficCtrl.dump(dw, false);
-    dw.blankline();
-
-    gCtls->xfrmCtrl.dump(dw);
-    dw.blankline();
 
-    gCtls->clatdCtrl.dump(dw);
-    dw.blankline();
-
-    gCtls->tetherCtrl.dump(dw);
-    dw.blankline();
-
-    {
-        ScopedIndent indentLog(dw);
-        if (contains(args, String16(OPT_SHORT))) {
-            dw.println("Log: <omitted>");
+    // Sections render concurrently, each into its own buffer, so a controller that is slow or
+    // stuck on a lock delays the dump by at most its budget and does not block the others.
+    // Sections can outlive this call, so they only capture globals and copies.
+    const bool shortDump = contains(args, String16(OPT_SHORT));
+    ParallelDump sections(gCtls->dumpExecutor);
+    const auto withBlankline = [](auto dumpFn) {
+        return [dumpFn](DumpWriter& sectionDw) {
+            dumpFn(sectionDw);
+            sectionDw.blankline();
+        };
+    };
+    sections.add("NetworkController", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->netCtrl.dump(sectionDw); }));
+    sections.add("TrafficController", kDumpTrafficBudget,
+                 withBlankline([](DumpWriter& sectionDw) {
+                     gCtls->trafficCtrl.dump(sectionDw, false);
+                 }));
+    sections.add("XfrmController", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->xfrmCtrl.dump(sectionDw); }));
+    sections.add("ClatdController", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->clatdCtrl.dump(sectionDw); }));
+    sections.add("TetherController", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->tetherCtrl.dump(sectionDw); }));
+    sections.add("IptablesRestoreController", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) {
+                     gCtls->iptablesRestoreCtrl.dump(sectionDw);
+                 }));
+    sections.add("SockDiag", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { SockDiag::dump(sectionDw); }));
+    sections.add("Executor", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->executor.dump(sectionDw); }));
+    sections.add("EventLoop", kDumpSectionBudget,
+                 withBlankline([](DumpWriter& sectionDw) { gCtls->listenerLoop.dump(sectionDw); }));
+    sections.add("Log", kDumpSectionBudget, [shortDump](DumpWriter& sectionDw) {
+        ScopedIndent indentLog(sectionDw);
+        if (shortDump) {
+            sectionDw.println("Log: <omitted>");
         } else {
-            dw.println("Log:");
-            ScopedIndent indentLogEntries(dw);
-            gLog.forEachEntry([&dw](const std::string& entry) mutable { dw.println(entry); });
+            sectionDw.println("Log:");
+            ScopedIndent indentLogEntries(sectionDw);
+            gLog.forEachEntry(
+                    [&sectionDw](const std::string& entry) mutable { sectionDw.println(entry); });
         }
-        dw.blankline();
-    }
-
-    {
-        ScopedIndent indentLog(dw);
-        if (contains(args, String16(OPT_SHORT))) {
-            dw.println("UnsolicitedLog: <omitted>");
+        sectionDw.blankline();
+    });
+    sections.add("UnsolicitedLog", kDumpSectionBudget, [shortDump](DumpWriter& sectionDw) {
+        ScopedIndent indentLog(sectionDw);
+        if (shortDump) {
+            sectionDw.println("UnsolicitedLog: <omitted>");
         } else {
-            dw.println("UnsolicitedLog:");
-            ScopedIndent indentLogEntries(dw);
+            sectionDw.println("UnsolicitedLog:");
+            ScopedIndent indentLogEntries(sectionDw);
             gUnsolicitedLog.forEachEntry(
-                    [&dw](const std::string& entry) mutable { dw.println(entry); });
+                    [&sectionDw](const std::string& entry) mutable { sectionDw.println(entry); });
         }
+        sectionDw.blankline();
+    });
+    sections.run(dw);
+
+    {
+        ScopedIndent indentTimings(dw);
+        sections.dumpTimings(dw);
         dw.blankline();
     }
 
@@ -377,6 +460,29 @@ binder::Status NetdNativeService::networkDestroy(int32_t netId) {
     return statusFromErrcode(ret);
 }
 
+binder::Status NetdNativeService::networkProvision(const NetworkProvisionParcel& config) {
+    ENFORCE_NETWORK_STACK_PERMISSIONS();
+    NetworkController::NetworkConfig netConfig = {
+            .netId = static_cast<unsigned>(config.netId),
+            .vpn = config.vpn,
+            .permission = convertPermission(config.permission),
+            .secure = config.secure,
+            .interfaces = config.interfaces,
+            .uidRanges = UidRanges(config.uidRanges),
+    };
+    for (const RouteInfoParcel& route : config.routes) {
+        netConfig.routes.push_back({
+                .interface = route.ifName,
+                .destination = route.destination,
+                .nexthop = route.nextHop,
+                .mtu = route.mtu,
+        });
+    }
+    // NetworkController::provisionNetwork is thread-safe.
+    const int ret = gCtls->netCtrl.provisionNetwork(netConfig);
+    return statusFromErrcode(ret);
+}
+
 binder::Status NetdNativeService::networkAddInterface(int32_t netId, const std::string& iface) {
     ENFORCE_NETWORK_STACK_PERMISSIONS();
     int ret = gCtls->netCtrl.addInterfaceToNetwork(netId, iface.c_str());
@@ -444,6 +550,26 @@ binder::Status NetdNativeService::socketDestroy(const std::vector<UidRangeParcel
     return binder::Status::ok();
 }
 
+binder::Status NetdNativeService::socketDestroyForNetwork(int32_t netId,
+                                                          const std::vector<int32_t>& exemptUids) {
+    ENFORCE_NETWORK_STACK_PERMISSIONS();
+
+    SockDiag sd;
+    if (!sd.open()) {
+        return binder::Status::fromServiceSpecificError(EIO,
+                String8("Could not open SOCK_DIAG socket"));
+    }
+
+    int err = sd.destroySocketsForNetwork(netId,
+                                          std::set<uid_t>(exemptUids.begin(), exemptUids.end()),
+                                          true /* excludeLoopback */);
+    if (err) {
+        return binder::Status::fromServiceSpecificError(-err,
+                String8::format("destroySocketsForNetwork: %s", strerror(-err)));
+    }
+    return binder::Status::ok();
+}
+
 binder::Status NetdNativeService::tetherApplyDnsInterfaces(bool *ret) {
     NETD_LOCKING_RPC(gCtls->tetherCtrl.lock, PERM_NETWORK_STACK, PERM_MAINLINE_NETWORK_STACK);
     *ret = gCtls->tetherCtrl.applyDnsInterfaces();
@@ -871,8 +997,9 @@ binder::Status NetdNativeService::interfaceGetList(std::vector<std::string>* int
 
     interfaceListResult->clear();
     interfaceListResult->reserve(ifaceList.value().size());
-    interfaceListResult->insert(end(*interfaceListResult), begin(ifaceList.value()),
-                                end(ifaceList.value()));
+    std::copy_if(begin(ifaceList.value()), end(ifaceList.value()),
+                 std::back_inserter(*interfaceListResult),
+                 [](const auto& ifName) { return !ClatdController::isSpareTunName(ifName); });
 
     return binder::Status::ok();
 }
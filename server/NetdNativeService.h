@@ -72,6 +72,7 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     binder::Status networkCreatePhysical(int32_t netId, int32_t permission) override;
     binder::Status networkCreateVpn(int32_t netId, bool secure) override;
     binder::Status networkDestroy(int32_t netId) override;
+    binder::Status networkProvision(const NetworkProvisionParcel& config) override;
 
     binder::Status networkAddInterface(int32_t netId, const std::string& iface) override;
     binder::Status networkRemoveInterface(int32_t netId, const std::string& iface) override;
@@ -115,6 +116,8 @@ class NetdNativeService : public BinderService<NetdNativeService>, public BnNetd
     // SOCK_DIAG commands.
     binder::Status socketDestroy(const std::vector<UidRangeParcel>& uids,
                                  const std::vector<int32_t>& skipUids) override;
+    binder::Status socketDestroyForNetwork(int32_t netId,
+                                           const std::vector<int32_t>& exemptUids) override;
 
     binder::Status setIPv6AddrGenMode(const std::string& ifName, int32_t mode) override;
 
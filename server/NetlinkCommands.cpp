@@ -22,6 +22,8 @@
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #define LOG_TAG "Netd"
 #include <log/log.h>
 
@@ -78,6 +80,35 @@ int recvNetlinkAck(int sock) {
 #define OPTNONE /* nop */
 #endif
 
+// Writes a netlink request whose header is in iov[0] and possibly expects an ack, or processes the
+// dump if |callback| is not null.
+static int sendNetlinkIov(uint16_t flags, const iovec* iov, int iovlen,
+                          const NetlinkDumpCallback* callback) {
+    int sock = openNetlinkSocket(NETLINK_ROUTE);
+    if (sock < 0) {
+        return sock;
+    }
+
+    int ret = 0;
+
+    if (writev(sock, iov, iovlen) == -1) {
+        ret = -errno;
+        ALOGE("netlink socket connect/writev failed (%s)", strerror(-ret));
+        close(sock);
+        return ret;
+    }
+
+    if (flags & NLM_F_ACK) {
+        ret = recvNetlinkAck(sock);
+    } else if ((flags & NLM_F_DUMP) && callback != nullptr) {
+        ret = processNetlinkDump(sock, *callback);
+    }
+
+    close(sock);
+
+    return ret;
+}
+
 // Sends a netlink request and possibly expects an ack.
 // |iov| is an array of struct iovec that contains the netlink message payload.
 // The netlink header is generated by this function based on |action| and |flags|.
@@ -94,24 +125,90 @@ OPTNONE int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int
         nlmsg.nlmsg_len += iov[i].iov_len;
     }
 
+    return sendNetlinkIov(flags, iov, iovlen, callback);
+}
+
+int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen) {
+    return sendNetlinkRequest(action, flags, iov, iovlen, nullptr);
+}
+
+int sendNetlinkRequest(netdutils::Slice request) {
+    nlmsghdr nlmsg = {};
+    if (netdutils::extract(request, nlmsg) < sizeof(nlmsg)) {
+        return -EINVAL;
+    }
+    // There is no callback to process the replies to a dump.
+    if ((nlmsg.nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP) {
+        ALOGE("netlink dump requests need a callback");
+        return -EINVAL;
+    }
+
+    const iovec iov = {request.base(), request.size()};
+    return sendNetlinkIov(nlmsg.nlmsg_flags, &iov, 1, nullptr);
+}
+
+// Receives the ACK of one request of a batch. Returns 0 and sets |*error| to the result of the
+// request, or negative errno if no ACK could be received.
+static int recvBatchAck(int sock, int* error) {
+    struct {
+        nlmsghdr msg;
+        nlmsgerr err;
+    } response;
+
+    ssize_t ret = recv(sock, &response, sizeof(response), 0);
+    if (ret == -1) {
+        ret = -errno;
+        ALOGE("netlink recv failed (%s)", strerror(-ret));
+        return ret;
+    }
+    if (ret != sizeof(response) || response.msg.nlmsg_type != NLMSG_ERROR) {
+        ALOGE("bad netlink ACK (size %zd, type %u)", ret, response.msg.nlmsg_type);
+        return -EBADMSG;
+    }
+    *error = response.err.error;
+    return 0;
+}
+
+int sendNetlinkRequests(netdutils::Slice requests, size_t count, std::vector<int>* errors) {
+    errors->clear();
     int sock = openNetlinkSocket(NETLINK_ROUTE);
     if (sock < 0) {
         return sock;
     }
 
     int ret = 0;
+    while (ret == 0 && errors->size() < count) {
+        // Find the end of the next batch.
+        size_t batchLen = 0;
+        size_t batchCount = 0;
+        while (batchCount < kNetlinkBatchSize && errors->size() + batchCount < count) {
+            const netdutils::Slice rest = netdutils::drop(requests, batchLen);
+            nlmsghdr nlmsg = {};
+            if (netdutils::extract(rest, nlmsg) < sizeof(nlmsg) ||
+                nlmsg.nlmsg_len < sizeof(nlmsg) || nlmsg.nlmsg_len > rest.size() ||
+                !(nlmsg.nlmsg_flags & NLM_F_ACK)) {
+                ALOGE("malformed netlink request %zu of %zu", errors->size() + batchCount, count);
+                ret = -EINVAL;
+                break;
+            }
+            batchLen += std::min<size_t>(NLMSG_ALIGN(nlmsg.nlmsg_len), rest.size());
+            batchCount++;
+        }
+        if (ret) break;
 
-    if (writev(sock, iov, iovlen) == -1) {
-        ret = -errno;
-        ALOGE("netlink socket connect/writev failed (%s)", strerror(-ret));
-        close(sock);
-        return ret;
-    }
+        if (write(sock, requests.base(), batchLen) == -1) {
+            ret = -errno;
+            ALOGE("netlink socket write failed (%s)", strerror(-ret));
+            break;
+        }
+        requests = netdutils::drop(requests, batchLen);
 
-    if (flags & NLM_F_ACK) {
-        ret = recvNetlinkAck(sock);
-    } else if ((flags & NLM_F_DUMP) && callback != nullptr) {
-        ret = processNetlinkDump(sock, *callback);
+        // The kernel processes the requests in order and acknowledges each one.
+        for (size_t i = 0; i < batchCount && ret == 0; i++) {
+            int error = 0;
+            ret = recvBatchAck(sock, &error);
+            if (ret == 0) errors->push_back(error);
+        }
     }
 
     close(sock);
@@ -119,16 +216,15 @@ OPTNONE int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int
     return ret;
 }
 
-int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen) {
-    return sendNetlinkRequest(action, flags, iov, iovlen, nullptr);
-}
-
 int processNetlinkDump(int sock, const NetlinkDumpCallback& callback) {
     char buf[kNetlinkDumpBufferSize];
+    return processNetlinkDump(sock, callback, buf, sizeof(buf));
+}
 
+int processNetlinkDump(int sock, const NetlinkDumpCallback& callback, char* buf, size_t buflen) {
     ssize_t bytesread;
     do {
-        bytesread = read(sock, buf, sizeof(buf));
+        bytesread = read(sock, buf, buflen);
 
         if (bytesread < 0) {
             return -errno;
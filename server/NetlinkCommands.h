@@ -17,10 +17,12 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
 #include "NetdConstants.h"
+#include "netdutils/Slice.h"
 
 namespace android::net {
 
@@ -39,6 +41,9 @@ const uint16_t NETLINK_DUMP_FLAGS = NLM_F_REQUEST | NLM_F_DUMP;
 
 // Generic code for processing netlink dumps.
 const int kNetlinkDumpBufferSize = 8192;
+// Maximum number of requests sendNetlinkRequests() writes at once. Bounds the ACKs that can be
+// queued on the socket, which carry a copy of failed requests.
+const size_t kNetlinkBatchSize = 32;
 typedef std::function<void(nlmsghdr *)> NetlinkDumpCallback;
 typedef std::function<bool(nlmsghdr *)> NetlinkDumpFilter;
 
@@ -55,9 +60,27 @@ typedef std::function<bool(nlmsghdr *)> NetlinkDumpFilter;
 [[nodiscard]] int sendNetlinkRequest(uint16_t action, uint16_t flags, iovec* iov, int iovlen,
                                      const NetlinkDumpCallback* callback);
 
+// Sends a netlink request that is already serialized, including its header, e.g., by a
+// netdutils::NetlinkMessageWriter. Waits for an ACK if the request asks for one. Dump requests
+// are rejected with -EINVAL, since their replies would not be read.
+[[nodiscard]] int sendNetlinkRequest(netdutils::Slice request);
+
+// Sends |count| serialized requests, each of which must ask for an ACK, and collects their results
+// in |errors|, in order. The requests are written kNetlinkBatchSize at a time, so that a batch of
+// route or rule changes costs a few system calls instead of a socket, a write and a read each. The
+// kernel carries on with the remaining requests of a batch when one fails. Returns 0 if all the
+// requests were sent and acknowledged, even if some of them failed, or negative errno otherwise.
+[[nodiscard]] int sendNetlinkRequests(netdutils::Slice requests, size_t count,
+                                      std::vector<int>* errors);
+
 // Processes a netlink dump, passing every message to the specified |callback|.
 [[nodiscard]] int processNetlinkDump(int sock, const NetlinkDumpCallback& callback);
 
+// Same as above, but reads the dump into the caller-supplied buffer. Larger buffers let the kernel
+// pack more messages into each read.
+[[nodiscard]] int processNetlinkDump(int sock, const NetlinkDumpCallback& callback, char* buf,
+                                     size_t buflen);
+
 // Flushes netlink objects that take an rtmsg structure (FIB rules, routes...). |getAction| and
 // |deleteAction| specify the netlink message types, e.g., RTM_GETRULE and RTM_DELRULE.
 // |shouldDelete| specifies whether a given object should be deleted or not. |what| is a
@@ -14,11 +14,14 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 
 #define LOG_TAG "Netd"
 
@@ -29,9 +32,10 @@
 #include <netutils/ifc.h>
 #include <sysutils/NetlinkEvent.h>
 #include "Controllers.h"
+#include "InterfaceController.h"
 #include "NetlinkHandler.h"
+#include "NetlinkListener.h"
 #include "NetlinkManager.h"
-#include "SockDiag.h"
 
 #include <charconv>
 
@@ -85,6 +89,86 @@ int NetlinkHandler::stop() {
     return this->stopListener();
 }
 
+// True from the time an interface state resync is posted to the executor until it starts.
+static std::atomic_bool sResyncScheduled(false);
+
+// Re-reads the interfaces and addresses that netd otherwise learns from netlink events.
+static void resyncInterfaceState() {
+    const auto ifaces = InterfaceController::getIfaceList();
+    if (isOk(ifaces)) {
+        for (const auto& [name, index] : ifaces.value()) {
+            gCtls->trafficCtrl.addInterface(name.c_str(), index);
+        }
+        // Interface removals may have been lost too.
+        NetlinkManager::Instance()->updateRouteSocketFilter();
+    } else {
+        ALOGE("Unable to resync interfaces: %s", toString(ifaces).c_str());
+    }
+
+    const auto addresses = InterfaceController::getIfaceAddresses();
+    if (!isOk(addresses)) {
+        ALOGE("Unable to resync addresses: %s", toString(addresses).c_str());
+        return;
+    }
+    for (const std::string& address :
+         gCtls->netCtrl.resyncInterfaceAddresses(addresses.value())) {
+        // Strip the prefix length.
+        gCtls->sockDestroyQueue.enqueue(address.substr(0, address.find('/')));
+    }
+}
+
+static void scheduleInterfaceStateResync() {
+    // Overflows that happen before a scheduled resync starts are covered by it.
+    if (sResyncScheduled.exchange(true)) return;
+
+    const auto status = gCtls->executor.post(netdutils::Executor::Lane::BACKGROUND, [] {
+        sResyncScheduled = false;
+        resyncInterfaceState();
+    });
+    if (!isOk(status)) {
+        // The next overflow schedules another attempt.
+        ALOGE("Error scheduling interface state resync: %s", toString(status).c_str());
+        sResyncScheduled = false;
+    }
+}
+
+bool NetlinkHandler::onDataAvailable(SocketClient* cli) {
+    // The kernel reports lost messages by failing the next recvmsg() with ENOBUFS. The messages
+    // that are still queued are read on the next wakeup. The base class only returns false if
+    // recvmsg() failed, and logging the failure preserves errno.
+    if (::NetlinkListener::onDataAvailable(cli)) return true;
+    if (errno == ENOBUFS) {
+        onOverflow(cli->getSocket());
+    }
+    return false;
+}
+
+void NetlinkHandler::onOverflow(int sock) {
+    int protocol = -1;
+    socklen_t len = sizeof(protocol);
+    getsockopt(sock, SOL_SOCKET, SO_PROTOCOL, &protocol, &len);
+    const uint64_t overflows = ++mOverflows;
+    ALOGW("Netlink socket for protocol %d lost messages, %" PRIu64 " overflows so far", protocol,
+          overflows);
+
+    // Unqualified, NetlinkListener is the libsysutils base class.
+    const auto status = android::net::NetlinkListener::growReceiveBuffer(netdutils::Fd(sock));
+    if (!isOk(status)) {
+        ALOGE("Unable to grow netlink socket receive buffer: %s", toString(status).c_str());
+    }
+    // The other sockets report events, such as quota alerts, that netd keeps no state for.
+    if (protocol == NETLINK_ROUTE || protocol == NETLINK_KOBJECT_UEVENT) {
+        scheduleInterfaceStateResync();
+    }
+}
+
+// Whether evt is the "move" uevent of a spare clat tun interface being renamed.
+static bool isRenamedSpareTun(NetlinkEvent* evt) {
+    const char* oldPath = evt->findParam("DEVPATH_OLD");
+    const char* oldName = oldPath ? strrchr(oldPath, '/') : nullptr;
+    return oldName && ClatdController::isSpareTunName(oldName + 1);
+}
+
 static long parseIfIndex(const char* ifIndex) {
     if (ifIndex == nullptr) {
         return 0;
@@ -107,6 +191,12 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
     if (!strcmp(subsys, "net")) {
         NetlinkEvent::Action action = evt->getAction();
         const char *iface = evt->findParam("INTERFACE");
+        // Spare clat tun interfaces are internal to netd until they are renamed for clatd, which
+        // sends a "move" uevent that NetlinkEvent does not parse. Report the rename as an add.
+        if (iface && ClatdController::isSpareTunName(iface)) return;
+        if (action == NetlinkEvent::Action::kUnknown && isRenamedSpareTun(evt)) {
+            action = NetlinkEvent::Action::kAdd;
+        }
         if ((action == NetlinkEvent::Action::kAdd) ||
             (action == NetlinkEvent::Action::kLinkUp) ||
             (action == NetlinkEvent::Action::kLinkDown)) {
@@ -120,8 +210,10 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
         }
 
         if (action == NetlinkEvent::Action::kAdd) {
+            mNm->updateRouteSocketFilter();
             notifyInterfaceAdded(iface);
         } else if (action == NetlinkEvent::Action::kRemove) {
+            mNm->updateRouteSocketFilter();
             notifyInterfaceRemoved(iface);
         } else if (action == NetlinkEvent::Action::kChange) {
             evt->dump();
@@ -153,15 +245,9 @@ void NetlinkHandler::onEvent(NetlinkEvent *evt) {
             } else {  // action == NetlinkEvent::Action::kAddressRemoved
                 bool shouldDestroy = gCtls->netCtrl.removeInterfaceAddress(ifaceIndex, address);
                 if (shouldDestroy) {
-                    SockDiag sd;
-                    if (sd.open()) {
-                        int ret = sd.destroySockets(addrstr);
-                        if (ret < 0) {
-                            ALOGE("Error destroying sockets: %s", strerror(-ret));
-                        }
-                    } else {
-                        ALOGE("Error opening NETLINK_SOCK_DIAG socket: %s", strerror(errno));
-                    }
+                    // Don't block the listener thread on sock_diag dumps. Removals that arrive in
+                    // a burst are coalesced into a single dump.
+                    gCtls->sockDestroyQueue.enqueue(addrstr);
                 }
             }
             // Note: if this interface was deleted, iface is "" and we don't notify.
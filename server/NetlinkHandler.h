@@ -17,6 +17,7 @@
 #ifndef _NETLINKHANDLER_H
 #define _NETLINKHANDLER_H
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,8 @@ public:
 
   protected:
     virtual void onEvent(NetlinkEvent *evt);
+    // Lets ::NetlinkListener read the socket, and handles lost messages if that fails.
+    bool onDataAvailable(SocketClient* cli) override;
 
     void notifyInterfaceAdded(const std::string& ifName);
     void notifyInterfaceRemoved(const std::string& ifName);
@@ -56,6 +59,13 @@ public:
     void notifyRouteChange(bool updated, const std::string& route, const std::string& gateway,
                            const std::string& ifName);
     void notifyStrictCleartext(uid_t uid, const std::string& hex);
+
+  private:
+    // Grows the receive buffer and, if netd keeps state derived from the messages on sock,
+    // schedules a resync of that state.
+    void onOverflow(int sock);
+
+    std::atomic<uint64_t> mOverflows = 0;
 };
 
 }  // namespace net
@@ -18,10 +18,14 @@
 
 #include "NetlinkListener.h"
 
+#include <algorithm>
+#include <array>
+#include <cinttypes>
 #include <sstream>
 #include <vector>
 
 #include <linux/netfilter/nfnetlink.h>
+#include <sys/epoll.h>
 
 #include <log/log.h>
 #include <netdutils/Misc.h>
@@ -30,6 +34,7 @@
 namespace android {
 namespace net {
 
+using netdutils::EventLoop;
 using netdutils::Fd;
 using netdutils::Slice;
 using netdutils::Status;
@@ -59,6 +64,25 @@ const NetlinkListener::DispatchFn kDefaultDispatchFn = [](const nlmsghdr& nlmsg,
 
 NetlinkListener::NetlinkListener(UniqueFd event, UniqueFd sock, const std::string& name)
     : mEvent(std::move(event)), mSock(std::move(sock)), mThreadName(name) {
+    init();
+    // Start the thread
+    mWorker = std::thread([this]() { run().ignoreError(); });
+}
+
+NetlinkListener::NetlinkListener(UniqueFd sock, const std::string& name, EventLoop* loop)
+    : mSock(std::move(sock)), mThreadName(name), mLoop(loop) {
+    init();
+    // With EPOLLIN, the loop also reports EPOLLERR, which is how ENOBUFS is signalled.
+    auto id = mLoop->addFd(mSock, EPOLLIN, mThreadName, [this](uint32_t) { readBatch(); });
+    if (!isOk(id)) {
+        ALOGE("NetlinkListener(%s) cannot join the event loop: %s", mThreadName.c_str(),
+              toString(id).c_str());
+        return;
+    }
+    mSourceId = id.value();
+}
+
+void NetlinkListener::init() {
     const auto rxErrorHandler = [](const nlmsghdr& nlmsg, const Slice msg) {
         std::stringstream ss;
         ss << nlmsg << " " << msg << " " << netdutils::toHex(msg, 32);
@@ -69,12 +93,14 @@ NetlinkListener::NetlinkListener(UniqueFd event, UniqueFd sock, const std::strin
     mErrorHandler = [& name = mThreadName](const int fd, const int err) {
         ALOGE("Error on NetlinkListener(%s) fd=%d: %s", name.c_str(), fd, strerror(err));
     };
-
-    // Start the thread
-    mWorker = std::thread([this]() { run().ignoreError(); });
 }
 
 NetlinkListener::~NetlinkListener() {
+    if (mLoop != nullptr) {
+        // Waits for readBatch() to return if it is running.
+        if (mSourceId != 0) expectOk(mLoop->remove(mSourceId));
+        return;
+    }
     const auto& sys = sSyscalls.get();
     const uint64_t data = 1;
     // eventfd should never enter an error state unexpectedly
@@ -107,15 +133,75 @@ void NetlinkListener::registerSkErrorHandler(const SkErrorHandler& handler) {
     mErrorHandler = handler;
 }
 
-Status NetlinkListener::run() {
-    std::vector<char> rxbuf(4096);
+void NetlinkListener::registerOverflowHandler(const OverflowHandler& handler) {
+    std::lock_guard guard(mMutex);
+    mOverflowHandler = handler;
+}
+
+void NetlinkListener::handleOverflow() {
+    const uint64_t overflows = ++mOverflows;
+    ALOGW("NetlinkListener(%s) lost messages, %" PRIu64 " overflows so far", mThreadName.c_str(),
+          overflows);
+    if (const Status status = growReceiveBuffer(mSock); !isOk(status)) {
+        ALOGE("NetlinkListener(%s) cannot grow its receive buffer: %s", mThreadName.c_str(),
+              toString(status).c_str());
+    }
 
+    std::lock_guard guard(mMutex);
+    if (mOverflowHandler) mOverflowHandler();
+}
+
+Status NetlinkListener::growReceiveBuffer(Fd sock) {
+    const auto& sys = sSyscalls.get();
+    int size = 0;
+    socklen_t len = sizeof(size);
+    RETURN_IF_NOT_OK(sys.getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, &len));
+    if (size >= kMaxRcvBufSize) return ok;
+    // The kernel reports twice the size that was set, so setting the reported size doubles the
+    // buffer. SO_RCVBUFFORCE ignores net.core.rmem_max, but needs CAP_NET_ADMIN in the initial
+    // network namespace, so fall back to SO_RCVBUF elsewhere.
+    const int newSize = std::min(size, kMaxRcvBufSize / 2);
+    if (isOk(sys.setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &newSize, sizeof(newSize)))) {
+        return ok;
+    }
+    return sys.setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &newSize, sizeof(newSize));
+}
+
+void NetlinkListener::dispatch(const nlmsghdr& nlmsg, const Slice msg) {
+    std::lock_guard guard(mMutex);
+    const auto& fn = findWithDefault(mDispatchMap, nlmsg.nlmsg_type, kDefaultDispatchFn);
+    fn(nlmsg, msg);
+}
+
+void NetlinkListener::readBatch() {
+    // Drain up to kRxBatchSize datagrams per system call. Event storms (e.g., many NFLOG packets
+    // or address changes at once) are then handled in a few reads instead of one per datagram.
+    // Reading at most one batch per call keeps listeners that share an EventLoop from starving
+    // each other.
+    for (size_t i = 0; i < kRxBatchSize; i++) {
+        mRxIov[i] = {&mRxBuf[i * kRxBufferSize], kRxBufferSize};
+        mRxMsgs[i] = {.msg_hdr = {.msg_iov = &mRxIov[i], .msg_iovlen = 1}};
+    }
+    const auto& sys = sSyscalls.get();
+    auto rx = sys.recvmmsg(mSock, mRxMsgs, MSG_DONTWAIT);
+    int err = rx.status().code();
+    if (err) {
+        // The only error we expect to see here is ENOBUFS. The recvmmsg above will already
+        // have cleared the error indication and ensured we won't get EPOLLERR again, but
+        // the messages are gone, so let the subscribers know that they missed some.
+        if (err != EAGAIN) mErrorHandler(((Fd) mSock).get(), err);
+        if (err == ENOBUFS) handleOverflow();
+        return;
+    }
     const auto rxHandler = [this](const nlmsghdr& nlmsg, const Slice& buf) {
-        std::lock_guard guard(mMutex);
-        const auto& fn = findWithDefault(mDispatchMap, nlmsg.nlmsg_type, kDefaultDispatchFn);
-        fn(nlmsg, buf);
+        dispatch(nlmsg, buf);
     };
+    for (size_t i = 0; i < rx.value(); i++) {
+        forEachNetlinkMessage(Slice(mRxIov[i].iov_base, mRxMsgs[i].msg_len), rxHandler);
+    }
+}
 
+Status NetlinkListener::run() {
     if (mThreadName.length() > 0) {
         int ret = pthread_setname_np(pthread_self(), mThreadName.c_str());
         if (ret) {
@@ -133,17 +219,7 @@ Status NetlinkListener::run() {
             break;
         }
         if (revents[1] & (POLLIN|POLLERR)) {
-            auto rx = sys.recvfrom(mSock, makeSlice(rxbuf), 0);
-            int err = rx.status().code();
-            if (err) {
-                // Ignore errors. The only error we expect to see here is ENOBUFS, and there's
-                // nothing we can do about that. The recvfrom above will already have cleared the
-                // error indication and ensured we won't get EPOLLERR again.
-                // TODO: Consider using NETLINK_NO_ENOBUFS.
-                mErrorHandler(((Fd) mSock).get(), err);
-                continue;
-            }
-            forEachNetlinkMessage(rx.value(), rxHandler);
+            readBatch();
         }
     }
     return ok;
@@ -17,12 +17,18 @@
 #ifndef NETLINK_LISTENER_H
 #define NETLINK_LISTENER_H
 
+#include <sys/socket.h>
+
+#include <array>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/thread_annotations.h>
+#include <netdutils/EventLoop.h>
 #include <netdutils/Netlink.h>
 #include <netdutils/Slice.h>
 #include <netdutils/Status.h>
@@ -37,6 +43,8 @@ class NetlinkListenerInterface {
 
     using SkErrorHandler = std::function<void(const int fd, const int err)>;
 
+    using OverflowHandler = std::function<void()>;
+
     virtual ~NetlinkListenerInterface() = default;
 
     // Send message to the kernel using the underlying netlink socket
@@ -54,6 +62,11 @@ class NetlinkListenerInterface {
     virtual netdutils::Status unsubscribe(uint16_t type) = 0;
 
     virtual void registerSkErrorHandler(const SkErrorHandler& handler) = 0;
+
+    // Called on the service thread each time the socket receive buffer overflowed and messages
+    // were lost, so that the subscriber can resynchronize any state it derives from them. The
+    // handler must not block for long, since no messages are read while it runs.
+    virtual void registerOverflowHandler(const OverflowHandler& handler) = 0;
 };
 
 // NetlinkListener manages a netlink socket and associated blocking
@@ -73,10 +86,22 @@ class NetlinkListenerInterface {
 // Note that NetlinkListener is capable of processing multiple batched
 // netlink messages in a single system call. This is useful to
 // netfilter extensions that allow batching of events like NFLOG.
+//
+// By default each NetlinkListener has its own service thread. Listeners
+// can instead share the thread of a netdutils::EventLoop, which calls
+// them to read one batch of messages at a time.
+//
+// When the kernel drops messages because the receive buffer is full,
+// NetlinkListener counts the overflow, doubles the receive buffer (up
+// to kMaxRcvBufSize) so that the next burst is less likely to overflow,
+// and calls the overflow handler.
 class NetlinkListener : public NetlinkListenerInterface {
   public:
     NetlinkListener(netdutils::UniqueFd event, netdutils::UniqueFd sock, const std::string& name);
 
+    // Services sock on loop instead of a thread of its own. loop must outlive the listener.
+    NetlinkListener(netdutils::UniqueFd sock, const std::string& name, netdutils::EventLoop* loop);
+
     ~NetlinkListener() override;
 
     netdutils::Status send(const netdutils::Slice msg) override;
@@ -87,8 +112,30 @@ class NetlinkListener : public NetlinkListenerInterface {
 
     void registerSkErrorHandler(const SkErrorHandler& handler) override;
 
+    void registerOverflowHandler(const OverflowHandler& handler) override EXCLUDES(mMutex);
+
+    // Number of times the receive buffer overflowed.
+    uint64_t getOverflowCount() const { return mOverflows; }
+
+    // Largest receive buffer that overflows grow the socket to, as reported by SO_RCVBUF.
+    static constexpr int kMaxRcvBufSize = 4 * 1024 * 1024;
+
+    // Doubles the receive buffer of sock, up to kMaxRcvBufSize. NetlinkHandler also uses this for
+    // the sockets of the libsysutils listeners.
+    static netdutils::Status growReceiveBuffer(netdutils::Fd sock);
+
   private:
+    // Maximum number of datagrams read per system call, and the buffer size for each of them.
+    static constexpr size_t kRxBatchSize = 16;
+    static constexpr size_t kRxBufferSize = 4096;
+
+    void init();
     netdutils::Status run();
+    // Reads and dispatches up to kRxBatchSize datagrams. Only called on the service thread, or
+    // on the loop thread.
+    void readBatch() EXCLUDES(mMutex);
+    void dispatch(const nlmsghdr& nlmsg, const netdutils::Slice msg) EXCLUDES(mMutex);
+    void handleOverflow() EXCLUDES(mMutex);
 
     const netdutils::UniqueFd mEvent;
     const netdutils::UniqueFd mSock;
@@ -97,6 +144,14 @@ class NetlinkListener : public NetlinkListenerInterface {
     std::map<uint16_t, DispatchFn> mDispatchMap GUARDED_BY(mMutex);
     std::thread mWorker;
     SkErrorHandler mErrorHandler;
+    OverflowHandler mOverflowHandler GUARDED_BY(mMutex);
+    std::atomic<uint64_t> mOverflows = 0;
+    // Receive buffers, only used by readBatch().
+    std::vector<char> mRxBuf = std::vector<char>(kRxBatchSize * kRxBufferSize);
+    std::array<iovec, kRxBatchSize> mRxIov;
+    std::array<mmsghdr, kRxBatchSize> mRxMsgs;
+    netdutils::EventLoop* const mLoop = nullptr;
+    netdutils::EventLoop::SourceId mSourceId = 0;
 };
 
 }  // namespace net
@@ -37,8 +37,11 @@
 
 #include <arpa/inet.h>
 
+#include "InterfaceController.h"
 #include "NetlinkManager.h"
 #include "NetlinkHandler.h"
+#include "RouteController.h"
+#include "RouteSocketFilter.h"
 
 #include "pcap-netfilter-linux-android.h"
 
@@ -59,6 +62,7 @@ NetlinkManager *NetlinkManager::Instance() {
 
 NetlinkManager::NetlinkManager() {
     mBroadcaster = nullptr;
+    mRouteSock = -1;
 }
 
 NetlinkManager::~NetlinkManager() {
@@ -144,6 +148,7 @@ int NetlinkManager::start() {
          NetlinkListener::NETLINK_FORMAT_BINARY, false)) == nullptr) {
         return -1;
     }
+    updateRouteSocketFilter();
 
     if ((mQuotaHandler = setupSocket(&mQuotaSock, NETLINK_NFLOG,
             NFLOG_QUOTA_GROUP, NetlinkListener::NETLINK_FORMAT_BINARY, false)) == nullptr) {
@@ -160,6 +165,27 @@ int NetlinkManager::start() {
     return 0;
 }
 
+void NetlinkManager::updateRouteSocketFilter() {
+    const auto ifaces = InterfaceController::getIfaceList();
+    if (!isOk(ifaces)) {
+        // Keep the previous filter. It lets through the routes of interfaces created since.
+        ALOGE("Unable to update route socket filter: %s", toString(ifaces).c_str());
+        return;
+    }
+    std::set<uint32_t> tables;
+    for (const auto& [name, index] : ifaces.value()) {
+        tables.insert(index + RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX);
+    }
+
+    std::lock_guard guard(mRouteFilterLock);
+    if (mRouteSock == -1 || tables == mRouteFilterTables) return;
+    if (int ret = attachRouteSocketFilter(mRouteSock, tables)) {
+        ALOGE("Unable to attach route socket filter: %s", strerror(-ret));
+        return;
+    }
+    mRouteFilterTables = std::move(tables);
+}
+
 int NetlinkManager::stop() {
     int status = 0;
 
@@ -184,6 +210,11 @@ int NetlinkManager::stop() {
 
     close(mRouteSock);
     mRouteSock = -1;
+    {
+        // A new socket needs a new filter.
+        std::lock_guard guard(mRouteFilterLock);
+        mRouteFilterTables.clear();
+    }
 
     if (mQuotaHandler) {
         if (mQuotaHandler->stop()) {
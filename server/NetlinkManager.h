@@ -17,6 +17,11 @@
 #ifndef _NETLINKMANAGER_H
 #define _NETLINKMANAGER_H
 
+#include <cstdint>
+#include <mutex>
+#include <set>
+
+#include <android-base/thread_annotations.h>
 #include <sysutils/SocketListener.h>
 #include <sysutils/NetlinkListener.h>
 
@@ -40,6 +45,10 @@ private:
     int                  mQuotaSock;
     int                  mStrictSock;
 
+    std::mutex           mRouteFilterLock;
+    // Interface tables that the route socket filter was last built for.
+    std::set<uint32_t>   mRouteFilterTables GUARDED_BY(mRouteFilterLock);
+
 public:
     virtual ~NetlinkManager();
 
@@ -51,6 +60,10 @@ public:
 
     static NetlinkManager *Instance();
 
+    // Rebuilds the filter that drops irrelevant messages on the route socket for the current set
+    // of interfaces. Called when interfaces come and go.
+    void updateRouteSocketFilter() EXCLUDES(mRouteFilterLock);
+
     /* Group used by xt_quota2 */
     static const int NFLOG_QUOTA_GROUP;
     /* Group used by StrictController rules */
@@ -27,6 +27,8 @@
 
 #include "NetworkController.h"
 
+#include <algorithm>
+
 #include <android-base/strings.h>
 #include <cutils/misc.h>  // FIRST_APPLICATION_UID
 #include <netd_resolv/resolv.h>
@@ -137,9 +139,9 @@ int NetworkController::DelegateImpl::modifyFallthrough(const std::string& physic
     return 0;
 }
 
-NetworkController::NetworkController() :
+NetworkController::NetworkController(const std::string& connectPolicyPath) :
         mDelegateImpl(new NetworkController::DelegateImpl(this)), mDefaultNetId(NETID_UNSET),
-        mProtectableUsers({AID_VPN}) {
+        mProtectableUsers({AID_VPN}), mConnectPolicy(connectPolicyPath) {
     mNetworks[LOCAL_NET_ID] = new LocalNetwork(LOCAL_NET_ID);
     mNetworks[DUMMY_NET_ID] = new DummyNetwork(DUMMY_NET_ID);
 
@@ -171,6 +173,7 @@ int NetworkController::setDefaultNetwork(unsigned netId) {
     if (netId == mDefaultNetId) {
         return 0;
     }
+    mConnectPolicy.invalidate();
 
     if (netId != NETID_UNSET) {
         Network* network = getNetworkLocked(netId);
@@ -417,9 +420,7 @@ int NetworkController::createPhysicalOemNetwork(Permission permission, unsigned
     return ret;
 }
 
-int NetworkController::createVirtualNetwork(unsigned netId, bool secure) {
-    ScopedWLock lock(mRWLock);
-
+int NetworkController::createVirtualNetworkLocked(unsigned netId, bool secure) {
     if (!(MIN_NET_ID <= netId && netId <= MAX_NET_ID)) {
         ALOGE("invalid netId %u", netId);
         return -EINVAL;
@@ -437,9 +438,12 @@ int NetworkController::createVirtualNetwork(unsigned netId, bool secure) {
     return 0;
 }
 
-int NetworkController::destroyNetwork(unsigned netId) {
+int NetworkController::createVirtualNetwork(unsigned netId, bool secure) {
     ScopedWLock lock(mRWLock);
+    return createVirtualNetworkLocked(netId, secure);
+}
 
+int NetworkController::destroyNetworkLocked(unsigned netId) {
     if (netId == LOCAL_NET_ID) {
         ALOGE("cannot destroy local network");
         return -EINVAL;
@@ -484,14 +488,19 @@ int NetworkController::destroyNetwork(unsigned netId) {
         }
     }
 
+    android::net::gCtls->tcpSocketMonitor.removeNetwork(netId);
     updateTcpSocketMonitorPolling();
 
     return ret;
 }
 
-int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interface) {
+int NetworkController::destroyNetwork(unsigned netId) {
     ScopedWLock lock(mRWLock);
+    mConnectPolicy.invalidate();
+    return destroyNetworkLocked(netId);
+}
 
+int NetworkController::addInterfaceToNetworkLocked(unsigned netId, const char* interface) {
     if (!isValidNetworkLocked(netId)) {
         ALOGE("no such netId %u", netId);
         return -ENONET;
@@ -524,6 +533,77 @@ int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interfa
     return 0;
 }
 
+int NetworkController::addInterfaceToNetwork(unsigned netId, const char* interface) {
+    ScopedWLock lock(mRWLock);
+    return addInterfaceToNetworkLocked(netId, interface);
+}
+
+int NetworkController::checkNetworkConfigLocked(const NetworkConfig& config) const {
+    if (config.vpn) {
+        if (config.permission != PERMISSION_NONE) {
+            ALOGE("cannot set permissions on virtual network with netId %u", config.netId);
+            return -EINVAL;
+        }
+    } else if (!config.uidRanges.getRanges().empty()) {
+        ALOGE("cannot add users to non-virtual network with netId %u", config.netId);
+        return -EINVAL;
+    }
+    if (isValidNetworkLocked(config.netId)) {
+        ALOGE("duplicate netId %u", config.netId);
+        return -EEXIST;
+    }
+
+    for (const std::string& interface : config.interfaces) {
+        unsigned existingNetId = getNetworkForInterfaceLocked(interface.c_str());
+        if (existingNetId != NETID_UNSET) {
+            ALOGE("interface %s already assigned to netId %u", interface.c_str(), existingNetId);
+            return -EBUSY;
+        }
+    }
+    for (const auto& route : config.routes) {
+        if (std::find(config.interfaces.begin(), config.interfaces.end(), route.interface) ==
+            config.interfaces.end()) {
+            ALOGE("route interface %s not in netId %u", route.interface.c_str(), config.netId);
+            return -ENODEV;
+        }
+    }
+    return 0;
+}
+
+int NetworkController::provisionNetwork(const NetworkConfig& config) {
+    ScopedWLock lock(mRWLock);
+    mConnectPolicy.invalidate();
+
+    if (int ret = checkNetworkConfigLocked(config)) {
+        return ret;
+    }
+    const unsigned netId = config.netId;
+    int ret = config.vpn ? createVirtualNetworkLocked(netId, config.secure)
+                         : createPhysicalNetworkLocked(netId, config.permission);
+    if (ret) {
+        return ret;
+    }
+
+    for (const std::string& interface : config.interfaces) {
+        if ((ret = addInterfaceToNetworkLocked(netId, interface.c_str()))) break;
+    }
+    if (!ret && !config.uidRanges.getRanges().empty()) {
+        ret = addUsersToNetworkLocked(netId, config.uidRanges);
+    }
+    if (!ret) {
+        ret = RouteController::addRoutes(config.routes);
+    }
+
+    if (ret) {
+        // Removing the interfaces also flushes the routes from their tables.
+        ALOGE("Error %d provisioning netId %u, destroying it", ret, netId);
+        if (int err = destroyNetworkLocked(netId)) {
+            ALOGE("Error %d destroying partially provisioned netId %u", err, netId);
+        }
+    }
+    return ret;
+}
+
 int NetworkController::removeInterfaceFromNetwork(unsigned netId, const char* interface) {
     ScopedWLock lock(mRWLock);
 
@@ -542,9 +622,42 @@ Permission NetworkController::getPermissionForUser(uid_t uid) const {
 
 void NetworkController::setPermissionForUsers(Permission permission,
                                               const std::vector<uid_t>& uids) {
-    ScopedWLock lock(mRWLock);
-    for (uid_t uid : uids) {
-        mUsers[uid] = permission;
+    struct LostPermission {
+        unsigned netId;
+        Permission required;
+        std::set<uid_t> uids;
+    };
+    std::vector<LostPermission> lostPermissions;
+    {
+        ScopedWLock lock(mRWLock);
+        mConnectPolicy.invalidate();
+        // Only the sockets of the users that just lost access to a restricted network need to be
+        // destroyed, so pass that delta down instead of rescanning every socket on the network.
+        for (const auto& [netId, network] : mNetworks) {
+            if (network->getType() != Network::PHYSICAL) continue;
+            const Permission required = static_cast<PhysicalNetwork*>(network)->getPermission();
+            if (required == PERMISSION_NONE) continue;
+
+            std::set<uid_t> lostPermission;
+            for (uid_t uid : uids) {
+                const Permission previous = getPermissionForUserLocked(uid);
+                if ((previous & required) == required && (permission & required) != required) {
+                    lostPermission.insert(uid);
+                }
+            }
+            if (!lostPermission.empty()) {
+                lostPermissions.push_back({netId, required, std::move(lostPermission)});
+            }
+        }
+        for (uid_t uid : uids) {
+            mUsers[uid] = permission;
+        }
+    }
+
+    // Destroying sockets can take a while, so don't block other network operations on it. The new
+    // permissions are already in effect, so sockets these users open from now on lack them.
+    for (const auto& lost : lostPermissions) {
+        PhysicalNetwork::destroySocketsLackingPermission(lost.netId, lost.required, lost.uids);
     }
 }
 
@@ -574,8 +687,7 @@ int NetworkController::setPermissionForNetworks(Permission permission,
     return 0;
 }
 
-int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRanges) {
-    ScopedWLock lock(mRWLock);
+int NetworkController::addUsersToNetworkLocked(unsigned netId, const UidRanges& uidRanges) {
     Network* network = getNetworkLocked(netId);
     if (!network) {
         ALOGE("no such netId %u", netId);
@@ -591,8 +703,15 @@ int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRan
     return 0;
 }
 
+int NetworkController::addUsersToNetwork(unsigned netId, const UidRanges& uidRanges) {
+    ScopedWLock lock(mRWLock);
+    mConnectPolicy.invalidate();
+    return addUsersToNetworkLocked(netId, uidRanges);
+}
+
 int NetworkController::removeUsersFromNetwork(unsigned netId, const UidRanges& uidRanges) {
     ScopedWLock lock(mRWLock);
+    mConnectPolicy.invalidate();
     Network* network = getNetworkLocked(netId);
     if (!network) {
         ALOGE("no such netId %u", netId);
@@ -672,6 +791,17 @@ bool NetworkController::removeInterfaceAddress(unsigned ifindex, const char* add
     return true;
 }
 
+std::vector<std::string> NetworkController::resyncInterfaceAddresses(
+        std::unordered_map<std::string, std::unordered_set<unsigned>> addresses) {
+    ScopedWLock lock(mRWLock);
+    std::vector<std::string> removed;
+    for (const auto& entry : mAddressToIfindices) {
+        if (addresses.find(entry.first) == addresses.end()) removed.push_back(entry.first);
+    }
+    mAddressToIfindices = std::move(addresses);
+    return removed;
+}
+
 bool NetworkController::canProtectLocked(uid_t uid) const {
     return ((getPermissionForUserLocked(uid) & PERMISSION_SYSTEM) == PERMISSION_SYSTEM) ||
            mProtectableUsers.find(uid) != mProtectableUsers.end();
@@ -702,6 +832,7 @@ void NetworkController::dump(DumpWriter& dw) {
 
     dw.incIndent();
     dw.println("Default network: %u", mDefaultNetId);
+    dw.println("Connect policy generation: %u", mConnectPolicy.generation());
 
     dw.blankline();
     dw.println("Networks:");
@@ -20,8 +20,11 @@
 #include <android/multinetwork.h>
 
 
+#include "ConnectPolicyPublisher.h"
 #include "NetdConstants.h"
 #include "Permission.h"
+#include "RouteController.h"
+#include "UidRanges.h"
 #include "android/net/INetd.h"
 #include "netdutils/DumpWriter.h"
 
@@ -30,6 +33,7 @@
 #include <map>
 #include <set>
 #include <shared_mutex>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -71,7 +75,6 @@ static inline net_handle_t netIdToNetHandle(unsigned fromNetId) {
 }
 
 class Network;
-class UidRanges;
 class VirtualNetwork;
 
 /*
@@ -91,7 +94,25 @@ public:
     // Route mode for modify route
     enum RouteOperation { ROUTE_ADD, ROUTE_UPDATE, ROUTE_REMOVE };
 
-    NetworkController();
+    // Everything that provisionNetwork() sets up for a new network.
+    struct NetworkConfig {
+        unsigned netId = 0;
+        // Whether to create a VPN instead of a physical network.
+        bool vpn = false;
+        // Physical networks only.
+        Permission permission = PERMISSION_NONE;
+        // VPNs only.
+        bool secure = false;
+        std::vector<std::string> interfaces;
+        // Added to the tables of their interfaces, which must be in |interfaces|.
+        std::vector<RouteController::Route> routes;
+        // VPNs only.
+        UidRanges uidRanges;
+    };
+
+    // |connectPolicyPath| is where the ConnectPolicyPage is published. Tests pass a temporary path
+    // so that they do not invalidate what the clients on the device have learned.
+    explicit NetworkController(const std::string& connectPolicyPath = CONNECT_POLICY_PAGE_PATH);
 
     unsigned getDefaultNetwork() const;
     [[nodiscard]] int setDefaultNetwork(unsigned netId);
@@ -107,6 +128,11 @@ public:
     [[nodiscard]] int createVirtualNetwork(unsigned netId, bool secure);
     [[nodiscard]] int destroyNetwork(unsigned netId);
 
+    // Creates a network and adds its interfaces, users and routes while holding the lock, so that
+    // no other caller sees the network half set up. The routes are added with batched netlink
+    // requests. If any step fails, the network is destroyed again and the error is returned.
+    [[nodiscard]] int provisionNetwork(const NetworkConfig& config);
+
     [[nodiscard]] int addInterfaceToNetwork(unsigned netId, const char* interface);
     [[nodiscard]] int removeInterfaceFromNetwork(unsigned netId, const char* interface);
 
@@ -136,6 +162,12 @@ public:
     // Notes that the specified address has been removed from the specified interface.
     // Returns true if we should destroy sockets on this address.
     bool removeInterfaceAddress(unsigned ifIndex, const char* address);
+    // Replaces the addresses noted so far with |addresses|, e.g., as returned by
+    // InterfaceController::getIfaceAddresses(), after address notifications were lost. Returns
+    // the addresses that are no longer configured on any interface, whose sockets should be
+    // destroyed.
+    std::vector<std::string> resyncInterfaceAddresses(
+            std::unordered_map<std::string, std::unordered_set<unsigned>> addresses);
 
     bool canProtect(uid_t uid) const;
     void allowProtect(const std::vector<uid_t>& uids);
@@ -161,6 +193,12 @@ public:
     Permission getPermissionForUserLocked(uid_t uid) const;
     int checkUserNetworkAccessLocked(uid_t uid, unsigned netId) const;
     [[nodiscard]] int createPhysicalNetworkLocked(unsigned netId, Permission permission);
+    [[nodiscard]] int createVirtualNetworkLocked(unsigned netId, bool secure);
+    [[nodiscard]] int destroyNetworkLocked(unsigned netId);
+    [[nodiscard]] int addInterfaceToNetworkLocked(unsigned netId, const char* interface);
+    [[nodiscard]] int addUsersToNetworkLocked(unsigned netId, const UidRanges& uidRanges);
+    // Checks what can be checked about |config| without changing anything.
+    [[nodiscard]] int checkNetworkConfigLocked(const NetworkConfig& config) const;
 
     [[nodiscard]] int modifyRoute(unsigned netId, const char* interface, const char* destination,
                                   const char* nexthop, RouteOperation op, bool legacy, uid_t uid,
@@ -192,6 +230,10 @@ public:
     // we should fix it.
     std::unordered_map<std::string, std::unordered_set<unsigned>> mAddressToIfindices;
 
+    // Invalidated, under mRWLock, by every change to the state that getNetworkForConnect() and
+    // getPermissionForUser() read, i.e., everything that FwmarkServer uses in ON_CONNECT.
+    ConnectPolicyPublisher mConnectPolicy;
+
 };
 
 }  // namespace android::net
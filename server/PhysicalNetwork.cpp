@@ -83,6 +83,24 @@ int PhysicalNetwork::destroySocketsLackingPermission(Permission permission) {
     return 0;
 }
 
+/* static */
+int PhysicalNetwork::destroySocketsLackingPermission(unsigned netId, Permission permission,
+                                                     const std::set<uid_t>& uids) {
+    if (permission == PERMISSION_NONE || uids.empty()) return 0;
+
+    SockDiag sd;
+    if (!sd.open()) {
+       ALOGE("Error closing sockets for netId %d user permission change", netId);
+       return -EBADFD;
+    }
+    if (int ret = sd.destroySocketsLackingPermission(netId, uids, true /* excludeLoopback */)) {
+        ALOGE("Failed to close sockets for %zu users losing permission %d on netId %d: %s",
+              uids.size(), permission, netId, strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
+
 void PhysicalNetwork::invalidateRouteCache(const std::string& interface) {
     for (const auto& dst : { "0.0.0.0/0", "::/0" }) {
         // If any of these operations fail, there's no point in logging because RouteController will
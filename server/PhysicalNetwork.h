@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <set>
+
 #include "Network.h"
 #include "Permission.h"
 
@@ -39,6 +41,11 @@ class PhysicalNetwork : public Network {
     // These refer to permissions that apps must have in order to use this network.
     Permission getPermission() const;
     [[nodiscard]] int setPermission(Permission permission);
+    // Destroys the sockets on network |netId| owned by |uids|, which have just lost |permission|,
+    // the permission the network requires. Static so that it can run without holding the lock
+    // that protects the network.
+    static int destroySocketsLackingPermission(unsigned netId, Permission permission,
+                                               const std::set<uid_t>& uids);
 
     [[nodiscard]] int addAsDefault();
     [[nodiscard]] int removeAsDefault();
@@ -25,6 +25,7 @@
 
 #include <private/android_filesystem_config.h>
 
+#include <array>
 #include <map>
 
 #define LOG_TAG "Netd"
@@ -40,6 +41,7 @@
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include "log/log.h"
+#include "netdutils/NetlinkBuilder.h"
 #include "netid_client.h"
 #include "netutils/ifc.h"
 
@@ -47,6 +49,14 @@ using android::base::StartsWith;
 using android::base::StringPrintf;
 using android::base::WriteStringToFile;
 using android::net::UidRangeParcel;
+using android::netdutils::isOk;
+using android::netdutils::makeSlice;
+using android::netdutils::NetlinkAttr;
+using android::netdutils::NetlinkBytesAttr;
+using android::netdutils::NetlinkMessage;
+using android::netdutils::NetlinkMessageWriter;
+using android::netdutils::NetlinkNestedAttr;
+using android::netdutils::Status;
 
 namespace android::net {
 
@@ -103,33 +113,26 @@ const bool MODIFY_NON_UID_BASED_RULES = true;
 const char* const RT_TABLES_PATH = "/data/misc/net/rt_tables";
 const mode_t RT_TABLES_MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;  // mode 0644, rw-r--r--
 
-// Avoids "non-constant-expression cannot be narrowed from type 'unsigned int' to 'unsigned short'"
-// warnings when using RTA_LENGTH(x) inside static initializers (even when x is already uint16_t).
-static constexpr uint16_t U16_RTA_LENGTH(uint16_t x) {
-    return RTA_LENGTH(x);
-}
-
-// These are practically const, but can't be declared so, because they are used to initialize
-// non-const pointers ("void* iov_base") in iovec arrays.
-rtattr FRATTR_PRIORITY  = { U16_RTA_LENGTH(sizeof(uint32_t)),           FRA_PRIORITY };
-rtattr FRATTR_TABLE     = { U16_RTA_LENGTH(sizeof(uint32_t)),           FRA_TABLE };
-rtattr FRATTR_FWMARK    = { U16_RTA_LENGTH(sizeof(uint32_t)),           FRA_FWMARK };
-rtattr FRATTR_FWMASK    = { U16_RTA_LENGTH(sizeof(uint32_t)),           FRA_FWMASK };
-rtattr FRATTR_UID_RANGE = { U16_RTA_LENGTH(sizeof(fib_rule_uid_range)), FRA_UID_RANGE };
-
-rtattr RTATTR_TABLE     = { U16_RTA_LENGTH(sizeof(uint32_t)),           RTA_TABLE };
-rtattr RTATTR_OIF       = { U16_RTA_LENGTH(sizeof(uint32_t)),           RTA_OIF };
-rtattr RTATTR_PRIO      = { U16_RTA_LENGTH(sizeof(uint32_t)),           RTA_PRIORITY };
-
-// One or more nested attributes in the RTA_METRICS attribute.
-rtattr RTATTRX_MTU      = { U16_RTA_LENGTH(sizeof(uint32_t)),           RTAX_MTU};
-constexpr size_t RTATTRX_MTU_SIZE = RTA_SPACE(sizeof(uint32_t));
-
-// The RTA_METRICS attribute itself.
-constexpr size_t RTATTR_METRICS_SIZE = RTATTRX_MTU_SIZE;
-rtattr RTATTR_METRICS   = { U16_RTA_LENGTH(RTATTR_METRICS_SIZE),         RTA_METRICS };
-
-uint8_t PADDING_BUFFER[RTA_ALIGNTO] = {0, 0, 0, 0};
+// Layouts of the rule and route requests sent by modifyIpRule and modifyIpRoute.
+using FraPriority = NetlinkAttr<FRA_PRIORITY, uint32_t>;
+using FraTable = NetlinkAttr<FRA_TABLE, uint32_t>;
+using FraFwmark = NetlinkAttr<FRA_FWMARK, uint32_t>;
+using FraFwmask = NetlinkAttr<FRA_FWMASK, uint32_t>;
+using FraUidRange = NetlinkAttr<FRA_UID_RANGE, fib_rule_uid_range>;
+using FraIifName = NetlinkBytesAttr<FRA_IIFNAME, IFNAMSIZ>;
+using FraOifName = NetlinkBytesAttr<FRA_OIFNAME, IFNAMSIZ>;
+using RuleMessage = NetlinkMessage<fib_rule_hdr, FraPriority, FraTable, FraFwmark, FraFwmask,
+                                   FraUidRange, FraIifName, FraOifName>;
+
+using RtaTable = NetlinkAttr<RTA_TABLE, uint32_t>;
+using RtaDst = NetlinkBytesAttr<RTA_DST, sizeof(in6_addr)>;
+using RtaOif = NetlinkAttr<RTA_OIF, uint32_t>;
+using RtaGateway = NetlinkBytesAttr<RTA_GATEWAY, sizeof(in6_addr)>;
+using RtaxMtu = NetlinkAttr<RTAX_MTU, uint32_t>;
+using RtaMetrics = NetlinkNestedAttr<RTA_METRICS, RtaxMtu>;
+using RtaPriority = NetlinkAttr<RTA_PRIORITY, uint32_t>;
+using RouteMessage =
+        NetlinkMessage<rtmsg, RtaTable, RtaDst, RtaOif, RtaGateway, RtaMetrics, RtaPriority>;
 
 // END CONSTANTS ----------------------------------------------------------------------------------
 
@@ -230,11 +233,11 @@ void RouteController::updateTableNamesFile() {
     }
 }
 
+// Copies |input| into |name| and sets |length| to its length including the terminating NULL.
 // Returns 0 on success or negative errno on failure.
-int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* padding) {
+int copyInterfaceName(const char* input, char* name, size_t* length) {
     if (!input) {
         *length = 0;
-        *padding = 0;
         return 0;
     }
     *length = strlcpy(name, input, IFNAMSIZ) + 1;
@@ -242,7 +245,6 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
         ALOGE("interface name too long (%zu > %u)", *length, IFNAMSIZ);
         return -ENAMETOOLONG;
     }
-    *padding = RTA_SPACE(*length) - RTA_LENGTH(*length);
     return 0;
 }
 
@@ -272,11 +274,10 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
     // kernels will refuse to delete rules.
     char iifName[IFNAMSIZ], oifName[IFNAMSIZ];
     size_t iifLength, oifLength;
-    uint16_t iifPadding, oifPadding;
-    if (int ret = padInterfaceName(iif, iifName, &iifLength, &iifPadding)) {
+    if (int ret = copyInterfaceName(iif, iifName, &iifLength)) {
         return ret;
     }
-    if (int ret = padInterfaceName(oif, oifName, &oifLength, &oifPadding)) {
+    if (int ret = copyInterfaceName(oif, oifName, &oifLength)) {
         return ret;
     }
 
@@ -288,12 +289,12 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
 
     bool isUidRule = (uidStart != INVALID_UID);
 
-    // Assemble a rule request and put it in an array of iovec structures.
-    fib_rule_hdr rule = {
-        .action = ruleType,
-        // Note that here we're implicitly setting rule.table to 0. When we want to specify a
-        // non-zero table, we do this via the FRATTR_TABLE attribute.
-    };
+    // Assemble a rule request.
+    RuleMessage msg;
+    fib_rule_hdr& rule = msg.family;
+    rule.action = ruleType;
+    // Note that here we're implicitly setting rule.table to 0. When we want to specify a
+    // non-zero table, we do this via the FRA_TABLE attribute.
 
     // Don't ever create a rule that looks up table 0, because table 0 is the local table.
     // It's OK to specify a table ID of 0 when deleting a rule, because that doesn't actually select
@@ -303,35 +304,24 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
         return -ENOTUNIQ;
     }
 
-    rtattr fraIifName = { U16_RTA_LENGTH(iifLength), FRA_IIFNAME };
-    rtattr fraOifName = { U16_RTA_LENGTH(oifLength), FRA_OIFNAME };
-    struct fib_rule_uid_range uidRange = { uidStart, uidEnd };
-
-    iovec iov[] = {
-        { nullptr,              0 },
-        { &rule,             sizeof(rule) },
-        { &FRATTR_PRIORITY,  sizeof(FRATTR_PRIORITY) },
-        { &priority,         sizeof(priority) },
-        { &FRATTR_TABLE,     table != RT_TABLE_UNSPEC ? sizeof(FRATTR_TABLE) : 0 },
-        { &table,            table != RT_TABLE_UNSPEC ? sizeof(table) : 0 },
-        { &FRATTR_FWMARK,    mask ? sizeof(FRATTR_FWMARK) : 0 },
-        { &fwmark,           mask ? sizeof(fwmark) : 0 },
-        { &FRATTR_FWMASK,    mask ? sizeof(FRATTR_FWMASK) : 0 },
-        { &mask,             mask ? sizeof(mask) : 0 },
-        { &FRATTR_UID_RANGE, isUidRule ? sizeof(FRATTR_UID_RANGE) : 0 },
-        { &uidRange,         isUidRule ? sizeof(uidRange) : 0 },
-        { &fraIifName,       iif != IIF_NONE ? sizeof(fraIifName) : 0 },
-        { iifName,           iifLength },
-        { PADDING_BUFFER,    iifPadding },
-        { &fraOifName,       oif != OIF_NONE ? sizeof(fraOifName) : 0 },
-        { oifName,           oifLength },
-        { PADDING_BUFFER,    oifPadding },
-    };
+    msg.get<FraPriority>().set(priority);
+    msg.get<FraTable>().set(table, table != RT_TABLE_UNSPEC);
+    msg.get<FraFwmark>().set(fwmark, mask != 0);
+    msg.get<FraFwmask>().set(mask, mask != 0);
+    msg.get<FraUidRange>().set({uidStart, uidEnd}, isUidRule);
+    msg.get<FraIifName>().set(iifName, iifLength, iif != IIF_NONE);
+    msg.get<FraOifName>().set(oifName, oifLength, oif != OIF_NONE);
 
     uint16_t flags = (action == RTM_NEWRULE) ? NETLINK_RULE_CREATE_FLAGS : NETLINK_REQUEST_FLAGS;
+    std::array<uint8_t, RuleMessage::kMaxSize> buf;
     for (size_t i = 0; i < ARRAY_SIZE(AF_FAMILIES); ++i) {
         rule.family = AF_FAMILIES[i];
-        if (int ret = sendNetlinkRequest(action, flags, iov, ARRAY_SIZE(iov), nullptr)) {
+        NetlinkMessageWriter writer(makeSlice(buf));
+        if (Status status = writer.append(action, flags, msg); !isOk(status)) {
+            ALOGE("Error assembling rule: %s", status.msg().c_str());
+            return -status.code();
+        }
+        if (int ret = sendNetlinkRequest(writer.messages())) {
             if (!(action == RTM_DELRULE && ret == -ENOENT && priority == RULE_PRIORITY_TETHERING)) {
                 // Don't log when deleting a tethering rule that's not there. This matches the
                 // behaviour of clearTetheringRules, which ignores ENOENT in this case.
@@ -358,10 +348,11 @@ int padInterfaceName(const char* input, char* name, size_t* length, uint16_t* pa
                         INVALID_UID);
 }
 
-// Adds or deletes an IPv4 or IPv6 route.
+// Appends a request that adds or deletes an IPv4 or IPv6 route to |writer|.
 // Returns 0 on success or negative errno on failure.
-int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* interface,
-                  const char* destination, const char* nexthop, uint32_t mtu) {
+[[nodiscard]] static int appendIpRoute(NetlinkMessageWriter* writer, uint16_t action,
+                                       uint16_t flags, uint32_t table, const char* interface,
+                                       const char* destination, const char* nexthop, uint32_t mtu) {
     // At least the destination must be non-null.
     if (!destination) {
         ALOGE("null destination");
@@ -385,7 +376,7 @@ int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* i
     }
 
     uint8_t type = RTN_UNICAST;
-    uint32_t ifindex;
+    uint32_t ifindex = 0;
     uint8_t rawNexthop[sizeof(in6_addr)];
 
     if (nexthop && !strcmp(nexthop, "unreachable")) {
@@ -418,35 +409,23 @@ int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* i
 
     bool isDefaultThrowRoute = (type == RTN_THROW && prefixLength == 0);
 
-    // Assemble a rtmsg and put it in an array of iovec structures.
-    rtmsg route = {
+    // Assemble a route request.
+    RouteMessage msg;
+    msg.family = {
             .rtm_family = family,
             .rtm_dst_len = prefixLength,
             .rtm_protocol = RTPROT_STATIC,
             .rtm_scope = static_cast<uint8_t>(nexthop ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK),
             .rtm_type = type,
     };
-
-    rtattr rtaDst     = { U16_RTA_LENGTH(rawLength), RTA_DST };
-    rtattr rtaGateway = { U16_RTA_LENGTH(rawLength), RTA_GATEWAY };
-
-    iovec iov[] = {
-        { nullptr,         0 },
-        { &route,          sizeof(route) },
-        { &RTATTR_TABLE,   sizeof(RTATTR_TABLE) },
-        { &table,          sizeof(table) },
-        { &rtaDst,         sizeof(rtaDst) },
-        { rawAddress,      static_cast<size_t>(rawLength) },
-        { &RTATTR_OIF,     interface != OIF_NONE ? sizeof(RTATTR_OIF) : 0 },
-        { &ifindex,        interface != OIF_NONE ? sizeof(ifindex) : 0 },
-        { &rtaGateway,     nexthop ? sizeof(rtaGateway) : 0 },
-        { rawNexthop,      nexthop ? static_cast<size_t>(rawLength) : 0 },
-        { &RTATTR_METRICS, mtu != 0 ? sizeof(RTATTR_METRICS) : 0 },
-        { &RTATTRX_MTU,    mtu != 0 ? sizeof(RTATTRX_MTU) : 0 },
-        { &mtu,            mtu != 0 ? sizeof(mtu) : 0 },
-        { &RTATTR_PRIO,    isDefaultThrowRoute ? sizeof(RTATTR_PRIO) : 0 },
-        { &PRIO_THROW,     isDefaultThrowRoute ? sizeof(PRIO_THROW) : 0 },
-    };
+    msg.get<RtaTable>().set(table);
+    msg.get<RtaDst>().set(rawAddress, rawLength);
+    msg.get<RtaOif>().set(ifindex, interface != OIF_NONE);
+    msg.get<RtaGateway>().set(rawNexthop, rawLength, nexthop != nullptr);
+    auto& metrics = msg.get<RtaMetrics>();
+    metrics.present = (mtu != 0);
+    metrics.get<RtaxMtu>().set(mtu);
+    msg.get<RtaPriority>().set(PRIO_THROW, isDefaultThrowRoute);
 
     // Allow creating multiple link-local routes in the same table, so we can make IPv6
     // work on all interfaces in the local_network table.
@@ -454,7 +433,24 @@ int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* i
         flags &= ~NLM_F_EXCL;
     }
 
-    int ret = sendNetlinkRequest(action, flags, iov, ARRAY_SIZE(iov), nullptr);
+    if (Status status = writer->append(action, flags, msg); !isOk(status)) {
+        ALOGE("Error assembling route %s: %s", destination, status.msg().c_str());
+        return -status.code();
+    }
+    return 0;
+}
+
+// Adds or deletes an IPv4 or IPv6 route.
+// Returns 0 on success or negative errno on failure.
+int modifyIpRoute(uint16_t action, uint16_t flags, uint32_t table, const char* interface,
+                  const char* destination, const char* nexthop, uint32_t mtu) {
+    std::array<uint8_t, RouteMessage::kMaxSize> buf;
+    NetlinkMessageWriter writer(makeSlice(buf));
+    if (int ret = appendIpRoute(&writer, action, flags, table, interface, destination, nexthop,
+                                mtu)) {
+        return ret;
+    }
+    int ret = sendNetlinkRequest(writer.messages());
     if (ret) {
         ALOGE("Error %s route %s -> %s %s to table %u: %s",
               actionName(action), destination, nexthop, interface, table, strerror(-ret));
@@ -1152,6 +1148,39 @@ int RouteController::updateRoute(const char* interface, const char* destination,
                        tableType, mtu);
 }
 
+int RouteController::addRoutes(const std::vector<Route>& routes) {
+    if (routes.empty()) return 0;
+
+    std::vector<uint8_t> buf(routes.size() * RouteMessage::kMaxSize);
+    NetlinkMessageWriter writer(makeSlice(buf));
+    for (const Route& route : routes) {
+        const char* interface = route.interface.c_str();
+        const uint32_t table = getRouteTableForInterface(interface);
+        if (table == RT_TABLE_UNSPEC) {
+            return -ESRCH;
+        }
+        const char* nexthop = route.nexthop.empty() ? nullptr : route.nexthop.c_str();
+        if (int ret = appendIpRoute(&writer, RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table,
+                                    interface, route.destination.c_str(), nexthop, route.mtu)) {
+            return ret;
+        }
+    }
+
+    std::vector<int> errors;
+    if (int ret = sendNetlinkRequests(writer.messages(), writer.count(), &errors)) {
+        return ret;
+    }
+    int ret = 0;
+    for (size_t i = 0; i < errors.size(); i++) {
+        // Trying to add a route that already exists shouldn't cause an error.
+        if (errors[i] == 0 || errors[i] == -EEXIST) continue;
+        ALOGE("Error adding route %s -> %s %s: %s", routes[i].destination.c_str(),
+              routes[i].nexthop.c_str(), routes[i].interface.c_str(), strerror(-errors[i]));
+        if (!ret) ret = errors[i];
+    }
+    return ret;
+}
+
 int RouteController::enableTethering(const char* inputInterface, const char* outputInterface) {
     return modifyTetheredNetwork(RTM_NEWRULE, inputInterface, outputInterface);
 }
@@ -25,6 +25,8 @@
 #include <sys/types.h>
 #include <map>
 #include <mutex>
+#include <string>
+#include <vector>
 
 namespace android::net {
 
@@ -96,6 +98,20 @@ public:
     [[nodiscard]] static int updateRoute(const char* interface, const char* destination,
                                          const char* nexthop, TableType tableType, int mtu);
 
+    struct Route {
+        std::string interface;
+        std::string destination;
+        // Empty for a directly-connected route, otherwise as |nexthop| above.
+        std::string nexthop;
+        int mtu = 0;
+    };
+
+    // Adds routes to the tables of their interfaces, like addRoute() with TableType INTERFACE, but
+    // with batched netlink requests. Nothing is sent if a route cannot be parsed. Otherwise all the
+    // routes are sent, and the first error is returned; routes that could be added are not
+    // removed.
+    [[nodiscard]] static int addRoutes(const std::vector<Route>& routes);
+
     [[nodiscard]] static int enableTethering(const char* inputInterface,
                                              const char* outputInterface);
     [[nodiscard]] static int disableTethering(const char* inputInterface,
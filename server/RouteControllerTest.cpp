@@ -99,6 +99,29 @@ TEST_F(RouteControllerTest, TestRouteFlush) {
                             nullptr, 0 /* mtu */));
 }
 
+TEST_F(RouteControllerTest, TestAddRoutes) {
+    const uint32_t table = RouteController::getRouteTableForInterface("lo");
+    ASSERT_NE(static_cast<uint32_t>(RT_TABLE_UNSPEC), table);
+
+    // More routes than fit in one batch, and one that is already there.
+    std::vector<RouteController::Route> routes;
+    for (size_t i = 0; i < 2 * kNetlinkBatchSize + 1; i++) {
+        routes.push_back({"lo", StringPrintf("192.0.2.%zu/32", i), "", 0});
+    }
+    routes.push_back(routes.front());
+    EXPECT_EQ(0, RouteController::addRoutes(routes));
+    for (size_t i = 0; i < 2 * kNetlinkBatchSize + 1; i++) {
+        EXPECT_EQ(-EEXIST, modifyIpRoute(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, table, "lo",
+                                         routes[i].destination.c_str(), nullptr, 0 /* mtu */));
+    }
+
+    EXPECT_EQ(-EINVAL, RouteController::addRoutes({{"lo", "192.0.2.200/32", "2001:db8::1", 0}}));
+    EXPECT_EQ(-ESRCH, RouteController::addRoutes(
+                              {{"netdtest_nonexistent", "192.0.2.201/32", "", 0}}));
+
+    EXPECT_EQ(0, flushRoutes(table));
+}
+
 TEST_F(RouteControllerTest, TestModifyIncomingPacketMark) {
   uint32_t mask = ~Fwmark::getUidBillingMask();
 
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RouteSocketFilter.h"
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netinet/icmp6.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+
+#include "RouteController.h"
+
+namespace android::net {
+
+namespace {
+
+// Return values of the filter: the number of bytes of the message to keep.
+constexpr uint32_t kAccept = 0xffffffff;
+constexpr uint32_t kDrop = 0;
+
+constexpr bool kLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+constexpr uint32_t kTypeOffset = offsetof(nlmsghdr, nlmsg_type);
+constexpr uint32_t kRtmOffset = NLMSG_HDRLEN;
+constexpr uint32_t kRtmFamilyOffset = kRtmOffset + offsetof(rtmsg, rtm_family);
+constexpr uint32_t kRtmSrcLenOffset = kRtmOffset + offsetof(rtmsg, rtm_src_len);
+constexpr uint32_t kRtmProtocolOffset = kRtmOffset + offsetof(rtmsg, rtm_protocol);
+constexpr uint32_t kRtmScopeOffset = kRtmOffset + offsetof(rtmsg, rtm_scope);
+constexpr uint32_t kRtmTypeOffset = kRtmOffset + offsetof(rtmsg, rtm_type);
+constexpr uint32_t kRtmFlagsOffset = kRtmOffset + offsetof(rtmsg, rtm_flags);
+constexpr uint32_t kRtmLength = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(rtmsg));
+// The kernel puts RTA_TABLE first in route notifications.
+constexpr uint32_t kTableAttrTypeOffset = kRtmLength + offsetof(rtattr, rta_type);
+constexpr uint32_t kTableAttrValueOffset = kRtmLength + RTA_LENGTH(0);
+constexpr uint32_t kTableAttrEnd = kTableAttrValueOffset + sizeof(uint32_t);
+constexpr uint32_t kNdUserOptFamilyOffset = NLMSG_HDRLEN + offsetof(nduseroptmsg, nduseropt_family);
+constexpr uint32_t kNdUserOptIcmpTypeOffset =
+        NLMSG_HDRLEN + offsetof(nduseroptmsg, nduseropt_icmp_type);
+constexpr uint32_t kNdUserOptIcmpCodeOffset =
+        NLMSG_HDRLEN + offsetof(nduseroptmsg, nduseropt_icmp_code);
+constexpr uint32_t kNdUserOptLength = NLMSG_HDRLEN + sizeof(nduseroptmsg);
+
+// Classic BPF loads halfwords and words in network byte order, but netlink messages are in host
+// byte order. Loads size bytes at offset into A one byte at a time instead. Clobbers X.
+void loadHostOrder(std::vector<sock_filter>* prog, uint32_t offset, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        // Most significant byte first.
+        const uint32_t byteOffset = kLittleEndian ? offset + size - 1 - i : offset + i;
+        if (i > 0) {
+            prog->push_back(BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8));
+            prog->push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+        }
+        prog->push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, byteOffset));
+        if (i > 0) {
+            prog->push_back(BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0));
+        }
+    }
+}
+
+void loadByte(std::vector<sock_filter>* prog, uint32_t offset) {
+    prog->push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset));
+}
+
+// Loads beyond the end of the message make the filter drop it, so check the length first.
+void returnUnlessLengthAtLeast(std::vector<sock_filter>* prog, uint32_t length, uint32_t ret) {
+    prog->push_back(BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+    prog->push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, length, 1, 0));
+    prog->push_back(BPF_STMT(BPF_RET | BPF_K, ret));
+}
+
+// Drops the message unless A is one of values.
+void dropUnlessOneOf(std::vector<sock_filter>* prog, const std::vector<uint32_t>& values) {
+    for (size_t i = 0; i < values.size(); i++) {
+        const uint8_t toNextCheck = values.size() - i;
+        prog->push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, values[i], toNextCheck, 0));
+    }
+    prog->push_back(BPF_STMT(BPF_RET | BPF_K, kDrop));
+}
+
+void acceptIf(std::vector<sock_filter>* prog, uint16_t jmp, uint32_t value) {
+    prog->push_back(BPF_JUMP(BPF_JMP | jmp | BPF_K, value, 0, 1));
+    prog->push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+}
+
+std::vector<sock_filter> ndUserOptSection() {
+    std::vector<sock_filter> prog;
+    returnUnlessLengthAtLeast(&prog, kNdUserOptLength, kDrop);
+    loadByte(&prog, kNdUserOptFamilyOffset);
+    dropUnlessOneOf(&prog, {AF_INET6});
+    loadByte(&prog, kNdUserOptIcmpTypeOffset);
+    dropUnlessOneOf(&prog, {ND_ROUTER_ADVERT});
+    loadByte(&prog, kNdUserOptIcmpCodeOffset);
+    dropUnlessOneOf(&prog, {0});
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+    return prog;
+}
+
+std::vector<sock_filter> routeSection(const std::set<uint32_t>& interfaceTables) {
+    std::vector<sock_filter> prog;
+    returnUnlessLengthAtLeast(&prog, kRtmLength, kDrop);
+    loadByte(&prog, kRtmFamilyOffset);
+    dropUnlessOneOf(&prog, {AF_INET, AF_INET6});
+    loadByte(&prog, kRtmSrcLenOffset);
+    dropUnlessOneOf(&prog, {0});
+    loadByte(&prog, kRtmProtocolOffset);
+    dropUnlessOneOf(&prog, {RTPROT_KERNEL, RTPROT_RA});
+    loadByte(&prog, kRtmScopeOffset);
+    dropUnlessOneOf(&prog, {RT_SCOPE_UNIVERSE});
+    loadByte(&prog, kRtmTypeOffset);
+    dropUnlessOneOf(&prog, {RTN_UNICAST});
+    loadHostOrder(&prog, kRtmFlagsOffset, sizeof(uint32_t));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, RTM_F_CLONED, 0, 1));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kDrop));
+
+    // If the table cannot be found, keep the route.
+    returnUnlessLengthAtLeast(&prog, kTableAttrEnd, kAccept);
+    loadHostOrder(&prog, kTableAttrTypeOffset, sizeof(uint16_t));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RTA_TABLE, 1, 0));
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+    loadHostOrder(&prog, kTableAttrValueOffset, sizeof(uint32_t));
+    acceptIf(&prog, BPF_JEQ, RT_TABLE_MAIN);
+    const uint32_t largestTable = interfaceTables.empty()
+                                          ? RouteController::ROUTE_TABLE_OFFSET_FROM_INDEX
+                                          : *interfaceTables.rbegin();
+    acceptIf(&prog, BPF_JGT, largestTable);
+    for (const uint32_t table : interfaceTables) {
+        acceptIf(&prog, BPF_JEQ, table);
+    }
+    prog.push_back(BPF_STMT(BPF_RET | BPF_K, kDrop));
+    return prog;
+}
+
+}  // namespace
+
+std::vector<sock_filter> makeRouteSocketFilter(const std::set<uint32_t>& interfaceTables) {
+    const std::vector<sock_filter> ndUserOpt = ndUserOptSection();
+    const std::vector<sock_filter> route = routeSection(interfaceTables);
+
+    // Types that need no further checks.
+    std::vector<sock_filter> otherTypes;
+    // Control messages such as NLMSG_ERROR.
+    otherTypes.push_back(BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, NLMSG_MIN_TYPE, 1, 0));
+    otherTypes.push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+    dropUnlessOneOf(&otherTypes, {RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR});
+    otherTypes.push_back(BPF_STMT(BPF_RET | BPF_K, kAccept));
+
+    std::vector<sock_filter> prog;
+    returnUnlessLengthAtLeast(&prog, NLMSG_HDRLEN, kAccept);
+    loadHostOrder(&prog, kTypeOffset, sizeof(uint16_t));
+    // Jump over the other type checks to the section for the type.
+    const uint8_t toNdUserOpt = 2 + otherTypes.size();
+    const uint8_t newRouteToRoute = toNdUserOpt - 1 + ndUserOpt.size();
+    const uint8_t delRouteToRoute = newRouteToRoute - 1;
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RTM_NEWNDUSEROPT, toNdUserOpt, 0));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RTM_NEWROUTE, newRouteToRoute, 0));
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RTM_DELROUTE, delRouteToRoute, 0));
+    prog.insert(prog.end(), otherTypes.begin(), otherTypes.end());
+    prog.insert(prog.end(), ndUserOpt.begin(), ndUserOpt.end());
+    prog.insert(prog.end(), route.begin(), route.end());
+    return prog;
+}
+
+int attachRouteSocketFilter(int sock, const std::set<uint32_t>& interfaceTables) {
+    std::vector<sock_filter> prog = makeRouteSocketFilter(interfaceTables);
+    const sock_fprog fprog = {
+            .len = static_cast<unsigned short>(prog.size()),
+            .filter = prog.data(),
+    };
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+}  // namespace android::net
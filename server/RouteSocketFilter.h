@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <linux/filter.h>
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+namespace android::net {
+
+// Returns a classic BPF socket filter for the NetlinkManager route socket. It drops the
+// rtnetlink messages that NetlinkEvent would discard anyway, before they are queued on the socket:
+//
+//   - message types that NetlinkEvent does not parse,
+//   - routes that do not belong to the kernel or to router advertisements, that are not global
+//     unicast routes, that are source routes or cloned routes, or whose family is not IPv4 or
+//     IPv6,
+//   - routes in tables other than the main table and interfaceTables, e.g., tables of interfaces
+//     that no longer exist,
+//   - ND user options that do not come from router advertisements.
+//
+// Routes in tables above the largest of interfaceTables are kept, because ifindexes, and thus the
+// tables that the kernel puts router advertisement routes in, are allocated in increasing order.
+// This way the routes of an interface created after the filter was built are not lost.
+std::vector<sock_filter> makeRouteSocketFilter(const std::set<uint32_t>& interfaceTables);
+
+// Attaches the filter returned by makeRouteSocketFilter() to sock, replacing any filter already
+// attached. Returns 0 on success or a negative errno value on failure.
+[[nodiscard]] int attachRouteSocketFilter(int sock, const std::set<uint32_t>& interfaceTables);
+
+}  // namespace android::net
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * RouteSocketFilterTest.cpp - unit tests for RouteSocketFilter.cpp
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/icmp6.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <android-base/scopeguard.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+#include "NetlinkCommands.h"
+#include "RouteSocketFilter.h"
+
+namespace android {
+namespace net {
+
+using android::base::unique_fd;
+
+namespace {
+
+constexpr uint32_t kLoTable = 1001;
+constexpr uint32_t kOtherTable = 1005;
+const std::set<uint32_t> kTables = {kLoTable, kOtherTable};
+
+struct RouteMessage {
+    nlmsghdr hdr;
+    rtmsg rtm;
+    rtattr tableAttr;
+    uint32_t table;
+};
+
+// An IPv6 route that the kernel installed for a router advertisement.
+RouteMessage raRoute(uint32_t table) {
+    return {
+            .hdr = {.nlmsg_len = sizeof(RouteMessage), .nlmsg_type = RTM_NEWROUTE},
+            .rtm = {.rtm_family = AF_INET6,
+                    .rtm_dst_len = 64,
+                    .rtm_table = static_cast<uint8_t>(table < 256 ? table : RT_TABLE_COMPAT),
+                    .rtm_protocol = RTPROT_RA,
+                    .rtm_scope = RT_SCOPE_UNIVERSE,
+                    .rtm_type = RTN_UNICAST},
+            .tableAttr = {.rta_len = RTA_LENGTH(sizeof(uint32_t)), .rta_type = RTA_TABLE},
+            .table = table,
+    };
+}
+
+struct NdUserOptMessage {
+    nlmsghdr hdr;
+    nduseroptmsg msg;
+};
+
+NdUserOptMessage ndUserOpt() {
+    return {
+            .hdr = {.nlmsg_len = sizeof(NdUserOptMessage), .nlmsg_type = RTM_NEWNDUSEROPT},
+            .msg = {.nduseropt_family = AF_INET6,
+                    .nduseropt_icmp_type = ND_ROUTER_ADVERT,
+                    .nduseropt_icmp_code = 0},
+    };
+}
+
+}  // namespace
+
+// Runs crafted messages through the filter, attached to a datagram socket.
+class RouteSocketFilterTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds));
+        mSender.reset(fds[0]);
+        mReceiver.reset(fds[1]);
+        ASSERT_EQ(0, attachRouteSocketFilter(mReceiver.get(), kTables));
+    }
+
+    template <typename T>
+    bool delivered(const T& msg) {
+        return deliveredBytes(&msg, sizeof(msg));
+    }
+
+    bool deliveredBytes(const void* msg, size_t len) {
+        EXPECT_EQ(static_cast<ssize_t>(len), send(mSender.get(), msg, len, 0));
+        char buf[256];
+        return recv(mReceiver.get(), buf, sizeof(buf), MSG_DONTWAIT) == static_cast<ssize_t>(len);
+    }
+
+    unique_fd mSender;
+    unique_fd mReceiver;
+};
+
+TEST_F(RouteSocketFilterTest, RouteTables) {
+    EXPECT_TRUE(delivered(raRoute(RT_TABLE_MAIN)));
+    EXPECT_TRUE(delivered(raRoute(kLoTable)));
+    EXPECT_TRUE(delivered(raRoute(kOtherTable)));
+    // Interface that no longer exists.
+    EXPECT_FALSE(delivered(raRoute(kLoTable + 1)));
+    EXPECT_FALSE(delivered(raRoute(RT_TABLE_LOCAL)));
+    EXPECT_FALSE(delivered(raRoute(97)));
+    // Interface created after the filter was built.
+    EXPECT_TRUE(delivered(raRoute(kOtherTable + 1)));
+
+    RouteMessage route = raRoute(kLoTable);
+    route.hdr.nlmsg_type = RTM_DELROUTE;
+    EXPECT_TRUE(delivered(route));
+    route.table = kLoTable + 1;
+    EXPECT_FALSE(delivered(route));
+}
+
+TEST_F(RouteSocketFilterTest, RouteAttributes) {
+    RouteMessage route = raRoute(kLoTable);
+    route.rtm.rtm_protocol = RTPROT_KERNEL;
+    EXPECT_TRUE(delivered(route));
+    route.rtm.rtm_family = AF_INET;
+    EXPECT_TRUE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_protocol = RTPROT_STATIC;
+    EXPECT_FALSE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_family = AF_BRIDGE;
+    EXPECT_FALSE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_src_len = 64;
+    EXPECT_FALSE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_scope = RT_SCOPE_LINK;
+    EXPECT_FALSE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_type = RTN_LOCAL;
+    EXPECT_FALSE(delivered(route));
+
+    route = raRoute(kLoTable);
+    route.rtm.rtm_flags = RTM_F_CLONED;
+    EXPECT_FALSE(delivered(route));
+}
+
+TEST_F(RouteSocketFilterTest, RouteWithoutTable) {
+    // The table cannot be checked, so the route is kept.
+    RouteMessage route = raRoute(kLoTable + 1);
+    route.tableAttr.rta_type = RTA_DST;
+    EXPECT_TRUE(delivered(route));
+
+    route = raRoute(kLoTable + 1);
+    route.hdr.nlmsg_len = offsetof(RouteMessage, tableAttr);
+    EXPECT_TRUE(deliveredBytes(&route, offsetof(RouteMessage, tableAttr)));
+
+    // Too short to be a route.
+    route.hdr.nlmsg_len = NLMSG_HDRLEN + 4;
+    EXPECT_FALSE(deliveredBytes(&route, NLMSG_HDRLEN + 4));
+}
+
+TEST_F(RouteSocketFilterTest, NdUserOpt) {
+    EXPECT_TRUE(delivered(ndUserOpt()));
+
+    NdUserOptMessage msg = ndUserOpt();
+    msg.msg.nduseropt_family = AF_INET;
+    EXPECT_FALSE(delivered(msg));
+
+    msg = ndUserOpt();
+    msg.msg.nduseropt_icmp_type = ND_ROUTER_SOLICIT;
+    EXPECT_FALSE(delivered(msg));
+
+    msg = ndUserOpt();
+    msg.msg.nduseropt_icmp_code = 1;
+    EXPECT_FALSE(delivered(msg));
+}
+
+TEST_F(RouteSocketFilterTest, MessageTypes) {
+    nlmsghdr hdr = {.nlmsg_len = sizeof(nlmsghdr)};
+    for (const uint16_t type : {RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR}) {
+        hdr.nlmsg_type = type;
+        EXPECT_TRUE(delivered(hdr)) << type;
+    }
+    for (const uint16_t type : {NLMSG_ERROR, NLMSG_DONE}) {
+        hdr.nlmsg_type = type;
+        EXPECT_TRUE(delivered(hdr)) << type;
+    }
+    for (const uint16_t type : {RTM_NEWNEIGH, RTM_NEWRULE, RTM_NEWPREFIX, RTM_NEWNETCONF}) {
+        hdr.nlmsg_type = type;
+        EXPECT_FALSE(delivered(hdr)) << type;
+    }
+    // Not even a netlink header: leave it to the parser.
+    EXPECT_TRUE(deliveredBytes(&hdr, 4));
+}
+
+namespace {
+
+// Adds an IPv6 route to lo, as the kernel does when it processes a router advertisement, or as
+// a daemon does if protocol is RTPROT_STATIC.
+int addRoute(const char* dst, uint32_t table, uint8_t protocol) {
+    rtmsg rtm = {
+            .rtm_family = AF_INET6,
+            .rtm_dst_len = 64,
+            .rtm_table = RT_TABLE_UNSPEC,
+            .rtm_protocol = protocol,
+            .rtm_scope = RT_SCOPE_UNIVERSE,
+            .rtm_type = RTN_UNICAST,
+    };
+    in6_addr addr;
+    if (inet_pton(AF_INET6, dst, &addr) != 1) return -EINVAL;
+    const uint32_t oif = if_nametoindex("lo");
+
+    rtattr dstAttr = {.rta_len = RTA_LENGTH(sizeof(addr)), .rta_type = RTA_DST};
+    rtattr tableAttr = {.rta_len = RTA_LENGTH(sizeof(table)), .rta_type = RTA_TABLE};
+    rtattr oifAttr = {.rta_len = RTA_LENGTH(sizeof(oif)), .rta_type = RTA_OIF};
+    iovec iov[] = {
+            {nullptr, 0},
+            {&rtm, sizeof(rtm)},
+            {&dstAttr, sizeof(dstAttr)},
+            {&addr, sizeof(addr)},
+            {&tableAttr, sizeof(tableAttr)},
+            {&table, sizeof(table)},
+            {&oifAttr, sizeof(oifAttr)},
+            {const_cast<uint32_t*>(&oif), sizeof(oif)},
+    };
+    return sendNetlinkRequest(RTM_NEWROUTE, NETLINK_ROUTE_CREATE_FLAGS, iov, std::size(iov),
+                              nullptr);
+}
+
+unique_fd openRouteListener() {
+    unique_fd sock(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE));
+    sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = RTMGRP_IPV6_ROUTE};
+    EXPECT_EQ(0, bind(sock.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    return sock;
+}
+
+int countRouteMessages(int sock) {
+    int count = 0;
+    char buf[8192];
+    ssize_t len;
+    while ((len = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        for (const nlmsghdr* nh = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(nh, len);
+             nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == RTM_NEWROUTE) count++;
+        }
+    }
+    return count;
+}
+
+}  // namespace
+
+// Generates route churn that netd does not care about in a network namespace, and checks that
+// only the relevant routes reach the filtered socket.
+TEST(RouteSocketFilterNetnsTest, DropsIrrelevantRoutes) {
+    unique_fd origNs(open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC));
+    ASSERT_NE(-1, origNs.get());
+    ASSERT_EQ(0, unshare(CLONE_NEWNET));
+    auto restoreNs = base::make_scope_guard([&origNs] { setns(origNs.get(), CLONE_NEWNET); });
+
+    unique_fd ioctlSock(socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ifreq ifr = {};
+    strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+    ASSERT_EQ(0, ioctl(ioctlSock.get(), SIOCGIFFLAGS, &ifr));
+    ifr.ifr_flags |= IFF_UP;
+    ASSERT_EQ(0, ioctl(ioctlSock.get(), SIOCSIFFLAGS, &ifr));
+
+    const uint32_t loTable = 1000 + if_nametoindex("lo");
+    unique_fd unfiltered = openRouteListener();
+    unique_fd filtered = openRouteListener();
+    ASSERT_EQ(0, attachRouteSocketFilter(filtered.get(), {loTable}));
+
+    // Relevant: router advertisement routes in the main table and in the lo table, and in the
+    // table of an interface newer than the filter.
+    ASSERT_EQ(0, addRoute("2001:db8:1::", RT_TABLE_MAIN, RTPROT_RA));
+    ASSERT_EQ(0, addRoute("2001:db8:2::", loTable, RTPROT_RA));
+    ASSERT_EQ(0, addRoute("2001:db8:3::", loTable + 10, RTPROT_RA));
+
+    // Churn: routes installed by other daemons, or in tables of no interface.
+    constexpr int kChurn = 50;
+    for (int i = 0; i < kChurn; i++) {
+        const std::string prefix = "2001:db8:100:" + std::to_string(i) + "::";
+        ASSERT_EQ(0, addRoute(prefix.c_str(), loTable, RTPROT_STATIC));
+        ASSERT_EQ(0, addRoute(prefix.c_str(), 500, RTPROT_RA));
+    }
+
+    EXPECT_EQ(3, countRouteMessages(filtered.get()));
+    // The unfiltered socket also sees the kernel's local routes for lo.
+    EXPECT_LE(3 + 2 * kChurn, countRouteMessages(unfiltered.get()));
+}
+
+}  // namespace net
+}  // namespace android
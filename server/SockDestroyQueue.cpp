@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Netd"
+
+#include "SockDestroyQueue.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#include "SockDiag.h"
+
+namespace android {
+namespace net {
+
+namespace {
+
+int destroySocketsOnAddresses(const std::vector<std::string>& addrs) {
+    SockDiag sd;
+    if (!sd.open()) {
+        int ret = errno;
+        ALOGE("Error opening NETLINK_SOCK_DIAG socket: %s", strerror(ret));
+        return -ret;
+    }
+    return sd.destroySockets(addrs);
+}
+
+}  // namespace
+
+SockDestroyQueue::SockDestroyQueue(netdutils::Executor& executor)
+    : SockDestroyQueue(executor, destroySocketsOnAddresses) {}
+
+SockDestroyQueue::SockDestroyQueue(netdutils::Executor& executor, DestroyFunction destroy)
+    : mExecutor(executor), mDestroy(std::move(destroy)) {}
+
+SockDestroyQueue::~SockDestroyQueue() NO_THREAD_SAFETY_ANALYSIS {
+    // A run() already posted still references this object, so wait for it. It returns without
+    // doing anything once mRunning is false.
+    std::unique_lock<std::mutex> ul(mLock);
+    mRunning = false;
+    mCv.wait(ul, [this]() NO_THREAD_SAFETY_ANALYSIS { return !mScheduled; });
+}
+
+void SockDestroyQueue::enqueue(const std::string& addrstr) {
+    {
+        std::lock_guard guard(mLock);
+        mPending.insert(addrstr);
+        if (mScheduled) return;
+        mScheduled = true;
+    }
+    const auto status = mExecutor.post(netdutils::Executor::Lane::NORMAL, [this] { run(); });
+    if (!isOk(status)) {
+        // The address stays pending and is handled by the pass that the next enqueue schedules.
+        ALOGE("Error scheduling socket destruction: %s", toString(status).c_str());
+        std::lock_guard guard(mLock);
+        mScheduled = false;
+        mCv.notify_all();
+    }
+}
+
+void SockDestroyQueue::waitForIdle() NO_THREAD_SAFETY_ANALYSIS {
+    std::unique_lock<std::mutex> ul(mLock);
+    mCv.wait(ul, [this]() NO_THREAD_SAFETY_ANALYSIS { return !mScheduled; });
+}
+
+int SockDestroyQueue::passCount() {
+    std::lock_guard guard(mLock);
+    return mPassCount;
+}
+
+void SockDestroyQueue::run() NO_THREAD_SAFETY_ANALYSIS {
+    std::unique_lock<std::mutex> ul(mLock);
+    while (mRunning && !mPending.empty()) {
+        const std::vector<std::string> addrs(mPending.begin(), mPending.end());
+        mPending.clear();
+        mPassCount++;
+
+        ul.unlock();
+        int ret = mDestroy(addrs);
+        if (ret < 0) {
+            ALOGE("Error destroying sockets on %zu addresses: %s", addrs.size(), strerror(-ret));
+        }
+        ul.lock();
+    }
+    mScheduled = false;
+    mCv.notify_all();
+}
+
+}  // namespace net
+}  // namespace android
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_SERVER_SOCK_DESTROY_QUEUE_H
+#define NETD_SERVER_SOCK_DESTROY_QUEUE_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <android-base/thread_annotations.h>
+
+#include "netdutils/Executor.h"
+
+namespace android {
+namespace net {
+
+// Destroys sockets on removed addresses on a shared executor, so that the netlink listener thread
+// that sees the address removals is never blocked on sock_diag dumps. Addresses enqueued while a
+// pass is running are coalesced into the next pass, which handles all of them at once.
+class SockDestroyQueue {
+  public:
+    // Destroys the sockets on all the given addresses. Returns the number of sockets destroyed,
+    // or a negative errno.
+    using DestroyFunction = std::function<int(const std::vector<std::string>& addrs)>;
+
+    // executor must outlive this object.
+    explicit SockDestroyQueue(netdutils::Executor& executor);
+    SockDestroyQueue(netdutils::Executor& executor, DestroyFunction destroy);
+    ~SockDestroyQueue();
+
+    // Schedules the destruction of all sockets on the given IPv4 or IPv6 address.
+    void enqueue(const std::string& addrstr);
+
+    // Blocks until every address enqueued before the call has been processed.
+    void waitForIdle();
+
+    // Number of passes run so far. Only used by tests.
+    int passCount();
+
+  private:
+    // Runs passes on the executor until there is nothing left to do.
+    void run();
+
+    netdutils::Executor& mExecutor;
+    const DestroyFunction mDestroy;
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    // Addresses waiting for the next pass.
+    std::set<std::string> mPending GUARDED_BY(mLock);
+    // True from the time run() is posted to the executor until it returns. At most one run() is
+    // outstanding at a time.
+    bool mScheduled GUARDED_BY(mLock) = false;
+    bool mRunning GUARDED_BY(mLock) = true;
+    int mPassCount GUARDED_BY(mLock) = 0;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_SERVER_SOCK_DESTROY_QUEUE_H
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SockDestroyQueueTest.cpp - unit tests for SockDestroyQueue.cpp
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+#include "SockDestroyQueue.h"
+
+namespace android {
+namespace net {
+
+using android::base::StringPrintf;
+using android::base::unique_fd;
+using android::netdutils::Executor;
+
+namespace {
+
+Executor::Options testExecutorOptions() {
+    return {.name = "sockdestroy", .threads = 1};
+}
+
+}  // namespace
+
+TEST(SockDestroyQueueTest, CoalescesPendingAddresses) {
+    std::promise<void> firstPassStarted;
+    std::promise<void> releaseFirstPass;
+    std::shared_future<void> released = releaseFirstPass.get_future().share();
+    std::vector<std::vector<std::string>> passes;
+
+    Executor executor(testExecutorOptions());
+    SockDestroyQueue queue(executor, [&](const std::vector<std::string>& addrs) {
+        passes.push_back(addrs);
+        if (passes.size() == 1) {
+            firstPassStarted.set_value();
+            released.wait();
+        }
+        return 0;
+    });
+
+    // Block the worker in the first pass, then queue a burst of removals behind it.
+    queue.enqueue("192.0.2.1");
+    firstPassStarted.get_future().wait();
+    for (int i = 2; i <= 50; i++) {
+        queue.enqueue(StringPrintf("192.0.2.%d", i));
+    }
+    queue.enqueue("2001:db8::1");
+    queue.enqueue("192.0.2.2");  // Duplicate.
+    releaseFirstPass.set_value();
+    queue.waitForIdle();
+
+    ASSERT_EQ(2U, passes.size());
+    EXPECT_EQ(2, queue.passCount());
+    EXPECT_EQ(std::vector<std::string>{"192.0.2.1"}, passes[0]);
+    EXPECT_EQ(50U, passes[1].size());
+}
+
+TEST(SockDestroyQueueTest, WaitForIdleWithNothingQueued) {
+    Executor executor(testExecutorOptions());
+    SockDestroyQueue queue(executor, [](const std::vector<std::string>&) { return 0; });
+    queue.waitForIdle();
+    EXPECT_EQ(0, queue.passCount());
+}
+
+TEST(SockDestroyQueueTest, RunsOnExecutor) {
+    Executor executor({.name = "sockdestroy", .threads = 0});
+    std::vector<std::vector<std::string>> passes;
+    SockDestroyQueue queue(executor, [&passes](const std::vector<std::string>& addrs) {
+        passes.push_back(addrs);
+        return 0;
+    });
+
+    // Nothing runs until the executor does, and everything queued by then is a single pass.
+    queue.enqueue("192.0.2.1");
+    queue.enqueue("2001:db8::1");
+    queue.enqueue("192.0.2.1");
+    EXPECT_TRUE(passes.empty());
+    EXPECT_EQ(1U, executor.runPending());
+    ASSERT_EQ(1U, passes.size());
+    EXPECT_EQ(2U, passes[0].size());
+
+    queue.enqueue("192.0.2.2");
+    EXPECT_EQ(1U, executor.runPending());
+    EXPECT_EQ(2, queue.passCount());
+}
+
+// Binds many connected sockets to different loopback addresses, removes a burst of them at once
+// and checks that exactly the sockets on those addresses are destroyed.
+TEST(SockDestroyQueueTest, DestroysSocketsOnAllQueuedAddresses) {
+    constexpr int kNumAddresses = 16;
+    constexpr int kSocketsPerAddress = 8;
+
+    unique_fd listenSocket(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, listenSocket);
+    sockaddr_in server = {.sin_family = AF_INET, .sin_addr = {htonl(INADDR_ANY)}};
+    socklen_t serverLen = sizeof(server);
+    ASSERT_EQ(0, bind(listenSocket, (sockaddr*)&server, sizeof(server)));
+    ASSERT_EQ(0, getsockname(listenSocket, (sockaddr*)&server, &serverLen));
+    ASSERT_EQ(0, listen(listenSocket, kNumAddresses * kSocketsPerAddress));
+
+    std::vector<unique_fd> clients[kNumAddresses];
+    std::vector<unique_fd> accepted;
+    for (int i = 0; i < kNumAddresses; i++) {
+        // Every address in 127.0.0.0/8 is local without any configuration.
+        const std::string addr = StringPrintf("127.0.1.%d", i + 1);
+        sockaddr_in dst = server;
+        ASSERT_EQ(1, inet_pton(AF_INET, addr.c_str(), &dst.sin_addr));
+        sockaddr_in src = {.sin_family = AF_INET, .sin_addr = dst.sin_addr};
+        for (int j = 0; j < kSocketsPerAddress; j++) {
+            unique_fd s(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+            ASSERT_LE(0, s);
+            ASSERT_EQ(0, bind(s, (sockaddr*)&src, sizeof(src))) << strerror(errno);
+            ASSERT_EQ(0, connect(s, (sockaddr*)&dst, sizeof(dst))) << strerror(errno);
+            unique_fd a(accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC));
+            ASSERT_LE(0, a);
+            clients[i].push_back(std::move(s));
+            accepted.push_back(std::move(a));
+        }
+    }
+
+    Executor executor(testExecutorOptions());
+    SockDestroyQueue queue(executor);
+    for (int i = 0; i < kNumAddresses; i += 2) {
+        queue.enqueue(StringPrintf("127.0.1.%d", i + 1));
+    }
+    queue.waitForIdle();
+    EXPECT_GE(2, queue.passCount());
+
+    const char data[] = "foo";
+    for (int i = 0; i < kNumAddresses; i++) {
+        const bool removed = (i % 2 == 0);
+        for (const auto& s : clients[i]) {
+            const ssize_t ret = send(s, data, sizeof(data), MSG_NOSIGNAL);
+            if (removed) {
+                EXPECT_EQ(-1, ret) << "socket on 127.0.1." << i + 1 << " not closed";
+                EXPECT_EQ(ECONNABORTED, errno);
+            } else {
+                EXPECT_EQ((ssize_t)sizeof(data), ret) << strerror(errno);
+            }
+        }
+    }
+}
+
+}  // namespace net
+}  // namespace android
@@ -18,6 +18,7 @@
 
 #include "SockDiag.h"
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <linux/inet_diag.h>
 #include <linux/netlink.h>
@@ -29,6 +30,8 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
 
 #include <android-base/properties.h>
@@ -62,6 +65,17 @@ bool isAdbSocket(const inet_diag_msg *msg, int adbPort) {
         (msg->idiag_uid == AID_ROOT || msg->idiag_uid == AID_SHELL);
 }
 
+// Totals over all SockDiag objects, for dump().
+std::atomic<uint64_t> sTotalSocketsDestroyed = 0;
+std::atomic<uint64_t> sTotalDestroyFailures = 0;
+
+struct markmatch {
+    inet_diag_bc_op op;
+    // TODO: switch to inet_diag_markcond
+    __u32 mark;
+    __u32 mask;
+} __attribute__((packed));
+
 int checkError(int fd) {
     struct {
         nlmsghdr h;
@@ -83,6 +97,11 @@ int checkError(int fd) {
 
 }  // namespace
 
+void SockDiag::dump(netdutils::DumpWriter& dw) {
+    dw.println("SockDiag: sockets destroyed=%" PRIu64 " failed SOCK_DESTROY requests=%" PRIu64,
+               sTotalSocketsDestroyed.load(), sTotalDestroyFailures.load());
+}
+
 bool SockDiag::open() {
     if (hasSocks()) {
         return false;
@@ -102,6 +121,8 @@ bool SockDiag::open() {
         return false;
     }
 
+    mReadBuffer.resize(kBufferSize);
+    mDestroyRequests.reserve(kDestroyRequestsPerDatagram * kDestroyDatagramsPerSend);
     return true;
 }
 
@@ -218,11 +239,13 @@ int SockDiag::readDiagMsg(uint8_t proto, const SockDiag::DestroyFilter& shouldDe
     NetlinkDumpCallback callback = [this, proto, shouldDestroy] (nlmsghdr *nlh) {
         const inet_diag_msg *msg = reinterpret_cast<inet_diag_msg *>(NLMSG_DATA(nlh));
         if (shouldDestroy(proto, msg)) {
-            sockDestroy(proto, msg);
+            queueDestroy(proto, msg);
         }
     };
 
-    return processNetlinkDump(mSock, callback);
+    int ret = processNetlinkDump(mSock, callback, mReadBuffer.data(), mReadBuffer.size());
+    int flushRet = flushDestroyRequests();
+    return ret ? ret : flushRet;
 }
 
 int SockDiag::readDiagMsgWithTcpInfo(const TcpInfoReader& tcpInfoReader) {
@@ -251,7 +274,7 @@ int SockDiag::readDiagMsgWithTcpInfo(const TcpInfoReader& tcpInfoReader) {
         tcpInfoReader(mark, msg, tcpinfo, tcpinfoLength);
     };
 
-    return processNetlinkDump(mSock, callback);
+    return processNetlinkDump(mSock, callback, mReadBuffer.data(), mReadBuffer.size());
 }
 
 // Determines whether a socket is a loopback socket. Does not check socket state.
@@ -259,17 +282,32 @@ bool SockDiag::isLoopbackSocket(const inet_diag_msg *msg) {
     switch (msg->idiag_family) {
         case AF_INET:
             // Old kernels only copy the IPv4 address and leave the other 12 bytes uninitialized.
+            return hasLoopbackAddress(msg) || msg->id.idiag_src[0] == msg->id.idiag_dst[0];
+
+        case AF_INET6:
+            return hasLoopbackAddress(msg) ||
+                   !memcmp(msg->id.idiag_src, msg->id.idiag_dst, sizeof(in6_addr));
+
+        default:
+            return false;
+    }
+}
+
+// Determines whether either address of a socket is a loopback address. Unlike isLoopbackSocket,
+// does not treat sockets whose source and destination are equal, such as unconnected sockets bound
+// to the wildcard address, as loopback.
+bool SockDiag::hasLoopbackAddress(const inet_diag_msg *msg) {
+    switch (msg->idiag_family) {
+        case AF_INET:
             return IN_LOOPBACK(htonl(msg->id.idiag_src[0])) ||
-                   IN_LOOPBACK(htonl(msg->id.idiag_dst[0])) ||
-                   msg->id.idiag_src[0] == msg->id.idiag_dst[0];
+                   IN_LOOPBACK(htonl(msg->id.idiag_dst[0]));
 
         case AF_INET6: {
             const struct in6_addr *src = (const struct in6_addr *) &msg->id.idiag_src;
             const struct in6_addr *dst = (const struct in6_addr *) &msg->id.idiag_dst;
             return (IN6_IS_ADDR_V4MAPPED(src) && IN_LOOPBACK(src->s6_addr32[3])) ||
                    (IN6_IS_ADDR_V4MAPPED(dst) && IN_LOOPBACK(dst->s6_addr32[3])) ||
-                   IN6_IS_ADDR_LOOPBACK(src) || IN6_IS_ADDR_LOOPBACK(dst) ||
-                   !memcmp(src, dst, sizeof(*src));
+                   IN6_IS_ADDR_LOOPBACK(src) || IN6_IS_ADDR_LOOPBACK(dst);
         }
         default:
             return false;
@@ -300,7 +338,111 @@ int SockDiag::sockDestroy(uint8_t proto, const inet_diag_msg *msg) {
     }
 
     int ret = checkError(mWriteSock);
-    if (!ret) mSocketsDestroyed++;
+    if (!ret) {
+        mSocketsDestroyed++;
+        sTotalSocketsDestroyed++;
+    } else {
+        mDestroyFailures++;
+        sTotalDestroyFailures++;
+    }
+    return ret;
+}
+
+void SockDiag::queueDestroy(uint8_t proto, const inet_diag_msg *msg) {
+    if (msg == nullptr) {
+        return;
+    }
+
+    DestroyRequest request = {
+        .nlh = {
+            .nlmsg_len = sizeof(DestroyRequest),
+            .nlmsg_type = SOCK_DESTROY,
+            .nlmsg_flags = NLM_F_REQUEST,
+            .nlmsg_seq = (uint32_t) mDestroyRequests.size(),
+        },
+        .req = {
+            .sdiag_family = msg->idiag_family,
+            .sdiag_protocol = proto,
+            .idiag_states = (uint32_t) (1 << msg->idiag_state),
+            .id = msg->id,
+        },
+    };
+    mDestroyRequests.push_back(request);
+
+    if (mDestroyRequests.size() >= kDestroyRequestsPerDatagram * kDestroyDatagramsPerSend) {
+        if (int ret = flushDestroyRequests()) {
+            ALOGE("Failed to send SOCK_DESTROY requests: %s", strerror(-ret));
+        }
+    }
+}
+
+// Reads the errors returned for SOCK_DESTROY requests that failed. Requests without NLM_F_ACK are
+// only answered on failure, and the kernel processes netlink requests synchronously in sendmsg, so
+// every error is already queued when this is called and the socket can be read without blocking.
+int SockDiag::collectDestroyErrors() {
+    int failures = 0;
+    char buf[kNetlinkDumpBufferSize];
+    ssize_t bytesread;
+    while ((bytesread = recv(mWriteSock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        uint32_t len = bytesread;
+        for (nlmsghdr *nlh = reinterpret_cast<nlmsghdr *>(buf);
+             NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_ERROR) continue;
+            const nlmsgerr *err = reinterpret_cast<nlmsgerr *>(NLMSG_DATA(nlh));
+            if (err->error == 0) continue;
+            failures++;
+            // The socket may have been closed after the dump, which is not worth a log line.
+            if (err->error != -ENOENT && err->msg.nlmsg_seq < mDestroyRequests.size()) {
+                const DestroyRequest& request = mDestroyRequests[err->msg.nlmsg_seq];
+                ALOGW("Failed to destroy socket with cookie %08x%08x: %s",
+                      request.req.id.idiag_cookie[1], request.req.id.idiag_cookie[0],
+                      strerror(-err->error));
+            }
+        }
+    }
+    return failures;
+}
+
+int SockDiag::flushDestroyRequests() {
+    const size_t total = mDestroyRequests.size();
+    size_t sent = 0;
+    int failures = 0;
+    int ret = 0;
+
+    while (sent < total) {
+        mmsghdr msgs[kDestroyDatagramsPerSend] = {};
+        iovec iov[kDestroyDatagramsPerSend];
+        size_t datagrams = 0;
+        for (size_t i = sent; i < total && datagrams < kDestroyDatagramsPerSend;
+             i += kDestroyRequestsPerDatagram, datagrams++) {
+            const size_t count = std::min(kDestroyRequestsPerDatagram, total - i);
+            iov[datagrams] = { &mDestroyRequests[i], count * sizeof(DestroyRequest) };
+            msgs[datagrams].msg_hdr.msg_iov = &iov[datagrams];
+            msgs[datagrams].msg_hdr.msg_iovlen = 1;
+        }
+
+        int nsent = sendmmsg(mWriteSock, msgs, datagrams, 0);
+        if (nsent <= 0) {
+            ret = (nsent == 0) ? -EIO : -errno;
+            break;
+        }
+        for (int i = 0; i < nsent; i++) {
+            sent += msgs[i].msg_len / sizeof(DestroyRequest);
+        }
+        // Drain errors after every call so they never overflow the receive buffer.
+        failures += collectDestroyErrors();
+    }
+
+    const int failed = failures + (total - sent);
+    mSocketsDestroyed += sent - failures;
+    mDestroyFailures += failed;
+    sTotalSocketsDestroyed += sent - failures;
+    sTotalDestroyFailures += failed;
+    if (failed > 0) {
+        ALOGW("%d of %zu SOCK_DESTROY requests failed", failed, total);
+    }
+    mDestroyRequests.clear();
     return ret;
 }
 
@@ -321,6 +463,7 @@ int SockDiag::destroySockets(uint8_t proto, int family, const char *addrstr) {
 int SockDiag::destroySockets(const char *addrstr) {
     Stopwatch s;
     mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
 
     if (!strchr(addrstr, ':')) {
         if (int ret = destroySockets(IPPROTO_TCP, AF_INET, addrstr)) {
@@ -341,6 +484,123 @@ int SockDiag::destroySockets(const char *addrstr) {
     return mSocketsDestroyed;
 }
 
+// Builds a SOCK_DIAG bytecode program that accepts sockets whose source address is any of addrs.
+// IPv4 addresses are matched as IPv4-mapped addresses in IPv6 dumps. Returns an empty program if
+// no address applies to the given family.
+//
+// Each address compiles to a host condition followed by a JMP, which is how the kernel expects an
+// OR to be expressed: if the condition matches, execution falls through to the JMP, which jumps to
+// the end of the program and accepts the socket. Otherwise it jumps over the JMP to the next
+// condition. The last condition has no JMP, so failing it jumps past the end and rejects the
+// socket. The JMPs also keep every condition reachable by yes jumps, as the verifier requires.
+std::vector<uint8_t> SockDiag::hostCondBytecode(uint8_t family,
+                                                const std::vector<std::string>& addrs) {
+    std::vector<std::vector<uint8_t>> conds;
+    for (const auto& addrstr : addrs) {
+        in6_addr addr6;
+        in_addr addr4;
+        const void *addr;
+        uint8_t addrlen;
+        if (inet_pton(AF_INET, addrstr.c_str(), &addr4) == 1) {
+            if (family == AF_INET) {
+                addr = &addr4;
+                addrlen = sizeof(addr4);
+            } else {
+                addr6 = { .s6_addr32 = { 0, 0, htonl(0xffff), addr4.s_addr } };
+                addr = &addr6;
+                addrlen = sizeof(addr6);
+            }
+        } else if (inet_pton(AF_INET6, addrstr.c_str(), &addr6) == 1) {
+            if (family != AF_INET6) continue;
+            addr = &addr6;
+            addrlen = sizeof(addr6);
+        } else {
+            ALOGE("Not destroying sockets on invalid address %s", addrstr.c_str());
+            continue;
+        }
+
+        const uint8_t condlen = sizeof(inet_diag_bc_op) + sizeof(inet_diag_hostcond) + addrlen;
+        const inet_diag_bc_op op = { INET_DIAG_BC_S_COND, condlen, (uint16_t) (condlen + 4) };
+        const inet_diag_hostcond cond = { family, (uint8_t) (addrlen * 8), -1, {} };
+
+        std::vector<uint8_t> bytes(condlen);
+        memcpy(bytes.data(), &op, sizeof(op));
+        memcpy(bytes.data() + sizeof(op), &cond, sizeof(cond));
+        memcpy(bytes.data() + sizeof(op) + sizeof(cond), addr, addrlen);
+        conds.push_back(std::move(bytes));
+    }
+
+    size_t total = 0;
+    for (const auto& cond : conds) {
+        total += cond.size() + sizeof(inet_diag_bc_op);
+    }
+    if (total > 0) total -= sizeof(inet_diag_bc_op);  // No JMP after the last condition.
+
+    std::vector<uint8_t> bytecode;
+    bytecode.reserve(total);
+    for (size_t i = 0; i < conds.size(); i++) {
+        bytecode.insert(bytecode.end(), conds[i].begin(), conds[i].end());
+        if (i + 1 == conds.size()) break;
+        const size_t remaining = total - bytecode.size();
+        const inet_diag_bc_op jmp = { INET_DIAG_BC_JMP, sizeof(inet_diag_bc_op),
+                                      (uint16_t) remaining };
+        const uint8_t *jmpBytes = reinterpret_cast<const uint8_t *>(&jmp);
+        bytecode.insert(bytecode.end(), jmpBytes, jmpBytes + sizeof(jmp));
+    }
+    return bytecode;
+}
+
+int SockDiag::destroySockets(const std::vector<std::string>& addrs) {
+    if (!hasSocks()) {
+        return -EBADFD;
+    }
+
+    Stopwatch s;
+    mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
+    auto destroyAll = [] (uint8_t, const inet_diag_msg*) { return true; };
+    const uint32_t states = ~(1 << TCP_TIME_WAIT);
+
+    for (size_t start = 0; start < addrs.size(); start += kMaxAddressesPerDump) {
+        const size_t end = std::min(addrs.size(), start + kMaxAddressesPerDump);
+        const std::vector<std::string> batch(addrs.begin() + start, addrs.begin() + end);
+
+        for (const int family : {AF_INET, AF_INET6}) {
+            const char *familyName = (family == AF_INET) ? "IPv4" : "IPv6";
+            std::vector<uint8_t> bytecode = hostCondBytecode(family, batch);
+            if (bytecode.empty()) continue;
+
+            nlattr nla = {
+                .nla_len = (uint16_t) (sizeof(nlattr) + bytecode.size()),
+                .nla_type = INET_DIAG_REQ_BYTECODE,
+            };
+            iovec iov[] = {
+                { nullptr,         0 },
+                { &nla,            sizeof(nla) },
+                { bytecode.data(), bytecode.size() },
+            };
+
+            if (int ret = sendDumpRequest(IPPROTO_TCP, family, 0, states, iov, ARRAY_SIZE(iov))) {
+                ALOGE("Failed to dump %s sockets on %zu addresses: %s", familyName, batch.size(),
+                      strerror(-ret));
+                return ret;
+            }
+            if (int ret = readDiagMsg(IPPROTO_TCP, destroyAll)) {
+                ALOGE("Failed to destroy %s sockets on %zu addresses: %s", familyName,
+                      batch.size(), strerror(-ret));
+                return ret;
+            }
+        }
+    }
+
+    if (mSocketsDestroyed > 0) {
+        ALOGI("Destroyed %d sockets on %s in %" PRId64 "us", mSocketsDestroyed,
+              android::base::Join(addrs, " ").c_str(), s.timeTakenUs());
+    }
+
+    return mSocketsDestroyed;
+}
+
 int SockDiag::destroyLiveSockets(const DestroyFilter& destroyFilter, const char *what,
                                  iovec *iov, int iovcnt) {
     const int proto = IPPROTO_TCP;
@@ -385,8 +645,26 @@ int SockDiag::getLiveTcpInfos(const TcpInfoReader& tcpInfoReader) {
     return 0;
 }
 
+int SockDiag::getSocketCookies(std::set<uint64_t>* cookies) {
+    const DestroyFilter collect = [cookies](uint8_t, const inet_diag_msg* msg) {
+        cookies->insert(static_cast<uint64_t>(msg->id.idiag_cookie[0]) |
+                        (static_cast<uint64_t>(msg->id.idiag_cookie[1]) << 32));
+        return false;
+    };
+
+    for (const int proto : {IPPROTO_TCP, IPPROTO_UDP}) {
+        for (const int family : {AF_INET, AF_INET6}) {
+            if (int ret = sendDumpRequest(proto, family, ~0U)) return ret;
+            if (int ret = readDiagMsg(proto, collect)) return ret;
+        }
+    }
+
+    return 0;
+}
+
 int SockDiag::destroySockets(uint8_t proto, const uid_t uid, bool excludeLoopback) {
     mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
     Stopwatch s;
 
     auto shouldDestroy = [uid, excludeLoopback] (uint8_t, const inet_diag_msg *msg) {
@@ -418,6 +696,7 @@ int SockDiag::destroySockets(uint8_t proto, const uid_t uid, bool excludeLoopbac
 int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>& skipUids,
                              bool excludeLoopback) {
     mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
     Stopwatch s;
 
     auto shouldDestroy = [&] (uint8_t, const inet_diag_msg *msg) {
@@ -456,12 +735,6 @@ int SockDiag::destroySockets(const UidRanges& uidRanges, const std::set<uid_t>&
 // that they are now sending and receiving traffic on a network that is now restricted.
 int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permission,
                                               bool excludeLoopback) {
-    struct markmatch {
-        inet_diag_bc_op op;
-        // TODO: switch to inet_diag_markcond
-        __u32 mark;
-        __u32 mask;
-    } __attribute__((packed));
     constexpr uint8_t matchlen = sizeof(markmatch);
 
     Fwmark netIdMark, netIdMask;
@@ -519,6 +792,7 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
     };
 
     mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
     Stopwatch s;
 
     auto shouldDestroy = [&] (uint8_t, const inet_diag_msg *msg) {
@@ -537,5 +811,135 @@ int SockDiag::destroySocketsLackingPermission(unsigned netId, Permission permiss
     return 0;
 }
 
+// Destroys the "live" TCP sockets on |netId| owned by |uids|. The kernel only returns the sockets
+// on the network, by matching the netId bits of the mark. The explicitlySelected and permission
+// bits are not checked: they were set when the socket was created, so they say nothing about
+// whether the owner still holds the permission. sock_diag bytecode has no condition on the socket
+// UID, so the UIDs are matched here, on the already small set of sockets returned.
+int SockDiag::destroySocketsLackingPermission(unsigned netId, const std::set<uid_t>& uids,
+                                              bool excludeLoopback) {
+    if (uids.empty()) return 0;
+
+    Fwmark netIdMark, netIdMask;
+    netIdMark.netId = netId;
+    netIdMask.netId = 0xffff;
+
+    constexpr uint8_t matchlen = sizeof(markmatch);
+    // Jump exactly this far past the end of the program to reject.
+    constexpr uint8_t rejectoffset = sizeof(inet_diag_bc_op);
+
+    // If netId matches, go to the end of the program and accept. Otherwise, reject.
+    markmatch bytecode = {
+        { INET_DIAG_BC_MARK_COND, matchlen, matchlen + rejectoffset },
+        netIdMark.intValue, netIdMask.intValue,
+    };
+
+    struct nlattr nla = {
+            .nla_len = sizeof(struct nlattr) + matchlen,
+            .nla_type = INET_DIAG_REQ_BYTECODE,
+    };
+
+    iovec iov[] = {
+        { nullptr,   0 },
+        { &nla,      sizeof(nla) },
+        { &bytecode, matchlen },
+    };
+
+    mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
+    Stopwatch s;
+
+    auto shouldDestroy = [&] (uint8_t, const inet_diag_msg *msg) {
+        return msg != nullptr &&
+               uids.find(msg->idiag_uid) != uids.end() &&
+               !(excludeLoopback && isLoopbackSocket(msg));
+    };
+
+    if (int ret = destroyLiveSockets(shouldDestroy, "permission change", iov, ARRAY_SIZE(iov))) {
+        return ret;
+    }
+
+    if (mSocketsDestroyed > 0) {
+        ALOGI("Destroyed %d sockets for netId %d uids={%s} in %" PRId64 "us", mSocketsDestroyed,
+              netId, android::base::Join(uids, " ").c_str(), s.timeTakenUs());
+    }
+
+    return 0;
+}
+
+int SockDiag::destroySocketsForNetwork(unsigned netId, const std::set<uid_t>& exemptUids,
+                                       bool excludeLoopback) {
+    Fwmark netIdMark, netIdMask;
+    netIdMark.netId = netId;
+    netIdMask.netId = 0xffff;
+
+    constexpr uint8_t matchlen = sizeof(markmatch);
+    // Jump exactly this far past the end of the program to reject.
+    constexpr uint8_t rejectoffset = sizeof(inet_diag_bc_op);
+
+    // If netId matches, go to the end of the program and accept. Otherwise, reject.
+    markmatch bytecode = {
+        { INET_DIAG_BC_MARK_COND, matchlen, matchlen + rejectoffset },
+        netIdMark.intValue, netIdMask.intValue,
+    };
+
+    struct nlattr nla = {
+            .nla_len = sizeof(struct nlattr) + matchlen,
+            .nla_type = INET_DIAG_REQ_BYTECODE,
+    };
+
+    iovec iov[] = {
+        { nullptr,   0 },
+        { &nla,      sizeof(nla) },
+        { &bytecode, matchlen },
+    };
+
+    // Unconnected UDP sockets bound to the wildcard address have equal source and destination, so
+    // isLoopbackSocket would skip them.
+    auto shouldDestroy = [&] (uint8_t, const inet_diag_msg *msg) {
+        return msg != nullptr &&
+               exemptUids.find(msg->idiag_uid) == exemptUids.end() &&
+               !(excludeLoopback && hasLoopbackAddress(msg));
+    };
+
+    // UDP sockets are either connected (TCP_ESTABLISHED) or not (TCP_CLOSE).
+    const struct {
+        uint8_t proto;
+        uint32_t states;
+    } dumps[] = {
+        { IPPROTO_TCP, (1 << TCP_ESTABLISHED) | (1 << TCP_SYN_SENT) | (1 << TCP_SYN_RECV) },
+        { IPPROTO_UDP, (1 << TCP_ESTABLISHED) | (1 << TCP_CLOSE) },
+    };
+
+    mSocketsDestroyed = 0;
+    mDestroyFailures = 0;
+    Stopwatch s;
+
+    for (const auto& dump : dumps) {
+        const char *protoName = (dump.proto == IPPROTO_TCP) ? "TCP" : "UDP";
+        for (const int family : {AF_INET, AF_INET6}) {
+            const char *familyName = (family == AF_INET) ? "IPv4" : "IPv6";
+            if (int ret = sendDumpRequest(dump.proto, family, 0, dump.states, iov,
+                                          ARRAY_SIZE(iov))) {
+                ALOGE("Failed to dump %s %s sockets for netId %u: %s", familyName, protoName,
+                      netId, strerror(-ret));
+                return ret;
+            }
+            if (int ret = readDiagMsg(dump.proto, shouldDestroy)) {
+                ALOGE("Failed to destroy %s %s sockets for netId %u: %s", familyName, protoName,
+                      netId, strerror(-ret));
+                return ret;
+            }
+        }
+    }
+
+    if (mSocketsDestroyed > 0) {
+        ALOGI("Destroyed %d sockets for netId %u exempt={%s} in %" PRId64 "us", mSocketsDestroyed,
+              netId, android::base::Join(exemptUids, " ").c_str(), s.timeTakenUs());
+    }
+
+    return 0;
+}
+
 }  // namespace net
 }  // namespace android
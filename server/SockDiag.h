@@ -26,11 +26,14 @@
 
 #include <functional>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "Fwmark.h"
 #include "NetlinkCommands.h"
 #include "Permission.h"
 #include "UidRanges.h"
+#include "netdutils/DumpWriter.h"
 
 struct inet_diag_msg;
 struct tcp_info;
@@ -41,7 +44,17 @@ namespace net {
 class SockDiag {
 
   public:
-    static const int kBufferSize = 4096;
+    // Size of the buffer used to read dumps. The kernel sizes each batch of dump messages after the
+    // largest buffer passed to recvmsg() on the socket, up to 32 KiB (see netlink_recvmsg() and
+    // netlink_dump()), so a 32 KiB buffer gets the most sockets per read.
+    static const int kBufferSize = 32768;
+    // Number of SOCK_DESTROY requests packed into each netlink datagram.
+    static constexpr size_t kDestroyRequestsPerDatagram = 64;
+    // Maximum number of datagrams sent by each sendmmsg call.
+    static constexpr size_t kDestroyDatagramsPerSend = 16;
+    // Maximum number of addresses matched by a single dump. Keeps the bytecode jump offsets, which
+    // are 16 bits wide, in range.
+    static constexpr size_t kMaxAddressesPerDump = 512;
 
     // Callback function that is called once for every socket in the sockDestroy dump.
     // A return value of true means destroy the socket.
@@ -59,7 +72,7 @@ class SockDiag {
         inet_diag_req_v2 req;
     } __attribute__((__packed__));
 
-    SockDiag() : mSock(-1), mWriteSock(-1), mSocketsDestroyed(0) {}
+    SockDiag() : mSock(-1), mWriteSock(-1), mSocketsDestroyed(0), mDestroyFailures(0) {}
     bool open();
     virtual ~SockDiag() { closeSocks(); }
 
@@ -69,8 +82,18 @@ class SockDiag {
     int readDiagMsgWithTcpInfo(const TcpInfoReader& callback);
 
     int sockDestroy(uint8_t proto, const inet_diag_msg *);
+    // Queues a SOCK_DESTROY request for the given socket. Queued requests are sent in batches when
+    // enough of them accumulate, or when flushDestroyRequests is called.
+    void queueDestroy(uint8_t proto, const inet_diag_msg *);
+    // Sends all queued SOCK_DESTROY requests, many per datagram and many datagrams per system
+    // call, and accounts for the ones the kernel rejected. Returns 0 on success or a negative
+    // errno if the requests could not be sent.
+    int flushDestroyRequests();
     // Destroys all sockets on the given IPv4 or IPv6 address.
     int destroySockets(const char *addrstr);
+    // Destroys all sockets on any of the given IPv4 or IPv6 addresses, using a single dump per
+    // address family. Returns the number of sockets destroyed, or a negative errno.
+    int destroySockets(const std::vector<std::string>& addrs);
     // Destroys all sockets for the given protocol and UID.
     int destroySockets(uint8_t proto, uid_t uid, bool excludeLoopback);
     // Destroys all "live" (CONNECTED, SYN_SENT, SYN_RECV) TCP sockets for the given UID ranges.
@@ -80,22 +103,58 @@ class SockDiag {
     // the permissions required by the specified network.
     int destroySocketsLackingPermission(unsigned netId, Permission permission,
                                         bool excludeLoopback);
+    // Destroys all "live" (CONNECTED, SYN_SENT, SYN_RECV) TCP sockets on the specified network
+    // that are owned by |uids|, which no longer hold the permissions the network requires. This
+    // includes the sockets that explicitly selected the network. Only the sockets on the network
+    // are examined, so this is cheaper than a full rescan when few UIDs change permission.
+    int destroySocketsLackingPermission(unsigned netId, const std::set<uid_t>& uids,
+                                        bool excludeLoopback);
+    // Destroys all "live" (CONNECTED, SYN_SENT, SYN_RECV) TCP sockets and all UDP sockets that are
+    // marked with the specified netId, except those owned by |exemptUids|. The sockets are
+    // selected by the kernel, so only the sockets on the network are dumped. If |excludeLoopback|
+    // is true, skips only the sockets with a loopback address, not unconnected wildcard sockets.
+    int destroySocketsForNetwork(unsigned netId, const std::set<uid_t>& exemptUids,
+                                 bool excludeLoopback);
+
+    // Number of sockets destroyed by the last destroy operation.
+    int socketsDestroyed() const { return mSocketsDestroyed; }
+    // Number of SOCK_DESTROY requests that failed in the last destroy operation, e.g., because the
+    // socket was closed between the dump and the request. These sockets are not counted as
+    // destroyed.
+    int destroyFailures() const { return mDestroyFailures; }
+
+    // Dumps the number of sockets destroyed and of failed SOCK_DESTROY requests since netd started.
+    static void dump(netdutils::DumpWriter& dw);
 
     // Dump struct tcp_info for all "live" (CONNECTED, SYN_SENT, SYN_RECV) TCP sockets.
     int getLiveTcpInfos(const TcpInfoReader& sockInfoReader);
 
+    // Adds the cookie of every TCP and UDP socket that sock_diag dumps to |cookies|. Sockets that
+    // are neither bound nor connected are not dumped. Returns 0 on success or a negative errno.
+    int getSocketCookies(std::set<uint64_t>* cookies);
+
   private:
     friend class SockDiagTest;
     int mSock;
     int mWriteSock;
     int mSocketsDestroyed;
+    // See destroyFailures().
+    int mDestroyFailures;
+    // SOCK_DESTROY requests waiting to be sent. The nlmsg_seq of each request is its index, which
+    // identifies the socket that a returned error refers to.
+    std::vector<DestroyRequest> mDestroyRequests;
+    std::vector<char> mReadBuffer;
     int sendDumpRequest(uint8_t proto, uint8_t family, uint8_t extensions, uint32_t states,
                         iovec *iov, int iovcnt);
     int destroySockets(uint8_t proto, int family, const char *addrstr);
+    static std::vector<uint8_t> hostCondBytecode(uint8_t family,
+                                                 const std::vector<std::string>& addrs);
     int destroyLiveSockets(const DestroyFilter& destroy, const char *what, iovec *iov, int iovcnt);
+    int collectDestroyErrors();
     bool hasSocks() { return mSock != -1 && mWriteSock != -1; }
     void closeSocks() { close(mSock); close(mWriteSock); mSock = mWriteSock = -1; }
     static bool isLoopbackSocket(const inet_diag_msg *msg);
+    static bool hasLoopbackAddress(const inet_diag_msg *msg);
 };
 
 }  // namespace net
@@ -16,14 +16,21 @@
  * sock_diag_test.cpp - unit tests for SockDiag.cpp
  */
 
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <net/if.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <linux/inet_diag.h>
 
+#include <android-base/scopeguard.h>
+#include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
+#include <netutils/ifc.h>
 
 #include "Fwmark.h"
 #include "NetdConstants.h"
@@ -38,6 +45,9 @@ protected:
     static bool isLoopbackSocket(const inet_diag_msg *msg) {
         return SockDiag::isLoopbackSocket(msg);
     };
+    static bool hasLoopbackAddress(const inet_diag_msg *msg) {
+        return SockDiag::hasLoopbackAddress(msg);
+    };
 };
 
 uint16_t bindAndListen(int s) {
@@ -265,6 +275,30 @@ TEST_F(SockDiagTest, TestIsLoopbackSocket) {
     EXPECT_TRUE(isLoopbackSocket(&msg));
 }
 
+TEST_F(SockDiagTest, TestHasLoopbackAddress) {
+    inet_diag_msg msg;
+
+    msg = makeDiagMessage("127.0.0.1", "192.0.2.1");
+    EXPECT_TRUE(hasLoopbackAddress(&msg));
+
+    msg = makeDiagMessage("::1", "2001:db8::1");
+    EXPECT_TRUE(hasLoopbackAddress(&msg));
+
+    msg = makeDiagMessage("2001:db8::1", "::ffff:127.0.0.1");
+    EXPECT_TRUE(hasLoopbackAddress(&msg));
+
+    // Unlike isLoopbackSocket, equal addresses are not enough. This includes unconnected sockets
+    // bound to the wildcard address.
+    msg = makeDiagMessage("192.0.2.1", "192.0.2.1");
+    EXPECT_FALSE(hasLoopbackAddress(&msg));
+
+    msg = makeDiagMessage("0.0.0.0", "0.0.0.0");
+    EXPECT_FALSE(hasLoopbackAddress(&msg));
+
+    msg = makeDiagMessage("::", "::");
+    EXPECT_FALSE(hasLoopbackAddress(&msg));
+}
+
 enum MicroBenchmarkTestType {
     ADDRESS,
     UID,
@@ -528,5 +562,261 @@ INSTANTIATE_TEST_CASE_P(Address, SockDiagMicroBenchmarkTest,
                                         UID_EXCLUDE_LOOPBACK, UIDRANGE_EXCLUDE_LOOPBACK,
                                         PERMISSION));
 
+// Checks that destroying sockets for the UIDs that lost permission on a network closes exactly the
+// sockets on that network owned by one of those UIDs. This includes the sockets that explicitly
+// selected the network with mark permission bits that still cover the required permission, since
+// those bits were set when the socket was created.
+TEST_F(SockDiagTest, TestDestroySocketsForLostPermission) {
+    constexpr unsigned TEST_NETID = 42;
+    constexpr unsigned OTHER_NETID = 43;
+    constexpr uid_t START_UID = 8000;
+    constexpr int NUM_UIDS = 16;
+    constexpr int NUM_SOCKETS = 64;
+    constexpr int NUM_ROUNDS = 5;
+    const Permission permissions[] = { PERMISSION_NONE, PERMISSION_NETWORK, PERMISSION_SYSTEM };
+
+    SockDiag sd;
+    ASSERT_TRUE(sd.open()) << "Failed to open SOCK_DIAG socket";
+
+    int listensocket = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(-1, listensocket) << "Failed to open listen socket";
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+    sockaddr_in6 server = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    server.sin6_addr = in6addr_loopback;
+
+    const char data[] = "foo";
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        int clientsockets[NUM_SOCKETS], serversockets[NUM_SOCKETS];
+        uid_t uids[NUM_SOCKETS];
+        unsigned netIds[NUM_SOCKETS];
+
+        for (int i = 0; i < NUM_SOCKETS; i++) {
+            int s = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            ASSERT_NE(-1, s);
+            ASSERT_EQ(0, connect(s, (sockaddr *) &server, sizeof(server)))
+                << "Connecting socket " << i << " failed " << strerror(errno);
+
+            uids[i] = START_UID + arc4random_uniform(NUM_UIDS);
+            netIds[i] = arc4random_uniform(4) ? TEST_NETID : OTHER_NETID;
+            Fwmark fwmark;
+            fwmark.netId = netIds[i];
+            fwmark.explicitlySelected = arc4random_uniform(2);
+            fwmark.permission = permissions[arc4random_uniform(std::size(permissions))];
+            ASSERT_EQ(0, fchown(s, uids[i], -1));
+            ASSERT_EQ(0, setsockopt(s, SOL_SOCKET, SO_MARK, &fwmark.intValue,
+                                    sizeof(fwmark.intValue)));
+
+            serversockets[i] = accept4(listensocket, nullptr, nullptr, SOCK_CLOEXEC);
+            ASSERT_NE(-1, serversockets[i])
+                << "Accepting socket " << i << " failed " << strerror(errno);
+            clientsockets[i] = s;
+        }
+
+        std::set<uid_t> lostPermission;
+        for (int i = 0; i < NUM_UIDS; i++) {
+            if (arc4random_uniform(3) == 0) lostPermission.insert(START_UID + i);
+        }
+
+        int ret = sd.destroySocketsLackingPermission(TEST_NETID, lostPermission, false);
+        EXPECT_EQ(0, ret) << "Failed to destroy sockets: " << strerror(-ret);
+
+        for (int i = 0; i < NUM_SOCKETS; i++) {
+            const bool shouldClose = netIds[i] == TEST_NETID &&
+                                     lostPermission.find(uids[i]) != lostPermission.end();
+            const int sent = send(clientsockets[i], data, sizeof(data), 0);
+            if (shouldClose) {
+                EXPECT_EQ(-1, sent) << "Round " << round << ": socket " << i << " not closed";
+                EXPECT_EQ(ECONNABORTED, errno);
+            } else {
+                EXPECT_EQ((ssize_t) sizeof(data), sent)
+                    << "Round " << round << ": socket " << i << " unexpectedly closed";
+            }
+        }
+
+        for (int i = 0; i < NUM_SOCKETS; i++) {
+            close(clientsockets[i]);
+            close(serversockets[i]);
+        }
+    }
+
+    close(listensocket);
+}
+
+namespace {
+
+int getSocketError(int s) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len)) return errno;
+    return err;
+}
+
+}  // namespace
+
+// Checks that destroying the sockets of a network closes the TCP and UDP sockets marked with that
+// netId, and only those. Uses excludeLoopback like netd does, so the sockets connect to a
+// non-loopback address, and unconnected UDP sockets must still be closed. Runs in a private network
+// namespace so that no other sockets are affected.
+TEST_F(SockDiagTest, TestDestroySocketsForNetwork) {
+    using android::base::make_scope_guard;
+    using android::base::unique_fd;
+
+    const unsigned netIds[] = { 100, 101, 102 };
+    constexpr unsigned DESTROY_NETID = 101;
+    constexpr uid_t TEST_UID = 8000;
+    constexpr uid_t SKIP_UID = 8001;
+    constexpr int SOCKETS_PER_NETWORK = 8;
+
+    unique_fd origNetns(open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC));
+    ASSERT_LE(0, origNetns);
+    ASSERT_EQ(0, unshare(CLONE_NEWNET));
+    auto restoreNetns = make_scope_guard([&origNetns] { setns(origNetns, CLONE_NEWNET); });
+
+    unique_fd ctl(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, ctl);
+    struct ifreq ifr = {};
+    strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+    ASSERT_EQ(0, ioctl(ctl, SIOCGIFFLAGS, &ifr));
+    ifr.ifr_flags |= IFF_UP;
+    ASSERT_EQ(0, ioctl(ctl, SIOCSIFFLAGS, &ifr));
+    ASSERT_EQ(0, ifc_add_address("lo", "2001:db8::1", 128));
+
+    unique_fd listensocket(socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, listensocket);
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+    sockaddr_in6 server = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    ASSERT_EQ(1, inet_pton(AF_INET6, "2001:db8::1", &server.sin6_addr));
+    sockaddr_in6 loopback = server;
+    loopback.sin6_addr = in6addr_loopback;
+
+    struct TestSocket {
+        unique_fd fd;
+        unsigned netId;
+        uid_t uid;
+        bool tcp;
+        bool loopback;
+    };
+    std::vector<TestSocket> sockets;
+    std::vector<unique_fd> acceptedSockets;
+
+    for (const unsigned netId : netIds) {
+        for (int i = 0; i <= SOCKETS_PER_NETWORK; i++) {
+            const bool tcp = (i % 2 == 0) && i < SOCKETS_PER_NETWORK;
+            // The last socket is a UDP socket connected to the loopback address.
+            const bool isLoopback = (i == SOCKETS_PER_NETWORK);
+            // Every network has a socket owned by SKIP_UID.
+            const uid_t uid = (i < 2) ? SKIP_UID : TEST_UID;
+            unique_fd s(socket(AF_INET6, (tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_CLOEXEC, 0));
+            ASSERT_LE(0, s);
+
+            Fwmark fwmark;
+            fwmark.netId = netId;
+            fwmark.explicitlySelected = true;
+            fwmark.permission = PERMISSION_NETWORK;
+            ASSERT_EQ(0, setsockopt(s, SOL_SOCKET, SO_MARK, &fwmark.intValue,
+                                    sizeof(fwmark.intValue)));
+            ASSERT_EQ(0, fchown(s, uid, -1));
+
+            // Leave some of the UDP sockets unconnected.
+            if (isLoopback) {
+                ASSERT_EQ(0, connect(s, (sockaddr *) &loopback, sizeof(loopback)));
+            } else if (tcp || i % 4 == 1) {
+                ASSERT_EQ(0, connect(s, (sockaddr *) &server, sizeof(server)))
+                    << "Connecting socket failed: " << strerror(errno);
+            } else {
+                sockaddr_in6 any = { .sin6_family = AF_INET6 };
+                ASSERT_EQ(0, bind(s, (sockaddr *) &any, sizeof(any)));
+            }
+            if (tcp) {
+                acceptedSockets.emplace_back(accept4(listensocket, nullptr, nullptr,
+                                                     SOCK_CLOEXEC));
+                ASSERT_LE(0, acceptedSockets.back());
+            }
+            sockets.push_back({std::move(s), netId, uid, tcp, isLoopback});
+        }
+    }
+
+    SockDiag sd;
+    ASSERT_TRUE(sd.open()) << "Failed to open SOCK_DIAG socket";
+    int ret = sd.destroySocketsForNetwork(DESTROY_NETID, {SKIP_UID}, true /* excludeLoopback */);
+    ASSERT_EQ(0, ret) << "Failed to destroy sockets: " << strerror(-ret);
+
+    for (const auto& s : sockets) {
+        const bool shouldClose = s.netId == DESTROY_NETID && s.uid != SKIP_UID && !s.loopback;
+        EXPECT_EQ(shouldClose ? ECONNABORTED : 0, getSocketError(s.fd))
+            << (s.tcp ? "TCP" : "UDP") << (s.loopback ? " loopback" : "") << " socket on netId "
+            << s.netId << " uid " << s.uid;
+    }
+    // Accepted sockets are not marked, so they are never destroyed.
+    for (const auto& s : acceptedSockets) {
+        EXPECT_NE(ECONNABORTED, getSocketError(s));
+    }
+}
+
+// Checks that SOCK_DESTROY requests rejected by the kernel are counted as failures and not as
+// destroyed sockets. Runs in a private network namespace so that no other sockets are affected.
+TEST_F(SockDiagTest, TestDestroyPartialFailure) {
+    using android::base::make_scope_guard;
+    using android::base::unique_fd;
+
+    constexpr int NUM_SOCKETS = 4;
+
+    unique_fd origNetns(open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC));
+    ASSERT_LE(0, origNetns);
+    ASSERT_EQ(0, unshare(CLONE_NEWNET));
+    auto restoreNetns = make_scope_guard([&origNetns] { setns(origNetns, CLONE_NEWNET); });
+
+    unique_fd ctl(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, ctl);
+    struct ifreq ifr = {};
+    strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+    ASSERT_EQ(0, ioctl(ctl, SIOCGIFFLAGS, &ifr));
+    ifr.ifr_flags |= IFF_UP;
+    ASSERT_EQ(0, ioctl(ctl, SIOCSIFFLAGS, &ifr));
+
+    unique_fd listensocket(socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, listensocket);
+    uint16_t port = bindAndListen(listensocket);
+    ASSERT_NE(0, port) << "Can't bind to server port";
+    sockaddr_in6 server = { .sin6_family = AF_INET6, .sin6_port = htons(port) };
+    server.sin6_addr = in6addr_loopback;
+
+    std::vector<unique_fd> sockets;
+    for (int i = 0; i < NUM_SOCKETS; i++) {
+        unique_fd s(socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        ASSERT_LE(0, s);
+        ASSERT_EQ(0, connect(s, (sockaddr *) &server, sizeof(server)))
+            << "Connecting socket failed: " << strerror(errno);
+        sockets.push_back(std::move(s));
+        sockets.emplace_back(accept4(listensocket, nullptr, nullptr, SOCK_CLOEXEC));
+        ASSERT_LE(0, sockets.back());
+    }
+
+    SockDiag sd;
+    ASSERT_TRUE(sd.open()) << "Failed to open SOCK_DIAG socket";
+    ASSERT_EQ(0, sd.sendDumpRequest(IPPROTO_TCP, AF_INET6, 1 << TCP_ESTABLISHED));
+
+    // Before each socket, queue a request that names the same socket with a different cookie,
+    // which the kernel rejects.
+    int seen = 0;
+    auto destroyWithStaleRequest = [&] (uint8_t proto, const inet_diag_msg *msg) {
+        inet_diag_msg stale = *msg;
+        stale.id.idiag_cookie[0] ^= 0xffffffff;
+        sd.queueDestroy(proto, &stale);
+        seen++;
+        return true;
+    };
+    ASSERT_EQ(0, sd.readDiagMsg(IPPROTO_TCP, destroyWithStaleRequest));
+
+    EXPECT_EQ(2 * NUM_SOCKETS, seen);
+    EXPECT_EQ(seen, sd.socketsDestroyed());
+    EXPECT_EQ(seen, sd.destroyFailures());
+    for (const auto& s : sockets) {
+        EXPECT_EQ(ECONNABORTED, getSocketError(s));
+    }
+}
+
 }  // namespace net
 }  // namespace android
@@ -22,16 +22,27 @@
 #include <vector>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <linux/bpf.h>
 #include <linux/tcp.h>
+#include <unistd.h>
+
+#include <android-base/unique_fd.h>
+#include <processgroup/processgroup.h>
 
 #include "Controllers.h"
 #include "SockDiag.h"
 #include "TcpSocketMonitor.h"
+#include "bpf/BpfUtils.h"
 #include "netdutils/DumpWriter.h"
 
+using android::base::unique_fd;
+using android::bpf::BpfMap;
 using android::netdutils::DumpWriter;
 using android::netdutils::ScopedIndent;
+using android::netdutils::Status;
+using android::netdutils::statusFromErrno;
 
 namespace android {
 namespace net {
@@ -111,6 +122,7 @@ void TcpSocketMonitor::dump(DumpWriter& dw) {
     const auto d = duration_cast<milliseconds>(now - mLastPoll);
     dw.println("running=%d, suspended=%d, last poll %lld ms ago",
             mIsRunning, mIsSuspended, d.count());
+    dw.println("source=%s", mSockOpsEnabled ? "sock_ops" : "sock_diag");
 
     if (!mNetworkStats.empty()) {
         dw.blankline();
@@ -123,7 +135,9 @@ void TcpSocketMonitor::dump(DumpWriter& dw) {
                        stats.first,
                        stats.second.sent,
                        stats.second.lost,
-                       stats.second.rttUs / 1000.0 / stats.second.nSockets,
+                       stats.second.rttSamples
+                               ? stats.second.rttUs / 1000.0 / stats.second.rttSamples
+                               : 0.0,
                        stats.second.sentAckDiffMs / stats.second.nSockets);
         }
     }
@@ -154,6 +168,60 @@ void TcpSocketMonitor::dump(DumpWriter& dw) {
     }
 }
 
+Status TcpSocketMonitor::initSockOpsAggregation() {
+    std::string cg2_path;
+    if (!CgroupGetControllerPath(CGROUPV2_CONTROLLER_NAME, &cg2_path)) {
+        return statusFromErrno(errno, "Failed to find cgroup v2 root");
+    }
+
+    unique_fd cg_fd(open(cg2_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC));
+    if (cg_fd == -1) {
+        return statusFromErrno(errno, "Open the cgroup directory failed");
+    }
+
+    unique_fd prog(bpf::retrieveProgram(TCP_HEALTH_SOCK_OPS_PROG_PATH));
+    if (prog == -1) {
+        return statusFromErrno(errno, "sock_ops program get failed");
+    }
+
+    std::lock_guard guard(mLock);
+
+    auto res = mTcpHealthMap.init(TCP_HEALTH_MAP_PATH);
+    if (!res.ok()) {
+        return statusFromErrno(res.error().code(), "TCP health map init failed");
+    }
+    // Entries left by a previous netd instance belong to networks that no longer exist.
+    res = mTcpHealthMap.clear();
+    if (!res.ok()) {
+        return statusFromErrno(res.error().code(), "TCP health map clear failed");
+    }
+    if (bpf::attachProgram(BPF_CGROUP_SOCK_OPS, prog, cg_fd)) {
+        return statusFromErrno(errno, "sock_ops program attach failed");
+    }
+
+    mSockOpsEnabled = true;
+    mSocketEntries.clear();
+    mHasTcpHealthBaseline = false;
+    ALOGD("tcpinfo polling uses sock_ops aggregates");
+    return netdutils::status::ok;
+}
+
+void TcpSocketMonitor::removeNetwork(uint32_t netId) {
+    std::lock_guard guard(mLock);
+
+    mLastTcpHealth.erase(netId);
+    if (!mSockOpsEnabled) {
+        return;
+    }
+    // Sockets that outlive the network may recreate the entry with zeroed counters. That is
+    // handled like a network seen for the first time.
+    auto res = mTcpHealthMap.deleteValue(netId);
+    if (!res.ok() && res.error().code() != ENOENT) {
+        ALOGE("Failed to delete TCP health entry for netId %u: %s", netId,
+              strerror(res.error().code()));
+    }
+}
+
 void TcpSocketMonitor::setPollingInterval(milliseconds nextSleepDurationMs) {
     std::lock_guard guard(mLock);
 
@@ -186,6 +254,8 @@ void TcpSocketMonitor::suspendPolling() {
 
     if (!wasSuspended) {
         mSocketEntries.clear();
+        mLastTcpHealth.clear();
+        mHasTcpHealthBaseline = false;
     }
 }
 
@@ -196,13 +266,49 @@ void TcpSocketMonitor::poll() {
         return;
     }
 
+    const auto now = steady_clock::now();
+
+    // Reset mNetworkStats
+    mNetworkStats.clear();
+
+    const bool polled = mSockOpsEnabled ? pollSockOpsAggregates() : pollSockDiag(now);
+    if (!polled) {
+        return;
+    }
+
+    const auto listener = gCtls->eventReporter.getNetdEventListener();
+    if (listener != nullptr) {
+        std::vector<int> netIds;
+        std::vector<int> sentPackets;
+        std::vector<int> lostPackets;
+        std::vector<int> rtts;
+        std::vector<int> sentAckDiffs;
+        for (auto const& stats : mNetworkStats) {
+            int32_t nSockets = stats.second.nSockets;
+            if (nSockets == 0) {
+                continue;
+            }
+            netIds.push_back(stats.first);
+            sentPackets.push_back(stats.second.sent);
+            lostPackets.push_back(stats.second.lost);
+            rtts.push_back(stats.second.rttSamples
+                                   ? static_cast<int>(stats.second.rttUs / stats.second.rttSamples)
+                                   : 0);
+            sentAckDiffs.push_back(stats.second.sentAckDiffMs / nSockets);
+        }
+        listener->onTcpSocketStatsEvent(netIds, sentPackets, lostPackets, rtts, sentAckDiffs);
+    }
+
+    mLastPoll = now;
+}
+
+bool TcpSocketMonitor::pollSockDiag(time_point now) {
     SockDiag sd;
     if (!sd.open()) {
         ALOGE("Error opening sock diag for polling TCP socket info");
-        return;
+        return false;
     }
 
-    const auto now = steady_clock::now();
     const auto tcpInfoReader = [this, now](Fwmark mark, const struct inet_diag_msg *sockinfo,
                                            const struct tcp_info *tcpinfo,
                                            uint32_t tcpinfoLen) NO_THREAD_SAFETY_ANALYSIS {
@@ -212,12 +318,9 @@ void TcpSocketMonitor::poll() {
         updateSocketStats(now, mark, sockinfo, tcpinfo, tcpinfoLen);
     };
 
-    // Reset mNetworkStats
-    mNetworkStats.clear();
-
     if (int ret = sd.getLiveTcpInfos(tcpInfoReader)) {
         ALOGE("Failed to poll TCP socket info: %s", strerror(-ret));
-        return;
+        return false;
     }
 
     // Remove any SocketEntry not updated
@@ -228,29 +331,61 @@ void TcpSocketMonitor::poll() {
             it++;
         }
     }
+    return true;
+}
+
+bool TcpSocketMonitor::pollSockOpsAggregates() {
+    std::unordered_map<uint32_t, TcpHealthValue> current;
+    const auto readEntry = [&current](const uint32_t& netId, const TcpHealthValue& value,
+                                      const BpfMap<uint32_t, TcpHealthValue>&) {
+        current[netId] = value;
+        return base::Result<void>();
+    };
+    auto res = mTcpHealthMap.iterateWithValue(readEntry);
+    if (!res.ok()) {
+        ALOGE("Failed to read TCP health map: %s", strerror(res.error().code()));
+        return false;
+    }
 
-    const auto listener = gCtls->eventReporter.getNetdEventListener();
-    if (listener != nullptr) {
-        std::vector<int> netIds;
-        std::vector<int> sentPackets;
-        std::vector<int> lostPackets;
-        std::vector<int> rtts;
-        std::vector<int> sentAckDiffs;
-        for (auto const& stats : mNetworkStats) {
-            int32_t nSockets = stats.second.nSockets;
-            if (nSockets == 0) {
+    // The kernel counters only ever increase, so the stats for this interval are the diff with
+    // the previous read. The first read after resuming only establishes the baseline.
+    //
+    // Like with sock_diag, only networks with established connections at the time of the poll are
+    // reported, and nSockets is the number of those connections. The other fields count different
+    // things than their sock_diag counterparts, because sock_ops has no per-socket state to diff:
+    //   - sent is the number of data segments sent by the connections that closed in the interval,
+    //   - lost is the number of segments retransmitted in the interval,
+    //   - rttUs and rttSamples are the RTT samples taken in the interval, or over the lifetime of
+    //     the network if there were none, rather than the current smoothed RTT of each socket,
+    //   - sentAckDiffMs is not observable and is always 0.
+    if (mHasTcpHealthBaseline) {
+        for (const auto& [netId, value] : current) {
+            const TcpHealthValue previous = mLastTcpHealth[netId];
+            if (value.established <= value.closedEstablished) {
                 continue;
             }
-            netIds.push_back(stats.first);
-            sentPackets.push_back(stats.second.sent);
-            lostPackets.push_back(stats.second.lost);
-            rtts.push_back(stats.second.rttUs / nSockets);
-            sentAckDiffs.push_back(stats.second.sentAckDiffMs / nSockets);
+            const uint64_t liveSockets = value.established - value.closedEstablished;
+            uint64_t rttSamples = value.rttSamples - previous.rttSamples;
+            uint64_t rttUsSum = value.rttUsSum - previous.rttUsSum;
+            if (rttSamples == 0) {
+                rttSamples = value.rttSamples;
+                rttUsSum = value.rttUsSum;
+            }
+            mNetworkStats[netId] = {
+                    .sent = static_cast<uint32_t>(value.closedDataSegsOut -
+                                                  previous.closedDataSegsOut),
+                    .lost = static_cast<uint32_t>(value.retransSegs - previous.retransSegs),
+                    .rttUs = rttUsSum,
+                    .rttSamples = rttSamples,
+                    .sentAckDiffMs = 0,
+                    .nSockets = static_cast<int32_t>(liveSockets),
+            };
         }
-        listener->onTcpSocketStatsEvent(netIds, sentPackets, lostPackets, rtts, sentAckDiffs);
     }
 
-    mLastPoll = now;
+    mLastTcpHealth = std::move(current);
+    mHasTcpHealthBaseline = true;
+    return true;
 }
 
 void TcpSocketMonitor::waitForNextPoll() {
@@ -285,6 +420,7 @@ void TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
         .sent = TCPINFO_GET(tcpinfo, tcpi_segs_out, tcpinfoLen, 0),
         .lost = TCPINFO_GET(tcpinfo, tcpi_lost, tcpinfoLen, 0),
         .rttUs = TCPINFO_GET(tcpinfo, tcpi_rtt, tcpinfoLen, 0),
+        .rttSamples = 1,
         .sentAckDiffMs = lastAck - lastSent,
         .nSockets = 1,
     };
@@ -312,6 +448,7 @@ void TcpSocketMonitor::updateSocketStats(time_point now, Fwmark mark,
         stats.sent += diff.sent;
         stats.lost += diff.lost;
         stats.rttUs += diff.rttUs;
+        stats.rttSamples += diff.rttSamples;
         stats.sentAckDiffMs += diff.sentAckDiffMs;
         stats.nSockets += diff.nSockets;
     }
@@ -24,7 +24,10 @@
 #include <unordered_map>
 
 #include <android-base/thread_annotations.h>
+#include "bpf/BpfMap.h"
+#include "netdbpf/bpf_shared.h"
 #include "netdutils/DumpWriter.h"
+#include "netdutils/Status.h"
 #include "utils/String16.h"
 
 #include "Fwmark.h"
@@ -51,8 +54,10 @@ class TcpSocketMonitor {
         uint32_t sent;
         // Number of packets lost. Tracks struct tcp_sock lost_out.
         uint32_t lost;
-        // Smoothed round trip time. Tracks struct tcp_sock srtt_us.
-        uint32_t rttUs;
+        // Sum of smoothed round trip times. Tracks struct tcp_sock srtt_us.
+        uint64_t rttUs;
+        // Number of round trip times summed in rttUs.
+        uint64_t rttSamples;
         // Milliseconds difference between the last packet sent and last ack received.
         int32_t sentAckDiffMs;
         // Number of socket stats aggregated in this TcpStats entry.
@@ -78,12 +83,21 @@ class TcpSocketMonitor {
     ~TcpSocketMonitor();
 
     void dump(netdutils::DumpWriter& dw);
+    // Attaches the sock_ops TCP health program to the root cgroup. On success, polling only reads
+    // the per-network aggregates maintained by the kernel instead of dumping every TCP socket with
+    // sock_diag. On failure, polling keeps using sock_diag.
+    netdutils::Status initSockOpsAggregation();
+    // Forgets the TCP health counters of a network that is being destroyed, so that its netId can
+    // be reused and does not hold a slot in the sock_ops map.
+    void removeNetwork(uint32_t netId);
     void setPollingInterval(milliseconds duration);
     void resumePolling();
     void suspendPolling();
 
   private:
     void poll();
+    bool pollSockDiag(time_point now) REQUIRES(mLock);
+    bool pollSockOpsAggregates() REQUIRES(mLock);
     void waitForNextPoll();
     bool isRunning();
     void updateSocketStats(time_point now, Fwmark mark, const struct inet_diag_msg *sockinfo,
@@ -112,6 +126,14 @@ class TcpSocketMonitor {
     // This map tracks per-network data for a single sock_diag dump and is cleared before every dump
     // operation.
     std::unordered_map<uint32_t, TcpStats> mNetworkStats GUARDED_BY(mLock);
+    // True if the sock_ops program is attached and mTcpHealthMap is the source of TcpStats.
+    bool mSockOpsEnabled GUARDED_BY(mLock) = false;
+    // Per-network TCP health counters maintained by the sock_ops program.
+    bpf::BpfMap<uint32_t, TcpHealthValue> mTcpHealthMap GUARDED_BY(mLock);
+    // Counters read from mTcpHealthMap at the last poll, used for computing per-interval diffs.
+    std::unordered_map<uint32_t, TcpHealthValue> mLastTcpHealth GUARDED_BY(mLock);
+    // False until mLastTcpHealth holds a complete read of mTcpHealthMap since polling resumed.
+    bool mHasTcpHealthBaseline GUARDED_BY(mLock) = false;
 };
 
 }  // namespace net
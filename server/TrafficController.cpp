@@ -32,6 +32,9 @@
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -49,7 +52,9 @@
 #include "FirewallController.h"
 #include "InterfaceController.h"
 #include "NetlinkListener.h"
+#include "SockDiag.h"
 #include "netdutils/DumpWriter.h"
+#include "netd_dump.pb.h"
 #include "qtaguid/qtaguid.h"
 
 using namespace android::bpf;  // NOLINT(google-build-using-namespace): grandfathered
@@ -59,6 +64,8 @@ namespace net {
 
 using base::StringPrintf;
 using base::unique_fd;
+using netd::StatsValueProto;
+using netd::TrafficControllerProto;
 using netdutils::DumpWriter;
 using netdutils::extract;
 using netdutils::ScopedIndent;
@@ -134,19 +141,17 @@ const std::string UidPermissionTypeToString(int permission) {
     return permissionType;
 }
 
-StatusOr<std::unique_ptr<NetlinkListenerInterface>> TrafficController::makeSkDestroyListener() {
+StatusOr<std::unique_ptr<NetlinkListenerInterface>> TrafficController::makeSkDestroyListener(
+        netdutils::EventLoop* eventLoop) {
     const auto& sys = sSyscalls.get();
-    ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
     const int domain = AF_NETLINK;
     const int type = SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK;
     const int protocol = NETLINK_INET_DIAG;
     ASSIGN_OR_RETURN(auto sock, sys.socket(domain, type, protocol));
 
-    // TODO: if too many sockets are closed too quickly, we can overflow the socket buffer, and
-    // some entries in mCookieTagMap will not be freed. In order to fix this we would need to
-    // periodically dump all sockets and remove the tag entries for sockets that have been closed.
-    // For now, set a large-enough buffer that we can close hundreds of sockets without getting
-    // ENOBUFS and leaking mCookieTagMap entries.
+    // If too many sockets are closed too quickly, the socket buffer overflows and some entries in
+    // mCookieTagMap are never freed. Set a large-enough buffer that we can close hundreds of
+    // sockets without getting ENOBUFS. The listener grows it further if it overflows anyway.
     int rcvbuf = 512 * 1024;
     auto ret = sys.setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
     if (!ret.ok()) {
@@ -162,14 +167,22 @@ StatusOr<std::unique_ptr<NetlinkListenerInterface>> TrafficController::makeSkDes
     const sockaddr_nl kernel = {.nl_family = AF_NETLINK};
     RETURN_IF_NOT_OK(sys.connect(sock, kernel));
 
+    if (eventLoop != nullptr) {
+        return std::unique_ptr<NetlinkListenerInterface>(
+                std::make_unique<NetlinkListener>(std::move(sock), "SkDestroyListen", eventLoop));
+    }
+    ASSIGN_OR_RETURN(auto event, sys.eventfd(0, EFD_CLOEXEC));
     std::unique_ptr<NetlinkListenerInterface> listener =
             std::make_unique<NetlinkListener>(std::move(event), std::move(sock), "SkDestroyListen");
 
     return listener;
 }
 
-TrafficController::TrafficController()
-    : mBpfEnabled(isBpfSupported()),
+TrafficController::TrafficController(netdutils::Executor* executor,
+                                     netdutils::EventLoop* eventLoop)
+    : mExecutor(executor),
+      mEventLoop(eventLoop),
+      mBpfEnabled(isBpfSupported()),
       mPerUidStatsEntriesLimit(PER_UID_STATS_ENTRIES_LIMIT),
       mTotalUidStatsEntriesLimit(TOTAL_UID_STATS_ENTRIES_LIMIT) {}
 
@@ -181,23 +194,23 @@ TrafficController::TrafficController(uint32_t perUidLimit, uint32_t totalLimit)
 Status TrafficController::initMaps() {
     std::lock_guard guard(mMutex);
 
-    RETURN_IF_NOT_OK(mCookieTagMap.init(COOKIE_TAG_MAP_PATH));
-    RETURN_IF_NOT_OK(mUidCounterSetMap.init(UID_COUNTERSET_MAP_PATH));
-    RETURN_IF_NOT_OK(mAppUidStatsMap.init(APP_UID_STATS_MAP_PATH));
-    RETURN_IF_NOT_OK(mStatsMapA.init(STATS_MAP_A_PATH));
-    RETURN_IF_NOT_OK(mStatsMapB.init(STATS_MAP_B_PATH));
-    RETURN_IF_NOT_OK(mIfaceIndexNameMap.init(IFACE_INDEX_NAME_MAP_PATH));
-    RETURN_IF_NOT_OK(mIfaceStatsMap.init(IFACE_STATS_MAP_PATH));
+    RETURN_IF_NOT_OK(mCookieTagMap->init(COOKIE_TAG_MAP_PATH));
+    RETURN_IF_NOT_OK(mUidCounterSetMap->init(UID_COUNTERSET_MAP_PATH));
+    RETURN_IF_NOT_OK(mAppUidStatsMap->init(APP_UID_STATS_MAP_PATH));
+    RETURN_IF_NOT_OK(mStatsMapA->init(STATS_MAP_A_PATH));
+    RETURN_IF_NOT_OK(mStatsMapB->init(STATS_MAP_B_PATH));
+    RETURN_IF_NOT_OK(mIfaceIndexNameMap->init(IFACE_INDEX_NAME_MAP_PATH));
+    RETURN_IF_NOT_OK(mIfaceStatsMap->init(IFACE_STATS_MAP_PATH));
 
-    RETURN_IF_NOT_OK(mConfigurationMap.init(CONFIGURATION_MAP_PATH));
+    RETURN_IF_NOT_OK(mConfigurationMap->init(CONFIGURATION_MAP_PATH));
     RETURN_IF_NOT_OK(
-            mConfigurationMap.writeValue(UID_RULES_CONFIGURATION_KEY, DEFAULT_CONFIG, BPF_ANY));
-    RETURN_IF_NOT_OK(mConfigurationMap.writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY, SELECT_MAP_A,
-                                                  BPF_ANY));
+            mConfigurationMap->writeValue(UID_RULES_CONFIGURATION_KEY, DEFAULT_CONFIG, BPF_ANY));
+    RETURN_IF_NOT_OK(mConfigurationMap->writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY,
+                                                   SELECT_MAP_A, BPF_ANY));
 
-    RETURN_IF_NOT_OK(mUidOwnerMap.init(UID_OWNER_MAP_PATH));
-    RETURN_IF_NOT_OK(mUidOwnerMap.clear());
-    RETURN_IF_NOT_OK(mUidPermissionMap.init(UID_PERMISSION_MAP_PATH));
+    RETURN_IF_NOT_OK(mUidOwnerMap->init(UID_OWNER_MAP_PATH));
+    RETURN_IF_NOT_OK(mUidOwnerMap->clear());
+    RETURN_IF_NOT_OK(mUidPermissionMap->init(UID_PERMISSION_MAP_PATH));
 
     return netdutils::status::ok;
 }
@@ -273,7 +286,7 @@ Status TrafficController::start() {
         addInterface(ifacePair.first.c_str(), ifacePair.second);
     }
 
-    auto result = makeSkDestroyListener();
+    auto result = makeSkDestroyListener(mEventLoop);
     if (!isOk(result)) {
         ALOGE("Unable to create SkDestroyListener: %s", toString(result).c_str());
     } else {
@@ -290,7 +303,7 @@ Status TrafficController::start() {
         uint64_t sock_cookie = static_cast<uint64_t>(diagmsg.id.idiag_cookie[0]) |
                                (static_cast<uint64_t>(diagmsg.id.idiag_cookie[1]) << 32);
 
-        Status s = mCookieTagMap.deleteValue(sock_cookie);
+        Status s = mCookieTagMap->deleteValue(sock_cookie);
         if (!isOk(s) && s.code() != ENOENT) {
             ALOGE("Failed to delete cookie %" PRIx64 ": %s", sock_cookie, toString(s).c_str());
             return;
@@ -307,9 +320,71 @@ Status TrafficController::start() {
     };
     expectOk(mSkDestroyListener->subscribe(kSockDiagDoneMsgType, rxDoneHandler));
 
+    mSkDestroyListener->registerOverflowHandler([this] {
+        mSkDestroyOverflows++;
+        scheduleCookieTagMapAudit();
+    });
+
     return netdutils::status::ok;
 }
 
+void TrafficController::scheduleCookieTagMapAudit() {
+    // Overflows that happen before a scheduled audit starts are covered by it.
+    if (mCookieTagMapAuditScheduled.exchange(true)) return;
+
+    const auto audit = [this] {
+        mCookieTagMapAuditScheduled = false;
+        const int ret = auditCookieTagMap();
+        if (ret < 0) ALOGE("Failed to audit mCookieTagMap: %s", strerror(-ret));
+    };
+    if (mExecutor == nullptr) {
+        audit();
+        return;
+    }
+    const auto status = mExecutor->post(netdutils::Executor::Lane::BACKGROUND, audit);
+    if (!isOk(status)) {
+        // The next overflow schedules another attempt.
+        ALOGE("Error scheduling mCookieTagMap audit: %s", toString(status).c_str());
+        mCookieTagMapAuditScheduled = false;
+    }
+}
+
+int TrafficController::auditCookieTagMap() {
+    // Only consider the sockets tagged before the first dump starts. Sockets tagged later may be
+    // missing from it even though they are alive. Cookies are never reused.
+    std::set<uint64_t> candidates;
+    {
+        std::lock_guard guard(mMutex);
+        const auto collect = [&candidates](const uint64_t& cookie,
+                                           const BpfMapInterface<uint64_t, UidTagValue>&) {
+            candidates.insert(cookie);
+            return base::Result<void>();
+        };
+        base::Result<void> res = mCookieTagMap->iterate(collect);
+        if (!res.ok()) return -res.error().code();
+    }
+
+    // Apps usually tag sockets before connecting them, so only count the sockets that are missing
+    // from two dumps taken a while apart. This leaves out most sockets that were about to connect,
+    // but the count remains an upper bound on the number of leaked entries.
+    SockDiag sd;
+    if (!sd.open()) return -errno;
+    for (int pass = 0; pass < 2 && !candidates.empty(); pass++) {
+        if (pass > 0) std::this_thread::sleep_for(kCookieTagMapAuditGracePeriod);
+        std::set<uint64_t> live;
+        if (int ret = sd.getSocketCookies(&live)) return ret;
+        for (const uint64_t cookie : live) candidates.erase(cookie);
+    }
+
+    const int suspected = candidates.size();
+    mSuspectedStaleCookies = suspected;
+    if (suspected > 0) {
+        ALOGW("%d mCookieTagMap entries may be stale after SkDestroyListener overflows",
+              suspected);
+    }
+    return suspected;
+}
+
 int TrafficController::tagSocket(int sockFd, uint32_t tag, uid_t uid, uid_t callingUid) {
     std::lock_guard guard(mMutex);
     if (uid != callingUid && !hasUpdateDeviceStatsPermission(callingUid)) {
@@ -334,17 +409,17 @@ int TrafficController::tagSocket(int sockFd, uint32_t tag, uid_t uid, uid_t call
     // the live stats map and clean it. So nobody can delete entries from the map.
     const auto countUidStatsEntries = [uid, &totalEntryCount, &perUidEntryCount](
                                               const StatsKey& key,
-                                              const BpfMap<StatsKey, StatsValue>&) {
+                                              const BpfMapInterface<StatsKey, StatsValue>&) {
         if (key.uid == uid) {
             perUidEntryCount++;
         }
         totalEntryCount++;
         return base::Result<void>();
     };
-    auto configuration = mConfigurationMap.readValue(CURRENT_STATS_MAP_CONFIGURATION_KEY);
+    auto configuration = mConfigurationMap->readValue(CURRENT_STATS_MAP_CONFIGURATION_KEY);
     if (!configuration.ok()) {
         ALOGE("Failed to get current configuration: %s, fd: %d",
-              strerror(configuration.error().code()), mConfigurationMap.getMap().get());
+              strerror(configuration.error().code()), mConfigurationMap->getMap().get());
         return -configuration.error().code();
     }
     if (configuration.value() != SELECT_MAP_A && configuration.value() != SELECT_MAP_B) {
@@ -352,8 +427,8 @@ int TrafficController::tagSocket(int sockFd, uint32_t tag, uid_t uid, uid_t call
         return -EINVAL;
     }
 
-    BpfMap<StatsKey, StatsValue>& currentMap =
-            (configuration.value() == SELECT_MAP_A) ? mStatsMapA : mStatsMapB;
+    BpfMapInterface<StatsKey, StatsValue>& currentMap =
+            (configuration.value() == SELECT_MAP_A) ? *mStatsMapA : *mStatsMapB;
     base::Result<void> res = currentMap.iterate(countUidStatsEntries);
     if (!res.ok()) {
         ALOGE("Failed to count the stats entry in map %d: %s", currentMap.getMap().get(),
@@ -373,10 +448,10 @@ int TrafficController::tagSocket(int sockFd, uint32_t tag, uid_t uid, uid_t call
     // yet. And update the tag if there is already a tag stored. Since the eBPF
     // program in kernel only read this map, and is protected by rcu read lock. It
     // should be fine to cocurrently update the map while eBPF program is running.
-    res = mCookieTagMap.writeValue(sock_cookie, newKey, BPF_ANY);
+    res = mCookieTagMap->writeValue(sock_cookie, newKey, BPF_ANY);
     if (!res.ok()) {
         ALOGE("Failed to tag the socket: %s, fd: %d", strerror(res.error().code()),
-              mCookieTagMap.getMap().get());
+              mCookieTagMap->getMap().get());
         return -res.error().code();
     }
     return 0;
@@ -391,7 +466,7 @@ int TrafficController::untagSocket(int sockFd) {
     uint64_t sock_cookie = getSocketCookie(sockFd);
 
     if (sock_cookie == NONEXISTENT_COOKIE) return -errno;
-    base::Result<void> res = mCookieTagMap.deleteValue(sock_cookie);
+    base::Result<void> res = mCookieTagMap->deleteValue(sock_cookie);
     if (!res.ok()) {
         ALOGE("Failed to untag socket: %s\n", strerror(res.error().code()));
         return -res.error().code();
@@ -413,7 +488,7 @@ int TrafficController::setCounterSet(int counterSetNum, uid_t uid, uid_t calling
     // The default counter set for all uid is 0, so deleting the current counterset for that uid
     // will automatically set it to 0.
     if (counterSetNum == 0) {
-        Status res = mUidCounterSetMap.deleteValue(uid);
+        Status res = mUidCounterSetMap->deleteValue(uid);
         if (isOk(res) || (!isOk(res) && res.code() == ENOENT)) {
             return 0;
         } else {
@@ -422,10 +497,10 @@ int TrafficController::setCounterSet(int counterSetNum, uid_t uid, uid_t calling
         }
     }
     uint8_t tmpCounterSetNum = (uint8_t)counterSetNum;
-    Status res = mUidCounterSetMap.writeValue(uid, tmpCounterSetNum, BPF_ANY);
+    Status res = mUidCounterSetMap->writeValue(uid, tmpCounterSetNum, BPF_ANY);
     if (!isOk(res)) {
         ALOGE("Failed to set the counterSet: %s, fd: %d", strerror(res.code()),
-              mUidCounterSetMap.getMap().get());
+              mUidCounterSetMap->getMap().get());
         return -res.code();
     }
     return 0;
@@ -445,9 +520,9 @@ int TrafficController::deleteTagData(uint32_t tag, uid_t uid, uid_t callingUid)
 
     // First we go through the cookieTagMap to delete the target uid tag combination. Or delete all
     // the tags related to the uid if the tag is 0.
-    const auto deleteMatchedCookieEntries = [uid, tag](const uint64_t& key,
-                                                       const UidTagValue& value,
-                                                       BpfMap<uint64_t, UidTagValue>& map) {
+    const auto deleteMatchedCookieEntries = [uid, tag](
+                                                    const uint64_t& key, const UidTagValue& value,
+                                                    BpfMapInterface<uint64_t, UidTagValue>& map) {
         if (value.uid == uid && (value.tag == tag || tag == 0)) {
             auto res = map.deleteValue(key);
             if (res.ok() || (res.error().code() == ENOENT)) {
@@ -459,11 +534,12 @@ int TrafficController::deleteTagData(uint32_t tag, uid_t uid, uid_t callingUid)
         // Move forward to next cookie in the map.
         return base::Result<void>();
     };
-    mCookieTagMap.iterateWithValue(deleteMatchedCookieEntries);
+    mCookieTagMap->iterateWithValue(deleteMatchedCookieEntries);
     // Now we go through the Tag stats map and delete the data entry with correct uid and tag
     // combination. Or all tag stats under that uid if the target tag is 0.
-    const auto deleteMatchedUidTagEntries = [uid, tag](const StatsKey& key,
-                                                       BpfMap<StatsKey, StatsValue>& map) {
+    const auto deleteMatchedUidTagEntries = [uid, tag](
+                                                    const StatsKey& key,
+                                                    BpfMapInterface<StatsKey, StatsValue>& map) {
         if (key.uid == uid && (key.tag == tag || tag == 0)) {
             auto res = map.deleteValue(key);
             if (res.ok() || (res.error().code() == ENOENT)) {
@@ -475,20 +551,21 @@ int TrafficController::deleteTagData(uint32_t tag, uid_t uid, uid_t callingUid)
         }
         return base::Result<void>();
     };
-    mStatsMapB.iterate(deleteMatchedUidTagEntries);
-    mStatsMapA.iterate(deleteMatchedUidTagEntries);
+    mStatsMapB->iterate(deleteMatchedUidTagEntries);
+    mStatsMapA->iterate(deleteMatchedUidTagEntries);
     // If the tag is not zero, we already deleted all the data entry required. If tag is 0, we also
     // need to delete the stats stored in uidStatsMap and counterSet map.
     if (tag != 0) return 0;
 
-    auto res = mUidCounterSetMap.deleteValue(uid);
+    auto res = mUidCounterSetMap->deleteValue(uid);
     if (!res.ok() && res.error().code() != ENOENT) {
         ALOGE("Failed to delete counterSet data(uid=%u, tag=%u): %s\n", uid, tag,
               strerror(res.error().code()));
     }
 
     auto deleteAppUidStatsEntry = [uid](const uint32_t& key,
-                                        BpfMap<uint32_t, StatsValue>& map) -> base::Result<void> {
+                                        BpfMapInterface<uint32_t, StatsValue>& map)
+            -> base::Result<void> {
         if (key == uid) {
             auto res = map.deleteValue(key);
             if (res.ok() || (res.error().code() == ENOENT)) {
@@ -498,7 +575,7 @@ int TrafficController::deleteTagData(uint32_t tag, uid_t uid, uid_t callingUid)
         }
         return {};
     };
-    mAppUidStatsMap.iterate(deleteAppUidStatsEntry);
+    mAppUidStatsMap->iterate(deleteAppUidStatsEntry);
     return 0;
 }
 
@@ -512,7 +589,7 @@ int TrafficController::addInterface(const char* name, uint32_t ifaceIndex) {
     }
 
     strlcpy(iface.name, name, sizeof(IfaceValue));
-    Status res = mIfaceIndexNameMap.writeValue(ifaceIndex, iface, BPF_ANY);
+    Status res = mIfaceIndexNameMap->writeValue(ifaceIndex, iface, BPF_ANY);
     if (!isOk(res)) {
         ALOGE("Failed to add iface %s(%d): %s", name, ifaceIndex, strerror(res.code()));
         return -res.code();
@@ -524,9 +601,9 @@ Status TrafficController::updateOwnerMapEntry(UidOwnerMatchType match, uid_t uid
                                               FirewallType type) {
     std::lock_guard guard(mMutex);
     if ((rule == ALLOW && type == WHITELIST) || (rule == DENY && type == BLACKLIST)) {
-        RETURN_IF_NOT_OK(addRule(mUidOwnerMap, uid, match));
+        RETURN_IF_NOT_OK(addRule(*mUidOwnerMap, uid, match));
     } else if ((rule == ALLOW && type == BLACKLIST) || (rule == DENY && type == WHITELIST)) {
-        RETURN_IF_NOT_OK(removeRule(mUidOwnerMap, uid, match));
+        RETURN_IF_NOT_OK(removeRule(*mUidOwnerMap, uid, match));
     } else {
         //Cannot happen.
         return statusFromErrno(EINVAL, "");
@@ -545,7 +622,7 @@ UidOwnerMatchType TrafficController::jumpOpToMatch(BandwidthController::IptJumpO
     }
 }
 
-Status TrafficController::removeRule(BpfMap<uint32_t, UidOwnerValue>& map, uint32_t uid,
+Status TrafficController::removeRule(BpfMapInterface<uint32_t, UidOwnerValue>& map, uint32_t uid,
                                      UidOwnerMatchType match, uint32_t ifBlacklistSlot) {
     if (match & IF_BLACKLIST && ifBlacklistSlot >= UID_MAX_IF_BLACKLIST) {
         return statusFromErrno(EINVAL, StringPrintf("Interface rule iface slot is out of range: %d",
@@ -581,7 +658,7 @@ Status TrafficController::removeRule(BpfMap<uint32_t, UidOwnerValue>& map, uint3
     return netdutils::status::ok;
 }
 
-Status TrafficController::addRule(BpfMap<uint32_t, UidOwnerValue>& map, uint32_t uid,
+Status TrafficController::addRule(BpfMapInterface<uint32_t, UidOwnerValue>& map, uint32_t uid,
                                   UidOwnerMatchType match, uint32_t iif, uint32_t ifBlacklistSlot) {
     if ((match & IIF_MATCH) && (match & IF_BLACKLIST)) {
         return statusFromErrno(EINVAL, "Cannot match on IIF_MATCH and IF_BLACKLIST in the "
@@ -643,9 +720,9 @@ Status TrafficController::updateUidOwnerMap(const std::vector<std::string>& appS
         }
 
         if (op == BandwidthController::IptOpDelete) {
-            RETURN_IF_NOT_OK(removeRule(mUidOwnerMap, uid, match));
+            RETURN_IF_NOT_OK(removeRule(*mUidOwnerMap, uid, match));
         } else if (op == BandwidthController::IptOpInsert) {
-            RETURN_IF_NOT_OK(addRule(mUidOwnerMap, uid, match));
+            RETURN_IF_NOT_OK(addRule(*mUidOwnerMap, uid, match));
         } else {
             // Cannot happen.
             return statusFromErrno(EINVAL, StringPrintf("invalid IptOp: %d, %d", op, match));
@@ -691,21 +768,22 @@ Status TrafficController::replaceRulesInMap(const UidOwnerMatchType match,
     std::lock_guard guard(mMutex);
     std::set<int32_t> uidSet(uids.begin(), uids.end());
     std::vector<uint32_t> uidsToDelete;
-    auto getUidsToDelete = [&uidsToDelete, &uidSet](const uint32_t& key,
-                                                    const BpfMap<uint32_t, UidOwnerValue>&) {
+    auto getUidsToDelete = [&uidsToDelete, &uidSet](
+                                   const uint32_t& key,
+                                   const BpfMapInterface<uint32_t, UidOwnerValue>&) {
         if (uidSet.find((int32_t) key) == uidSet.end()) {
             uidsToDelete.push_back(key);
         }
         return base::Result<void>();
     };
-    RETURN_IF_NOT_OK(mUidOwnerMap.iterate(getUidsToDelete));
+    RETURN_IF_NOT_OK(mUidOwnerMap->iterate(getUidsToDelete));
 
     for(auto uid : uidsToDelete) {
-        RETURN_IF_NOT_OK(removeRule(mUidOwnerMap, uid, match));
+        RETURN_IF_NOT_OK(removeRule(*mUidOwnerMap, uid, match));
     }
 
     for (auto uid : uids) {
-        RETURN_IF_NOT_OK(addRule(mUidOwnerMap, uid, match));
+        RETURN_IF_NOT_OK(addRule(*mUidOwnerMap, uid, match));
     }
     return netdutils::status::ok;
 }
@@ -722,7 +800,7 @@ Status TrafficController::addUidInterfaceRules(const int iif,
     std::lock_guard guard(mMutex);
 
     for (auto uid : uidsToAdd) {
-        netdutils::Status result = addRule(mUidOwnerMap, uid, IIF_MATCH, iif);
+        netdutils::Status result = addRule(*mUidOwnerMap, uid, IIF_MATCH, iif);
         if (!isOk(result)) {
             ALOGW("addRule failed(%d): uid=%d iif=%d", result.code(), uid, iif);
         }
@@ -738,7 +816,7 @@ Status TrafficController::removeUidInterfaceRules(const std::vector<int32_t>& ui
     std::lock_guard guard(mMutex);
 
     for (auto uid : uidsToDelete) {
-        netdutils::Status result = removeRule(mUidOwnerMap, uid, IIF_MATCH);
+        netdutils::Status result = removeRule(*mUidOwnerMap, uid, IIF_MATCH);
         if (!isOk(result)) {
             ALOGW("removeRule failed(%d): uid=%d", result.code(), uid);
         }
@@ -759,7 +837,8 @@ Status TrafficController::addUidInterfaceBlacklist(const int ifBlacklistSlot, co
 
     for (const auto& appStrUid : appStrUids) {
         uint32_t uid = (uint32_t) std::stoi(appStrUid, nullptr, 0);
-        netdutils::Status result = addRule(mUidOwnerMap, uid, IF_BLACKLIST, iface, ifBlacklistSlot);
+        netdutils::Status result =
+                addRule(*mUidOwnerMap, uid, IF_BLACKLIST, iface, ifBlacklistSlot);
         if (!isOk(result)) {
             ALOGW("addRule failed(%d): uid=%d iface=%d ifBlacklistSlot=%d "
                   "(addUidInterfaceBlacklist)", result.code(), uid, iface, ifBlacklistSlot);
@@ -778,7 +857,7 @@ Status TrafficController::removeUidInterfaceBlacklist(const int ifBlacklistSlot,
 
     for (const auto& appStrUid : appStrUids) {
         uint32_t uid = (uint32_t) std::stoi(appStrUid, nullptr, 0);
-        netdutils::Status result = removeRule(mUidOwnerMap, uid, IF_BLACKLIST, ifBlacklistSlot);
+        netdutils::Status result = removeRule(*mUidOwnerMap, uid, IF_BLACKLIST, ifBlacklistSlot);
         if (!isOk(result)) {
             ALOGW("removeRule failed(%d): uid=%d ifBlacklistSlot=%d (removeUidInterfaceBlacklist)",
                   result.code(), uid, ifBlacklistSlot);
@@ -814,7 +893,7 @@ int TrafficController::replaceUidOwnerMap(const std::string& name, bool isWhitel
 int TrafficController::toggleUidOwnerMap(ChildChain chain, bool enable) {
     std::lock_guard guard(mMutex);
     uint32_t key = UID_RULES_CONFIGURATION_KEY;
-    auto oldConfiguration = mConfigurationMap.readValue(key);
+    auto oldConfiguration = mConfigurationMap->readValue(key);
     if (!oldConfiguration.ok()) {
         ALOGE("Cannot read the old configuration from map: %s",
               oldConfiguration.error().message().c_str());
@@ -841,7 +920,7 @@ int TrafficController::toggleUidOwnerMap(ChildChain chain, bool enable) {
     }
     newConfiguration =
             enable ? (oldConfiguration.value() | match) : (oldConfiguration.value() & (~match));
-    res = mConfigurationMap.writeValue(key, newConfiguration, BPF_EXIST);
+    res = mConfigurationMap->writeValue(key, newConfiguration, BPF_EXIST);
     if (!isOk(res)) {
         ALOGE("Failed to toggleUidOwnerMap(%d): %s", chain, res.msg().c_str());
     }
@@ -860,7 +939,7 @@ Status TrafficController::swapActiveStatsMap() {
     }
 
     uint32_t key = CURRENT_STATS_MAP_CONFIGURATION_KEY;
-    auto oldConfiguration = mConfigurationMap.readValue(key);
+    auto oldConfiguration = mConfigurationMap->readValue(key);
     if (!oldConfiguration.ok()) {
         ALOGE("Cannot read the old configuration from map: %s",
               oldConfiguration.error().message().c_str());
@@ -871,7 +950,7 @@ Status TrafficController::swapActiveStatsMap() {
     // from using one map to the other. Use flag BPF_EXIST here since the map should
     // be already populated in initMaps.
     uint8_t newConfigure = (oldConfiguration.value() == SELECT_MAP_A) ? SELECT_MAP_B : SELECT_MAP_A;
-    auto res = mConfigurationMap.writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY, newConfigure,
+    auto res = mConfigurationMap->writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY, newConfigure,
                                             BPF_EXIST);
     if (!res.ok()) {
         ALOGE("Failed to toggle the stats map: %s", strerror(res.error().code()));
@@ -902,7 +981,7 @@ void TrafficController::setPermissionForUids(int permission, const std::vector<u
             // packages related to it are uninstalled.
             mPrivilegedUser.erase(uid);
             if (mBpfEnabled) {
-                Status ret = mUidPermissionMap.deleteValue(uid);
+                Status ret = mUidPermissionMap->deleteValue(uid);
                 if (!isOk(ret) && ret.code() != ENOENT) {
                     ALOGE("Failed to clean up the permission for %u: %s", uid,
                           strerror(ret.code()));
@@ -928,13 +1007,13 @@ void TrafficController::setPermissionForUids(int permission, const std::vector<u
         // The map stores all the permissions that the UID has, except if the only permission
         // the UID has is the INTERNET permission, then the UID should not appear in the map.
         if (permission != INetd::PERMISSION_INTERNET) {
-            Status ret = mUidPermissionMap.writeValue(uid, permission, BPF_ANY);
+            Status ret = mUidPermissionMap->writeValue(uid, permission, BPF_ANY);
             if (!isOk(ret)) {
                 ALOGE("Failed to set permission: %s of uid(%u) to permission map: %s",
                       UidPermissionTypeToString(permission).c_str(), uid, strerror(ret.code()));
             }
         } else {
-            Status ret = mUidPermissionMap.deleteValue(uid);
+            Status ret = mUidPermissionMap->deleteValue(uid);
             if (!isOk(ret) && ret.code() != ENOENT) {
                 ALOGE("Failed to remove uid %u from permission map: %s", uid, strerror(ret.code()));
             }
@@ -974,8 +1053,58 @@ void dumpBpfMap(const std::string& mapName, DumpWriter& dw, const std::string& h
 
 const String16 TrafficController::DUMP_KEYWORD = String16("trafficcontroller");
 
+// The entries of a BPF map, and the result of iterating over it.
+template <class Key, class Value>
+struct MapContents {
+    std::vector<std::pair<Key, Value>> entries;
+    base::Result<void> result;
+};
+
+template <class Key, class Value>
+static MapContents<Key, Value> copyMap(const BpfMapInterface<Key, Value>& map) {
+    MapContents<Key, Value> contents;
+    contents.result = map.iterateWithValue(
+            [&contents](const Key& key, const Value& value, const BpfMapInterface<Key, Value>&) {
+                contents.entries.emplace_back(key, value);
+                return base::Result<void>();
+            });
+    return contents;
+}
+
+struct TrafficController::MapsSnapshot {
+    MapContents<uint64_t, UidTagValue> cookieTags;
+    MapContents<uint32_t, uint8_t> uidCounterSets;
+    MapContents<uint32_t, StatsValue> appUidStats;
+    MapContents<StatsKey, StatsValue> statsMapA;
+    MapContents<StatsKey, StatsValue> statsMapB;
+    MapContents<uint32_t, IfaceValue> ifaceNames;
+    MapContents<uint32_t, StatsValue> ifaceStats;
+    base::Result<uint8_t> ownerMatchConfiguration;
+    base::Result<uint8_t> statsMapConfiguration;
+    MapContents<uint32_t, UidOwnerValue> uidOwners;
+    MapContents<uint32_t, uint8_t> uidPermissions;
+    std::set<uid_t> privilegedUsers;
+};
+
+TrafficController::MapsSnapshot TrafficController::snapshotMapsLocked() {
+    return {
+            .cookieTags = copyMap(*mCookieTagMap),
+            .uidCounterSets = copyMap(*mUidCounterSetMap),
+            .appUidStats = copyMap(*mAppUidStatsMap),
+            .statsMapA = copyMap(*mStatsMapA),
+            .statsMapB = copyMap(*mStatsMapB),
+            .ifaceNames = copyMap(*mIfaceIndexNameMap),
+            .ifaceStats = copyMap(*mIfaceStatsMap),
+            .ownerMatchConfiguration = mConfigurationMap->readValue(UID_RULES_CONFIGURATION_KEY),
+            .statsMapConfiguration =
+                    mConfigurationMap->readValue(CURRENT_STATS_MAP_CONFIGURATION_KEY),
+            .uidOwners = copyMap(*mUidOwnerMap),
+            .uidPermissions = copyMap(*mUidPermissionMap),
+            .privilegedUsers = mPrivilegedUser,
+    };
+}
+
 void TrafficController::dump(DumpWriter& dw, bool verbose) {
-    std::lock_guard guard(mMutex);
     ScopedIndent indentTop(dw);
     dw.println("TrafficController");
 
@@ -987,25 +1116,39 @@ void TrafficController::dump(DumpWriter& dw, bool verbose) {
         return;
     }
 
+    // Only copy the maps under mMutex. Writing the dump can block for as long as its reader
+    // takes, which must not stall tagging and firewall changes.
+    std::vector<std::pair<const char*, std::string>> mapStatus;
+    std::optional<MapsSnapshot> snapshot;
+    {
+        std::lock_guard guard(mMutex);
+        mapStatus = {
+                {"mCookieTagMap", getMapStatus(mCookieTagMap->getMap(), COOKIE_TAG_MAP_PATH)},
+                {"mUidCounterSetMap",
+                 getMapStatus(mUidCounterSetMap->getMap(), UID_COUNTERSET_MAP_PATH)},
+                {"mAppUidStatsMap",
+                 getMapStatus(mAppUidStatsMap->getMap(), APP_UID_STATS_MAP_PATH)},
+                {"mStatsMapA", getMapStatus(mStatsMapA->getMap(), STATS_MAP_A_PATH)},
+                {"mStatsMapB", getMapStatus(mStatsMapB->getMap(), STATS_MAP_B_PATH)},
+                {"mIfaceIndexNameMap",
+                 getMapStatus(mIfaceIndexNameMap->getMap(), IFACE_INDEX_NAME_MAP_PATH)},
+                {"mIfaceStatsMap", getMapStatus(mIfaceStatsMap->getMap(), IFACE_STATS_MAP_PATH)},
+                {"mConfigurationMap",
+                 getMapStatus(mConfigurationMap->getMap(), CONFIGURATION_MAP_PATH)},
+                {"mUidOwnerMap", getMapStatus(mUidOwnerMap->getMap(), UID_OWNER_MAP_PATH)},
+        };
+        if (verbose) {
+            snapshot.emplace(snapshotMapsLocked());
+        }
+    }
+
     dw.blankline();
-    dw.println("mCookieTagMap status: %s",
-               getMapStatus(mCookieTagMap.getMap(), COOKIE_TAG_MAP_PATH).c_str());
-    dw.println("mUidCounterSetMap status: %s",
-               getMapStatus(mUidCounterSetMap.getMap(), UID_COUNTERSET_MAP_PATH).c_str());
-    dw.println("mAppUidStatsMap status: %s",
-               getMapStatus(mAppUidStatsMap.getMap(), APP_UID_STATS_MAP_PATH).c_str());
-    dw.println("mStatsMapA status: %s",
-               getMapStatus(mStatsMapA.getMap(), STATS_MAP_A_PATH).c_str());
-    dw.println("mStatsMapB status: %s",
-               getMapStatus(mStatsMapB.getMap(), STATS_MAP_B_PATH).c_str());
-    dw.println("mIfaceIndexNameMap status: %s",
-               getMapStatus(mIfaceIndexNameMap.getMap(), IFACE_INDEX_NAME_MAP_PATH).c_str());
-    dw.println("mIfaceStatsMap status: %s",
-               getMapStatus(mIfaceStatsMap.getMap(), IFACE_STATS_MAP_PATH).c_str());
-    dw.println("mConfigurationMap status: %s",
-               getMapStatus(mConfigurationMap.getMap(), CONFIGURATION_MAP_PATH).c_str());
-    dw.println("mUidOwnerMap status: %s",
-               getMapStatus(mUidOwnerMap.getMap(), UID_OWNER_MAP_PATH).c_str());
+    for (const auto& [name, status] : mapStatus) {
+        dw.println("%s status: %s", name, status.c_str());
+    }
+    dw.println("SkDestroyListener overflows: %" PRIu64
+               ", mCookieTagMap entries of sockets not found by the last audit: %d",
+               mSkDestroyOverflows.load(), mSuspectedStaleCookies.load());
 
     dw.blankline();
     dw.println("Cgroup ingress program status: %s",
@@ -1029,121 +1172,97 @@ void TrafficController::dump(DumpWriter& dw, bool verbose) {
 
     ScopedIndent indentForMapContent(dw);
 
+    const auto printError = [&dw](const char* mapName, const base::Result<void>& res) {
+        if (!res.ok()) {
+            dw.println("%s print end with error: %s", mapName, res.error().message().c_str());
+        }
+    };
+
+    std::unordered_map<uint32_t, const char*> ifaceNames;
+    for (const auto& [ifaceIndex, value] : snapshot->ifaceNames.entries) {
+        ifaceNames[ifaceIndex] = value.name;
+    }
+    const auto ifaceName = [&ifaceNames](uint32_t ifaceIndex) {
+        const auto it = ifaceNames.find(ifaceIndex);
+        return it != ifaceNames.end() ? it->second : "unknown";
+    };
+
     // Print CookieTagMap content.
     dumpBpfMap("mCookieTagMap", dw, "");
-    const auto printCookieTagInfo = [&dw](const uint64_t& key, const UidTagValue& value,
-                                          const BpfMap<uint64_t, UidTagValue>&) {
-        dw.println("cookie=%" PRIu64 " tag=0x%x uid=%u", key, value.tag, value.uid);
-        return base::Result<void>();
-    };
-    base::Result<void> res = mCookieTagMap.iterateWithValue(printCookieTagInfo);
-    if (!res.ok()) {
-        dw.println("mCookieTagMap print end with error: %s", res.error().message().c_str());
+    for (const auto& [cookie, value] : snapshot->cookieTags.entries) {
+        dw.println("cookie=%" PRIu64 " tag=0x%x uid=%u", cookie, value.tag, value.uid);
     }
+    printError("mCookieTagMap", snapshot->cookieTags.result);
 
     // Print UidCounterSetMap Content
     dumpBpfMap("mUidCounterSetMap", dw, "");
-    const auto printUidInfo = [&dw](const uint32_t& key, const uint8_t& value,
-                                    const BpfMap<uint32_t, uint8_t>&) {
-        dw.println("%u %u", key, value);
-        return base::Result<void>();
-    };
-    res = mUidCounterSetMap.iterateWithValue(printUidInfo);
-    if (!res.ok()) {
-        dw.println("mUidCounterSetMap print end with error: %s", res.error().message().c_str());
+    for (const auto& [uid, counterSet] : snapshot->uidCounterSets.entries) {
+        dw.println("%u %u", uid, counterSet);
     }
+    printError("mUidCounterSetMap", snapshot->uidCounterSets.result);
 
     // Print AppUidStatsMap content
     std::string appUidStatsHeader = StringPrintf("uid rxBytes rxPackets txBytes txPackets");
     dumpBpfMap("mAppUidStatsMap:", dw, appUidStatsHeader);
-    auto printAppUidStatsInfo = [&dw](const uint32_t& key, const StatsValue& value,
-                                      const BpfMap<uint32_t, StatsValue>&) {
-        dw.println("%u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, key, value.rxBytes,
+    for (const auto& [uid, value] : snapshot->appUidStats.entries) {
+        dw.println("%u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, uid, value.rxBytes,
                    value.rxPackets, value.txBytes, value.txPackets);
-        return base::Result<void>();
-    };
-    res = mAppUidStatsMap.iterateWithValue(printAppUidStatsInfo);
-    if (!res.ok()) {
-        dw.println("mAppUidStatsMap print end with error: %s", res.error().message().c_str());
     }
+    printError("mAppUidStatsMap", snapshot->appUidStats.result);
 
     // Print uidStatsMap content
     std::string statsHeader = StringPrintf("ifaceIndex ifaceName tag_hex uid_int cnt_set rxBytes"
                                            " rxPackets txBytes txPackets");
-    dumpBpfMap("mStatsMapA", dw, statsHeader);
-    const auto printStatsInfo = [&dw, this](const StatsKey& key, const StatsValue& value,
-                                            const BpfMap<StatsKey, StatsValue>&) {
-        uint32_t ifIndex = key.ifaceIndex;
-        auto ifname = mIfaceIndexNameMap.readValue(ifIndex);
-        if (!ifname.ok()) {
-            ifname = IfaceValue{"unknown"};
+    const auto printStatsInfo = [&dw, &ifaceName](const MapContents<StatsKey, StatsValue>& map) {
+        for (const auto& [key, value] : map.entries) {
+            dw.println("%u %s 0x%x %u %u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64,
+                       key.ifaceIndex, ifaceName(key.ifaceIndex), key.tag, key.uid,
+                       key.counterSet, value.rxBytes, value.rxPackets, value.txBytes,
+                       value.txPackets);
         }
-        dw.println("%u %s 0x%x %u %u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, ifIndex,
-                   ifname.value().name, key.tag, key.uid, key.counterSet, value.rxBytes,
-                   value.rxPackets, value.txBytes, value.txPackets);
-        return base::Result<void>();
     };
-    res = mStatsMapA.iterateWithValue(printStatsInfo);
-    if (!res.ok()) {
-        dw.println("mStatsMapA print end with error: %s", res.error().message().c_str());
-    }
+    dumpBpfMap("mStatsMapA", dw, statsHeader);
+    printStatsInfo(snapshot->statsMapA);
+    printError("mStatsMapA", snapshot->statsMapA.result);
 
     // Print TagStatsMap content.
     dumpBpfMap("mStatsMapB", dw, statsHeader);
-    res = mStatsMapB.iterateWithValue(printStatsInfo);
-    if (!res.ok()) {
-        dw.println("mStatsMapB print end with error: %s", res.error().message().c_str());
-    }
+    printStatsInfo(snapshot->statsMapB);
+    printError("mStatsMapB", snapshot->statsMapB.result);
 
     // Print ifaceIndexToNameMap content.
     dumpBpfMap("mIfaceIndexNameMap", dw, "");
-    const auto printIfaceNameInfo = [&dw](const uint32_t& key, const IfaceValue& value,
-                                          const BpfMap<uint32_t, IfaceValue>&) {
-        const char* ifname = value.name;
-        dw.println("ifaceIndex=%u ifaceName=%s", key, ifname);
-        return base::Result<void>();
-    };
-    res = mIfaceIndexNameMap.iterateWithValue(printIfaceNameInfo);
-    if (!res.ok()) {
-        dw.println("mIfaceIndexNameMap print end with error: %s", res.error().message().c_str());
+    for (const auto& [ifaceIndex, value] : snapshot->ifaceNames.entries) {
+        dw.println("ifaceIndex=%u ifaceName=%s", ifaceIndex, value.name);
     }
+    printError("mIfaceIndexNameMap", snapshot->ifaceNames.result);
 
     // Print ifaceStatsMap content
     std::string ifaceStatsHeader = StringPrintf("ifaceIndex ifaceName rxBytes rxPackets txBytes"
                                                 " txPackets");
     dumpBpfMap("mIfaceStatsMap:", dw, ifaceStatsHeader);
-    const auto printIfaceStatsInfo = [&dw, this](const uint32_t& key, const StatsValue& value,
-                                                 const BpfMap<uint32_t, StatsValue>&) {
-        auto ifname = mIfaceIndexNameMap.readValue(key);
-        if (!ifname.ok()) {
-            ifname = IfaceValue{"unknown"};
-        }
-        dw.println("%u %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, key, ifname.value().name,
-                   value.rxBytes, value.rxPackets, value.txBytes, value.txPackets);
-        return base::Result<void>();
-    };
-    res = mIfaceStatsMap.iterateWithValue(printIfaceStatsInfo);
-    if (!res.ok()) {
-        dw.println("mIfaceStatsMap print end with error: %s", res.error().message().c_str());
+    for (const auto& [ifaceIndex, value] : snapshot->ifaceStats.entries) {
+        dw.println("%u %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64, ifaceIndex,
+                   ifaceName(ifaceIndex), value.rxBytes, value.rxPackets, value.txBytes,
+                   value.txPackets);
     }
+    printError("mIfaceStatsMap", snapshot->ifaceStats.result);
 
     dw.blankline();
 
-    uint32_t key = UID_RULES_CONFIGURATION_KEY;
-    auto configuration = mConfigurationMap.readValue(key);
-    if (configuration.ok()) {
-        dw.println("current ownerMatch configuration: %d%s", configuration.value(),
-                   uidMatchTypeToString(configuration.value()).c_str());
+    const auto& ownerMatch = snapshot->ownerMatchConfiguration;
+    if (ownerMatch.ok()) {
+        dw.println("current ownerMatch configuration: %d%s", ownerMatch.value(),
+                   uidMatchTypeToString(ownerMatch.value()).c_str());
     } else {
         dw.println("mConfigurationMap read ownerMatch configure failed with error: %s",
-                   configuration.error().message().c_str());
+                   ownerMatch.error().message().c_str());
     }
 
-    key = CURRENT_STATS_MAP_CONFIGURATION_KEY;
-    configuration = mConfigurationMap.readValue(key);
-    if (configuration.ok()) {
+    const auto& statsMap = snapshot->statsMapConfiguration;
+    if (statsMap.ok()) {
         const char* statsMapDescription = "???";
-        switch (configuration.value()) {
+        switch (statsMap.value()) {
             case SELECT_MAP_A:
                 statsMapDescription = "SELECT_MAP_A";
                 break;
@@ -1152,48 +1271,149 @@ void TrafficController::dump(DumpWriter& dw, bool verbose) {
                 break;
                 // No default clause, so if we ever add a third map, this code will fail to build.
         }
-        dw.println("current statsMap configuration: %d %s", configuration.value(),
+        dw.println("current statsMap configuration: %d %s", statsMap.value(),
                    statsMapDescription);
     } else {
         dw.println("mConfigurationMap read stats map configure failed with error: %s",
-                   configuration.error().message().c_str());
+                   statsMap.error().message().c_str());
     }
     dumpBpfMap("mUidOwnerMap", dw, "");
-    const auto printUidMatchInfo = [&dw, this](const uint32_t& key, const UidOwnerValue& value,
-                                               const BpfMap<uint32_t, UidOwnerValue>&) {
+    for (const auto& [uid, value] : snapshot->uidOwners.entries) {
         if (value.rule & IIF_MATCH) {
-            auto ifname = mIfaceIndexNameMap.readValue(value.iif);
-            if (ifname.ok()) {
-                dw.println("%u %s %s", key, uidMatchTypeToString(value.rule).c_str(),
-                           ifname.value().name);
+            const auto it = ifaceNames.find(value.iif);
+            if (it != ifaceNames.end()) {
+                dw.println("%u %s %s", uid, uidMatchTypeToString(value.rule).c_str(), it->second);
             } else {
-                dw.println("%u %s %u", key, uidMatchTypeToString(value.rule).c_str(), value.iif);
+                dw.println("%u %s %u", uid, uidMatchTypeToString(value.rule).c_str(), value.iif);
             }
         } else {
-            dw.println("%u %s", key, uidMatchTypeToString(value.rule).c_str());
+            dw.println("%u %s", uid, uidMatchTypeToString(value.rule).c_str());
         }
-        return base::Result<void>();
-    };
-    res = mUidOwnerMap.iterateWithValue(printUidMatchInfo);
-    if (!res.ok()) {
-        dw.println("mUidOwnerMap print end with error: %s", res.error().message().c_str());
     }
+    printError("mUidOwnerMap", snapshot->uidOwners.result);
     dumpBpfMap("mUidPermissionMap", dw, "");
-    const auto printUidPermissionInfo = [&dw](const uint32_t& key, const int& value,
-                                              const BpfMap<uint32_t, uint8_t>&) {
-        dw.println("%u %s", key, UidPermissionTypeToString(value).c_str());
-        return base::Result<void>();
-    };
-    res = mUidPermissionMap.iterateWithValue(printUidPermissionInfo);
-    if (!res.ok()) {
-        dw.println("mUidPermissionMap print end with error: %s", res.error().message().c_str());
+    for (const auto& [uid, permission] : snapshot->uidPermissions.entries) {
+        dw.println("%u %s", uid, UidPermissionTypeToString(permission).c_str());
     }
+    printError("mUidPermissionMap", snapshot->uidPermissions.result);
 
     dumpBpfMap("mPrivilegedUser", dw, "");
-    for (uid_t uid : mPrivilegedUser) {
+    for (uid_t uid : snapshot->privilegedUsers) {
         dw.println("%u ALLOW_UPDATE_DEVICE_STATS", (uint32_t)uid);
     }
 }
 
+static void setStats(const StatsValue& value, StatsValueProto* proto) {
+    proto->set_rx_packets(value.rxPackets);
+    proto->set_rx_bytes(value.rxBytes);
+    proto->set_tx_packets(value.txPackets);
+    proto->set_tx_bytes(value.txBytes);
+}
+
+static void addError(const char* mapName, const base::Result<void>& res,
+                     TrafficControllerProto* proto) {
+    if (!res.ok()) {
+        proto->add_errors(StringPrintf("%s: %s", mapName, res.error().message().c_str()));
+    }
+}
+
+void TrafficController::dumpProto(TrafficControllerProto* proto) {
+    proto->set_bpf_enabled(mBpfEnabled);
+    if (!mBpfEnabled) {
+        return;
+    }
+
+    // As in dump(), only hold mMutex while copying the maps.
+    const MapsSnapshot snapshot = [this] {
+        std::lock_guard guard(mMutex);
+        return snapshotMapsLocked();
+    }();
+
+    for (const auto& [cookie, value] : snapshot.cookieTags.entries) {
+        auto* entry = proto->add_cookie_tags();
+        entry->set_cookie(cookie);
+        entry->set_uid(value.uid);
+        entry->set_tag(value.tag);
+    }
+    addError("mCookieTagMap", snapshot.cookieTags.result, proto);
+
+    for (const auto& [uid, counterSet] : snapshot.uidCounterSets.entries) {
+        auto* entry = proto->add_uid_counter_sets();
+        entry->set_uid(uid);
+        entry->set_counter_set(counterSet);
+    }
+    addError("mUidCounterSetMap", snapshot.uidCounterSets.result, proto);
+
+    for (const auto& [uid, value] : snapshot.appUidStats.entries) {
+        auto* entry = proto->add_app_uid_stats();
+        entry->set_uid(uid);
+        setStats(value, entry->mutable_stats());
+    }
+    addError("mAppUidStatsMap", snapshot.appUidStats.result, proto);
+
+    const auto addTagStats = [](const StatsKey& key, const StatsValue& value,
+                                TrafficControllerProto::TagStats* entry) {
+        entry->set_iface_index(key.ifaceIndex);
+        entry->set_uid(key.uid);
+        entry->set_tag(key.tag);
+        entry->set_counter_set(key.counterSet);
+        setStats(value, entry->mutable_stats());
+    };
+    for (const auto& [key, value] : snapshot.statsMapA.entries) {
+        addTagStats(key, value, proto->add_stats_map_a());
+    }
+    addError("mStatsMapA", snapshot.statsMapA.result, proto);
+    for (const auto& [key, value] : snapshot.statsMapB.entries) {
+        addTagStats(key, value, proto->add_stats_map_b());
+    }
+    addError("mStatsMapB", snapshot.statsMapB.result, proto);
+
+    for (const auto& [ifaceIndex, value] : snapshot.ifaceNames.entries) {
+        auto* entry = proto->add_iface_names();
+        entry->set_iface_index(ifaceIndex);
+        entry->set_name(std::string(value.name, strnlen(value.name, sizeof(value.name))));
+    }
+    addError("mIfaceIndexNameMap", snapshot.ifaceNames.result, proto);
+
+    for (const auto& [ifaceIndex, value] : snapshot.ifaceStats.entries) {
+        auto* entry = proto->add_iface_stats();
+        entry->set_iface_index(ifaceIndex);
+        setStats(value, entry->mutable_stats());
+    }
+    addError("mIfaceStatsMap", snapshot.ifaceStats.result, proto);
+
+    if (snapshot.ownerMatchConfiguration.ok()) {
+        proto->set_owner_match_configuration(snapshot.ownerMatchConfiguration.value());
+    } else {
+        proto->add_errors("mConfigurationMap: ownerMatch: " +
+                          snapshot.ownerMatchConfiguration.error().message());
+    }
+    if (snapshot.statsMapConfiguration.ok()) {
+        proto->set_stats_map_configuration(snapshot.statsMapConfiguration.value());
+    } else {
+        proto->add_errors("mConfigurationMap: statsMap: " +
+                          snapshot.statsMapConfiguration.error().message());
+    }
+
+    for (const auto& [uid, value] : snapshot.uidOwners.entries) {
+        auto* entry = proto->add_uid_owners();
+        entry->set_uid(uid);
+        entry->set_rule(value.rule);
+        if (value.rule & IIF_MATCH) entry->set_iif(value.iif);
+    }
+    addError("mUidOwnerMap", snapshot.uidOwners.result, proto);
+
+    for (const auto& [uid, permission] : snapshot.uidPermissions.entries) {
+        auto* entry = proto->add_uid_permissions();
+        entry->set_uid(uid);
+        entry->set_permission(permission);
+    }
+    addError("mUidPermissionMap", snapshot.uidPermissions.result, proto);
+
+    for (uid_t uid : snapshot.privilegedUsers) {
+        proto->add_privileged_uids(uid);
+    }
+}
+
 }  // namespace net
 }  // namespace android
@@ -19,6 +19,10 @@
 
 #include <linux/bpf.h>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+
 #include "BandwidthController.h"
 #include "FirewallController.h"
 #include "NetlinkListener.h"
@@ -26,8 +30,12 @@
 #include "android-base/thread_annotations.h"
 #include "android-base/unique_fd.h"
 #include "bpf/BpfMap.h"
+#include "bpf/BpfUtils.h"
+#include "netdbpf/BpfMapInterface.h"
 #include "netdbpf/bpf_shared.h"
 #include "netdutils/DumpWriter.h"
+#include "netdutils/EventLoop.h"
+#include "netdutils/Executor.h"
 #include "netdutils/StatusOr.h"
 #include "utils/String16.h"
 
@@ -36,9 +44,19 @@ using android::bpf::BpfMap;
 namespace android {
 namespace net {
 
+namespace netd {
+class TrafficControllerProto;
+}  // namespace netd
+
 class TrafficController {
   public:
-    TrafficController();
+    // If executor is not null, the cookie tag map is audited on it after the socket destroy
+    // listener overflows. Otherwise, it is audited on the listener thread. If
+    // eventLoop is not null, the socket destroy listener runs on it instead of on a thread of its
+    // own. Both must outlive this object.
+    explicit TrafficController(netdutils::Executor* executor = nullptr,
+                               netdutils::EventLoop* eventLoop = nullptr);
+
     /*
      * Initialize the whole controller
      */
@@ -105,6 +123,9 @@ class TrafficController {
 
     void dump(netdutils::DumpWriter& dw, bool verbose) EXCLUDES(mMutex);
 
+    // Fills proto with the content of the BPF maps, for "dumpsys netd --proto".
+    void dumpProto(netd::TrafficControllerProto* proto) EXCLUDES(mMutex);
+
     netdutils::Status replaceRulesInMap(UidOwnerMatchType match, const std::vector<int32_t>& uids)
             EXCLUDES(mMutex);
 
@@ -126,11 +147,31 @@ class TrafficController {
 
     int toggleUidOwnerMap(ChildChain chain, bool enable) EXCLUDES(mMutex);
 
-    static netdutils::StatusOr<std::unique_ptr<NetlinkListenerInterface>> makeSkDestroyListener();
+    static netdutils::StatusOr<std::unique_ptr<NetlinkListenerInterface>> makeSkDestroyListener(
+            netdutils::EventLoop* eventLoop = nullptr);
+
+    /*
+     * Counts the entries of mCookieTagMap whose sockets appear to no longer exist, e.g., because
+     * the notifications of their destruction were lost when the SkDestroyListener overflowed.
+     * Nothing is deleted: sock_diag does not dump sockets that are neither bound nor connected,
+     * nor sockets other than TCP and UDP, so a live socket can look just like a leaked one.
+     * Returns the count, or a negative errno.
+     */
+    int auditCookieTagMap() EXCLUDES(mMutex);
 
     void setPermissionForUids(int permission, const std::vector<uid_t>& uids) EXCLUDES(mMutex);
 
   private:
+    // The maps are accessed through BpfMapInterface so that benchmarks can replace them with
+    // in-memory maps before calling initMaps(). netd always uses kernel BPF maps.
+    template <class Key, class Value>
+    using BpfMapPtr = std::unique_ptr<bpf::BpfMapInterface<Key, Value>>;
+
+    template <class Key, class Value>
+    static BpfMapPtr<Key, Value> makeKernelBpfMap() {
+        return std::make_unique<bpf::BpfMapAdapter<Key, Value>>();
+    }
+
     /*
      * mCookieTagMap: Store the corresponding tag and uid for a specific socket.
      * DO NOT hold any locks when modifying this map, otherwise when the untag
@@ -141,7 +182,8 @@ class TrafficController {
      * Map Key: uint64_t socket cookie
      * Map Value: UidTagValue, contains a uint32 uid and a uint32 tag.
      */
-    BpfMap<uint64_t, UidTagValue> mCookieTagMap GUARDED_BY(mMutex);
+    BpfMapPtr<uint64_t, UidTagValue> mCookieTagMap GUARDED_BY(mMutex) =
+            makeKernelBpfMap<uint64_t, UidTagValue>();
 
     /*
      * mUidCounterSetMap: Store the counterSet of a specific uid.
@@ -149,14 +191,16 @@ class TrafficController {
      * Map Value: uint32 counterSet specifies if the traffic is a background
      * or foreground traffic.
      */
-    BpfMap<uint32_t, uint8_t> mUidCounterSetMap GUARDED_BY(mMutex);
+    BpfMapPtr<uint32_t, uint8_t> mUidCounterSetMap GUARDED_BY(mMutex) =
+            makeKernelBpfMap<uint32_t, uint8_t>();
 
     /*
      * mAppUidStatsMap: Store the total traffic stats for a uid regardless of
      * tag, counterSet and iface. The stats is used by TrafficStats.getUidStats
      * API to return persistent stats for a specific uid since device boot.
      */
-    BpfMap<uint32_t, StatsValue> mAppUidStatsMap;
+    BpfMapPtr<uint32_t, StatsValue> mAppUidStatsMap =
+            makeKernelBpfMap<uint32_t, StatsValue>();
 
     /*
      * mStatsMapA/mStatsMapB: Store the traffic statistics for a specific
@@ -167,22 +211,26 @@ class TrafficController {
      * Map Value: Stats, contains packet count and byte count of each
      * transport protocol on egress and ingress direction.
      */
-    BpfMap<StatsKey, StatsValue> mStatsMapA GUARDED_BY(mMutex);
+    BpfMapPtr<StatsKey, StatsValue> mStatsMapA GUARDED_BY(mMutex) =
+            makeKernelBpfMap<StatsKey, StatsValue>();
 
-    BpfMap<StatsKey, StatsValue> mStatsMapB GUARDED_BY(mMutex);
+    BpfMapPtr<StatsKey, StatsValue> mStatsMapB GUARDED_BY(mMutex) =
+            makeKernelBpfMap<StatsKey, StatsValue>();
 
     /*
      * mIfaceIndexNameMap: Store the index name pair of each interface show up
      * on the device since boot. The interface index is used by the eBPF program
      * to correctly match the iface name when receiving a packet.
      */
-    BpfMap<uint32_t, IfaceValue> mIfaceIndexNameMap;
+    BpfMapPtr<uint32_t, IfaceValue> mIfaceIndexNameMap =
+            makeKernelBpfMap<uint32_t, IfaceValue>();
 
     /*
      * mIfaceStataMap: Store per iface traffic stats gathered from xt_bpf
      * filter.
      */
-    BpfMap<uint32_t, StatsValue> mIfaceStatsMap;
+    BpfMapPtr<uint32_t, StatsValue> mIfaceStatsMap =
+            makeKernelBpfMap<uint32_t, StatsValue>();
 
     /*
      * mConfigurationMap: Store the current network policy about uid filtering
@@ -196,25 +244,41 @@ class TrafficController {
      *    Userspace can do scraping and cleaning job on the other one depending on the
      *    current configs.
      */
-    BpfMap<uint32_t, uint8_t> mConfigurationMap GUARDED_BY(mMutex);
+    BpfMapPtr<uint32_t, uint8_t> mConfigurationMap GUARDED_BY(mMutex) =
+            makeKernelBpfMap<uint32_t, uint8_t>();
 
     /*
      * mUidOwnerMap: Store uids that are used for bandwidth control uid match.
      */
-    BpfMap<uint32_t, UidOwnerValue> mUidOwnerMap GUARDED_BY(mMutex);
+    BpfMapPtr<uint32_t, UidOwnerValue> mUidOwnerMap GUARDED_BY(mMutex) =
+            makeKernelBpfMap<uint32_t, UidOwnerValue>();
 
     /*
      * mUidOwnerMap: Store uids that are used for INTERNET permission check.
      */
-    BpfMap<uint32_t, uint8_t> mUidPermissionMap GUARDED_BY(mMutex);
+    BpfMapPtr<uint32_t, uint8_t> mUidPermissionMap GUARDED_BY(mMutex) =
+            makeKernelBpfMap<uint32_t, uint8_t>();
 
     std::unique_ptr<NetlinkListenerInterface> mSkDestroyListener;
 
-    netdutils::Status removeRule(BpfMap<uint32_t, UidOwnerValue>& map, uint32_t uid,
-                                 UidOwnerMatchType match, uint32_t ifBlacklistSlot = 0)
-                                 REQUIRES(mMutex);
+    void scheduleCookieTagMapAudit();
+
+    // How long auditCookieTagMap() waits before confirming that a socket looks gone.
+    static constexpr std::chrono::milliseconds kCookieTagMapAuditGracePeriod{500};
 
-    netdutils::Status addRule(BpfMap<uint32_t, UidOwnerValue>& map, uint32_t uid,
+    netdutils::Executor* const mExecutor = nullptr;
+    netdutils::EventLoop* const mEventLoop = nullptr;
+    // True from the time an audit is posted to mExecutor until it starts.
+    std::atomic_bool mCookieTagMapAuditScheduled = false;
+    std::atomic<uint64_t> mSkDestroyOverflows = 0;
+    // The result of the latest auditCookieTagMap().
+    std::atomic<int> mSuspectedStaleCookies = 0;
+
+    netdutils::Status removeRule(bpf::BpfMapInterface<uint32_t, UidOwnerValue>& map,
+                                 uint32_t uid, UidOwnerMatchType match,
+                                 uint32_t ifBlacklistSlot = 0) REQUIRES(mMutex);
+
+    netdutils::Status addRule(bpf::BpfMapInterface<uint32_t, UidOwnerValue>& map, uint32_t uid,
                               UidOwnerMatchType match, uint32_t iif = 0,
                               uint32_t ifBlacklistSlot = 0) REQUIRES(mMutex);
 
@@ -259,11 +323,17 @@ class TrafficController {
 
     bool hasUpdateDeviceStatsPermission(uid_t uid) REQUIRES(mMutex);
 
+    // A copy of the BPF maps and of mPrivilegedUser, so that dump() and dumpProto() can format
+    // them without holding mMutex.
+    struct MapsSnapshot;
+    MapsSnapshot snapshotMapsLocked() REQUIRES(mMutex);
+
     // For testing
     TrafficController(uint32_t perUidLimit, uint32_t totalLimit);
 
     // For testing
     friend class TrafficControllerTest;
+    friend class TrafficControllerBenchmark;
 };
 
 }  // namespace net
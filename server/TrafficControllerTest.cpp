@@ -16,12 +16,15 @@
  * TrafficControllerTest.cpp - unit tests for TrafficController.cpp
  */
 
+#include <algorithm>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <fcntl.h>
 #include <inttypes.h>
 #include <linux/inet_diag.h>
+#include <netinet/in.h>
 #include <linux/sock_diag.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -35,8 +38,10 @@
 #include <netdutils/MockSyscalls.h>
 
 #include "FirewallController.h"
+#include "NetdDumpDecoder.h"
 #include "TrafficController.h"
 #include "bpf/BpfUtils.h"
+#include "netd_dump.pb.h"
 
 using namespace android::bpf;  // NOLINT(google-build-using-namespace): grandfathered
 
@@ -44,6 +49,7 @@ namespace android {
 namespace net {
 
 using base::Result;
+using base::StringPrintf;
 using netdutils::isOk;
 
 constexpr int TEST_MAP_SIZE = 10;
@@ -104,24 +110,24 @@ class TrafficControllerTest : public ::testing::Test {
                 createMap(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint8_t), TEST_MAP_SIZE, 0));
         ASSERT_VALID(mFakeUidPermissionMap);
 
-        mTc.mCookieTagMap.reset(dupFd(mFakeCookieTagMap.getMap()));
-        ASSERT_VALID(mTc.mCookieTagMap);
-        mTc.mUidCounterSetMap.reset(dupFd(mFakeUidCounterSetMap.getMap()));
-        ASSERT_VALID(mTc.mUidCounterSetMap);
-        mTc.mAppUidStatsMap.reset(dupFd(mFakeAppUidStatsMap.getMap()));
-        ASSERT_VALID(mTc.mAppUidStatsMap);
-        mTc.mStatsMapA.reset(dupFd(mFakeStatsMapA.getMap()));
-        ASSERT_VALID(mTc.mStatsMapA);
-        mTc.mConfigurationMap.reset(dupFd(mFakeConfigurationMap.getMap()));
-        ASSERT_VALID(mTc.mConfigurationMap);
+        mTc.mCookieTagMap = dupMap(mFakeCookieTagMap);
+        ASSERT_VALID(*mTc.mCookieTagMap);
+        mTc.mUidCounterSetMap = dupMap(mFakeUidCounterSetMap);
+        ASSERT_VALID(*mTc.mUidCounterSetMap);
+        mTc.mAppUidStatsMap = dupMap(mFakeAppUidStatsMap);
+        ASSERT_VALID(*mTc.mAppUidStatsMap);
+        mTc.mStatsMapA = dupMap(mFakeStatsMapA);
+        ASSERT_VALID(*mTc.mStatsMapA);
+        mTc.mConfigurationMap = dupMap(mFakeConfigurationMap);
+        ASSERT_VALID(*mTc.mConfigurationMap);
 
         // Always write to stats map A by default.
-        ASSERT_RESULT_OK(mTc.mConfigurationMap.writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY,
-                                                          SELECT_MAP_A, BPF_ANY));
-        mTc.mUidOwnerMap.reset(dupFd(mFakeUidOwnerMap.getMap()));
-        ASSERT_VALID(mTc.mUidOwnerMap);
-        mTc.mUidPermissionMap.reset(dupFd(mFakeUidPermissionMap.getMap()));
-        ASSERT_VALID(mTc.mUidPermissionMap);
+        ASSERT_RESULT_OK(mTc.mConfigurationMap->writeValue(CURRENT_STATS_MAP_CONFIGURATION_KEY,
+                                                           SELECT_MAP_A, BPF_ANY));
+        mTc.mUidOwnerMap = dupMap(mFakeUidOwnerMap);
+        ASSERT_VALID(*mTc.mUidOwnerMap);
+        mTc.mUidPermissionMap = dupMap(mFakeUidPermissionMap);
+        ASSERT_VALID(*mTc.mUidPermissionMap);
         mTc.mPrivilegedUser.clear();
     }
 
@@ -129,6 +135,14 @@ class TrafficControllerTest : public ::testing::Test {
         return fcntl(mapFd.get(), F_DUPFD_CLOEXEC, 0);
     }
 
+    // A kernel map for mTc that refers to the same map as fakeMap.
+    template <class Key, class Value>
+    std::unique_ptr<BpfMapInterface<Key, Value>> dupMap(const BpfMap<Key, Value>& fakeMap) {
+        auto map = std::make_unique<BpfMapAdapter<Key, Value>>();
+        map->map().reset(dupFd(fakeMap.getMap()));
+        return map;
+    }
+
     int setUpSocketAndTag(int protocol, uint64_t* cookie, uint32_t tag, uid_t uid,
                           uid_t callingUid) {
         int sock = socket(protocol, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -408,6 +422,30 @@ TEST_F(TrafficControllerTest, TestUntagInvalidSocket) {
     expectMapEmpty(mFakeCookieTagMap);
 }
 
+TEST_F(TrafficControllerTest, TestAuditCookieTagMap) {
+    SKIP_IF_BPF_NOT_SUPPORTED;
+
+    uint64_t liveCookie;
+    int liveSocket = setUpSocketAndTag(AF_INET6, &liveCookie, TEST_TAG, TEST_UID, TEST_UID);
+    // Sockets that are neither bound nor connected are not dumped, so listen on this one.
+    const sockaddr_in6 loopback = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+    ASSERT_EQ(0, bind(liveSocket, (const sockaddr*) &loopback, sizeof(loopback)));
+    ASSERT_EQ(0, listen(liveSocket, 1));
+
+    // Nothing listens for socket destruction in this test, so closing a socket leaves its tag
+    // behind, as when the SkDestroyListener overflows.
+    uint64_t staleCookie;
+    int staleSocket = setUpSocketAndTag(AF_INET6, &staleCookie, TEST_TAG, TEST_UID2, TEST_UID2);
+    ASSERT_EQ(0, close(staleSocket));
+
+    EXPECT_EQ(1, mTc.auditCookieTagMap());
+    // The audit cannot tell a closed socket from an unconnected one, so it deletes nothing.
+    expectUidTag(liveCookie, TEST_UID, TEST_TAG);
+    expectUidTag(staleCookie, TEST_UID2, TEST_TAG);
+    EXPECT_EQ(1, mTc.auditCookieTagMap());
+    ASSERT_EQ(0, close(liveSocket));
+}
+
 TEST_F(TrafficControllerTest, TestTagSocketReachLimitFail) {
     SKIP_IF_BPF_NOT_SUPPORTED;
 
@@ -949,5 +987,108 @@ TEST_F(TrafficControllerTest, TestGrantDuplicatePermissionSlientlyFail) {
     expectPrivilegedUserSetEmpty();
 }
 
+TEST_F(TrafficControllerTest, TestDumpProto) {
+    SKIP_IF_BPF_NOT_SUPPORTED;
+
+    uint64_t cookie = 1;
+    uid_t uid = TEST_UID;
+    uint32_t tag = TEST_TAG;
+    StatsKey tagStatsMapKey;
+    populateFakeStats(cookie, uid, tag, &tagStatsMapKey);
+    ASSERT_EQ(0, mTc.changeUidOwnerRule(DOZABLE, TEST_UID2, ALLOW, WHITELIST));
+    mTc.setPermissionForUids(INetd::PERMISSION_UPDATE_DEVICE_STATS, {TEST_UID3});
+
+    netd::NetdDumpProto dump;
+    mTc.dumpProto(dump.mutable_traffic_controller());
+
+    // Check the decoded form, as a reader of "dumpsys netd --proto" would see it.
+    std::string serialized;
+    ASSERT_TRUE(dump.SerializeToString(&serialized));
+    netd::NetdDumpProto decoded;
+    ASSERT_TRUE(decoded.ParseFromString(serialized));
+    const netd::TrafficControllerProto& tc = decoded.traffic_controller();
+
+    EXPECT_TRUE(tc.bpf_enabled());
+    EXPECT_EQ(static_cast<uint32_t>(SELECT_MAP_A), tc.stats_map_configuration());
+
+    ASSERT_EQ(1, tc.cookie_tags_size());
+    EXPECT_EQ(cookie, tc.cookie_tags(0).cookie());
+    EXPECT_EQ(uid, tc.cookie_tags(0).uid());
+    EXPECT_EQ(tag, tc.cookie_tags(0).tag());
+
+    ASSERT_EQ(1, tc.uid_counter_sets_size());
+    EXPECT_EQ(uid, tc.uid_counter_sets(0).uid());
+    EXPECT_EQ(TEST_COUNTERSET, tc.uid_counter_sets(0).counter_set());
+
+    ASSERT_EQ(1, tc.app_uid_stats_size());
+    EXPECT_EQ(uid, tc.app_uid_stats(0).uid());
+    EXPECT_EQ(1U, tc.app_uid_stats(0).stats().rx_packets());
+    EXPECT_EQ(100U, tc.app_uid_stats(0).stats().rx_bytes());
+
+    // populateFakeStats() writes a tagged and an untagged entry.
+    ASSERT_EQ(2, tc.stats_map_a_size());
+    std::set<uint32_t> tags;
+    for (const auto& entry : tc.stats_map_a()) {
+        EXPECT_EQ(uid, entry.uid());
+        EXPECT_EQ(1U, entry.iface_index());
+        EXPECT_EQ(100U, entry.stats().rx_bytes());
+        tags.insert(entry.tag());
+    }
+    EXPECT_EQ(std::set<uint32_t>({0, tag}), tags);
+
+    ASSERT_EQ(1, tc.uid_owners_size());
+    EXPECT_EQ(TEST_UID2, tc.uid_owners(0).uid());
+    EXPECT_EQ(static_cast<uint32_t>(DOZABLE_MATCH), tc.uid_owners(0).rule());
+    EXPECT_FALSE(tc.uid_owners(0).has_iif());
+
+    ASSERT_EQ(1, tc.uid_permissions_size());
+    EXPECT_EQ(TEST_UID3, tc.uid_permissions(0).uid());
+    EXPECT_EQ(static_cast<uint32_t>(INetd::PERMISSION_UPDATE_DEVICE_STATS),
+              tc.uid_permissions(0).permission());
+
+    ASSERT_EQ(1, tc.privileged_uids_size());
+    EXPECT_EQ(TEST_UID3, tc.privileged_uids(0));
+}
+
+// Checks that netd_dump_decoder can read what dumpProto() writes.
+TEST_F(TrafficControllerTest, TestDumpProtoDecodes) {
+    SKIP_IF_BPF_NOT_SUPPORTED;
+
+    uint64_t cookie = 1;
+    uid_t uid = TEST_UID;
+    uint32_t tag = TEST_TAG;
+    StatsKey tagStatsMapKey;
+    populateFakeStats(cookie, uid, tag, &tagStatsMapKey);
+    mTc.setPermissionForUids(INetd::PERMISSION_UPDATE_DEVICE_STATS, {TEST_UID3});
+
+    netd::NetdDumpProto dump;
+    mTc.dumpProto(dump.mutable_traffic_controller());
+    std::string serialized;
+    ASSERT_TRUE(dump.SerializeToString(&serialized));
+    netd::NetdDumpProto decoded;
+    ASSERT_TRUE(decoded.ParseFromString(serialized));
+    const std::string text = decodeNetdDump(decoded);
+
+    // The fixture does not set up mIfaceIndexNameMap, so interface names are unknown.
+    std::vector<std::string> expectedLines = {
+            "BPF module status: enabled",
+            StringPrintf("  cookie=%" PRIu64 " tag=0x%x uid=%u", cookie, tag, uid),
+            StringPrintf("  %u %u", uid, TEST_COUNTERSET),
+            StringPrintf("  %u 100 1 0 0", uid),
+            StringPrintf("  1 unknown 0x%x %u %u 100 1 0 0", tag, uid, TEST_COUNTERSET),
+            StringPrintf("  1 unknown 0x0 %u %u 100 1 0 0", uid, TEST_COUNTERSET),
+            StringPrintf("current statsMap configuration: %u", static_cast<uint32_t>(SELECT_MAP_A)),
+            StringPrintf("  %u ALLOW_UPDATE_DEVICE_STATS", TEST_UID3),
+    };
+    for (const auto& error : decoded.traffic_controller().errors()) {
+        expectedLines.push_back("error: " + error);
+    }
+    const std::vector<std::string> lines = base::Split(text, "\n");
+    for (const auto& expected : expectedLines) {
+        EXPECT_NE(lines.end(), std::find(lines.begin(), lines.end(), expected))
+                << "Missing \"" << expected << "\" in:\n" << text;
+    }
+}
+
 }  // namespace net
 }  // namespace android
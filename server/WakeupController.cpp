@@ -42,6 +42,7 @@ namespace android {
 namespace net {
 
 using base::StringPrintf;
+using netdutils::NetlinkAttributeTable;
 using netdutils::Slice;
 using netdutils::Status;
 
@@ -130,60 +131,39 @@ netdutils::Status WakeupController::init(NFLogListenerInterface* listener) {
             .dstPort = -1,
             // and all other fields set to 0 as the default
         };
-        bool parseAgain = false;
-
-        const auto attrHandler = [&args, &parseAgain](const nlattr attr, const Slice payload) {
-            switch (attr.nla_type) {
-                case NFULA_TIMESTAMP: {
-                    timespec ts = {};
-                    extract(payload, ts);
-                    constexpr uint64_t kNsPerS = 1000000000ULL;
-                    args.timestampNs = ntohl(ts.tv_nsec) + (ntohl(ts.tv_sec) * kNsPerS);
-                    break;
-                }
-                case NFULA_PREFIX:
-                    // Strip trailing '\0'
-                    args.prefix = toString(take(payload, payload.size() - 1));
-                    break;
-                case NFULA_UID:
-                    extract(payload, args.uid);
-                    args.uid = ntohl(args.uid);
-                    break;
-                case NFULA_GID:
-                    extract(payload, args.gid);
-                    args.gid = ntohl(args.gid);
-                    break;
-                case NFULA_HWADDR: {
-                    struct nfulnl_msg_packet_hw hwaddr = {};
-                    extract(payload, hwaddr);
-                    size_t hwAddrLen = ntohs(hwaddr.hw_addrlen);
-                    hwAddrLen = std::min(hwAddrLen, sizeof(hwaddr.hw_addr));
-                    args.dstHw.assign(hwaddr.hw_addr, hwaddr.hw_addr + hwAddrLen);
-                    break;
-                }
-                case NFULA_PACKET_HDR: {
-                    struct nfulnl_msg_packet_hdr packetHdr = {};
-                    extract(payload, packetHdr);
-                    args.ethertype = ntohs(packetHdr.hw_protocol);
-                    break;
-                }
-                case NFULA_PAYLOAD:
-                    // The packet payload is expected to come last in the Netlink message.
-                    // At that point NFULA_PACKET_HDR has already been parsed and processed.
-                    // If this is not the case, set parseAgain to true.
-                    parseAgain = (args.ethertype == -1);
-                    extractIpHeader(args, payload);
-                    break;
-                default:
-                    break;
-            }
-        };
-
-        forEachNetlinkAttribute(msg, attrHandler);
-        if (parseAgain) {
-            // NFULA_PAYLOAD was parsed before NFULA_PACKET_HDR.
-            // Now that the ethertype is known, reparse msg for correctly extracting the payload.
-            forEachNetlinkAttribute(msg, attrHandler);
+        // Malformed attributes are skipped; report whatever could be parsed.
+        NetlinkAttributeTable<NFULA_MAX> attrs;
+        attrs.parse(msg).ignoreError();
+
+        timespec ts = {};
+        if (attrs.get(NFULA_TIMESTAMP, ts)) {
+            constexpr uint64_t kNsPerS = 1000000000ULL;
+            args.timestampNs = ntohl(ts.tv_nsec) + (ntohl(ts.tv_sec) * kNsPerS);
+        }
+        if (attrs.has(NFULA_PREFIX)) {
+            // Strip trailing '\0'
+            const Slice prefix = attrs.get(NFULA_PREFIX);
+            args.prefix = toString(take(prefix, prefix.size() - 1));
+        }
+        if (attrs.get(NFULA_UID, args.uid)) {
+            args.uid = ntohl(args.uid);
+        }
+        if (attrs.get(NFULA_GID, args.gid)) {
+            args.gid = ntohl(args.gid);
+        }
+        struct nfulnl_msg_packet_hw hwaddr = {};
+        if (attrs.get(NFULA_HWADDR, hwaddr)) {
+            size_t hwAddrLen = ntohs(hwaddr.hw_addrlen);
+            hwAddrLen = std::min(hwAddrLen, sizeof(hwaddr.hw_addr));
+            args.dstHw.assign(hwaddr.hw_addr, hwaddr.hw_addr + hwAddrLen);
+        }
+        struct nfulnl_msg_packet_hdr packetHdr = {};
+        if (attrs.get(NFULA_PACKET_HDR, packetHdr)) {
+            args.ethertype = ntohs(packetHdr.hw_protocol);
+        }
+        // The payload is parsed last, since its format depends on the ethertype.
+        if (attrs.has(NFULA_PAYLOAD)) {
+            extractIpHeader(args, attrs.get(NFULA_PAYLOAD));
         }
         mReport(args);
     };
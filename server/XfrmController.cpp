@@ -176,7 +176,7 @@ void logHex(const char* desc16, const char* buf, size_t len) {
     delete[] printBuf;
 }
 
-void logIov(const std::vector<iovec>& iov) {
+void logIov(std::span<const iovec> iov) {
     for (const iovec& row : iov) {
         logHex(nullptr, reinterpret_cast<char*>(row.iov_base), row.iov_len);
     }
@@ -279,23 +279,23 @@ public:
     }
 
     netdutils::Status sendMessage(uint16_t nlMsgType, uint16_t nlMsgFlags, uint16_t nlMsgSeqNum,
-                                  std::vector<iovec>* iovecs) const override {
+                                  std::span<iovec> iovecs) const override {
         nlmsghdr nlMsg = {
             .nlmsg_type = nlMsgType,
             .nlmsg_flags = nlMsgFlags,
             .nlmsg_seq = nlMsgSeqNum,
         };
 
-        (*iovecs)[0].iov_base = &nlMsg;
-        (*iovecs)[0].iov_len = NLMSG_HDRLEN;
-        for (const iovec& iov : *iovecs) {
+        iovecs[0].iov_base = &nlMsg;
+        iovecs[0].iov_len = NLMSG_HDRLEN;
+        for (const iovec& iov : iovecs) {
             nlMsg.nlmsg_len += iov.iov_len;
         }
 
         ALOGD("Sending Netlink XFRM Message: %s", xfrmMsgTypeToString(nlMsgType));
-        LOG_IOV(*iovecs);
+        LOG_IOV(iovecs);
 
-        StatusOr<size_t> writeResult = getSyscallInstance().writev(mSock, *iovecs);
+        StatusOr<size_t> writeResult = getSyscallInstance().writev(mSock, iovecs);
         if (!isOk(writeResult)) {
             ALOGE("netlink socket writev failed (%s)", toString(writeResult).c_str());
             return writeResult;
@@ -427,16 +427,18 @@ netdutils::Status XfrmController::flushInterfaces() {
 netdutils::Status XfrmController::flushSaDb(const XfrmSocket& s) {
     struct xfrm_usersa_flush flushUserSa = {.proto = IPSEC_PROTO_ANY};
 
-    std::vector<iovec> iov = {{nullptr, 0}, // reserved for the eventual addition of a NLMSG_HDR
-                              {&flushUserSa, sizeof(flushUserSa)}, // xfrm_usersa_flush structure
-                              {kPadBytes, NLMSG_ALIGN(sizeof(flushUserSa)) - sizeof(flushUserSa)}};
+    iovec iov[] = {
+            {nullptr, 0},                         // reserved for the NLMSG_HDR
+            {&flushUserSa, sizeof(flushUserSa)},  // xfrm_usersa_flush structure
+            {kPadBytes, NLMSG_ALIGN(sizeof(flushUserSa)) - sizeof(flushUserSa)},
+    };
 
-    return s.sendMessage(XFRM_MSG_FLUSHSA, NETLINK_REQUEST_FLAGS, 0, &iov);
+    return s.sendMessage(XFRM_MSG_FLUSHSA, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 netdutils::Status XfrmController::flushPolicyDb(const XfrmSocket& s) {
-    std::vector<iovec> iov = {{nullptr, 0}}; // reserved for the eventual addition of a NLMSG_HDR
-    return s.sendMessage(XFRM_MSG_FLUSHPOLICY, NETLINK_REQUEST_FLAGS, 0, &iov);
+    iovec iov[] = {{nullptr, 0}}; // reserved for the eventual addition of a NLMSG_HDR
+    return s.sendMessage(XFRM_MSG_FLUSHPOLICY, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 bool XfrmController::isXfrmIntfSupported() {
@@ -905,7 +907,7 @@ netdutils::Status XfrmController::updateSecurityAssociation(const XfrmSaInfo& re
         INTF_ID_PAD,
     };
 
-    std::vector<iovec> iov = {
+    iovec iov[] = {
             {nullptr, 0},          // reserved for the eventual addition of a NLMSG_HDR
             {&usersa, 0},          // main usersa_info struct
             {kPadBytes, 0},        // up to NLMSG_ALIGNTO pad bytes of padding
@@ -970,7 +972,7 @@ netdutils::Status XfrmController::updateSecurityAssociation(const XfrmSaInfo& re
     len = iov[INTF_ID].iov_len = fillNlAttrXfrmIntfId(record.xfrm_if_id, &xfrm_if_id);
     iov[INTF_ID_PAD].iov_len = NLA_ALIGN(len) - len;
 
-    return sock.sendMessage(XFRM_MSG_UPDSA, NETLINK_REQUEST_FLAGS, 0, &iov);
+    return sock.sendMessage(XFRM_MSG_UPDSA, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 int XfrmController::fillNlAttrXfrmAlgoEnc(const XfrmAlgo& inAlgo, nlattr_algo_crypt* algo) {
@@ -1087,7 +1089,7 @@ netdutils::Status XfrmController::deleteSecurityAssociation(const XfrmCommonInfo
 
     enum { NLMSG_HDR, USERSAID, USERSAID_PAD, MARK, MARK_PAD, INTF_ID, INTF_ID_PAD };
 
-    std::vector<iovec> iov = {
+    iovec iov[] = {
             {nullptr, 0},      // reserved for the eventual addition of a NLMSG_HDR
             {&said, 0},        // main usersa_info struct
             {kPadBytes, 0},    // up to NLMSG_ALIGNTO pad bytes of padding
@@ -1107,7 +1109,7 @@ netdutils::Status XfrmController::deleteSecurityAssociation(const XfrmCommonInfo
     len = iov[INTF_ID].iov_len = fillNlAttrXfrmIntfId(record.xfrm_if_id, &xfrm_if_id);
     iov[INTF_ID_PAD].iov_len = NLA_ALIGN(len) - len;
 
-    return sock.sendMessage(XFRM_MSG_DELSA, NETLINK_REQUEST_FLAGS, 0, &iov);
+    return sock.sendMessage(XFRM_MSG_DELSA, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 netdutils::Status XfrmController::allocateSpi(const XfrmSaInfo& record, uint32_t minSpi,
@@ -1117,7 +1119,7 @@ netdutils::Status XfrmController::allocateSpi(const XfrmSaInfo& record, uint32_t
 
     enum { NLMSG_HDR, USERSAID, USERSAID_PAD };
 
-    std::vector<iovec> iov = {
+    iovec iov[] = {
         {nullptr, 0},      // reserved for the eventual addition of a NLMSG_HDR
         {&spiInfo, 0},  // main userspi_info struct
         {kPadBytes, 0}, // up to NLMSG_ALIGNTO pad bytes of padding
@@ -1137,7 +1139,7 @@ netdutils::Status XfrmController::allocateSpi(const XfrmSaInfo& record, uint32_t
     while ((spi = spiGen.next()) != INVALID_SPI) {
         spiInfo.min = spi;
         spiInfo.max = spi;
-        ret = sock.sendMessage(XFRM_MSG_ALLOCSPI, NETLINK_REQUEST_FLAGS, 0, &iov);
+        ret = sock.sendMessage(XFRM_MSG_ALLOCSPI, NETLINK_REQUEST_FLAGS, 0, iov);
 
         /* If the SPI is in use, we'll get ENOENT */
         if (netdutils::equalToErrno(ret, ENOENT))
@@ -1179,7 +1181,7 @@ netdutils::Status XfrmController::updateTunnelModeSecurityPolicy(const XfrmSpInf
         INTF_ID_PAD,
     };
 
-    std::vector<iovec> iov = {
+    iovec iov[] = {
             {nullptr, 0},      // reserved for the eventual addition of a NLMSG_HDR
             {&userpolicy, 0},  // main xfrm_userpolicy_info struct
             {kPadBytes, 0},    // up to NLMSG_ALIGNTO pad bytes of padding
@@ -1204,7 +1206,7 @@ netdutils::Status XfrmController::updateTunnelModeSecurityPolicy(const XfrmSpInf
     len = iov[INTF_ID].iov_len = fillNlAttrXfrmIntfId(record.xfrm_if_id, &xfrm_if_id);
     iov[INTF_ID_PAD].iov_len = NLA_ALIGN(len) - len;
 
-    return sock.sendMessage(msgType, NETLINK_REQUEST_FLAGS, 0, &iov);
+    return sock.sendMessage(msgType, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 netdutils::Status XfrmController::deleteTunnelModeSecurityPolicy(const XfrmSpInfo& record,
@@ -1224,7 +1226,7 @@ netdutils::Status XfrmController::deleteTunnelModeSecurityPolicy(const XfrmSpInf
         INTF_ID_PAD,
     };
 
-    std::vector<iovec> iov = {
+    iovec iov[] = {
             {nullptr, 0},      // reserved for the eventual addition of a NLMSG_HDR
             {&policyid, 0},    // main xfrm_userpolicy_id struct
             {kPadBytes, 0},    // up to NLMSG_ALIGNTO pad bytes of padding
@@ -1243,7 +1245,7 @@ netdutils::Status XfrmController::deleteTunnelModeSecurityPolicy(const XfrmSpInf
     len = iov[INTF_ID].iov_len = fillNlAttrXfrmIntfId(record.xfrm_if_id, &xfrm_if_id);
     iov[INTF_ID_PAD].iov_len = NLA_ALIGN(len) - len;
 
-    return sock.sendMessage(XFRM_MSG_DELPOLICY, NETLINK_REQUEST_FLAGS, 0, &iov);
+    return sock.sendMessage(XFRM_MSG_DELPOLICY, NETLINK_REQUEST_FLAGS, 0, iov);
 }
 
 int XfrmController::fillUserSpInfo(const XfrmSpInfo& record, XfrmDirection direction,
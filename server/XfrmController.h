@@ -19,6 +19,7 @@
 #include <atomic>
 #include <list>
 #include <map>
+#include <span>
 #include <string>
 #include <utility> // for pair
 
@@ -71,7 +72,7 @@ public:
     // a valid netlink message header.
     virtual netdutils::Status sendMessage(uint16_t nlMsgType, uint16_t nlMsgFlags,
                                           uint16_t nlMsgSeqNum,
-                                          std::vector<iovec>* iovecs) const = 0;
+                                          std::span<iovec> iovecs) const = 0;
 
 protected:
     int mSock;
@@ -85,7 +85,7 @@ ACTION_TEMPLATE(SetArgSlice, HAS_1_TEMPLATE_PARAMS(int, N), AND_1_VALUE_PARAMS(v
  * they point to will still be valid after the mock method returns.
  */
 ACTION_TEMPLATE(SaveFlattenedIovecs, HAS_1_TEMPLATE_PARAMS(int, N), AND_1_VALUE_PARAMS(resVec)) {
-    const std::vector<iovec>& iovs = ::testing::get<N>(args);
+    std::span<const iovec> iovs = ::testing::get<N>(args);
 
     for (const iovec& iov : iovs) {
         resVec->insert(resVec->end(), reinterpret_cast<uint8_t*>(iov.iov_base),
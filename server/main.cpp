@@ -139,7 +139,7 @@ int main() {
 
     std::unique_ptr<NFLogListener> logListener;
     {
-        auto result = makeNFLogListener();
+        auto result = makeNFLogListener(&gCtls->listenerLoop);
         if (!isOk(result)) {
             ALOGE("Unable to create NFLogListener: %s", toString(result).c_str());
             exit(1);
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tool that turns the output of "dumpsys netd --proto" back into text:
+//     adb shell dumpsys netd --proto | netd_dump_decoder
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "NetdDumpDecoder.h"
+
+using android::net::decodeNetdDump;
+using android::net::netd::NetdDumpProto;
+
+int main() {
+    NetdDumpProto dump;
+    if (!dump.ParseFromFileDescriptor(STDIN_FILENO)) {
+        fprintf(stderr, "Failed to parse NetdDumpProto from stdin\n");
+        return 1;
+    }
+    fputs(decodeNetdDump(dump).c_str(), stdout);
+    return 0;
+}
@@ -242,3 +242,83 @@ static void ipv6_high_load(::benchmark::State& state) {
     run(ipv6_loopback, state, false);
 }
 BENCHMARK(ipv6_high_load)->ThreadRange(MIN_THREADS, MAX_THREADS)->MinTime(MIN_TIME)->UseRealTime();
+
+// Connecting a fresh socket each time, which is what most connect() calls do. These always need
+// ON_CONNECT, so they show what checking for the reconnect fast path below costs them.
+static void ipv6_fresh_connect(::benchmark::State& state, const int type) {
+    const int server = socket(AF_INET6, type | SOCK_CLOEXEC, 0);
+    sockaddr_in6 sin6 = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+    socklen_t len = sizeof(sin6);
+    if (bind(server, (sockaddr*) &sin6, len) || getsockname(server, (sockaddr*) &sin6, &len) ||
+        (type == SOCK_STREAM && listen(server, 1))) {
+        state.SkipWithError("Unable to bind server socket");
+        close(server);
+        return;
+    }
+
+    while (state.KeepRunning()) {
+        const int sock = socket(AF_INET6, type | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+            state.SkipWithError(StringPrintf("socket() failed with errno=%d", errno).c_str());
+            break;
+        }
+        if (connect(sock, (sockaddr*) &sin6, sizeof(sin6))) {
+            state.SkipWithError(StringPrintf("connect() failed with errno=%d", errno).c_str());
+            close(sock);
+            break;
+        }
+        if (type == SOCK_STREAM) {
+            const int accepted = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+            if (accepted < 0) {
+                state.SkipWithError(StringPrintf("accept() failed with errno=%d", errno).c_str());
+                close(sock);
+                break;
+            }
+            close(accepted);
+        }
+        close(sock);
+    }
+    close(server);
+}
+
+static void ipv6_tcp_connect(::benchmark::State& state) {
+    ipv6_fresh_connect(state, SOCK_STREAM);
+}
+BENCHMARK(ipv6_tcp_connect)->MinTime(MIN_TIME)->UseRealTime();
+
+static void ipv6_udp_connect(::benchmark::State& state) {
+    ipv6_fresh_connect(state, SOCK_DGRAM);
+}
+BENCHMARK(ipv6_udp_connect)->MinTime(MIN_TIME)->UseRealTime();
+
+// Reconnecting an already connected UDP socket, as apps do to pick a source address or to switch
+// servers. ON_CONNECT does not change the mark of such a socket, so libnetd_client skips it as long
+// as netd's connect policy has not changed since the first connect().
+static void ipv6_udp_reconnect(::benchmark::State& state) {
+    const int server = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in6 sin6 = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+    socklen_t len = sizeof(sin6);
+    if (bind(server, (sockaddr*) &sin6, len) || getsockname(server, (sockaddr*) &sin6, &len)) {
+        state.SkipWithError("Unable to bind server socket");
+        close(server);
+        return;
+    }
+
+    const int sock = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    // The first connect() always goes to netd.
+    if (connect(sock, (sockaddr*) &sin6, sizeof(sin6))) {
+        state.SkipWithError(StringPrintf("connect() failed with errno=%d", errno).c_str());
+        close(sock);
+        close(server);
+        return;
+    }
+    while (state.KeepRunning()) {
+        if (connect(sock, (sockaddr*) &sin6, sizeof(sin6))) {
+            state.SkipWithError(StringPrintf("connect() failed with errno=%d", errno).c_str());
+            break;
+        }
+    }
+    close(sock);
+    close(server);
+}
+BENCHMARK(ipv6_udp_reconnect)->MinTime(MIN_TIME)->UseRealTime();
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures netd's control-plane operations against the real kernel: creating networks, adding
+// interfaces, adding UID ranges, setting up tethering and replacing firewall chains. Everything
+// runs in a private network namespace with tun interfaces, so the routing rules, routes, qdiscs,
+// iptables chains and sysctls of the device are not touched, and every run starts from the same
+// state.
+//
+// The controllers are set up by Controllers::createForNetnsTest(), which skips the parts of
+// Controllers::init() that act on state that is not per-namespace (TrafficController, clatd and
+// XFRM). Constructing Controllers still clears the tethering offload BPF maps, which are shared by
+// all namespaces, so the benchmark refuses to run while they are in use. The ConnectPolicyPage is
+// published in a temporary directory, so that clients on the device keep what they have learned.
+
+#include <net/if.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <netutils/ifc.h>
+
+#include "Controllers.h"
+#include "OffloadUtils.h"
+#include "UidRanges.h"
+#include "bpf/BpfMap.h"
+#include "tun_interface.h"
+
+namespace android {
+namespace net {
+
+using base::StringPrintf;
+
+namespace {
+
+constexpr unsigned FIRST_BACKGROUND_NET_ID = 100;
+constexpr unsigned TEST_NET_ID = 5000;
+constexpr uid_t FIRST_APP_UID = 10000;
+
+std::unique_ptr<TunInterface> makeInterface(benchmark::State& state) {
+    auto iface = std::make_unique<TunInterface>();
+    if (int ret = iface->init()) {
+        state.SkipWithError(StringPrintf("Creating tun interface: %s", strerror(-ret)).c_str());
+        return nullptr;
+    }
+    return iface;
+}
+
+// Physical networks with one interface each, so that the routing rules, routing tables and
+// iptables chains are as large as on a device with that many networks. Destroyed when it goes out
+// of scope.
+class BackgroundNetworks {
+  public:
+    bool create(benchmark::State& state, int count) {
+        for (int i = 0; i < count; i++) {
+            const unsigned netId = FIRST_BACKGROUND_NET_ID + i;
+            auto iface = makeInterface(state);
+            if (!iface) return false;
+            if (int ret = gCtls->netCtrl.createPhysicalNetwork(netId, PERMISSION_NONE)) {
+                return fail(state, "createPhysicalNetwork", ret);
+            }
+            mNetIds.push_back(netId);
+            if (int ret = gCtls->netCtrl.addInterfaceToNetwork(netId, iface->name().c_str())) {
+                return fail(state, "addInterfaceToNetwork", ret);
+            }
+            mInterfaces.push_back(std::move(iface));
+        }
+        return true;
+    }
+
+    ~BackgroundNetworks() {
+        for (unsigned netId : mNetIds) {
+            (void) gCtls->netCtrl.destroyNetwork(netId);
+        }
+    }
+
+  private:
+    static bool fail(benchmark::State& state, const char* what, int ret) {
+        state.SkipWithError(StringPrintf("%s: %s", what, strerror(-ret)).c_str());
+        return false;
+    }
+
+    std::vector<unsigned> mNetIds;
+    std::vector<std::unique_ptr<TunInterface>> mInterfaces;
+};
+
+bool check(benchmark::State& state, const char* what, int ret) {
+    if (ret == 0) return true;
+    state.SkipWithError(StringPrintf("%s: %s", what, strerror(-ret)).c_str());
+    return false;
+}
+
+// Returns whether the map behind fd has any entries. Takes ownership of fd.
+template <class Key, class Value>
+bool hasEntries(int fd) {
+    if (fd < 0) return false;
+    bpf::BpfMap<Key, Value> map;
+    map.reset(fd);
+    return map.getFirstKey().ok();
+}
+
+// Whether tethering offload is, or recently was, in use on the device.
+bool tetherOffloadInUse() {
+    return hasEntries<TetherIngressKey, TetherIngressValue>(getTetherIngressMapFd()) ||
+           hasEntries<uint32_t, TetherStatsValue>(getTetherStatsMapFd()) ||
+           hasEntries<uint32_t, uint64_t>(getTetherLimitMapFd());
+}
+
+}  // namespace
+
+// Creates and destroys a physical network while state.range(0) other networks exist.
+void BM_CreateDestroyPhysicalNetwork(benchmark::State& state) {
+    BackgroundNetworks background;
+    if (!background.create(state, state.range(0))) return;
+
+    auto& netCtrl = gCtls->netCtrl;
+    for (auto _ : state) {
+        if (!check(state, "createPhysicalNetwork",
+                   netCtrl.createPhysicalNetwork(TEST_NET_ID, PERMISSION_NONE)) ||
+            !check(state, "destroyNetwork", netCtrl.destroyNetwork(TEST_NET_ID))) {
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CreateDestroyPhysicalNetwork)->Arg(0)->Arg(16)->Arg(64)->UseRealTime();
+
+// Brings an interface into a network the way the framework does for a new cellular connection:
+// routing rules, clsact qdisc, a directly-connected route and a data quota, then takes it down
+// again. state.range(0) other networks exist.
+void BM_AddRemoveInterface(benchmark::State& state) {
+    BackgroundNetworks background;
+    if (!background.create(state, state.range(0))) return;
+    auto iface = makeInterface(state);
+    if (!iface) return;
+
+    auto& netCtrl = gCtls->netCtrl;
+    auto& bandwidthCtrl = gCtls->bandwidthCtrl;
+    const char* name = iface->name().c_str();
+    if (!check(state, "createPhysicalNetwork",
+               netCtrl.createPhysicalNetwork(TEST_NET_ID, PERMISSION_NONE))) {
+        return;
+    }
+    for (auto _ : state) {
+        if (!check(state, "addInterfaceToNetwork",
+                   netCtrl.addInterfaceToNetwork(TEST_NET_ID, name)) ||
+            !check(state, "addRoute",
+                   netCtrl.addRoute(TEST_NET_ID, name, "2001:db8::/64", nullptr, false, 0, 0)) ||
+            !check(state, "setInterfaceQuota", bandwidthCtrl.setInterfaceQuota(name, 1 << 30)) ||
+            !check(state, "removeInterfaceQuota", bandwidthCtrl.removeInterfaceQuota(name)) ||
+            !check(state, "removeRoute",
+                   netCtrl.removeRoute(TEST_NET_ID, name, "2001:db8::/64", nullptr, false, 0)) ||
+            !check(state, "removeInterfaceFromNetwork",
+                   netCtrl.removeInterfaceFromNetwork(TEST_NET_ID, name))) {
+            break;
+        }
+    }
+    (void) netCtrl.destroyNetwork(TEST_NET_ID);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddRemoveInterface)->Arg(0)->Arg(16)->Arg(64)->UseRealTime();
+
+// Adds state.range(0) UID ranges to a VPN and removes them again, as when a VPN is set up for a
+// user with many work profile or per-app exclusions.
+void BM_AddRemoveUidRanges(benchmark::State& state) {
+    auto iface = makeInterface(state);
+    if (!iface) return;
+
+    auto& netCtrl = gCtls->netCtrl;
+    if (!check(state, "createVirtualNetwork", netCtrl.createVirtualNetwork(TEST_NET_ID, true)) ||
+        !check(state, "addInterfaceToNetwork",
+               netCtrl.addInterfaceToNetwork(TEST_NET_ID, iface->name().c_str()))) {
+        return;
+    }
+
+    std::vector<UidRangeParcel> parcels;
+    for (int i = 0; i < state.range(0); i++) {
+        UidRangeParcel range;
+        range.start = FIRST_APP_UID + i * 100;
+        range.stop = range.start + 49;
+        parcels.push_back(range);
+    }
+    const UidRanges ranges(parcels);
+    for (auto _ : state) {
+        if (!check(state, "addUsersToNetwork", netCtrl.addUsersToNetwork(TEST_NET_ID, ranges)) ||
+            !check(state, "removeUsersFromNetwork",
+                   netCtrl.removeUsersFromNetwork(TEST_NET_ID, ranges))) {
+            break;
+        }
+    }
+    (void) netCtrl.destroyNetwork(TEST_NET_ID);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AddRemoveUidRanges)->Arg(10)->Arg(100)->Arg(500)->UseRealTime();
+
+// Enables forwarding and NAT from state.range(0) downstream interfaces to one upstream, then tears
+// it all down again.
+void BM_TetherSetup(benchmark::State& state) {
+    auto upstream = makeInterface(state);
+    if (!upstream) return;
+    std::vector<std::unique_ptr<TunInterface>> downstreams;
+    for (int i = 0; i < state.range(0); i++) {
+        downstreams.push_back(makeInterface(state));
+        if (!downstreams.back()) return;
+    }
+
+    auto& tetherCtrl = gCtls->tetherCtrl;
+    const char* up = upstream->name().c_str();
+    for (auto _ : state) {
+        tetherCtrl.enableForwarding("benchmark");
+        bool ok = true;
+        for (const auto& downstream : downstreams) {
+            ok = ok &&
+                 check(state, "enableNat", tetherCtrl.enableNat(downstream->name().c_str(), up));
+        }
+        for (const auto& downstream : downstreams) {
+            ok = ok &&
+                 check(state, "disableNat", tetherCtrl.disableNat(downstream->name().c_str(), up));
+        }
+        tetherCtrl.disableForwarding("benchmark");
+        if (!ok) break;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TetherSetup)->Arg(1)->Arg(4)->Arg(16)->UseRealTime();
+
+// Replaces the dozable chain, alternating between two whitelists of state.range(0) UIDs that
+// overlap by half.
+void BM_ReplaceFirewallChain(benchmark::State& state) {
+    if (gCtls->trafficCtrl.getBpfEnabled()) {
+        // With BPF the chain is a BPF map, which is not per namespace. traffic_controller_benchmark
+        // measures that path against in-memory maps.
+        state.SkipWithError("Firewall chains are in BPF maps on this device");
+        return;
+    }
+
+    std::vector<int32_t> uids[2];
+    for (int i = 0; i < state.range(0); i++) {
+        uids[0].push_back(FIRST_APP_UID + i);
+        uids[1].push_back(FIRST_APP_UID + state.range(0) / 2 + i);
+    }
+    auto& firewallCtrl = gCtls->firewallCtrl;
+    int next = 0;
+    for (auto _ : state) {
+        if (!check(state, "replaceUidChain",
+                   firewallCtrl.replaceUidChain(FirewallController::LOCAL_DOZABLE, true,
+                                                uids[next]))) {
+            break;
+        }
+        next = 1 - next;
+    }
+    (void) firewallCtrl.replaceUidChain(FirewallController::LOCAL_DOZABLE, true, {});
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ReplaceFirewallChain)->Arg(100)->Arg(1000)->Arg(5000)->UseRealTime();
+
+}  // namespace net
+}  // namespace android
+
+int main(int argc, char** argv) {
+    using android::net::Controllers;
+    using android::net::gCtls;
+
+    // Must happen before any threads or iptables-restore processes are started, so that they all
+    // end up in the new namespace.
+    if (unshare(CLONE_NEWNET)) {
+        fprintf(stderr, "unshare(CLONE_NEWNET) failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (ifc_enable("lo")) {
+        fprintf(stderr, "Failed to bring up lo: %s\n", strerror(errno));
+        return 1;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    // TetherController clears the offload maps on construction.
+    if (android::net::tetherOffloadInUse()) {
+        fprintf(stderr, "Tethering offload BPF maps are in use. Stop tethering and retry.\n");
+        return 1;
+    }
+    TemporaryDir connectPolicyDir;
+    gCtls = Controllers::createForNetnsTest(std::string(connectPolicyDir.path) + "/connect_policy")
+                    .release();
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the cost of constructing the FIB rule requests that RouteController sends, with the
+// iovec assembly it used to do and with the typed builders in netdutils/NetlinkBuilder.h. Both
+// end with the request in a contiguous buffer, which is where the kernel's copy of a writev puts
+// it.
+
+#include <linux/fib_rules.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "netdutils/NetlinkBuilder.h"
+#include "netdutils/Slice.h"
+
+using android::netdutils::makeSlice;
+using android::netdutils::NetlinkAttr;
+using android::netdutils::NetlinkBytesAttr;
+using android::netdutils::NetlinkMessage;
+using android::netdutils::NetlinkMessageWriter;
+
+namespace {
+
+using FraPriority = NetlinkAttr<FRA_PRIORITY, uint32_t>;
+using FraTable = NetlinkAttr<FRA_TABLE, uint32_t>;
+using FraFwmark = NetlinkAttr<FRA_FWMARK, uint32_t>;
+using FraFwmask = NetlinkAttr<FRA_FWMASK, uint32_t>;
+using FraUidRange = NetlinkAttr<FRA_UID_RANGE, fib_rule_uid_range>;
+using FraIifName = NetlinkBytesAttr<FRA_IIFNAME, IFNAMSIZ>;
+using FraOifName = NetlinkBytesAttr<FRA_OIFNAME, IFNAMSIZ>;
+using RuleMessage = NetlinkMessage<fib_rule_hdr, FraPriority, FraTable, FraFwmark, FraFwmask,
+                                   FraUidRange, FraIifName, FraOifName>;
+
+constexpr uint16_t kFlags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE;
+constexpr char kOif[] = "wlan0";
+
+// Parameters of a typical per-app network rule.
+struct Rule {
+    uint32_t priority;
+    uint32_t table;
+    uint32_t fwmark;
+    uint32_t mask;
+    uid_t uidStart;
+    uid_t uidEnd;
+};
+
+Rule makeRule(int i) {
+    return {
+            .priority = 12000,
+            .table = 1022,
+            .fwmark = 0x10064,
+            .mask = 0x1ffff,
+            .uidStart = static_cast<uid_t>(10000 + 100 * i),
+            .uidEnd = static_cast<uid_t>(10000 + 100 * i + 99),
+    };
+}
+
+// The iovec assembly RouteController::modifyIpRule used, followed by the gather that writev does.
+size_t buildWithIovecs(const Rule& r, uint8_t* out) {
+    static rtattr kPriority = {RTA_LENGTH(sizeof(uint32_t)), FRA_PRIORITY};
+    static rtattr kTable = {RTA_LENGTH(sizeof(uint32_t)), FRA_TABLE};
+    static rtattr kFwmark = {RTA_LENGTH(sizeof(uint32_t)), FRA_FWMARK};
+    static rtattr kFwmask = {RTA_LENGTH(sizeof(uint32_t)), FRA_FWMASK};
+    static rtattr kUidRange = {RTA_LENGTH(sizeof(fib_rule_uid_range)), FRA_UID_RANGE};
+    static uint8_t kPadding[RTA_ALIGNTO] = {};
+
+    char oifName[IFNAMSIZ];
+    const size_t oifLength = strlcpy(oifName, kOif, IFNAMSIZ) + 1;
+    const uint16_t oifPadding = RTA_SPACE(oifLength) - RTA_LENGTH(oifLength);
+    rtattr fraOifName = {static_cast<uint16_t>(RTA_LENGTH(oifLength)), FRA_OIFNAME};
+
+    fib_rule_hdr rule = {.family = AF_INET6, .action = FR_ACT_TO_TBL};
+    uint32_t priority = r.priority, table = r.table, fwmark = r.fwmark, mask = r.mask;
+    fib_rule_uid_range uidRange = {r.uidStart, r.uidEnd};
+    nlmsghdr nlmsg = {.nlmsg_type = RTM_NEWRULE, .nlmsg_flags = kFlags};
+    iovec iov[] = {
+            {&nlmsg, sizeof(nlmsg)},
+            {&rule, sizeof(rule)},
+            {&kPriority, sizeof(kPriority)},
+            {&priority, sizeof(priority)},
+            {&kTable, sizeof(kTable)},
+            {&table, sizeof(table)},
+            {&kFwmark, sizeof(kFwmark)},
+            {&fwmark, sizeof(fwmark)},
+            {&kFwmask, sizeof(kFwmask)},
+            {&mask, sizeof(mask)},
+            {&kUidRange, sizeof(kUidRange)},
+            {&uidRange, sizeof(uidRange)},
+            {&fraOifName, sizeof(fraOifName)},
+            {oifName, oifLength},
+            {kPadding, oifPadding},
+    };
+    for (const auto& v : iov) nlmsg.nlmsg_len += v.iov_len;
+
+    size_t len = 0;
+    for (const auto& v : iov) {
+        memcpy(out + len, v.iov_base, v.iov_len);
+        len += v.iov_len;
+    }
+    return len;
+}
+
+void buildWithBuilder(const Rule& r, NetlinkMessageWriter& writer) {
+    char oifName[IFNAMSIZ];
+    const size_t oifLength = strlcpy(oifName, kOif, IFNAMSIZ) + 1;
+
+    RuleMessage msg;
+    msg.family = {.family = AF_INET6, .action = FR_ACT_TO_TBL};
+    msg.get<FraPriority>().set(r.priority);
+    msg.get<FraTable>().set(r.table);
+    msg.get<FraFwmark>().set(r.fwmark);
+    msg.get<FraFwmask>().set(r.mask);
+    msg.get<FraUidRange>().set({r.uidStart, r.uidEnd});
+    msg.get<FraIifName>().present = false;
+    msg.get<FraOifName>().set(oifName, oifLength);
+    writer.append(RTM_NEWRULE, kFlags, msg).ignoreError();
+}
+
+void BM_Iovecs(benchmark::State& state) {
+    std::array<uint8_t, RuleMessage::kMaxSize> buf;
+    const Rule rule = makeRule(0);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(buildWithIovecs(rule, buf.data()));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Iovecs);
+
+void BM_Builder(benchmark::State& state) {
+    std::array<uint8_t, RuleMessage::kMaxSize> buf;
+    const Rule rule = makeRule(0);
+    for (auto _ : state) {
+        NetlinkMessageWriter writer(makeSlice(buf));
+        buildWithBuilder(rule, writer);
+        benchmark::DoNotOptimize(writer.messages().size());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Builder);
+
+// Many rules into one buffer, as when adding a range of UIDs to a network in one write.
+void BM_BuilderBatch(benchmark::State& state) {
+    constexpr int kRules = 32;
+    std::array<uint8_t, kRules * RuleMessage::kMaxSize> buf;
+    for (auto _ : state) {
+        NetlinkMessageWriter writer(makeSlice(buf));
+        for (int i = 0; i < kRules; i++) {
+            buildWithBuilder(makeRule(i), writer);
+        }
+        benchmark::DoNotOptimize(writer.messages().size());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * kRules);
+}
+BENCHMARK(BM_BuilderBatch);
+
+}  // namespace
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures netlink dump throughput through the plain and io_uring implementations of
+// netdutils::Syscalls. Runs unprivileged on the device: the dump is a sock_diag dump of loopback
+// TCP sockets owned by the benchmark itself.
+
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "netdutils/IoUringSyscalls.h"
+#include "netdutils/Slice.h"
+#include "netdutils/Syscalls.h"
+
+using android::netdutils::Fd;
+using android::netdutils::IoUringSyscalls;
+using android::netdutils::makeSlice;
+using android::netdutils::Slice;
+using android::netdutils::sSyscalls;
+using android::netdutils::Syscalls;
+using android::netdutils::UniqueFd;
+
+namespace {
+
+constexpr size_t kBufferSize = 32768;
+constexpr size_t kBatchSize = 16;
+
+// Loopback TCP connections that make the sock_diag dump non-trivial.
+class Connections {
+  public:
+    // Makes exactly |n| connections exist, so that the dump size matches the benchmark argument.
+    bool connect(int n) {
+        if (n == mConnections) return true;
+        mFds.clear();
+        mConnections = 0;
+        // Two fds per connection, plus some slack.
+        rlimit limit;
+        const rlim_t needed = 2 * n + 100;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+            limit.rlim_cur = std::min(needed, limit.rlim_max);
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        int listenFd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in6 server = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+        socklen_t len = sizeof(server);
+        if (listenFd == -1 || ::bind(listenFd, (sockaddr*)&server, sizeof(server)) ||
+            getsockname(listenFd, (sockaddr*)&server, &len) || listen(listenFd, n)) {
+            return false;
+        }
+        mFds.emplace_back(Fd(listenFd));
+        for (int i = 0; i < n; i++) {
+            int s = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (s == -1) return false;
+            mFds.emplace_back(Fd(s));
+            if (::connect(s, (sockaddr*)&server, sizeof(server))) return false;
+            int a = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (a == -1) return false;
+            mFds.emplace_back(Fd(a));
+        }
+        mConnections = n;
+        return true;
+    }
+
+  private:
+    std::vector<UniqueFd> mFds;
+    int mConnections = 0;
+};
+
+Connections sConnections;
+
+bool sendDumpRequest(const Syscalls& sys, Fd sock) {
+    struct {
+        nlmsghdr nlh;
+        inet_diag_req_v2 req;
+    } request = {
+            .nlh = {
+                    .nlmsg_len = sizeof(request),
+                    .nlmsg_type = SOCK_DIAG_BY_FAMILY,
+                    .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+            },
+            .req = {
+                    .sdiag_family = AF_INET6,
+                    .sdiag_protocol = IPPROTO_TCP,
+                    .idiag_states = (1 << TCP_ESTABLISHED),
+            },
+    };
+    const sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    return isOk(sys.sendto(sock, makeSlice(request), 0, kernel));
+}
+
+// Counts the messages in |buf|. Returns false once NLMSG_DONE or an error is seen.
+bool countMessages(Slice buf, int64_t* messages) {
+    auto* nlh = reinterpret_cast<const nlmsghdr*>(buf.base());
+    int len = buf.size();
+    for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+        if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) return false;
+        (*messages)++;
+    }
+    return true;
+}
+
+// One read() per datagram.
+bool readDump(const Syscalls& sys, Fd sock, std::vector<char>* buf, int64_t* messages) {
+    while (true) {
+        auto rx = sys.read(sock, Slice(buf->data(), kBufferSize));
+        if (!isOk(rx)) return false;
+        if (!countMessages(rx.value(), messages)) return true;
+    }
+}
+
+// Up to kBatchSize datagrams per recvmmsg().
+bool recvmmsgDump(const Syscalls& sys, Fd sock, std::vector<char>* buf, int64_t* messages) {
+    std::array<iovec, kBatchSize> iov;
+    std::array<mmsghdr, kBatchSize> msgs;
+    while (true) {
+        for (size_t i = 0; i < kBatchSize; i++) {
+            iov[i] = {buf->data() + i * kBufferSize, kBufferSize};
+            msgs[i] = {.msg_hdr = {.msg_iov = &iov[i], .msg_iovlen = 1}};
+        }
+        auto rx = sys.recvmmsg(sock, msgs, MSG_WAITFORONE);
+        if (!isOk(rx)) return false;
+        for (size_t i = 0; i < rx.value(); i++) {
+            if (!countMessages(Slice(iov[i].iov_base, msgs[i].msg_len), messages)) return true;
+        }
+    }
+}
+
+enum class Backend { kPlain, kIoUring, kIoUringFixed };
+
+template <Backend backend, bool batched>
+void BM_SockDiagDump(benchmark::State& state) {
+    if (!sConnections.connect(state.range(0))) {
+        state.SkipWithError("Failed to create loopback connections");
+        return;
+    }
+
+    Syscalls& real = sSyscalls.get();
+    IoUringSyscalls ioUring(real);
+    const Syscalls& sys = (backend == Backend::kPlain) ? real : ioUring;
+    if (backend != Backend::kPlain && !ioUring.ringAvailable()) {
+        state.SkipWithError("io_uring not available");
+        return;
+    }
+
+    std::vector<char> buf(kBatchSize * kBufferSize);
+    if (backend == Backend::kIoUringFixed) {
+        const iovec fixed = {buf.data(), buf.size()};
+        if (!isOk(ioUring.registerBuffers({&fixed, 1}))) {
+            state.SkipWithError("Failed to register buffers");
+            return;
+        }
+    }
+
+    auto sock = sys.socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (!isOk(sock)) {
+        state.SkipWithError("Failed to open sock_diag socket");
+        return;
+    }
+
+    int64_t messages = 0;
+    for (auto _ : state) {
+        const bool ok = sendDumpRequest(sys, sock.value()) &&
+                        (batched ? recvmmsgDump(sys, sock.value(), &buf, &messages)
+                                 : readDump(sys, sock.value(), &buf, &messages));
+        if (!ok) {
+            state.SkipWithError("Dump failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(messages);
+    ioUring.unregisterBuffers().ignoreError();
+}
+
+}  // namespace
+
+#define DUMP_BENCHMARK(backend, batched)                                   \
+    BENCHMARK_TEMPLATE(BM_SockDiagDump, backend, batched)                  \
+            ->Arg(100)                                                     \
+            ->Arg(1000)                                                    \
+            ->Unit(benchmark::kMicrosecond)
+
+DUMP_BENCHMARK(Backend::kPlain, false);
+DUMP_BENCHMARK(Backend::kPlain, true);
+DUMP_BENCHMARK(Backend::kIoUring, false);
+DUMP_BENCHMARK(Backend::kIoUring, true);
+DUMP_BENCHMARK(Backend::kIoUringFixed, false);
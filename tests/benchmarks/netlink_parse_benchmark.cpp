@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the cost of walking the attributes of NFLOG packet messages, as WakeupController does,
+// with a std::function callback, an inlined template callback, and an attribute table.
+
+#include <arpa/inet.h>
+#include <linux/netfilter/nfnetlink_log.h>
+#include <linux/netlink.h>
+
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "netdutils/Math.h"
+#include "netdutils/Netlink.h"
+#include "netdutils/Slice.h"
+
+using android::netdutils::align;
+using android::netdutils::drop;
+using android::netdutils::extract;
+using android::netdutils::forEachNetlinkAttribute;
+using android::netdutils::forEachNetlinkMessage;
+using android::netdutils::makeSlice;
+using android::netdutils::NetlinkAttributeTable;
+using android::netdutils::Slice;
+using android::netdutils::take;
+
+namespace {
+
+constexpr int kMessages = 64;
+
+// The iteration as it was before it became a template: one indirect call per attribute.
+void forEachAttributeStdFunction(const Slice buf,
+                                 const std::function<void(const nlattr&, const Slice)>& onAttr) {
+    Slice tail = buf;
+    while (tail.size() >= sizeof(nlattr)) {
+        nlattr hdr = {};
+        extract(tail, hdr);
+        const auto len = std::max<size_t>(hdr.nla_len, sizeof(hdr));
+        onAttr(hdr, drop(take(tail, len), sizeof(hdr)));
+        tail = drop(tail, align(len, 2));
+    }
+}
+
+void appendAttr(std::vector<uint8_t>* buf, uint16_t type, const void* payload, size_t len) {
+    const nlattr hdr = {.nla_len = static_cast<uint16_t>(sizeof(hdr) + len), .nla_type = type};
+    const size_t offset = buf->size();
+    buf->resize(offset + NLA_ALIGN(sizeof(hdr) + len));
+    memcpy(buf->data() + offset, &hdr, sizeof(hdr));
+    memcpy(buf->data() + offset + sizeof(hdr), payload, len);
+}
+
+template <typename T>
+void appendAttr(std::vector<uint8_t>* buf, uint16_t type, const T& value) {
+    appendAttr(buf, type, &value, sizeof(value));
+}
+
+// A batch of NFLOG packet messages with the attributes that the wakeup group carries.
+std::vector<uint8_t> makeNflogBatch() {
+    std::vector<uint8_t> batch;
+    for (int i = 0; i < kMessages; i++) {
+        std::vector<uint8_t> attrs;
+        const nfulnl_msg_packet_hdr packetHdr = {.hw_protocol = htons(0x86dd)};
+        appendAttr(&attrs, NFULA_PACKET_HDR, packetHdr);
+        appendAttr(&attrs, NFULA_MARK, htonl(0x10064));
+        const uint64_t ts[2] = {htonl(1000 + i), htonl(i)};
+        appendAttr(&attrs, NFULA_TIMESTAMP, ts);
+        appendAttr(&attrs, NFULA_IFINDEX_INDEV, htonl(3));
+        nfulnl_msg_packet_hw hw = {.hw_addrlen = htons(6)};
+        appendAttr(&attrs, NFULA_HWADDR, hw);
+        appendAttr(&attrs, NFULA_UID, htonl(10000 + i));
+        appendAttr(&attrs, NFULA_GID, htonl(10000 + i));
+        const char prefix[] = "wakeup:wlan0";
+        appendAttr(&attrs, NFULA_PREFIX, prefix, sizeof(prefix));
+        const uint8_t packet[60] = {0x60};
+        appendAttr(&attrs, NFULA_PAYLOAD, packet, sizeof(packet));
+
+        const nlmsghdr nlh = {
+                .nlmsg_len = static_cast<uint32_t>(sizeof(nlh) + sizeof(nfgenmsg) + attrs.size()),
+                .nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET,
+        };
+        const nfgenmsg nfmsg = {.nfgen_family = AF_INET6, .res_id = htons(1)};
+        const size_t offset = batch.size();
+        batch.resize(offset + NLMSG_ALIGN(nlh.nlmsg_len));
+        memcpy(batch.data() + offset, &nlh, sizeof(nlh));
+        memcpy(batch.data() + offset + sizeof(nlh), &nfmsg, sizeof(nfmsg));
+        memcpy(batch.data() + offset + sizeof(nlh) + sizeof(nfmsg), attrs.data(), attrs.size());
+    }
+    return batch;
+}
+
+// The fields WakeupController extracts from each message.
+struct Fields {
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint64_t ts[2] = {};
+    uint16_t ethertype = 0;
+    size_t prefixLen = 0;
+    size_t payloadLen = 0;
+};
+
+void visit(const nlattr& attr, const Slice payload, Fields& fields) {
+    switch (attr.nla_type) {
+        case NFULA_UID:
+            extract(payload, fields.uid);
+            break;
+        case NFULA_GID:
+            extract(payload, fields.gid);
+            break;
+        case NFULA_TIMESTAMP:
+            extract(payload, fields.ts);
+            break;
+        case NFULA_PACKET_HDR: {
+            nfulnl_msg_packet_hdr hdr = {};
+            extract(payload, hdr);
+            fields.ethertype = hdr.hw_protocol;
+            break;
+        }
+        case NFULA_PREFIX:
+            fields.prefixLen = payload.size();
+            break;
+        case NFULA_PAYLOAD:
+            fields.payloadLen = payload.size();
+            break;
+        default:
+            break;
+    }
+}
+
+void BM_StdFunction(benchmark::State& state) {
+    std::vector<uint8_t> batch = makeNflogBatch();
+    for (auto _ : state) {
+        forEachNetlinkMessage(makeSlice(batch), [](const nlmsghdr&, const Slice msg) {
+            Fields fields;
+            forEachAttributeStdFunction(
+                    drop(msg, sizeof(nfgenmsg)),
+                    [&fields](const nlattr& attr, const Slice payload) {
+                        visit(attr, payload, fields);
+                    });
+            benchmark::DoNotOptimize(fields);
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * kMessages);
+}
+BENCHMARK(BM_StdFunction);
+
+void BM_Template(benchmark::State& state) {
+    std::vector<uint8_t> batch = makeNflogBatch();
+    for (auto _ : state) {
+        forEachNetlinkMessage(makeSlice(batch), [](const nlmsghdr&, const Slice msg) {
+            Fields fields;
+            forEachNetlinkAttribute(drop(msg, sizeof(nfgenmsg)),
+                                    [&fields](const nlattr& attr, const Slice payload) {
+                                        visit(attr, payload, fields);
+                                    });
+            benchmark::DoNotOptimize(fields);
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * kMessages);
+}
+BENCHMARK(BM_Template);
+
+void BM_AttributeTable(benchmark::State& state) {
+    std::vector<uint8_t> batch = makeNflogBatch();
+    for (auto _ : state) {
+        forEachNetlinkMessage(makeSlice(batch), [](const nlmsghdr&, const Slice msg) {
+            NetlinkAttributeTable<NFULA_MAX> attrs;
+            attrs.parse(drop(msg, sizeof(nfgenmsg))).ignoreError();
+            Fields fields;
+            attrs.get(NFULA_UID, fields.uid);
+            attrs.get(NFULA_GID, fields.gid);
+            attrs.get(NFULA_TIMESTAMP, fields.ts);
+            nfulnl_msg_packet_hdr hdr = {};
+            if (attrs.get(NFULA_PACKET_HDR, hdr)) fields.ethertype = hdr.hw_protocol;
+            fields.prefixLen = attrs.get(NFULA_PREFIX).size();
+            fields.payloadLen = attrs.get(NFULA_PAYLOAD).size();
+            benchmark::DoNotOptimize(fields);
+        });
+    }
+    state.SetItemsProcessed(state.iterations() * kMessages);
+}
+BENCHMARK(BM_AttributeTable);
+
+}  // namespace
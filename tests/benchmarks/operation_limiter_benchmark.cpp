@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures start()/finish() throughput of OperationLimiter and ShardedOperationLimiter with 1 to
+// 32 threads. Each thread acts for its own UID, as concurrent DNS queries from different apps do,
+// so any contention comes from the limiter and not from the keys themselves.
+
+#include <sys/types.h>
+
+#include <benchmark/benchmark.h>
+
+#include "netdutils/OperationLimiter.h"
+
+using android::netdutils::OperationLimiter;
+using android::netdutils::ShardedOperationLimiter;
+
+namespace {
+
+constexpr int kLimitPerUid = 256;
+constexpr int kGlobalLimit = 1024;
+
+template <typename Limiter>
+void acquireRelease(benchmark::State& state, Limiter& limiter) {
+    const uid_t uid = 10000 + state.thread_index;
+    int64_t rejected = 0;
+    for (auto _ : state) {
+        if (limiter.start(uid)) {
+            limiter.finish(uid);
+        } else {
+            rejected++;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["rejected"] = rejected;
+}
+
+void BM_OperationLimiter(benchmark::State& state) {
+    static OperationLimiter<uid_t> limiter(kLimitPerUid);
+    acquireRelease(state, limiter);
+}
+BENCHMARK(BM_OperationLimiter)->ThreadRange(1, 32)->UseRealTime();
+
+void BM_ShardedOperationLimiter(benchmark::State& state) {
+    static ShardedOperationLimiter<uid_t> limiter(kLimitPerUid);
+    acquireRelease(state, limiter);
+}
+BENCHMARK(BM_ShardedOperationLimiter)->ThreadRange(1, 32)->UseRealTime();
+
+// With a global limit every call also updates the shared total, which all threads contend on.
+// Without one, as above, threads whose keys are in different shards share nothing.
+void BM_ShardedOperationLimiterGlobalLimit(benchmark::State& state) {
+    static ShardedOperationLimiter<uid_t> limiter(kLimitPerUid, kGlobalLimit);
+    acquireRelease(state, limiter);
+}
+BENCHMARK(BM_ShardedOperationLimiterGlobalLimit)->ThreadRange(1, 32)->UseRealTime();
+
+// Every thread uses the same key, so all of them contend on one shard. This is the worst case for
+// sharding and should be no slower than the unsharded limiter.
+void BM_ShardedOperationLimiterSameKey(benchmark::State& state) {
+    static ShardedOperationLimiter<uid_t> limiter(kLimitPerUid);
+    const uid_t uid = 10000;
+    for (auto _ : state) {
+        if (limiter.start(uid)) limiter.finish(uid);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ShardedOperationLimiterSameKey)->ThreadRange(1, 32)->UseRealTime();
+
+}  // namespace
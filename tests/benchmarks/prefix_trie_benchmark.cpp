@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures longest-prefix-match lookups of IPv6 addresses in IPPrefixTrie against the linear scan
+// over a list of prefixes that callers use today, for 8 to 4096 prefixes.
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "netdutils/IPPrefixTrie.h"
+
+using android::netdutils::IPAddress;
+using android::netdutils::IPPrefix;
+using android::netdutils::IPPrefixTrie;
+
+namespace {
+
+constexpr int kLookups = 1024;
+
+// Prefixes of typical route lengths under 2001:db8::/32.
+std::vector<std::pair<IPPrefix, int>> makePrefixes(int n, std::mt19937& rng) {
+    constexpr int kLengths[] = {32, 40, 48, 56, 64, 64, 64, 128};
+    std::vector<std::pair<IPPrefix, int>> prefixes;
+    for (int i = 0; i < n; i++) {
+        in6_addr addr = {};
+        addr.s6_addr[0] = 0x20;
+        addr.s6_addr[1] = 0x01;
+        addr.s6_addr[2] = 0x0d;
+        addr.s6_addr[3] = 0xb8;
+        for (int b = 4; b < 16; b++) addr.s6_addr[b] = rng();
+        prefixes.emplace_back(IPPrefix(IPAddress(addr), kLengths[rng() % std::size(kLengths)]), i);
+    }
+    return prefixes;
+}
+
+// Addresses that mostly fall inside one of the prefixes.
+std::vector<IPAddress> makeAddresses(const std::vector<std::pair<IPPrefix, int>>& prefixes,
+                                     std::mt19937& rng) {
+    std::vector<IPAddress> addresses;
+    for (int i = 0; i < kLookups; i++) {
+        in6_addr addr = prefixes[rng() % prefixes.size()].first.addr6();
+        for (int b = 12; b < 16; b++) addr.s6_addr[b] = rng();
+        addresses.emplace_back(addr);
+    }
+    return addresses;
+}
+
+const int* linearMatch(const std::vector<std::pair<IPPrefix, int>>& prefixes,
+                       const IPAddress& ip) {
+    const int* best = nullptr;
+    int bestLength = -1;
+    for (const auto& [prefix, value] : prefixes) {
+        if (prefix.length() > bestLength && IPPrefix(ip, prefix.length()) == prefix) {
+            best = &value;
+            bestLength = prefix.length();
+        }
+    }
+    return best;
+}
+
+void BM_LinearScan(benchmark::State& state) {
+    std::mt19937 rng(42);
+    const auto prefixes = makePrefixes(state.range(0), rng);
+    const auto addresses = makeAddresses(prefixes, rng);
+    for (auto _ : state) {
+        for (const auto& ip : addresses) {
+            benchmark::DoNotOptimize(linearMatch(prefixes, ip));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kLookups);
+}
+BENCHMARK(BM_LinearScan)->RangeMultiplier(8)->Range(8, 4096);
+
+void BM_TrieLookup(benchmark::State& state) {
+    std::mt19937 rng(42);
+    const auto prefixes = makePrefixes(state.range(0), rng);
+    const auto addresses = makeAddresses(prefixes, rng);
+    const auto trie = IPPrefixTrie<int>::build(prefixes);
+    for (auto _ : state) {
+        for (const auto& ip : addresses) {
+            benchmark::DoNotOptimize(trie.longestMatch(ip));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kLookups);
+}
+BENCHMARK(BM_TrieLookup)->RangeMultiplier(8)->Range(8, 4096);
+
+void BM_TrieBuild(benchmark::State& state) {
+    std::mt19937 rng(42);
+    const auto prefixes = makePrefixes(state.range(0), rng);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(IPPrefixTrie<int>::build(prefixes));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TrieBuild)->RangeMultiplier(8)->Range(8, 4096);
+
+}  // namespace
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include "SockDiag.h"
+
+using android::base::StringPrintf;
+using android::base::unique_fd;
+using android::net::SockDiag;
+
+// Far above any app UID, so that only the benchmark sockets are destroyed.
+constexpr uid_t BENCHMARK_UID = 99999;
+
+// Connects |n| loopback TCP sockets owned by BENCHMARK_UID. Returns false on failure.
+static bool connectSockets(int n, std::vector<unique_fd>* clients,
+                           std::vector<unique_fd>* accepted) {
+    unique_fd listenSocket(socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    sockaddr_in6 server = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+    socklen_t serverLen = sizeof(server);
+    if (listenSocket == -1 || bind(listenSocket, (sockaddr*)&server, sizeof(server)) ||
+        getsockname(listenSocket, (sockaddr*)&server, &serverLen) || listen(listenSocket, n)) {
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        unique_fd s(socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (s == -1 || connect(s, (sockaddr*)&server, sizeof(server)) ||
+            fchown(s, BENCHMARK_UID, -1)) {
+            return false;
+        }
+        unique_fd a(accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC));
+        if (a == -1) return false;
+        clients->push_back(std::move(s));
+        accepted->push_back(std::move(a));
+    }
+    return true;
+}
+
+// Measures the time taken to destroy state.range(0) sockets with a single per-UID destroy call.
+static void BM_MassDestroy(benchmark::State& state) {
+    const int n = state.range(0);
+
+    // Two fds per connection, plus some slack. Only raise the soft limit, so that lowering the
+    // hard limit does not prevent later, larger runs from raising it again.
+    const rlim_t needed = 2 * n + 100;
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit)) {
+        state.SkipWithError(StringPrintf("getrlimit failed: %s", strerror(errno)).c_str());
+        return;
+    }
+    if (limit.rlim_cur < needed) {
+        limit.rlim_cur = needed;
+        if (setrlimit(RLIMIT_NOFILE, &limit)) {
+            state.SkipWithError(StringPrintf("setrlimit failed: %s", strerror(errno)).c_str());
+            return;
+        }
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<unique_fd> clients, accepted;
+        if (!connectSockets(n, &clients, &accepted)) {
+            state.SkipWithError(StringPrintf("connect failed: %s", strerror(errno)).c_str());
+            break;
+        }
+        SockDiag sd;
+        if (!sd.open()) {
+            state.SkipWithError("Failed to open SOCK_DIAG socket");
+            break;
+        }
+        state.ResumeTiming();
+
+        if (int ret = sd.destroySockets(IPPROTO_TCP, BENCHMARK_UID, false)) {
+            state.SkipWithError(StringPrintf("destroy failed: %s", strerror(-ret)).c_str());
+            break;
+        }
+
+        state.PauseTiming();
+        clients.clear();
+        accepted.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_MassDestroy)->Arg(100)->Arg(1000)->Arg(4000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures TrafficController and BpfNetworkStats operations whose cost grows with the size of the
+// BPF maps, at 10k-100k entries. The maps are bpf::InMemoryBpfMap, so this needs neither root nor
+// a kernel with BPF support, and the numbers reflect netd's own work rather than syscall overhead.
+
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include "TrafficController.h"
+#include "netdbpf/BpfMapInterface.h"
+#include "netdbpf/BpfNetworkStats.h"
+#include "netdbpf/InMemoryBpfMap.h"
+#include "netdbpf/bpf_shared.h"
+
+namespace android {
+namespace net {
+
+using base::StringPrintf;
+using base::unique_fd;
+using bpf::InMemoryBpfMap;
+using bpf::stats_line;
+
+namespace {
+
+constexpr uid_t FIRST_APP_UID = 10000;
+constexpr uid_t SYSTEM_UID = 1000;
+constexpr uint32_t NUM_UIDS = 1000;
+constexpr uint32_t NUM_IFACES = 8;
+constexpr uint32_t TEST_TAG = 42;
+
+// The maps that bpfloader creates on a device, pinned where initMaps() looks for them. They are
+// unpinned again on destruction so that each benchmark run starts from empty maps.
+class PinnedNetdMaps {
+  public:
+    explicit PinnedNetdMaps(uint32_t maxEntries)
+        : cookieTagMap(maxEntries),
+          uidCounterSetMap(maxEntries),
+          appUidStatsMap(maxEntries),
+          statsMapA(maxEntries),
+          statsMapB(maxEntries),
+          ifaceIndexNameMap(maxEntries),
+          ifaceStatsMap(maxEntries),
+          configurationMap(CONFIGURATION_MAP_SIZE),
+          uidOwnerMap(maxEntries),
+          uidPermissionMap(maxEntries) {
+        pin(cookieTagMap, COOKIE_TAG_MAP_PATH);
+        pin(uidCounterSetMap, UID_COUNTERSET_MAP_PATH);
+        pin(appUidStatsMap, APP_UID_STATS_MAP_PATH);
+        pin(statsMapA, STATS_MAP_A_PATH);
+        pin(statsMapB, STATS_MAP_B_PATH);
+        pin(ifaceIndexNameMap, IFACE_INDEX_NAME_MAP_PATH);
+        pin(ifaceStatsMap, IFACE_STATS_MAP_PATH);
+        pin(configurationMap, CONFIGURATION_MAP_PATH);
+        pin(uidOwnerMap, UID_OWNER_MAP_PATH);
+        pin(uidPermissionMap, UID_PERMISSION_MAP_PATH);
+    }
+
+    ~PinnedNetdMaps() {
+        // unpin() does not depend on the key and value types.
+        for (const char* path : mPaths) InMemoryBpfMap<uint32_t, uint32_t>::unpin(path);
+    }
+
+    InMemoryBpfMap<uint64_t, UidTagValue> cookieTagMap;
+    InMemoryBpfMap<uint32_t, uint8_t> uidCounterSetMap;
+    InMemoryBpfMap<uint32_t, StatsValue> appUidStatsMap;
+    InMemoryBpfMap<StatsKey, StatsValue> statsMapA;
+    InMemoryBpfMap<StatsKey, StatsValue> statsMapB;
+    InMemoryBpfMap<uint32_t, IfaceValue> ifaceIndexNameMap;
+    InMemoryBpfMap<uint32_t, StatsValue> ifaceStatsMap;
+    InMemoryBpfMap<uint32_t, uint8_t> configurationMap;
+    InMemoryBpfMap<uint32_t, UidOwnerValue> uidOwnerMap;
+    InMemoryBpfMap<uint32_t, uint8_t> uidPermissionMap;
+
+  private:
+    template <class Key, class Value>
+    void pin(const InMemoryBpfMap<Key, Value>& map, const char* path) {
+        const auto res = map.pin(path);
+        CHECK(res.ok()) << res.error().message();
+        mPaths.push_back(path);
+    }
+
+    std::vector<const char*> mPaths;
+};
+
+// The i-th of a set of distinct stats keys, spread over NUM_UIDS uids and NUM_IFACES interfaces.
+StatsKey makeStatsKey(uint32_t i) {
+    return {.uid = FIRST_APP_UID + i % NUM_UIDS,
+            .tag = i / (NUM_UIDS * NUM_IFACES),
+            .counterSet = 0,
+            .ifaceIndex = 1 + (i / NUM_UIDS) % NUM_IFACES};
+}
+
+void fillStatsMap(InMemoryBpfMap<StatsKey, StatsValue>& map, uint32_t entries) {
+    const StatsValue value = {.rxPackets = 1, .rxBytes = 100, .txPackets = 1, .txBytes = 100};
+    for (uint32_t i = 0; i < entries; i++) {
+        CHECK(map.writeValue(makeStatsKey(i), value, BPF_NOEXIST).ok());
+    }
+}
+
+void fillIfaceNameMap(InMemoryBpfMap<uint32_t, IfaceValue>& map, uint32_t entries) {
+    for (uint32_t i = 1; i <= entries; i++) {
+        IfaceValue name = {};
+        snprintf(name.name, sizeof(name.name), "iface%u", i);
+        CHECK(map.writeValue(i, name, BPF_NOEXIST).ok());
+    }
+}
+
+}  // namespace
+
+// A friend of TrafficController, so that it can use its testing constructor and replace its maps.
+class TrafficControllerBenchmark {
+  public:
+    // A controller with perUidLimit == totalLimit == limit, whose maps are the in-memory maps that
+    // PinnedNetdMaps pinned.
+    static std::unique_ptr<TrafficController> create(uint32_t limit) {
+        std::unique_ptr<TrafficController> tc(new TrafficController(limit, limit));
+        {
+            std::lock_guard guard(tc->mMutex);
+            tc->mCookieTagMap = makeInMemoryMap<uint64_t, UidTagValue>();
+            tc->mUidCounterSetMap = makeInMemoryMap<uint32_t, uint8_t>();
+            tc->mAppUidStatsMap = makeInMemoryMap<uint32_t, StatsValue>();
+            tc->mStatsMapA = makeInMemoryMap<StatsKey, StatsValue>();
+            tc->mStatsMapB = makeInMemoryMap<StatsKey, StatsValue>();
+            tc->mIfaceIndexNameMap = makeInMemoryMap<uint32_t, IfaceValue>();
+            tc->mIfaceStatsMap = makeInMemoryMap<uint32_t, StatsValue>();
+            tc->mConfigurationMap = makeInMemoryMap<uint32_t, uint8_t>();
+            tc->mUidOwnerMap = makeInMemoryMap<uint32_t, UidOwnerValue>();
+            tc->mUidPermissionMap = makeInMemoryMap<uint32_t, uint8_t>();
+        }
+        CHECK(isOk(tc->initMaps()));
+        return tc;
+    }
+
+  private:
+    template <class Key, class Value>
+    static std::unique_ptr<bpf::BpfMapInterface<Key, Value>> makeInMemoryMap() {
+        return std::make_unique<bpf::BpfMapAdapter<Key, Value, InMemoryBpfMap>>();
+    }
+};
+
+// tagSocket() counts the entries in the live stats map before every tag, to enforce the per-uid
+// and total limits.
+void BM_tagSocket(benchmark::State& state) {
+    const uint32_t entries = state.range(0);
+    PinnedNetdMaps maps(entries * 2);
+    fillStatsMap(maps.statsMapA, entries);
+    const auto tc = TrafficControllerBenchmark::create(entries * 2);
+
+    unique_fd sock(socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    CHECK(sock != -1);
+    for (auto _ : state) {
+        const int ret = tc->tagSocket(sock, TEST_TAG, FIRST_APP_UID, FIRST_APP_UID);
+        if (ret) {
+            state.SkipWithError(StringPrintf("tagSocket() failed: %s", strerror(-ret)).c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_tagSocket)->RangeMultiplier(10)->Range(10000, 100000);
+
+// Deletes one tag of one uid, which walks the cookie map and both stats maps. The deleted entries
+// are put back outside the timed region.
+void BM_deleteTagData(benchmark::State& state) {
+    const uint32_t entries = state.range(0);
+    PinnedNetdMaps maps(entries * 2);
+    fillStatsMap(maps.statsMapA, entries);
+    fillStatsMap(maps.statsMapB, entries);
+    std::vector<uint64_t> deletedCookies;
+    for (uint32_t i = 0; i < entries; i++) {
+        const UidTagValue tag = {.uid = FIRST_APP_UID + i % NUM_UIDS, .tag = i % 2};
+        CHECK(maps.cookieTagMap.writeValue(i, tag, BPF_NOEXIST).ok());
+        if (tag.uid == FIRST_APP_UID && tag.tag == 1) deletedCookies.push_back(i);
+    }
+    std::vector<StatsKey> deletedKeys;
+    for (uint32_t i = 0; i < entries; i++) {
+        const StatsKey key = makeStatsKey(i);
+        if (key.uid == FIRST_APP_UID && key.tag == 1) deletedKeys.push_back(key);
+    }
+    const auto tc = TrafficControllerBenchmark::create(entries * 2);
+
+    const UidTagValue tag = {.uid = FIRST_APP_UID, .tag = 1};
+    const StatsValue value = {.rxPackets = 1, .rxBytes = 100, .txPackets = 1, .txBytes = 100};
+    for (auto _ : state) {
+        const int ret = tc->deleteTagData(1, FIRST_APP_UID, SYSTEM_UID);
+        if (ret) {
+            state.SkipWithError(StringPrintf("deleteTagData() failed: %s", strerror(-ret)).c_str());
+            break;
+        }
+        state.PauseTiming();
+        for (uint64_t cookie : deletedCookies) {
+            CHECK(maps.cookieTagMap.writeValue(cookie, tag, BPF_NOEXIST).ok());
+        }
+        for (const StatsKey& key : deletedKeys) {
+            CHECK(maps.statsMapA.writeValue(key, value, BPF_NOEXIST).ok());
+            CHECK(maps.statsMapB.writeValue(key, value, BPF_NOEXIST).ok());
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_deleteTagData)->RangeMultiplier(10)->Range(10000, 100000);
+
+// Alternates between two uid lists that overlap by half, so that every call removes and adds a
+// quarter of the entries in the uid owner map.
+void BM_replaceRulesInMap(benchmark::State& state) {
+    const uint32_t entries = state.range(0);
+    PinnedNetdMaps maps(entries * 2);
+    const auto tc = TrafficControllerBenchmark::create(entries * 2);
+
+    std::vector<int32_t> uids[2];
+    for (uint32_t i = 0; i < entries; i++) {
+        uids[0].push_back(FIRST_APP_UID + i);
+        uids[1].push_back(FIRST_APP_UID + entries / 2 + i);
+    }
+    CHECK(isOk(tc->replaceRulesInMap(DOZABLE_MATCH, uids[0])));
+
+    int next = 1;
+    for (auto _ : state) {
+        const netdutils::Status res = tc->replaceRulesInMap(DOZABLE_MATCH, uids[next]);
+        if (!isOk(res)) {
+            state.SkipWithError(("replaceRulesInMap() failed: " + res.msg()).c_str());
+            break;
+        }
+        next = 1 - next;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_replaceRulesInMap)->RangeMultiplier(10)->Range(10000, 100000);
+
+void BM_parseBpfNetworkStatsDetail(benchmark::State& state) {
+    const uint32_t entries = state.range(0);
+    InMemoryBpfMap<StatsKey, StatsValue> statsMap(entries);
+    InMemoryBpfMap<uint32_t, IfaceValue> ifaceMap(NUM_IFACES);
+    fillStatsMap(statsMap, entries);
+    fillIfaceNameMap(ifaceMap, NUM_IFACES);
+
+    std::vector<stats_line> lines;
+    for (auto _ : state) {
+        lines.clear();
+        const int ret = bpf::parseBpfNetworkStatsDetailImpl(&lines, {}, bpf::TAG_ALL, bpf::UID_ALL,
+                                                            statsMap, ifaceMap);
+        if (ret) {
+            state.SkipWithError(StringPrintf("parse failed: %s", strerror(-ret)).c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * entries);
+}
+BENCHMARK(BM_parseBpfNetworkStatsDetail)->RangeMultiplier(10)->Range(10000, 100000);
+
+void BM_parseBpfNetworkStatsDev(benchmark::State& state) {
+    const uint32_t entries = state.range(0);
+    InMemoryBpfMap<uint32_t, StatsValue> statsMap(entries);
+    InMemoryBpfMap<uint32_t, IfaceValue> ifaceMap(entries);
+    const StatsValue value = {.rxPackets = 1, .rxBytes = 100, .txPackets = 1, .txBytes = 100};
+    for (uint32_t i = 1; i <= entries; i++) {
+        CHECK(statsMap.writeValue(i, value, BPF_NOEXIST).ok());
+    }
+    fillIfaceNameMap(ifaceMap, entries);
+
+    std::vector<stats_line> lines;
+    for (auto _ : state) {
+        lines.clear();
+        const int ret = bpf::parseBpfNetworkStatsDevImpl(&lines, statsMap, ifaceMap);
+        if (ret) {
+            state.SkipWithError(StringPrintf("parse failed: %s", strerror(-ret)).c_str());
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * entries);
+}
+BENCHMARK(BM_parseBpfNetworkStatsDev)->RangeMultiplier(10)->Range(10000, 100000);
+
+}  // namespace net
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -99,8 +99,10 @@ using android::net::INetd;
 using android::net::InterfaceConfigurationParcel;
 using android::net::InterfaceController;
 using android::net::MarkMaskParcel;
+using android::net::NetworkProvisionParcel;
 using android::net::SockDiag;
 using android::net::TetherOffloadRuleParcel;
+using android::net::RouteInfoParcel;
 using android::net::TetherStatsParcel;
 using android::net::TunInterface;
 using android::net::UidRangeParcel;
@@ -702,6 +704,36 @@ TEST_F(NetdBinderTest, SocketDestroy) {
     checkSocketpairClosed(clientSocket, acceptedSocket);
 }
 
+TEST_F(NetdBinderTest, SocketDestroyForNetwork) {
+    unique_fd clientSocket, serverSocket, acceptedSocket;
+    ASSERT_NO_FATAL_FAILURE(fakeRemoteSocketPair(&clientSocket, &serverSocket, &acceptedSocket));
+
+    constexpr int baseUid = AID_APP - 2000;
+    int uid = baseUid + 500 + arc4random_uniform(1000);
+    EXPECT_EQ(0, fchown(clientSocket, uid, -1));
+
+    Fwmark fwmark;
+    fwmark.netId = TEST_NETID1;
+    fwmark.explicitlySelected = true;
+    ASSERT_EQ(0, setsockopt(clientSocket, SOL_SOCKET, SO_MARK, &fwmark.intValue,
+                            sizeof(fwmark.intValue)));
+
+    // Close sockets on another network. Our test socket should be intact.
+    std::vector<int32_t> skipUids;
+    EXPECT_TRUE(mNetd->socketDestroyForNetwork(TEST_NETID2, skipUids).isOk());
+    checkSocketpairOpen(clientSocket, acceptedSocket);
+
+    // Close sockets on the test network, but exempt our UID. Our test socket should be intact.
+    skipUids.push_back(uid);
+    EXPECT_TRUE(mNetd->socketDestroyForNetwork(TEST_NETID1, skipUids).isOk());
+    checkSocketpairOpen(clientSocket, acceptedSocket);
+
+    // Now remove uid from skipUids, and close sockets. Our test socket should have been closed.
+    skipUids.clear();
+    EXPECT_TRUE(mNetd->socketDestroyForNetwork(TEST_NETID1, skipUids).isOk());
+    checkSocketpairClosed(clientSocket, acceptedSocket);
+}
+
 namespace {
 
 int netmaskToPrefixLength(const uint8_t *buf, size_t buflen) {
@@ -1993,6 +2025,114 @@ TEST_F(NetdBinderTest, NetworkPermissionDefault) {
     EXPECT_TRUE(mNetd->networkDestroy(TEST_NETID1).isOk());
 }
 
+namespace {
+
+RouteInfoParcel makeRouteInfoParcel(const std::string& ifName, const std::string& destination,
+                                    const std::string& nextHop) {
+    RouteInfoParcel res;
+    res.ifName = ifName;
+    res.destination = destination;
+    res.nextHop = nextHop;
+    res.mtu = 0;
+
+    return res;
+}
+
+NetworkProvisionParcel makePhysicalNetworkProvisionParcel(int netId, int permission,
+                                                          const std::string& ifName) {
+    NetworkProvisionParcel res;
+    res.netId = netId;
+    res.vpn = false;
+    res.permission = permission;
+    res.secure = false;
+    res.interfaces = {ifName};
+    res.routes = {
+            makeRouteInfoParcel(ifName, "10.251.0.0/16", ""),
+            makeRouteInfoParcel(ifName, "0.0.0.0/0", "10.251.10.0"),
+            makeRouteInfoParcel(ifName, "2001:db8:cafe::/64", "2001:db8::"),
+            makeRouteInfoParcel(ifName, "::/0", ""),
+    };
+
+    return res;
+}
+
+}  // namespace
+
+TEST_F(NetdBinderTest, NetworkProvisionPhysical) {
+    const std::string ifName = sTun.name();
+    const NetworkProvisionParcel config =
+            makePhysicalNetworkProvisionParcel(TEST_NETID1, INetd::PERMISSION_SYSTEM, ifName);
+
+    binder::Status status = mNetd->networkProvision(config);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    expectNetworkRouteExists(IP_RULE_V4, ifName, "10.251.0.0/16", "", ifName.c_str());
+    expectNetworkRouteExists(IP_RULE_V4, ifName, "0.0.0.0/0", "10.251.10.0", ifName.c_str());
+    expectNetworkRouteExists(IP_RULE_V6, ifName, "2001:db8:cafe::/64", "2001:db8::",
+                             ifName.c_str());
+    expectNetworkRouteExists(IP_RULE_V6, ifName, "::/0", "", ifName.c_str());
+    expectNetworkPermissionIpRuleExists(ifName.c_str(), INetd::PERMISSION_SYSTEM);
+    expectNetworkPermissionIptablesRuleExists(ifName.c_str(), INetd::PERMISSION_SYSTEM);
+
+    // The network exists, so nothing is changed.
+    EXPECT_EQ(EEXIST, mNetd->networkProvision(config).serviceSpecificErrorCode());
+    NetworkProvisionParcel other = config;
+    other.netId = TEST_NETID2;
+    EXPECT_EQ(EBUSY, mNetd->networkProvision(other).serviceSpecificErrorCode());
+    EXPECT_EQ(ENONET, mNetd->networkDestroy(TEST_NETID2).serviceSpecificErrorCode());
+
+    EXPECT_TRUE(mNetd->networkDestroy(TEST_NETID1).isOk());
+    expectNetworkRouteDoesNotExist(IP_RULE_V4, ifName, "10.251.0.0/16", "", ifName.c_str());
+}
+
+TEST_F(NetdBinderTest, NetworkProvisionVpn) {
+    const uint32_t RULE_PRIORITY_SECURE_VPN = 12000;
+    const std::string ifName = sTun.name();
+    NetworkProvisionParcel config;
+    config.netId = TEST_NETID1;
+    config.vpn = true;
+    config.permission = INetd::PERMISSION_NONE;
+    config.secure = true;
+    config.interfaces = {ifName};
+    config.routes = {makeRouteInfoParcel(ifName, "2001:db8:cafe::/64", "")};
+    config.uidRanges = {makeUidRangeParcel(BASE_UID + 8005, BASE_UID + 8012)};
+    std::string suffix = StringPrintf("lookup %s ", ifName.c_str());
+
+    binder::Status status = mNetd->networkProvision(config);
+    ASSERT_TRUE(status.isOk()) << status.exceptionMessage();
+    EXPECT_TRUE(ipRuleExistsForRange(RULE_PRIORITY_SECURE_VPN, config.uidRanges[0], suffix));
+    expectNetworkRouteExists(IP_RULE_V6, ifName, "2001:db8:cafe::/64", "", ifName.c_str());
+
+    EXPECT_TRUE(mNetd->networkDestroy(TEST_NETID1).isOk());
+    EXPECT_FALSE(ipRuleExistsForRange(RULE_PRIORITY_SECURE_VPN, config.uidRanges[0], suffix));
+}
+
+TEST_F(NetdBinderTest, NetworkProvisionRollback) {
+    const std::string ifName = sTun.name();
+    NetworkProvisionParcel config =
+            makePhysicalNetworkProvisionParcel(TEST_NETID1, INetd::PERMISSION_NONE, ifName);
+
+    // Invalid configurations are rejected before anything is changed.
+    NetworkProvisionParcel invalid = config;
+    invalid.routes.push_back(makeRouteInfoParcel("netdtest_nonexistent", "10.252.0.0/16", ""));
+    EXPECT_EQ(ENODEV, mNetd->networkProvision(invalid).serviceSpecificErrorCode());
+    invalid = config;
+    invalid.uidRanges = {makeUidRangeParcel(BASE_UID + 8005, BASE_UID + 8012)};
+    EXPECT_EQ(EINVAL, mNetd->networkProvision(invalid).serviceSpecificErrorCode());
+    EXPECT_EQ(ENONET, mNetd->networkDestroy(TEST_NETID1).serviceSpecificErrorCode());
+
+    // A route that fails after the network and its interface were set up undoes everything.
+    config.routes.push_back(makeRouteInfoParcel(ifName, "10.251.0.0/16", "fe80::/64"));
+    EXPECT_EQ(EINVAL, mNetd->networkProvision(config).serviceSpecificErrorCode());
+    EXPECT_EQ(ENONET, mNetd->networkDestroy(TEST_NETID1).serviceSpecificErrorCode());
+    expectNetworkRouteDoesNotExist(IP_RULE_V4, ifName, "10.251.0.0/16", "", ifName.c_str());
+    EXPECT_FALSE(ipRuleExists(IP_RULE_V4, StringPrintf("lookup %s", ifName.c_str())));
+
+    // The interface is free again.
+    EXPECT_TRUE(mNetd->networkCreatePhysical(TEST_NETID2, INetd::PERMISSION_NONE).isOk());
+    EXPECT_TRUE(mNetd->networkAddInterface(TEST_NETID2, ifName).isOk());
+    EXPECT_TRUE(mNetd->networkDestroy(TEST_NETID2).isOk());
+}
+
 TEST_F(NetdBinderTest, NetworkSetProtectAllowDeny) {
     binder::Status status = mNetd->networkSetProtectAllow(TEST_UID1);
     EXPECT_TRUE(status.isOk()) << status.exceptionMessage();
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <string>
 
 #include <fcntl.h>
@@ -22,6 +23,10 @@
 #include <linux/inet_diag.h>
 #include <linux/sock_diag.h>
 #include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -31,14 +36,18 @@
 #include <cutils/qtaguid.h>
 #include <processgroup/processgroup.h>
 
+#include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
 #include "bpf/BpfMap.h"
 #include "bpf/BpfUtils.h"
 #include "netdbpf/bpf_shared.h"
 
+using android::base::make_scope_guard;
 using android::base::Result;
+using android::base::unique_fd;
 
 namespace android {
 namespace bpf {
@@ -49,6 +58,13 @@ constexpr uid_t TEST_UID = UID_MAX - 1;
 constexpr uint32_t TEST_TAG = 42;
 constexpr int TEST_COUNTERSET = 1;
 constexpr int DEFAULT_COUNTERSET = 0;
+// Far above the netIds assigned by NetworkController, so that the test does not collide with them.
+constexpr uint32_t TEST_NET_ID = 65000;
+
+static TcpHealthValue readTcpHealth(const BpfMap<uint32_t, TcpHealthValue>& map) {
+    Result<TcpHealthValue> value = map.readValue(TEST_NET_ID);
+    return value.ok() ? value.value() : TcpHealthValue{};
+}
 
 class BpfBasicTest : public testing::Test {
   protected:
@@ -189,5 +205,92 @@ TEST_F(BpfBasicTest, TestDeleteTagData) {
     ASSERT_EQ(ENOENT, statsResult.error().code());
 }
 
+TEST_F(BpfBasicTest, TestTcpHealthAggregates) {
+    SKIP_IF_EXTENDED_BPF_NOT_SUPPORTED;
+    if (access(TCP_HEALTH_SOCK_OPS_PROG_PATH, R_OK)) {
+        GTEST_SKIP() << "sock_ops TCP health program not loaded";
+    }
+
+    BpfMap<uint32_t, TcpHealthValue> tcpHealthMap(TCP_HEALTH_MAP_PATH);
+    ASSERT_LE(0, tcpHealthMap.getMap());
+
+    // Run in a private network namespace, so that the only sockets marked with TEST_NET_ID are the
+    // ones created below. The cgroup sock_ops program applies regardless of the namespace.
+    unique_fd origNetns(open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC));
+    ASSERT_LE(0, origNetns);
+    ASSERT_EQ(0, unshare(CLONE_NEWNET));
+    auto restoreNetns = make_scope_guard([&origNetns] { setns(origNetns, CLONE_NEWNET); });
+
+    unique_fd ctl(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, ctl);
+    struct ifreq ifr = {};
+    strlcpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name));
+    ASSERT_EQ(0, ioctl(ctl, SIOCGIFFLAGS, &ifr));
+    ifr.ifr_flags |= IFF_UP;
+    ASSERT_EQ(0, ioctl(ctl, SIOCSIFFLAGS, &ifr));
+
+    unique_fd listener(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, listener);
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    ASSERT_EQ(0, bind(listener, (struct sockaddr*)&addr, addrlen));
+    ASSERT_EQ(0, getsockname(listener, (struct sockaddr*)&addr, &addrlen));
+
+    const uint32_t mark = TEST_NET_ID;
+    const struct linger abortOnClose = {.l_onoff = 1, .l_linger = 0};
+
+    // A connection to a port nobody listens on is reset and counts as a failure.
+    const TcpHealthValue beforeFailure = readTcpHealth(tcpHealthMap);
+    {
+        unique_fd client(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        ASSERT_LE(0, client);
+        ASSERT_EQ(0, setsockopt(client, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)));
+        ASSERT_EQ(-1, connect(client, (struct sockaddr*)&addr, addrlen));
+        ASSERT_EQ(ECONNREFUSED, errno);
+    }
+    const TcpHealthValue afterFailure = readTcpHealth(tcpHealthMap);
+    EXPECT_EQ(1U, afterFailure.connectFailure - beforeFailure.connectFailure);
+    EXPECT_EQ(0U, afterFailure.connectSuccess - beforeFailure.connectSuccess);
+
+    ASSERT_EQ(0, listen(listener, 1));
+    unique_fd client(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ASSERT_LE(0, client);
+    ASSERT_EQ(0, setsockopt(client, SOL_SOCKET, SO_MARK, &mark, sizeof(mark)));
+    ASSERT_EQ(0, connect(client, (struct sockaddr*)&addr, addrlen));
+    unique_fd server(accept4(listener, nullptr, nullptr, SOCK_CLOEXEC));
+    ASSERT_LE(0, server);
+
+    char buf[1000] = {};
+    for (int i = 0; i < 20; i++) {
+        ASSERT_EQ((ssize_t)sizeof(buf), send(client, buf, sizeof(buf), 0));
+        ASSERT_EQ((ssize_t)sizeof(buf), recv(server, buf, sizeof(buf), MSG_WAITALL));
+    }
+
+    // Same struct tcp_info as returned by sock_diag in INET_DIAG_INFO.
+    struct tcp_info snapshot = {};
+    socklen_t snapshotLen = sizeof(snapshot);
+    ASSERT_EQ(0, getsockopt(client, IPPROTO_TCP, TCP_INFO, &snapshot, &snapshotLen));
+
+    // Abort the connection so that it reaches TCP_CLOSE immediately instead of TIME_WAIT.
+    ASSERT_EQ(0, setsockopt(client, SOL_SOCKET, SO_LINGER, &abortOnClose, sizeof(abortOnClose)));
+    client.reset();
+
+    const TcpHealthValue after = readTcpHealth(tcpHealthMap);
+    EXPECT_EQ(1U, after.connectSuccess - afterFailure.connectSuccess);
+    EXPECT_EQ(0U, after.connectFailure - afterFailure.connectFailure);
+    EXPECT_EQ(snapshot.tcpi_data_segs_out,
+              after.closedDataSegsOut - afterFailure.closedDataSegsOut);
+    EXPECT_EQ(snapshot.tcpi_total_retrans, after.retransSegs - afterFailure.retransSegs);
+    // The accepted socket is not marked, so only the client is counted, and it is closed.
+    EXPECT_EQ(1U, after.established - afterFailure.established);
+    EXPECT_EQ(1U, after.closedEstablished - afterFailure.closedEstablished);
+    const uint64_t rttSamples = after.rttSamples - afterFailure.rttSamples;
+    ASSERT_LT(0U, rttSamples);
+    // Loopback RTTs are tiny; the average must be of the same order as the smoothed RTT.
+    const uint64_t avgRttUs = (after.rttUsSum - afterFailure.rttUsSum) / rttSamples;
+    EXPECT_LE(avgRttUs, std::max(10U * snapshot.tcpi_rtt, 10000U));
+}
+
 }
 }
@@ -28,6 +28,8 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include <atomic>
+
 #include <gtest/gtest.h>
 
 #include <cutils/qtaguid.h>
@@ -51,16 +53,18 @@ constexpr uint32_t ENOBUFS_POLL_WAIT_US = 10 * 1000;
 using android::base::Result;
 using android::base::ResultError;
 
+// Deadline for the production SkDestroyListener to resync the cookie tag map after an overflow,
+// which waits TrafficController::kCookieTagMapResyncGracePeriod between its two socket dumps.
+constexpr uint32_t RESYNC_WAIT_US = 2 * 1000 * 1000;
+constexpr uint32_t RESYNC_POLL_US = 50 * 1000;
+
 // This test set up a SkDestroyListener that is runing parallel with the production
 // SkDestroyListener. The test will create thousands of sockets and tag them on the
 // production cookieUidTagMap and close them in a short time. When the number of
 // sockets get closed exceeds the buffer size, it will start to return ENOBUFF
-// error. The error will be ignored by the production SkDestroyListener and the
-// test will clean up the tags in tearDown if there is any remains.
-
-// TODO: Instead of test the ENOBUFF error, we can test the production
-// SkDestroyListener to see if it failed to delete a tagged socket when ENOBUFF
-// triggerred.
+// error. The production SkDestroyListener then deletes the tags of the closed sockets
+// it missed by resyncing against the sockets that still exist, and the test checks
+// that no tags remain.
 class NetlinkListenerTest : public testing::Test {
   protected:
     NetlinkListenerTest() {}
@@ -103,9 +107,10 @@ class NetlinkListenerTest : public testing::Test {
         return mCookieTagMap.iterateWithValue(checkGarbageTags);
     }
 
-    void checkMassiveSocketDestroy(int totalNumber, bool expectError) {
+    void checkMassiveSocketDestroy(int totalNumber, bool expectError,
+                                   android::netdutils::EventLoop* eventLoop = nullptr) {
         std::unique_ptr<android::net::NetlinkListenerInterface> skDestroyListener;
-        auto result = android::net::TrafficController::makeSkDestroyListener();
+        auto result = android::net::TrafficController::makeSkDestroyListener(eventLoop);
         if (!isOk(result)) {
             ALOGE("Unable to create SkDestroyListener: %s", toString(result).c_str());
         } else {
@@ -115,6 +120,8 @@ class NetlinkListenerTest : public testing::Test {
         // Rx handler extracts nfgenmsg looks up and invokes registered dispatch function.
         const auto rxErrorHandler = [&rxErrorCount](const int, const int) { rxErrorCount++; };
         skDestroyListener->registerSkErrorHandler(rxErrorHandler);
+        std::atomic<int> overflowCount = 0;
+        skDestroyListener->registerOverflowHandler([&overflowCount] { overflowCount++; });
         int fds[totalNumber];
         for (int i = 0; i < totalNumber; i++) {
             fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -142,12 +149,25 @@ class NetlinkListenerTest : public testing::Test {
             // that the netlink handler is not spinning.
             int currentErrorCount = rxErrorCount;
             EXPECT_LT(0, rxErrorCount);
+            EXPECT_LT(0, overflowCount);
             usleep(ENOBUFS_POLL_WAIT_US);
             EXPECT_EQ(currentErrorCount, rxErrorCount);
+            EXPECT_RESULT_OK(waitForNoGarbageTags());
         } else {
             EXPECT_RESULT_OK(checkNoGarbageTagsExist());
             EXPECT_EQ(0, rxErrorCount);
+            EXPECT_EQ(0, overflowCount);
+        }
+    }
+
+    Result<void> waitForNoGarbageTags() {
+        Result<void> result = checkNoGarbageTagsExist();
+        for (uint32_t waited = 0; !result.ok() && waited < RESYNC_WAIT_US;
+             waited += RESYNC_POLL_US) {
+            usleep(RESYNC_POLL_US);
+            result = checkNoGarbageTagsExist();
         }
+        return result;
     }
 };
 
@@ -158,6 +178,14 @@ TEST_F(NetlinkListenerTest, TestAllSocketUntagged) {
     checkMassiveSocketDestroy(100, false);
 }
 
+TEST_F(NetlinkListenerTest, TestAllSocketUntaggedOnEventLoop) {
+    SKIP_IF_BPF_NOT_SUPPORTED;
+
+    android::netdutils::EventLoop loop({.name = "test-listen"});
+    checkMassiveSocketDestroy(10, false, &loop);
+    checkMassiveSocketDestroy(100, false, &loop);
+}
+
 TEST_F(NetlinkListenerTest, TestSkDestroyError) {
     SKIP_IF_BPF_NOT_SUPPORTED;
 
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NetdReplayer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <android-base/strings.h>
+#include <json/reader.h>
+
+namespace android {
+namespace net {
+
+using base::Errorf;
+using base::Result;
+using base::StartsWith;
+using base::Trim;
+
+namespace {
+
+// Decoding of input arguments from the JSON values logged by the AIDL backend. Each returns false
+// if the value does not have the expected type.
+
+bool decode(const Json::Value& json, bool* out) {
+    if (!json.isBool()) return false;
+    *out = json.asBool();
+    return true;
+}
+
+bool decode(const Json::Value& json, int32_t* out) {
+    if (!json.isInt()) return false;
+    *out = json.asInt();
+    return true;
+}
+
+bool decode(const Json::Value& json, int64_t* out) {
+    if (!json.isInt64()) return false;
+    *out = json.asInt64();
+    return true;
+}
+
+bool decode(const Json::Value& json, std::string* out) {
+    if (!json.isString()) return false;
+    *out = json.asString();
+    return true;
+}
+
+bool decode(const Json::Value& json, UidRangeParcel* out) {
+    return json.isObject() && decode(json["start"], &out->start) &&
+           decode(json["stop"], &out->stop);
+}
+
+bool decode(const Json::Value& json, RouteInfoParcel* out) {
+    return json.isObject() && decode(json["destination"], &out->destination) &&
+           decode(json["ifName"], &out->ifName) && decode(json["nextHop"], &out->nextHop) &&
+           decode(json["mtu"], &out->mtu);
+}
+
+template <class T>
+bool decode(const Json::Value& json, std::vector<T>* out);
+
+bool decode(const Json::Value& json, TetherConfigParcel* out) {
+    return json.isObject() && decode(json["usingLegacyDnsProxy"], &out->usingLegacyDnsProxy) &&
+           decode(json["dhcpRanges"], &out->dhcpRanges);
+}
+
+bool decode(const Json::Value& json, InterfaceConfigurationParcel* out) {
+    return json.isObject() && decode(json["ifName"], &out->ifName) &&
+           decode(json["hwAddr"], &out->hwAddr) && decode(json["ipv4Addr"], &out->ipv4Addr) &&
+           decode(json["prefixLength"], &out->prefixLength) && decode(json["flags"], &out->flags);
+}
+
+bool decode(const Json::Value& json, NetworkProvisionParcel* out) {
+    return json.isObject() && decode(json["netId"], &out->netId) &&
+           decode(json["vpn"], &out->vpn) && decode(json["permission"], &out->permission) &&
+           decode(json["secure"], &out->secure) && decode(json["interfaces"], &out->interfaces) &&
+           decode(json["routes"], &out->routes) && decode(json["uidRanges"], &out->uidRanges);
+}
+
+template <class T>
+bool decode(const Json::Value& json, std::vector<T>* out) {
+    if (!json.isArray()) return false;
+    out->resize(json.size());
+    for (Json::ArrayIndex i = 0; i < json.size(); i++) {
+        if (!decode(json[i], &(*out)[i])) return false;
+    }
+    return true;
+}
+
+// How a parameter of an INetd method is passed. AIDL puts the return value, if any, last, as a
+// pointer; everything before it is an input argument.
+template <class T>
+struct Param {
+    using Stored = std::decay_t<T>;
+    static constexpr bool kIsInput = true;
+    static bool decode(const Json::Value& args, Json::ArrayIndex i, Stored* out) {
+        return ::android::net::decode(args[i], out);
+    }
+    static T pass(Stored& stored) { return stored; }
+};
+
+template <class T>
+struct Param<T*> {
+    using Stored = T;
+    static constexpr bool kIsInput = false;
+    static bool decode(const Json::Value&, Json::ArrayIndex, Stored*) { return true; }
+    static T* pass(Stored& stored) { return &stored; }
+};
+
+// Decodes the arguments of a call and makes it. Returns false without calling if the arguments
+// do not match the method.
+using Invoker =
+        std::function<bool(INetd& netd, const Json::Value& args, binder::Status* status)>;
+
+template <class... Params, size_t... I>
+bool invoke(INetd& netd, binder::Status (INetd::*method)(Params...), const Json::Value& args,
+            binder::Status* status, std::index_sequence<I...>) {
+    constexpr Json::ArrayIndex kInputs = (0 + ... + (Param<Params>::kIsInput ? 1 : 0));
+    if (!args.isArray() || args.size() != kInputs) return false;
+    std::tuple<typename Param<Params>::Stored...> stored;
+    if (!(Param<Params>::decode(args, I, &std::get<I>(stored)) && ...)) return false;
+    *status = (netd.*method)(Param<Params>::pass(std::get<I>(stored))...);
+    return true;
+}
+
+template <class... Params>
+Invoker makeInvoker(binder::Status (INetd::*method)(Params...)) {
+    return [method](INetd& netd, const Json::Value& args, binder::Status* status) {
+        return invoke(netd, method, args, status, std::index_sequence_for<Params...>());
+    };
+}
+
+#define REPLAYABLE(method) {#method, makeInvoker(&INetd::method)}
+
+// Every method that can be replayed. Not replayed: the ipSec* methods, which use kernel-allocated
+// SPIs, key material and socket file descriptors; registerUnsolicitedEventListener and getOemNetd,
+// which pass binder objects; and tetherOffloadRuleAdd/Remove, which use interface indexes.
+const std::map<std::string, Invoker>& invokers() {
+    static const auto* table = new std::map<std::string, Invoker>({
+            REPLAYABLE(bandwidthAddNaughtyApp),
+            REPLAYABLE(bandwidthAddNiceApp),
+            REPLAYABLE(bandwidthAddRestrictAppOnInterface),
+            REPLAYABLE(bandwidthEnableDataSaver),
+            REPLAYABLE(bandwidthRemoveInterfaceAlert),
+            REPLAYABLE(bandwidthRemoveInterfaceQuota),
+            REPLAYABLE(bandwidthRemoveNaughtyApp),
+            REPLAYABLE(bandwidthRemoveNiceApp),
+            REPLAYABLE(bandwidthRemoveRestrictAppOnInterface),
+            REPLAYABLE(bandwidthSetGlobalAlert),
+            REPLAYABLE(bandwidthSetInterfaceAlert),
+            REPLAYABLE(bandwidthSetInterfaceQuota),
+            REPLAYABLE(clatdStart),
+            REPLAYABLE(clatdStop),
+            REPLAYABLE(firewallAddUidInterfaceRules),
+            REPLAYABLE(firewallEnableChildChain),
+            REPLAYABLE(firewallRemoveUidInterfaceRules),
+            REPLAYABLE(firewallReplaceUidChain),
+            REPLAYABLE(firewallSetFirewallType),
+            REPLAYABLE(firewallSetInterfaceRule),
+            REPLAYABLE(firewallSetUidRule),
+            REPLAYABLE(getFwmarkForNetwork),
+            REPLAYABLE(getProcSysNet),
+            REPLAYABLE(idletimerAddInterface),
+            REPLAYABLE(idletimerRemoveInterface),
+            REPLAYABLE(interfaceAddAddress),
+            REPLAYABLE(interfaceClearAddrs),
+            REPLAYABLE(interfaceDelAddress),
+            REPLAYABLE(interfaceGetCfg),
+            REPLAYABLE(interfaceGetList),
+            REPLAYABLE(interfaceSetCfg),
+            REPLAYABLE(interfaceSetEnableIPv6),
+            REPLAYABLE(interfaceSetIPv6PrivacyExtensions),
+            REPLAYABLE(interfaceSetMtu),
+            REPLAYABLE(ipfwdAddInterfaceForward),
+            REPLAYABLE(ipfwdDisableForwarding),
+            REPLAYABLE(ipfwdEnableForwarding),
+            REPLAYABLE(ipfwdEnabled),
+            REPLAYABLE(ipfwdGetRequesterList),
+            REPLAYABLE(ipfwdRemoveInterfaceForward),
+            REPLAYABLE(isAlive),
+            REPLAYABLE(networkAddInterface),
+            REPLAYABLE(networkAddLegacyRoute),
+            REPLAYABLE(networkAddRoute),
+            REPLAYABLE(networkAddRouteParcel),
+            REPLAYABLE(networkAddUidRanges),
+            REPLAYABLE(networkCanProtect),
+            REPLAYABLE(networkClearDefault),
+            REPLAYABLE(networkClearPermissionForUser),
+            REPLAYABLE(networkCreatePhysical),
+            REPLAYABLE(networkCreateVpn),
+            REPLAYABLE(networkDestroy),
+            REPLAYABLE(networkGetDefault),
+            REPLAYABLE(networkProvision),
+            REPLAYABLE(networkRejectNonSecureVpn),
+            REPLAYABLE(networkRemoveInterface),
+            REPLAYABLE(networkRemoveLegacyRoute),
+            REPLAYABLE(networkRemoveRoute),
+            REPLAYABLE(networkRemoveRouteParcel),
+            REPLAYABLE(networkRemoveUidRanges),
+            REPLAYABLE(networkSetDefault),
+            REPLAYABLE(networkSetPermissionForNetwork),
+            REPLAYABLE(networkSetPermissionForUser),
+            REPLAYABLE(networkSetProtectAllow),
+            REPLAYABLE(networkSetProtectDeny),
+            REPLAYABLE(networkUpdateRouteParcel),
+            REPLAYABLE(setIPv6AddrGenMode),
+            REPLAYABLE(setProcSysNet),
+            REPLAYABLE(setTcpRWmemorySize),
+            REPLAYABLE(socketDestroy),
+            REPLAYABLE(socketDestroyForNetwork),
+            REPLAYABLE(strictUidCleartextPenalty),
+            REPLAYABLE(tetherAddForward),
+            REPLAYABLE(tetherApplyDnsInterfaces),
+            REPLAYABLE(tetherDnsList),
+            REPLAYABLE(tetherDnsSet),
+            REPLAYABLE(tetherGetStats),
+            REPLAYABLE(tetherInterfaceAdd),
+            REPLAYABLE(tetherInterfaceList),
+            REPLAYABLE(tetherInterfaceRemove),
+            REPLAYABLE(tetherIsEnabled),
+            REPLAYABLE(tetherOffloadGetAndClearStats),
+            REPLAYABLE(tetherOffloadGetStats),
+            REPLAYABLE(tetherOffloadSetInterfaceQuota),
+            REPLAYABLE(tetherRemoveForward),
+            REPLAYABLE(tetherStart),
+            REPLAYABLE(tetherStartWithConfiguration),
+            REPLAYABLE(tetherStop),
+            REPLAYABLE(trafficSetNetPermForUids),
+            REPLAYABLE(trafficSwapActiveStatsMap),
+            REPLAYABLE(wakeupAddInterface),
+            REPLAYABLE(wakeupDelInterface),
+    });
+    return *table;
+}
+
+#undef REPLAYABLE
+
+// Nearest-rank percentile of a sorted, non-empty vector.
+double percentile(const std::vector<double>& sorted, int p) {
+    const size_t rank = (sorted.size() * p + 99) / 100;
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+}  // namespace
+
+Result<std::vector<TraceCall>> parseTrace(std::istream& in) {
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    std::vector<TraceCall> calls;
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+        line = Trim(line);
+        if (line.empty() || StartsWith(line, "#")) continue;
+
+        Json::Value json;
+        std::string errors;
+        if (!reader->parse(line.data(), line.data() + line.size(), &json, &errors) ||
+            !json.isObject()) {
+            return Errorf("line {}: not a JSON object: {}", lineNumber, errors);
+        }
+        TraceCall call;
+        if (!decode(json["method"], &call.method) || !decode(json["start_us"], &call.startUs) ||
+            !json["args"].isArray()) {
+            return Errorf("line {}: missing method, start_us or args", lineNumber);
+        }
+        call.args = json["args"];
+        decode(json["exception_code"], &call.exceptionCode);
+        decode(json["service_specific_error"], &call.serviceSpecificError);
+        calls.push_back(std::move(call));
+    }
+    return calls;
+}
+
+ReplayReport NetdReplayer::replay(const std::vector<TraceCall>& calls, ReplaySpeed speed) {
+    using Clock = std::chrono::steady_clock;
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    ReplayReport report;
+    const Clock::time_point replayStart = Clock::now();
+    for (const TraceCall& call : calls) {
+        const auto it = invokers().find(call.method);
+        if (it == invokers().end()) {
+            report.skipped["not replayable: " + call.method]++;
+            continue;
+        }
+        if (speed == ReplaySpeed::ORIGINAL) {
+            std::this_thread::sleep_until(
+                    replayStart + std::chrono::microseconds(call.startUs - calls[0].startUs));
+        }
+
+        binder::Status status;
+        const Clock::time_point start = Clock::now();
+        if (!it->second(*mNetd, call.args, &status)) {
+            report.skipped["bad arguments: " + call.method]++;
+            continue;
+        }
+        const Ms latency = Clock::now() - start;
+
+        MethodStats& stats = report.methods[call.method];
+        stats.latenciesMs.push_back(latency.count());
+        if (!status.isOk()) stats.failures++;
+        if (status.exceptionCode() != call.exceptionCode ||
+            status.serviceSpecificErrorCode() != call.serviceSpecificError) {
+            stats.mismatches++;
+        }
+    }
+    report.wallTimeMs = Ms(Clock::now() - replayStart).count();
+    return report;
+}
+
+void ReplayReport::print(FILE* out) const {
+    fprintf(out, "%-40s %6s %5s %5s %8s %8s %8s %8s %8s\n", "method", "calls", "fail", "diff",
+            "min_ms", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+    for (const auto& [method, stats] : methods) {
+        std::vector<double> sorted = stats.latenciesMs;
+        std::sort(sorted.begin(), sorted.end());
+        fprintf(out, "%-40s %6zu %5d %5d %8.3f %8.3f %8.3f %8.3f %8.3f\n", method.c_str(),
+                sorted.size(), stats.failures, stats.mismatches, sorted.front(),
+                percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+                sorted.back());
+    }
+    for (const auto& [reason, count] : skipped) {
+        fprintf(out, "skipped %d calls: %s\n", count, reason.c_str());
+    }
+    fprintf(out, "wall time: %.3f ms\n", wallTimeMs);
+}
+
+}  // namespace net
+}  // namespace android
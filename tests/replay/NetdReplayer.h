@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETD_TESTS_REPLAY_NETD_REPLAYER_H
+#define NETD_TESTS_REPLAY_NETD_REPLAYER_H
+
+#include <stdio.h>
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <android-base/result.h>
+#include <json/value.h>
+#include <utils/StrongPointer.h>
+
+#include "android/net/INetd.h"
+
+namespace android {
+namespace net {
+
+// One call from a trace written by "dumpsys netd binder_trace". See server/BinderCallRecorder.h.
+struct TraceCall {
+    int64_t startUs = 0;
+    std::string method;
+    Json::Value args;
+    int32_t exceptionCode = 0;
+    int32_t serviceSpecificError = 0;
+};
+
+// Parses a trace, skipping comments and blank lines. Fails on the first malformed line.
+base::Result<std::vector<TraceCall>> parseTrace(std::istream& in);
+
+enum class ReplaySpeed {
+    // Issues each call at the same offset from the first call as in the trace, or as soon as the
+    // previous call returns if the replay is running behind.
+    ORIGINAL,
+    // Issues each call as soon as the previous call returns.
+    MAX,
+};
+
+struct MethodStats {
+    // Client-side latency of each call, in the order they were made.
+    std::vector<double> latenciesMs;
+    // Calls that returned an error.
+    int failures = 0;
+    // Calls whose status differs from the recorded one. These usually mean that the replay did not
+    // start from the same state as the recording.
+    int mismatches = 0;
+};
+
+struct ReplayReport {
+    std::map<std::string, MethodStats> methods;
+    // Number of calls that were not made, by reason.
+    std::map<std::string, int> skipped;
+    double wallTimeMs = 0;
+
+    // Prints the latency distribution of each method, then the skipped calls.
+    void print(FILE* out) const;
+};
+
+// Replays traces against an INetd, one call at a time, in the order they were recorded.
+//
+// Calls that pass file descriptors, binder objects or key material cannot be reproduced from a
+// trace, and neither can calls that refer to kernel objects by number, such as IPsec SPIs or
+// interface indexes. These are skipped, as are methods unknown to this build. Parcelable arguments
+// are read from JSON objects keyed by field name.
+class NetdReplayer {
+  public:
+    explicit NetdReplayer(sp<INetd> netd) : mNetd(std::move(netd)) {}
+
+    ReplayReport replay(const std::vector<TraceCall>& calls, ReplaySpeed speed);
+
+  private:
+    const sp<INetd> mNetd;
+};
+
+}  // namespace net
+}  // namespace android
+
+#endif  // NETD_TESTS_REPLAY_NETD_REPLAYER_H
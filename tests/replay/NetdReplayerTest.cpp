@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "NetdReplayer.h"
+
+namespace android {
+namespace net {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Keeps just enough state to fail the way netd does when a trace is replayed out of order.
+class FakeNetd : public INetdDefault {
+  public:
+    binder::Status networkCreatePhysical(int32_t netId, int32_t) override {
+        record("networkCreatePhysical " + std::to_string(netId));
+        if (!mNetworks.insert(netId).second) {
+            return binder::Status::fromServiceSpecificError(EEXIST);
+        }
+        return binder::Status::ok();
+    }
+
+    binder::Status networkDestroy(int32_t netId) override {
+        record("networkDestroy " + std::to_string(netId));
+        if (!mNetworks.erase(netId)) return binder::Status::fromServiceSpecificError(ENONET);
+        return binder::Status::ok();
+    }
+
+    binder::Status networkAddInterface(int32_t netId, const std::string& iface) override {
+        record("networkAddInterface " + std::to_string(netId) + " " + iface);
+        return binder::Status::ok();
+    }
+
+    binder::Status networkAddUidRanges(int32_t netId,
+                                       const std::vector<UidRangeParcel>& ranges) override {
+        std::string call = "networkAddUidRanges " + std::to_string(netId);
+        for (const auto& range : ranges) {
+            call += " " + std::to_string(range.start) + "-" + std::to_string(range.stop);
+        }
+        record(call);
+        return binder::Status::ok();
+    }
+
+    binder::Status firewallReplaceUidChain(const std::string& chainName, bool isWhitelist,
+                                           const std::vector<int32_t>& uids, bool* ret) override {
+        record("firewallReplaceUidChain " + chainName + " " + std::to_string(isWhitelist) + " " +
+               std::to_string(uids.size()));
+        *ret = true;
+        return binder::Status::ok();
+    }
+
+    binder::Status bandwidthSetGlobalAlert(int64_t bytes) override {
+        record("bandwidthSetGlobalAlert " + std::to_string(bytes));
+        return binder::Status::ok();
+    }
+
+    std::vector<std::string> calls;
+    std::vector<Clock::time_point> callTimes;
+
+  private:
+    void record(const std::string& call) {
+        calls.push_back(call);
+        callTimes.push_back(Clock::now());
+    }
+
+    std::set<int32_t> mNetworks;
+};
+
+class NetdReplayerTest : public ::testing::Test {
+  protected:
+    std::vector<TraceCall> parse(const std::string& trace) {
+        std::istringstream in(trace);
+        auto calls = parseTrace(in);
+        EXPECT_TRUE(calls.ok()) << calls.error().message();
+        return calls.ok() ? calls.value() : std::vector<TraceCall>();
+    }
+
+    sp<FakeNetd> mFakeNetd = new FakeNetd();
+    NetdReplayer mReplayer{mFakeNetd};
+};
+
+TEST_F(NetdReplayerTest, ParseTrace) {
+    const auto calls = parse(
+            "# stopped, 2 calls, 0 dropped\n"
+            "\n"
+            R"({"args":[100,0],"duration_ms":1.5,"exception_code":0,)"
+            R"("method":"networkCreatePhysical","service_specific_error":0,"start_us":10})"
+            "\n"
+            R"({"args":[100],"duration_ms":0.5,"exception_code":-8,)"
+            R"("method":"networkDestroy","service_specific_error":64,"start_us":2000})"
+            "\n");
+    ASSERT_EQ(2U, calls.size());
+    EXPECT_EQ("networkCreatePhysical", calls[0].method);
+    EXPECT_EQ(10, calls[0].startUs);
+    EXPECT_EQ(2U, calls[0].args.size());
+    EXPECT_EQ(0, calls[0].exceptionCode);
+    EXPECT_EQ("networkDestroy", calls[1].method);
+    EXPECT_EQ(2000, calls[1].startUs);
+    EXPECT_EQ(-8, calls[1].exceptionCode);
+    EXPECT_EQ(64, calls[1].serviceSpecificError);
+
+    for (const char* bad : {"{\"method\":\"networkDestroy\"", "[1, 2]",
+                            R"({"method":"networkDestroy","start_us":1})"}) {
+        std::istringstream in(std::string("# comment\n") + bad + "\n");
+        const auto result = parseTrace(in);
+        ASSERT_FALSE(result.ok()) << bad;
+        EXPECT_EQ(0U, result.error().message().find("line 2: ")) << result.error().message();
+    }
+}
+
+TEST_F(NetdReplayerTest, ReplaysCallsInOrder) {
+    const auto calls = parse(
+            R"({"args":[100,0],"method":"networkCreatePhysical","start_us":0})"
+            "\n"
+            R"({"args":[100,"wlan0"],"method":"networkAddInterface","start_us":10})"
+            "\n"
+            R"({"args":[100,[{"start":10000,"stop":10099},{"start":20000,"stop":20000}]],)"
+            R"("method":"networkAddUidRanges","start_us":20})"
+            "\n"
+            R"({"args":["fw_dozable",true,[10001,10002]],"method":"firewallReplaceUidChain",)"
+            R"("start_us":30})"
+            "\n"
+            R"({"args":[5000000000],"method":"bandwidthSetGlobalAlert","start_us":40})"
+            "\n"
+            R"({"args":[100],"method":"networkDestroy","start_us":50})"
+            "\n");
+
+    const ReplayReport report = mReplayer.replay(calls, ReplaySpeed::MAX);
+    EXPECT_EQ(std::vector<std::string>({
+                      "networkCreatePhysical 100",
+                      "networkAddInterface 100 wlan0",
+                      "networkAddUidRanges 100 10000-10099 20000-20000",
+                      "firewallReplaceUidChain fw_dozable 1 2",
+                      "bandwidthSetGlobalAlert 5000000000",
+                      "networkDestroy 100",
+              }),
+              mFakeNetd->calls);
+    EXPECT_EQ(6U, report.methods.size());
+    for (const auto& [method, stats] : report.methods) {
+        EXPECT_EQ(1U, stats.latenciesMs.size()) << method;
+        EXPECT_EQ(0, stats.failures) << method;
+        EXPECT_EQ(0, stats.mismatches) << method;
+    }
+    EXPECT_TRUE(report.skipped.empty());
+}
+
+TEST_F(NetdReplayerTest, CountsFailuresAndMismatches) {
+    // The second create failed when recorded and fails again. The destroy succeeded when
+    // recorded, but fails on replay because the network was never created.
+    const auto calls = parse(
+            R"({"args":[100,0],"method":"networkCreatePhysical","start_us":0})"
+            "\n"
+            R"({"args":[100,0],"exception_code":-8,"method":"networkCreatePhysical",)"
+            R"("service_specific_error":17,"start_us":1})"
+            "\n"
+            R"({"args":[101],"method":"networkDestroy","start_us":2})"
+            "\n");
+
+    const ReplayReport report = mReplayer.replay(calls, ReplaySpeed::MAX);
+    const MethodStats& create = report.methods.at("networkCreatePhysical");
+    EXPECT_EQ(2U, create.latenciesMs.size());
+    EXPECT_EQ(1, create.failures);
+    EXPECT_EQ(0, create.mismatches);
+    const MethodStats& destroy = report.methods.at("networkDestroy");
+    EXPECT_EQ(1, destroy.failures);
+    EXPECT_EQ(1, destroy.mismatches);
+}
+
+TEST_F(NetdReplayerTest, SkipsCallsThatCannotBeReplayed) {
+    const auto calls = parse(
+            R"({"args":[1,"192.0.2.1","192.0.2.2",0],"method":"ipSecAllocateSpi","start_us":0})"
+            "\n"
+            R"({"args":[],"method":"noSuchMethod","start_us":1})"
+            "\n"
+            R"({"args":["100",0],"method":"networkCreatePhysical","start_us":2})"
+            "\n"
+            R"({"args":[100],"method":"networkCreatePhysical","start_us":3})"
+            "\n"
+            R"({"args":[100,[{"start":10000}]],"method":"networkAddUidRanges","start_us":4})"
+            "\n");
+
+    const ReplayReport report = mReplayer.replay(calls, ReplaySpeed::MAX);
+    EXPECT_TRUE(mFakeNetd->calls.empty());
+    EXPECT_TRUE(report.methods.empty());
+    EXPECT_EQ((std::map<std::string, int>{
+                      {"bad arguments: networkAddUidRanges", 1},
+                      {"bad arguments: networkCreatePhysical", 2},
+                      {"not replayable: ipSecAllocateSpi", 1},
+                      {"not replayable: noSuchMethod", 1},
+              }),
+              report.skipped);
+}
+
+TEST_F(NetdReplayerTest, ReplaySpeed) {
+    const auto calls = parse(
+            R"({"args":[100,0],"method":"networkCreatePhysical","start_us":1000000})"
+            "\n"
+            R"({"args":[100],"method":"networkDestroy","start_us":1100000})"
+            "\n");
+
+    mReplayer.replay(calls, ReplaySpeed::ORIGINAL);
+    ASSERT_EQ(2U, mFakeNetd->callTimes.size());
+    EXPECT_GE(mFakeNetd->callTimes[1] - mFakeNetd->callTimes[0], 100ms);
+
+    mFakeNetd->callTimes.clear();
+    mReplayer.replay(calls, ReplaySpeed::MAX);
+    ASSERT_EQ(2U, mFakeNetd->callTimes.size());
+    EXPECT_LT(mFakeNetd->callTimes[1] - mFakeNetd->callTimes[0], 100ms);
+}
+
+TEST_F(NetdReplayerTest, PrintReport) {
+    ReplayReport report;
+    report.methods["networkDestroy"].latenciesMs = {4, 1, 3, 2};
+    report.methods["networkDestroy"].failures = 1;
+    report.skipped["not replayable: ipSecAllocateSpi"] = 2;
+
+    char* buf = nullptr;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    ASSERT_NE(nullptr, out);
+    report.print(out);
+    fclose(out);
+    const std::string printed(buf, size);
+    free(buf);
+
+    EXPECT_NE(std::string::npos,
+              printed.find("networkDestroy                                "
+                           "4     1     0    1.000    2.000    4.000    4.000    4.000\n"))
+            << printed;
+    EXPECT_NE(std::string::npos, printed.find("skipped 2 calls: not replayable: ipSecAllocateSpi"))
+            << printed;
+}
+
+}  // namespace net
+}  // namespace android
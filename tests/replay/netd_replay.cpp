@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays INetd calls recorded by netd against the running netd, and prints the latency
+// distribution of each method:
+//     adb shell dumpsys netd binder_trace start
+//     <run the workload, e.g. connect a VPN>
+//     adb shell dumpsys netd binder_trace stop
+//     adb shell dumpsys netd binder_trace > trace.txt
+//     adb push trace.txt /data/local/tmp/
+//     adb shell stop
+//     adb shell /data/nativetest64/netd_replay/netd_replay [--max-speed] /data/local/tmp/trace.txt
+//
+// To record from boot, set persist.netd.record_binder_calls to true and reboot.
+//
+// The replayed calls change the device's network configuration just as the recorded ones did.
+// Stopping the framework first keeps it from making calls of its own; netd keeps running. Calls
+// that fail differently than when recorded are counted in the "diff" column, and usually mean that
+// netd did not start from the same state as when the trace was recorded.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+
+#include <binder/IServiceManager.h>
+
+#include "NetdReplayer.h"
+
+using android::defaultServiceManager;
+using android::IBinder;
+using android::interface_cast;
+using android::sp;
+using android::String16;
+using android::net::INetd;
+using android::net::NetdReplayer;
+using android::net::parseTrace;
+using android::net::ReplaySpeed;
+
+int main(int argc, char** argv) {
+    ReplaySpeed speed = ReplaySpeed::ORIGINAL;
+    if (argc == 3 && strcmp(argv[1], "--max-speed") == 0) {
+        speed = ReplaySpeed::MAX;
+    } else if (argc != 2) {
+        fprintf(stderr, "Usage: %s [--max-speed] <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(argv[argc - 1]);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[argc - 1], strerror(errno));
+        return 1;
+    }
+    const auto calls = parseTrace(in);
+    if (!calls.ok()) {
+        fprintf(stderr, "%s: %s\n", argv[argc - 1], calls.error().message().c_str());
+        return 1;
+    }
+
+    const sp<IBinder> binder = defaultServiceManager()->getService(String16("netd"));
+    if (binder == nullptr) {
+        fprintf(stderr, "Cannot get the netd service\n");
+        return 1;
+    }
+    NetdReplayer replayer(interface_cast<INetd>(binder));
+    replayer.replay(calls.value(), speed).print(stdout);
+    return 0;
+}